@@ -0,0 +1,60 @@
+//Add 'NetCommon' to Build Dependancies
+//Add path to \NetCommon in Include Directories
+
+#include <iostream>
+#include <cstring>
+#include "benchmarks.h"
+
+struct benchmark
+{
+	const char* name;
+	void (*fn)();
+};
+
+// Name used on the command line, NetBenchmark <name> runs a single benchmark
+static const benchmark g_benchmarks[] =
+{
+	{ "workerpool", BenchWorkerPool },
+	{ "lanes", BenchLanes },
+	{ "stream", BenchStream },
+	{ "tls", BenchTls },
+	{ "rpc", BenchRpc },
+	{ "snapshot", BenchSnapshot },
+	{ "interest", BenchInterest },
+	{ "tick", BenchTick },
+	{ "ratelimit", BenchRateLimit },
+	{ "wire", BenchWire },
+	{ "crc", BenchCrc },
+	{ "trace", BenchTrace },
+	{ "impair", BenchImpair },
+	{ "compact", BenchCompact },
+	{ "loadgen", BenchLoadGen },
+	{ "log", BenchLog },
+	{ "busypoll", BenchBusyPoll },
+	{ "delivery", BenchDelivery },
+	{ "outbox", BenchOutbox },
+};
+
+int main(int argc, char* argv[])
+{
+	const char* filter = argc > 1 ? argv[1] : nullptr;
+
+	bool bFound = false;
+	for(const auto& b : g_benchmarks)
+	{
+		if(filter == nullptr || std::strcmp(filter, b.name) == 0)
+		{
+			std::cout << "=== " << b.name << " ===\n";
+			b.fn();
+			bFound = true;
+		}
+	}
+
+	if(!bFound)
+	{
+		std::cout << "Unknown benchmark: " << filter << "\n";
+		return 1;
+	}
+
+	return 0;
+}
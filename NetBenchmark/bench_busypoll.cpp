@@ -0,0 +1,142 @@
+#include "benchmarks.h"
+
+// Ping round trips one at a time with the asio threads and Update blocking as
+// usual, then with the low latency mode spinning on them. With 4 or more cores
+// the four spinning threads are pinned to cores 0 to 3
+namespace
+{
+	enum class PollMsg : uint32_t
+	{
+		Ping,
+		Count
+	};
+
+	constexpr uint16_t nPort = 60113;
+	constexpr size_t nWarmup = 2000;
+	constexpr size_t nPings = 20000;
+
+	class echo_server : public net::server_interface<PollMsg>
+	{
+	public:
+		echo_server() : net::server_interface<PollMsg>(nPort)
+		{
+			RegisterHandler(PollMsg::Ping,
+				[this](std::shared_ptr<net::connection<PollMsg>> client, net::message<PollMsg>& msg)
+				{
+					MessageClient(client, msg, net::priority::control);
+				});
+		}
+
+	protected:
+		bool OnClientConnect(std::shared_ptr<net::connection<PollMsg>> /*client*/) override
+		{
+			return true;
+		}
+	};
+
+	class ping_client : public net::client_interface<PollMsg>
+	{
+	public:
+		ping_client()
+		{
+			RegisterHandler(PollMsg::Ping,
+				[this](net::message<PollMsg>& msg)
+				{
+					int64_t nSent = 0;
+					msg >> nSent;
+					const auto rtt = std::chrono::steady_clock::now().time_since_epoch() - std::chrono::steady_clock::duration(nSent);
+					vRtt.push_back(std::chrono::duration<double, std::micro>(rtt).count());
+				});
+		}
+
+		void Ping()
+		{
+			net::message<PollMsg> msg;
+			msg.header.id = PollMsg::Ping;
+			msg << int64_t(std::chrono::steady_clock::now().time_since_epoch().count());
+			Send(msg, net::priority::control);
+		}
+
+		// Exact percentile of the round trips so far, in us
+		double Percentile(double dP)
+		{
+			std::sort(vRtt.begin(), vRtt.end());
+			return vRtt.empty() ? 0.0 : vRtt[std::min(vRtt.size() - 1, size_t(dP * double(vRtt.size())))];
+		}
+
+		std::vector<double> vRtt;
+	};
+
+	void Run(bool bSpin)
+	{
+		const bool bPin = bSpin && std::thread::hardware_concurrency() >= 4;
+
+		net::busy_poll opts;
+		opts.bSpin = bSpin;
+		opts.nSocketPollUs = bSpin ? 50 : 0;
+
+		echo_server server;
+		opts.nCpu = bPin ? 0 : -1;
+		server.SetBusyPoll(opts);
+		server.Start();
+
+		std::atomic<bool> bRun = true;
+		std::thread thrServer([&]()
+			{
+				if(bPin)
+				{
+					net::PinThread(2);
+				}
+				while(bRun)
+				{
+					server.UpdateFor(std::chrono::milliseconds(10));
+				}
+			});
+
+		ping_client client;
+		opts.nCpu = bPin ? 1 : -1;
+		client.SetBusyPoll(opts);
+		client.Connect("127.0.0.1", nPort);
+		while(!client.IsConnected())
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+
+		std::thread thrClient([&]()
+			{
+				if(bPin)
+				{
+					net::PinThread(3);
+				}
+				for(size_t i = 0; i < nWarmup + nPings; i++)
+				{
+					if(i == nWarmup)
+					{
+						client.vRtt.clear();
+					}
+					const size_t nBefore = client.vRtt.size();
+					client.Ping();
+					while(client.vRtt.size() == nBefore)
+					{
+						client.Update(-1, true);
+					}
+				}
+			});
+		thrClient.join();
+
+		std::cout << (bSpin ? "spinning: " : "blocking: ") << "p50 " << client.Percentile(0.5) << " us, p99 " << client.Percentile(0.99)
+			<< " us, p99.9 " << client.Percentile(0.999) << " us, max " << client.vRtt.back() << " us" << (bPin ? " (pinned)" : "") << "\n";
+
+		client.Disconnect();
+		bRun = false;
+		thrServer.join();
+		server.Stop();
+	}
+}
+
+void BenchBusyPoll()
+{
+	std::cout << nPings << " pings one at a time, " << std::thread::hardware_concurrency() << " cores\n";
+	Run(false);
+	Run(true);
+}
@@ -0,0 +1,133 @@
+#include "benchmarks.h"
+
+// Compact frame headers against the 8 byte ones: header encode/decode on their
+// own, then small messages from a client to the server in either mode, with the
+// bytes each one takes on the wire
+namespace
+{
+	enum class CompactMsg : uint32_t
+	{
+		Data,
+		Count
+	};
+
+	constexpr uint16_t nPort = 60111;
+	constexpr size_t nMessages = 200000;
+
+	class compact_server : public net::server_interface<CompactMsg>
+	{
+	public:
+		compact_server() : net::server_interface<CompactMsg>(nPort)
+		{
+			SetFeatures(net::nFeatureCompact);
+			RegisterHandler(CompactMsg::Data,
+				[this](std::shared_ptr<net::connection<CompactMsg>> /*client*/, net::message<CompactMsg>& /*msg*/)
+				{
+					nReceived++;
+				});
+		}
+
+		size_t nReceived = 0;
+
+	protected:
+		bool OnClientConnect(std::shared_ptr<net::connection<CompactMsg>> /*client*/) override
+		{
+			return true;
+		}
+	};
+
+	// Messages per second
+	double Transfer(uint32_t nFeatures, size_t nBody, uint32_t& nAgreed)
+	{
+		compact_server server;
+		server.Start();
+
+		net::client_interface<CompactMsg> client;
+		client.SetFeatures(nFeatures);
+		client.Connect("127.0.0.1", nPort);
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		server.Update(-1);
+		nAgreed = client.Features();
+
+		net::message<CompactMsg> msg;
+		msg.header.id = CompactMsg::Data;
+		msg.body.resize(nBody, 0x5A);
+		msg.header.size = uint32_t(nBody);
+
+		const auto tStart = std::chrono::steady_clock::now();
+		for(size_t nSent = 0; server.nReceived < nMessages;)
+		{
+			while(nSent < nMessages && client.QueuedBytes() < 256 * 1024)
+			{
+				client.Send(msg);
+				nSent++;
+			}
+			server.Update(-1);
+			std::this_thread::yield();
+		}
+		const double dSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - tStart).count();
+
+		client.Disconnect();
+		server.Stop();
+		return double(nMessages) / dSeconds;
+	}
+}
+
+void BenchCompact()
+{
+	// Headers across every length of ID and size, with and without flag bits
+	std::mt19937 rng(7);
+	std::vector<net::wire_header> vHeaders(4096);
+	for(auto& h : vHeaders)
+	{
+		const uint32_t nId = uint32_t(rng()) >> (8 * (rng() % 4));
+		const uint32_t nSize = (uint32_t(rng()) & net::nFrameSizeMask) >> (8 * (rng() % 4));
+		const uint32_t nFlags = (rng() % 2) ? (uint32_t(rng()) & ~net::nFrameSizeMask) : 0;
+		h = { net::WireOrder(nId), net::WireOrder(nSize | nFlags) };
+	}
+
+	std::vector<uint8_t> vEncoded(vHeaders.size() * net::compact_header::nMaxSize + net::compact_header::nMaxSize);
+	size_t nEncoded = 0;
+	for(const auto& h : vHeaders)
+	{
+		nEncoded += net::compact_header::Encode(vEncoded.data() + nEncoded, h);
+	}
+
+	// Decode them all, many times over, checking each against what went in
+	constexpr int nRounds = 2000;
+	size_t nBad = 0;
+	const auto tStart = std::chrono::steady_clock::now();
+	for(int r = 0; r < nRounds; r++)
+	{
+		const uint8_t* p = vEncoded.data();
+		for(const auto& h : vHeaders)
+		{
+			net::wire_header out;
+			nBad += !net::compact_header::Decode(p, out) || out.id != h.id || out.size != h.size;
+			p += net::compact_header::Size(p[0]);
+		}
+	}
+	const double dDecodeNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - tStart).count() / (double(nRounds) * vHeaders.size());
+	std::cout << "compact header decode: " << dDecodeNs << " ns, " << double(nEncoded) / vHeaders.size() << " bytes average over mixed headers"
+		<< (nBad ? " (MISMATCH)" : "") << "\n";
+
+	// Alternate so drift on the machine hits both the same
+	for(size_t nBody : { size_t(0), size_t(16), size_t(200), size_t(1000), size_t(4000) })
+	{
+		double dFixed = 0.0, dCompact = 0.0;
+		uint32_t nFixedAgreed = 0, nCompactAgreed = 0;
+		for(int i = 0; i < 3; i++)
+		{
+			dFixed = std::max(dFixed, Transfer(0, nBody, nFixedAgreed));
+			dCompact = std::max(dCompact, Transfer(net::nFeatureCompact, nBody, nCompactAgreed));
+		}
+
+		std::array<uint8_t, net::compact_header::nMaxSize> compact;
+		const size_t nCompactHeader = net::compact_header::Encode(compact.data(), net::ToWire(net::message_header<CompactMsg>{ CompactMsg::Data, uint32_t(nBody) }));
+		const size_t nFixedWire = sizeof(net::wire_header) + nBody;
+		const size_t nCompactWire = nCompactHeader + nBody;
+		std::cout << nBody << " byte bodies: " << nFixedWire << " wire bytes and " << dFixed << " msg/s with 8 byte headers, "
+			<< nCompactWire << " and " << dCompact << " msg/s compact" << (nCompactAgreed & net::nFeatureCompact ? "" : " (NOT AGREED)")
+			<< ", " << (1.0 - double(nCompactWire) / nFixedWire) * 100.0 << "% fewer bytes\n";
+	}
+}
@@ -0,0 +1,112 @@
+#include "benchmarks.h"
+
+// CRC32C kernels on 64 KB, then 2 GB of 64 KB messages from a client to the
+// server with and without per frame CRCs agreed in the handshake
+namespace
+{
+	enum class CrcMsg : uint32_t
+	{
+		Data,
+		Count
+	};
+
+	constexpr uint16_t nPort = 60107;
+	constexpr size_t nBody = 64 * 1024;
+	constexpr size_t nMessages = 32768;
+
+	class crc_server : public net::server_interface<CrcMsg>
+	{
+	public:
+		crc_server() : net::server_interface<CrcMsg>(nPort)
+		{
+			SetFeatures(net::nFeatureCrc);
+			RegisterHandler(CrcMsg::Data,
+				[this](std::shared_ptr<net::connection<CrcMsg>> /*client*/, net::message<CrcMsg>& /*msg*/)
+				{
+					nReceived++;
+				});
+		}
+
+		size_t nReceived = 0;
+
+	protected:
+		bool OnClientConnect(std::shared_ptr<net::connection<CrcMsg>> /*client*/) override
+		{
+			return true;
+		}
+	};
+
+	double Transfer(uint32_t nFeatures, uint32_t& nAgreed)
+	{
+		crc_server server;
+		server.Start();
+
+		net::client_interface<CrcMsg> client;
+		client.SetFeatures(nFeatures);
+		client.Connect("127.0.0.1", nPort);
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		server.Update(-1);
+		nAgreed = client.Features();
+
+		net::message<CrcMsg> msg;
+		msg.header.id = CrcMsg::Data;
+		msg.body.resize(nBody, 0x5A);
+
+		const auto tStart = std::chrono::steady_clock::now();
+		for(size_t nSent = 0; server.nReceived < nMessages;)
+		{
+			// Keep a few MB in flight
+			while(nSent < nMessages && client.QueuedBytes() < 4 * 1024 * 1024)
+			{
+				client.Send(msg);
+				nSent++;
+			}
+			server.Update(-1);
+			std::this_thread::yield();
+		}
+		const double dSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - tStart).count();
+
+		client.Disconnect();
+		server.Stop();
+		return double(nMessages * nBody) / dSeconds / (1024.0 * 1024.0);
+	}
+}
+
+void BenchCrc()
+{
+	std::vector<uint8_t> vData(nBody);
+	std::mt19937 rng(5);
+	for(auto& b : vData)
+	{
+		b = uint8_t(rng());
+	}
+
+	auto Time = [&](auto&& fn)
+	{
+		constexpr int nRounds = 5000;
+		uint32_t nSum = 0;
+		const auto tStart = std::chrono::steady_clock::now();
+		for(int r = 0; r < nRounds; r++)
+		{
+			nSum += fn();
+		}
+		const double dSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - tStart).count();
+		return std::make_pair(double(nBody) * nRounds / dSeconds / 1e9, nSum);
+	};
+	const auto table = Time([&]() { return ~net::Crc32cUpdateTable(~0u, vData.data(), vData.size()); });
+	const auto built = Time([&]() { return net::Crc32c(vData.data(), vData.size()); });
+	std::cout << "CRC32C of 64 KB: table " << table.first << " GB/s, " << net::Crc32cKernel() << " " << built.first << " GB/s"
+		<< (table.second == built.second ? "" : " (MISMATCH)") << ", " << nBody / built.first / 1000.0 << " us per frame\n";
+
+	// Alternate so drift on the machine hits both the same
+	double dPlain = 0.0, dCrc = 0.0;
+	uint32_t nPlainAgreed = 0, nCrcAgreed = 0;
+	for(int i = 0; i < 2; i++)
+	{
+		dPlain += Transfer(0, nPlainAgreed) / 2.0;
+		dCrc += Transfer(net::nFeatureCrc, nCrcAgreed) / 2.0;
+	}
+	std::cout << "64 KB messages: " << dPlain << " MB/s plain, " << dCrc << " MB/s with CRC"
+		<< (nCrcAgreed & net::nFeatureCrc ? "" : " (NOT AGREED)") << (nPlainAgreed ? " (plain agreed to features)" : "")
+		<< ", overhead " << (1.0 - dCrc / dPlain) * 100.0 << "%\n";
+}
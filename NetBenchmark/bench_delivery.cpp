@@ -0,0 +1,162 @@
+#include "benchmarks.h"
+
+#ifndef _WIN32
+#include <poll.h>
+#endif
+
+// Ping round trips one at a time with the server handling messages three ways:
+// a thread waiting in Update, Update posted to the asio thread's own context
+// (DeliverOn), and a poll() loop on the delivery notifier calling Update
+namespace
+{
+	enum class DeliveryMsg : uint32_t
+	{
+		Ping,
+		Count
+	};
+
+	constexpr uint16_t nPort = 60114;
+	constexpr size_t nWarmup = 1000;
+	constexpr size_t nPings = 20000;
+
+	enum class mode
+	{
+		update_thread,
+		asio_thread,
+		notifier
+	};
+
+	class echo_server : public net::server_interface<DeliveryMsg>
+	{
+	public:
+		echo_server() : net::server_interface<DeliveryMsg>(nPort)
+		{
+			RegisterHandler(DeliveryMsg::Ping,
+				[this](std::shared_ptr<net::connection<DeliveryMsg>> client, net::message<DeliveryMsg>& msg)
+				{
+					MessageClient(client, msg, net::priority::control);
+				});
+		}
+
+	protected:
+		bool OnClientConnect(std::shared_ptr<net::connection<DeliveryMsg>> /*client*/) override
+		{
+			return true;
+		}
+	};
+
+	class ping_client : public net::client_interface<DeliveryMsg>
+	{
+	public:
+		ping_client()
+		{
+			RegisterHandler(DeliveryMsg::Ping,
+				[this](net::message<DeliveryMsg>& msg)
+				{
+					int64_t nSent = 0;
+					msg >> nSent;
+					const auto rtt = std::chrono::steady_clock::now().time_since_epoch() - std::chrono::steady_clock::duration(nSent);
+					vRtt.push_back(std::chrono::duration<double, std::micro>(rtt).count());
+				});
+		}
+
+		void Ping()
+		{
+			net::message<DeliveryMsg> msg;
+			msg.header.id = DeliveryMsg::Ping;
+			msg << int64_t(std::chrono::steady_clock::now().time_since_epoch().count());
+			Send(msg, net::priority::control);
+		}
+
+		// Exact percentile of the round trips so far, in us
+		double Percentile(double dP)
+		{
+			std::sort(vRtt.begin(), vRtt.end());
+			return vRtt.empty() ? 0.0 : vRtt[std::min(vRtt.size() - 1, size_t(dP * double(vRtt.size())))];
+		}
+
+		std::vector<double> vRtt;
+	};
+
+	void Run(mode eMode)
+	{
+		echo_server server;
+		int nFd = -1;
+		if(eMode == mode::asio_thread)
+		{
+			server.DeliverOn(server.Context());
+		}
+		else if(eMode == mode::notifier)
+		{
+			nFd = server.DeliveryNotifier();
+		}
+		server.Start();
+
+		std::atomic<bool> bRun = true;
+		std::thread thrServer([&]()
+			{
+				while(bRun)
+				{
+					if(eMode == mode::update_thread)
+					{
+						server.UpdateFor(std::chrono::milliseconds(10));
+					}
+#ifndef _WIN32
+					else if(eMode == mode::notifier)
+					{
+						pollfd pfd{ nFd, POLLIN, 0 };
+						if(poll(&pfd, 1, 10) > 0)
+						{
+							server.Update();
+						}
+					}
+#endif
+					else
+					{
+						std::this_thread::sleep_for(std::chrono::milliseconds(10));
+					}
+				}
+			});
+
+		ping_client client;
+		client.Connect("127.0.0.1", nPort);
+		while(!client.IsConnected())
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+
+		for(size_t i = 0; i < nWarmup + nPings; i++)
+		{
+			if(i == nWarmup)
+			{
+				client.vRtt.clear();
+			}
+			const size_t nBefore = client.vRtt.size();
+			client.Ping();
+			while(client.vRtt.size() == nBefore)
+			{
+				client.Update(-1, true);
+			}
+		}
+
+		static const char* szMode[] = { "thread in Update:   ", "on the asio thread: ", "notifier poll loop: " };
+		std::cout << szMode[int(eMode)] << "p50 " << client.Percentile(0.5) << " us, p99 " << client.Percentile(0.99)
+			<< " us, p99.9 " << client.Percentile(0.999) << " us\n";
+
+		client.Disconnect();
+		bRun = false;
+		thrServer.join();
+		server.Stop();
+	}
+}
+
+void BenchDelivery()
+{
+	net::SetLogLevel(net::log_level::warn);
+	Run(mode::update_thread);
+	Run(mode::asio_thread);
+#ifndef _WIN32
+	Run(mode::notifier);
+#endif
+	net::SetLogLevel(net::log_level::info);
+}
@@ -0,0 +1,187 @@
+#include "benchmarks.h"
+#include <net_impair.h>
+
+// A client talking to the server through the impairment proxy under a few link
+// profiles: ping round trips on an idle link, then an 8 MB upload as 64 KB
+// messages with a ping every 10 ms on the control lane alongside
+namespace
+{
+	enum class ImpairMsg : uint32_t
+	{
+		Ping,
+		Upload,
+		Count
+	};
+
+	constexpr uint16_t nPort = 60109;
+	constexpr uint16_t nProxyPort = 60110;
+	constexpr size_t nUploadBody = 64 * 1024;
+	constexpr size_t nUploadMessages = 128;
+
+	struct profile
+	{
+		const char* name;
+		net::impairment link;
+	};
+
+	profile Profile(const char* name, int nLatencyMs, int nJitterMs, double dMbit, double dLoss, double dReorder)
+	{
+		profile p{ name, {} };
+		p.link.latency = std::chrono::milliseconds(nLatencyMs);
+		p.link.jitter = std::chrono::milliseconds(nJitterMs);
+		p.link.dBytesPerSecond = dMbit * 1e6 / 8.0;
+		p.link.dLoss = dLoss;
+		p.link.dReorder = dReorder;
+		return p;
+	}
+
+	class echo_server : public net::server_interface<ImpairMsg>
+	{
+	public:
+		echo_server() : net::server_interface<ImpairMsg>(nPort)
+		{
+			RegisterHandler(ImpairMsg::Ping,
+				[this](std::shared_ptr<net::connection<ImpairMsg>> client, net::message<ImpairMsg>& msg)
+				{
+					MessageClient(client, msg, net::priority::control);
+				});
+			RegisterHandler(ImpairMsg::Upload,
+				[this](std::shared_ptr<net::connection<ImpairMsg>> /*client*/, net::message<ImpairMsg>& /*msg*/)
+				{
+					nUploaded++;
+				});
+		}
+
+		std::atomic<size_t> nUploaded = 0;
+
+	protected:
+		bool OnClientConnect(std::shared_ptr<net::connection<ImpairMsg>> /*client*/) override
+		{
+			return true;
+		}
+	};
+
+	class ping_client : public net::client_interface<ImpairMsg>
+	{
+	public:
+		ping_client()
+		{
+			RegisterHandler(ImpairMsg::Ping,
+				[this](net::message<ImpairMsg>& msg)
+				{
+					int64_t nSent = 0;
+					msg >> nSent;
+					const auto rtt = std::chrono::steady_clock::now().time_since_epoch() - std::chrono::steady_clock::duration(nSent);
+					vRtt.push_back(std::chrono::duration<double, std::milli>(rtt).count());
+				});
+		}
+
+		void Ping()
+		{
+			net::message<ImpairMsg> msg;
+			msg.header.id = ImpairMsg::Ping;
+			msg << int64_t(std::chrono::steady_clock::now().time_since_epoch().count());
+			Send(msg, net::priority::control);
+		}
+
+		// Exact percentile of the round trips so far, in ms
+		double Percentile(double dP)
+		{
+			if(vRtt.empty())
+			{
+				return 0.0;
+			}
+			std::sort(vRtt.begin(), vRtt.end());
+			return vRtt[std::min(vRtt.size() - 1, size_t(dP * double(vRtt.size())))];
+		}
+
+		std::vector<double> vRtt;
+	};
+
+	void Run(const profile& p)
+	{
+		echo_server server;
+		server.Start();
+		net::impairment_proxy proxy(nProxyPort, "127.0.0.1", nPort, p.link);
+		proxy.Start();
+
+		std::atomic<bool> bRun = true;
+		std::thread thrServer([&]()
+			{
+				while(bRun)
+				{
+					server.UpdateFor(std::chrono::milliseconds(10));
+				}
+			});
+
+		ping_client client;
+		client.Connect("127.0.0.1", nProxyPort);
+		while(!client.IsConnected())
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+
+		// Idle link, one ping at a time, 100 of them after a few that wait out the handshake
+		for(int i = 0; i < 105; i++)
+		{
+			if(i == 5)
+			{
+				client.vRtt.clear();
+			}
+			client.Ping();
+			client.Update(-1, true);
+			std::this_thread::sleep_for(std::chrono::milliseconds(2));
+		}
+		const double dIdle50 = client.Percentile(0.5);
+		const double dIdle99 = client.Percentile(0.99);
+		client.vRtt.clear();
+
+		// Upload with pings alongside
+		net::message<ImpairMsg> msg;
+		msg.header.id = ImpairMsg::Upload;
+		msg.body.resize(nUploadBody);
+		const auto tStart = std::chrono::steady_clock::now();
+		for(size_t i = 0; i < nUploadMessages; i++)
+		{
+			client.Send(msg, net::priority::bulk);
+		}
+		auto tPing = tStart;
+		while(server.nUploaded < nUploadMessages && std::chrono::steady_clock::now() < tStart + std::chrono::seconds(30))
+		{
+			if(std::chrono::steady_clock::now() >= tPing)
+			{
+				client.Ping();
+				tPing += std::chrono::milliseconds(10);
+			}
+			client.Update();
+			std::this_thread::sleep_for(std::chrono::microseconds(100));
+		}
+		const double dSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - tStart).count();
+
+		std::cout << p.name << ": idle rtt p50 " << dIdle50 << " ms, p99 " << dIdle99 << " ms; upload "
+			<< double(server.nUploaded * nUploadBody) / dSeconds / (1024.0 * 1024.0) << " MB/s, rtt under load p50 "
+			<< client.Percentile(0.5) << " ms, p99 " << client.Percentile(0.99) << " ms; "
+			<< proxy.Lost() << " lost, " << proxy.Reordered() << " reordered of " << proxy.Segments() << " segments\n";
+
+		client.Disconnect();
+		bRun = false;
+		thrServer.join();
+		proxy.Stop();
+		server.Stop();
+	}
+}
+
+void BenchImpair()
+{
+	const profile profiles[] = {
+		Profile("proxy only", 0, 0, 0.0, 0.0, 0.0),
+		Profile("wan 20 ms, 100 Mbit", 20, 2, 100.0, 0.0, 0.0),
+		Profile("wan + 1% loss", 20, 2, 100.0, 0.01, 0.0),
+		Profile("mobile 40 ms +-15, 20 Mbit, 0.5% loss, 1% reorder", 40, 15, 20.0, 0.005, 0.01),
+	};
+
+	for(const auto& p : profiles)
+	{
+		Run(p);
+	}
+}
@@ -0,0 +1,85 @@
+#include "benchmarks.h"
+
+// 10k clients wandering a 2D world, each publishing its position to everyone
+// within 50 units every tick. Finding the recipients through the interest grid
+// against scanning every client, which is what MessageAllClients plus a distance
+// check amounts to. Sockets are left out, this is the cost that grows with N
+namespace
+{
+	constexpr size_t nClients = 10000;
+	constexpr float fWorld = 4000.0f;
+	constexpr float fRadius = 50.0f;
+	constexpr int nTicks = 20;
+
+	struct walker
+	{
+		net::interest_pos pos;
+		float dx, dy;
+	};
+}
+
+void BenchInterest()
+{
+	std::mt19937 rng(11);
+	std::uniform_real_distribution<float> place(0.0f, fWorld);
+	std::uniform_real_distribution<float> step(-2.0f, 2.0f);
+
+	std::vector<walker> vClients(nClients);
+	net::interest_grid grid(fRadius);
+	net::interest_sets sets;
+	for(uint32_t i = 0; i < nClients; i++)
+	{
+		vClients[i] = { { place(rng), place(rng), 0.0f }, step(rng), step(rng) };
+		grid.Set(i, vClients[i].pos);
+		sets.Subscribe(i, fRadius);
+	}
+	sets.Refresh(grid, [](uint32_t, uint32_t) {}, [](uint32_t, uint32_t) {});
+
+	double dMoveMs = 0.0, dPublishMs = 0.0, dRefreshMs = 0.0;
+	uint64_t nRecipients = 0, nEnter = 0, nLeave = 0;
+	for(int t = 0; t < nTicks; t++)
+	{
+		auto tStart = std::chrono::steady_clock::now();
+		for(uint32_t i = 0; i < nClients; i++)
+		{
+			walker& w = vClients[i];
+			w.pos.x = std::clamp(w.pos.x + w.dx, 0.0f, fWorld);
+			w.pos.y = std::clamp(w.pos.y + w.dy, 0.0f, fWorld);
+			grid.Set(i, w.pos);
+		}
+		auto tMoved = std::chrono::steady_clock::now();
+
+		for(uint32_t i = 0; i < nClients; i++)
+		{
+			grid.Query(vClients[i].pos, fRadius, [&nRecipients, i](uint32_t nID) { nRecipients += nID != i ? 1 : 0; });
+		}
+		auto tPublished = std::chrono::steady_clock::now();
+
+		sets.Refresh(grid, [&nEnter](uint32_t, uint32_t) { nEnter++; }, [&nLeave](uint32_t, uint32_t) { nLeave++; });
+		auto tRefreshed = std::chrono::steady_clock::now();
+
+		dMoveMs += std::chrono::duration<double, std::milli>(tMoved - tStart).count();
+		dPublishMs += std::chrono::duration<double, std::milli>(tPublished - tMoved).count();
+		dRefreshMs += std::chrono::duration<double, std::milli>(tRefreshed - tPublished).count();
+	}
+
+	// One tick of the all clients scan is plenty to see the difference
+	uint64_t nScanRecipients = 0;
+	auto tStart = std::chrono::steady_clock::now();
+	for(uint32_t i = 0; i < nClients; i++)
+	{
+		const net::interest_pos& p = vClients[i].pos;
+		for(uint32_t j = 0; j < nClients; j++)
+		{
+			const float dx = vClients[j].pos.x - p.x;
+			const float dy = vClients[j].pos.y - p.y;
+			nScanRecipients += (j != i && dx * dx + dy * dy <= fRadius * fRadius) ? 1 : 0;
+		}
+	}
+	const double dScanMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - tStart).count();
+
+	std::cout << nClients << " clients, per tick: move " << dMoveMs / nTicks << " ms, publish " << dPublishMs / nTicks
+		<< " ms (" << nRecipients / nTicks << " recipients), interest refresh " << dRefreshMs / nTicks << " ms ("
+		<< (nEnter + nLeave) / nTicks << " enter/leave)\n";
+	std::cout << "scanning all clients instead: " << dScanMs << " ms per tick (" << nScanRecipients << " recipients)\n";
+}
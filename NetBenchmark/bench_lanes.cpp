@@ -0,0 +1,109 @@
+#include "benchmarks.h"
+
+// Ping round trip while the same connection is busy uploading 2 MB assets
+// A ping queued on the bulk lane waits behind every asset (the old single FIFO),
+// a ping on the control lane overtakes them at the next chunk boundary
+namespace
+{
+	enum class LaneMsg : uint32_t
+	{
+		Asset,
+		Ping,
+		Count
+	};
+
+	constexpr uint16_t nPort = 60100;
+	constexpr size_t nAssets = 50;
+	constexpr size_t nAssetSize = 2 * 1024 * 1024;
+
+	using clock = std::chrono::steady_clock;
+
+	class lane_server : public net::server_interface<LaneMsg>
+	{
+	public:
+		lane_server() : net::server_interface<LaneMsg>(nPort)
+		{
+			RegisterHandler(LaneMsg::Ping,
+				[](std::shared_ptr<net::connection<LaneMsg>> client, net::message<LaneMsg>& msg)
+				{
+					client->Send(msg, net::priority::control);
+				});
+
+			RegisterHandler(LaneMsg::Asset,
+				[this](std::shared_ptr<net::connection<LaneMsg>> /*client*/, net::message<LaneMsg>& msg)
+				{
+					nAssetBytes += msg.body.size();
+				});
+		}
+
+		std::atomic<size_t> nAssetBytes{0};
+
+	protected:
+		bool OnClientConnect(std::shared_ptr<net::connection<LaneMsg>> /*client*/) override
+		{
+			return true;
+		}
+	};
+
+	class lane_client : public net::client_interface<LaneMsg>
+	{
+	public:
+		lane_client()
+		{
+			RegisterHandler<clock::time_point>(LaneMsg::Ping,
+				[this](const clock::time_point& tSent)
+				{
+					dLastRtt = std::chrono::duration<double, std::milli>(clock::now() - tSent).count();
+				});
+		}
+
+		double dLastRtt = -1.0;
+	};
+
+	double MeasurePing(net::priority ePriority)
+	{
+		lane_server server;
+		server.Start();
+
+		lane_client client;
+		client.Connect("127.0.0.1", nPort);
+		// Give the handshake time to finish
+		std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+		net::message<LaneMsg> asset;
+		asset.header.id = LaneMsg::Asset;
+		asset.body.resize(nAssetSize);
+		asset.header.size = uint32_t(asset.body.size());
+		for(size_t i = 0; i < nAssets; i++)
+		{
+			client.Send(asset, net::priority::bulk);
+		}
+
+		net::message<LaneMsg> ping;
+		ping.header.id = LaneMsg::Ping;
+		ping << clock::now();
+		client.Send(ping, ePriority);
+
+		while(client.dLastRtt < 0.0)
+		{
+			server.Update();
+			client.Update();
+		}
+
+		// Let the transfer finish before tearing down
+		while(server.nAssetBytes < nAssets * nAssetSize)
+		{
+			server.Update(-1, true);
+		}
+
+		return client.dLastRtt;
+	}
+}
+
+void BenchLanes()
+{
+	const double dBulk = MeasurePing(net::priority::bulk);
+	const double dControl = MeasurePing(net::priority::control);
+	std::cout << "ping behind " << nAssets << " x 2 MB, bulk lane:    " << dBulk << " ms\n";
+	std::cout << "ping behind " << nAssets << " x 2 MB, control lane: " << dControl << " ms\n";
+}
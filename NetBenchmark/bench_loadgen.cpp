@@ -0,0 +1,97 @@
+#include "benchmarks.h"
+#include <net_loadgen.h>
+
+// 5000 client connections from the load generator on 2 asio threads against
+// the server, each sending 2 messages a second of mixed sizes and pinging
+// every 500 ms
+namespace
+{
+	enum class LoadMsg : uint32_t
+	{
+		Data,
+		Ping,
+		Count
+	};
+
+	constexpr uint16_t nPort = 60112;
+	constexpr size_t nConnections = 5000;
+
+	class load_server : public net::server_interface<LoadMsg>
+	{
+	public:
+		load_server() : net::server_interface<LoadMsg>(nPort)
+		{
+			RegisterHandler(LoadMsg::Ping,
+				[this](std::shared_ptr<net::connection<LoadMsg>> client, net::message<LoadMsg>& msg)
+				{
+					MessageClient(client, msg, net::priority::control);
+				});
+			RegisterHandler(LoadMsg::Data,
+				[this](std::shared_ptr<net::connection<LoadMsg>> /*client*/, net::message<LoadMsg>& /*msg*/)
+				{
+					nData++;
+				});
+		}
+
+		std::atomic<uint64_t> nData = 0;
+
+	protected:
+		bool OnClientConnect(std::shared_ptr<net::connection<LoadMsg>> /*client*/) override
+		{
+			return true;
+		}
+	};
+}
+
+void BenchLoadGen()
+{
+	load_server server;
+	server.Start();
+
+	std::atomic<bool> bRun = true;
+	std::thread thrServer([&]()
+		{
+			while(bRun)
+			{
+				server.UpdateFor(std::chrono::milliseconds(10));
+			}
+		});
+
+	net::load_script script;
+	script.dMessagesPerSecond = 2.0;
+	script.vBodySizes = { { 32, 8.0 }, { 512, 1.5 }, { 8192, 0.5 } };
+	script.pingInterval = std::chrono::milliseconds(500);
+	script.dConnectsPerSecond = 2500.0;
+
+	net::load_generator<LoadMsg> load(LoadMsg::Data, LoadMsg::Ping);
+	load.Start("127.0.0.1", nPort, nConnections, script, 2);
+
+	// Ramp up, then measure a steady stretch
+	std::this_thread::sleep_for(std::chrono::seconds(3));
+	const net::load_stats before = load.Progress();
+	std::this_thread::sleep_for(std::chrono::seconds(5));
+	const net::load_stats after = load.Progress();
+	const net::load_stats stats = load.Stop();
+
+	bRun = false;
+	thrServer.join();
+	server.Stop();
+
+	size_t nWorst = 0;
+	const auto& vConn = load.ConnectionStats();
+	for(size_t i = 0; i < vConn.size(); i++)
+	{
+		if(vConn[i].rtt.Max() > vConn[nWorst].rtt.Max())
+		{
+			nWorst = i;
+		}
+	}
+
+	const double dSteady = after.dSeconds - before.dSeconds;
+	std::cout << stats.nReady << "/" << stats.nConnections << " connections ready (p50 " << stats.ready.Percentile(0.5) / 1000.0
+		<< " ms, max " << stats.ready.Max() / 1000.0 << " ms), " << stats.nConnected << " connected at the end\n"
+		<< "steady: " << double(after.nSent - before.nSent) / dSteady << " msg/s, " << double(after.nBytesSent - before.nBytesSent) / dSteady / (1024.0 * 1024.0)
+		<< " MB/s, " << double(after.nPongs - before.nPongs) / dSteady << " pings/s; server handled " << server.nData << " of " << stats.nSent << " data messages\n"
+		<< "ping rtt: p50 " << stats.rtt.Percentile(0.5) << " us, p99 " << stats.rtt.Percentile(0.99) << " us, max " << stats.rtt.Max()
+		<< " us; worst connection #" << nWorst << " p99 " << vConn[nWorst].rtt.Percentile(0.99) << " us over " << vConn[nWorst].rtt.Count() << " pings\n";
+}
@@ -0,0 +1,180 @@
+#include "benchmarks.h"
+
+#include <filesystem>
+
+// Server to client messages of 256 bytes. Live, plainly and through the durable
+// outbox, then with the client away: the server sends to it while it is
+// disconnected and on resuming it is sent everything it missed from the mapped
+// segments. Missing and duplicate messages are counted
+namespace
+{
+	enum class OutboxMsg : uint32_t
+	{
+		Data,
+		Count
+	};
+
+	constexpr uint16_t nPort = 60115;
+	constexpr size_t nLive = 50000;
+	constexpr size_t nAway = 50000;
+	constexpr size_t nPayload = 256;
+
+	class push_server : public net::server_interface<OutboxMsg>
+	{
+	public:
+		push_server() : net::server_interface<OutboxMsg>(nPort)
+		{
+		}
+
+		// Until the client connected has been validated
+		void WaitClient(uint32_t nFeatures)
+		{
+			while(!Client() || Client()->Features() != nFeatures)
+			{
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			}
+		}
+
+		void Push(size_t nFirst, size_t nCount)
+		{
+			auto pTo = Client();
+			net::message<OutboxMsg> msg;
+			msg.header.id = OutboxMsg::Data;
+			for(size_t i = nFirst; i < nFirst + nCount; i++)
+			{
+				msg.body.assign(nPayload, uint8_t(i));
+				std::memcpy(msg.body.data(), &i, sizeof(i));
+				msg.header.size = uint32_t(msg.body.size());
+				MessageClient(pTo, msg);
+			}
+		}
+
+		// Connection of the client, set on the asio thread
+		std::shared_ptr<net::connection<OutboxMsg>> Client()
+		{
+			std::scoped_lock lock(m_mux);
+			return m_pClient;
+		}
+
+		void SetClient(std::shared_ptr<net::connection<OutboxMsg>> client)
+		{
+			std::scoped_lock lock(m_mux);
+			m_pClient = std::move(client);
+		}
+
+	protected:
+		bool OnClientConnect(std::shared_ptr<net::connection<OutboxMsg>> /*client*/) override
+		{
+			return true;
+		}
+
+		void OnClientValidated(std::shared_ptr<net::connection<OutboxMsg>> client) override
+		{
+			SetClient(client);
+		}
+
+		void OnClientResumed(std::shared_ptr<net::connection<OutboxMsg>> client) override
+		{
+			SetClient(client);
+		}
+
+	private:
+		std::mutex m_mux;
+		std::shared_ptr<net::connection<OutboxMsg>> m_pClient;
+	};
+
+	class sink_client : public net::client_interface<OutboxMsg>
+	{
+	public:
+		sink_client()
+		{
+			RegisterHandler(OutboxMsg::Data,
+				[this](net::message<OutboxMsg>& msg)
+				{
+					size_t i = 0;
+					std::memcpy(&i, msg.body.data(), sizeof(i));
+					if(i < vSeen.size() && vSeen[i]++ > 0)
+					{
+						nDuplicates++;
+					}
+					nReceived++;
+				});
+		}
+
+		// Receives until nCount more messages arrived, seconds taken
+		double Receive(size_t nCount)
+		{
+			const size_t nTarget = nReceived + nCount;
+			const auto tStart = std::chrono::steady_clock::now();
+			while(nReceived < nTarget && std::chrono::steady_clock::now() - tStart < std::chrono::seconds(20))
+			{
+				Incoming().wait_for(std::chrono::milliseconds(10));
+				Update();
+			}
+			return std::chrono::duration<double>(std::chrono::steady_clock::now() - tStart).count();
+		}
+
+		std::vector<uint8_t> vSeen = std::vector<uint8_t>(nLive + nAway, 0);
+		size_t nReceived = 0;
+		size_t nDuplicates = 0;
+	};
+
+	void Report(const char* szWhat, size_t nCount, double dSeconds)
+	{
+		std::cout << szWhat << nCount / dSeconds / 1e3 << "k msg/s, " << nCount * nPayload / dSeconds / 1e6 << " MB/s\n";
+	}
+}
+
+void BenchOutbox()
+{
+	net::SetLogLevel(net::log_level::warn);
+	const std::string sDir = (std::filesystem::temp_directory_path() / "netbench_outbox").string();
+	std::error_code ec;
+	std::filesystem::remove_all(sDir, ec);
+
+	push_server server;
+	server.EnableOutbox(sDir, 16 * 1024 * 1024, 4);
+	server.Start();
+
+	// Plain, for comparison
+	{
+		sink_client client;
+		client.Connect("127.0.0.1", nPort);
+		server.WaitClient(0);
+		std::thread thrPush([&]() { server.Push(0, nLive); });
+		Report("live, plain:       ", nLive, client.Receive(nLive));
+		thrPush.join();
+		client.Disconnect();
+		server.SetClient(nullptr);
+	}
+
+	sink_client client;
+	client.SetFeatures(net::nFeatureDurable);
+	client.Connect("127.0.0.1", nPort);
+	server.WaitClient(net::nFeatureDurable);
+
+	std::thread thrPush([&]() { server.Push(0, nLive); });
+	Report("live, durable:     ", nLive, client.Receive(nLive));
+	thrPush.join();
+
+	// Away, the server notices before sending on
+	client.Disconnect();
+	while(server.Client()->IsConnected())
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	const auto tStart = std::chrono::steady_clock::now();
+	server.Push(nLive, nAway);
+	Report("stored while away: ", nAway, std::chrono::duration<double>(std::chrono::steady_clock::now() - tStart).count());
+
+	client.Connect("127.0.0.1", nPort);
+	Report("resent on resume:  ", nAway, client.Receive(nAway));
+
+	const size_t nMissing = size_t(std::count(client.vSeen.begin(), client.vSeen.end(), uint8_t(0)));
+	std::cout << "missing " << nMissing << ", duplicates " << client.nDuplicates << "\n";
+
+	client.Disconnect();
+	server.Stop();
+	std::filesystem::remove_all(sDir, ec);
+	net::SetLogLevel(net::log_level::info);
+}
@@ -0,0 +1,171 @@
+#include "benchmarks.h"
+
+// One client floods the server as fast as it can while 4 others send a ping
+// every 10 ms, each message costing the server 20 us to handle. Ping round
+// trips and the backlog left behind, without a limit and with one of
+// 2000 messages/s per client
+namespace
+{
+	enum class FloodMsg : uint32_t
+	{
+		Ping,
+		Flood,
+		Count
+	};
+
+	constexpr uint16_t nPort = 60106;
+	constexpr size_t nHonest = 4;
+	constexpr int nSeconds = 2;
+	constexpr auto handlerCost = std::chrono::microseconds(20);
+
+	class flood_server : public net::server_interface<FloodMsg>
+	{
+	public:
+		flood_server() : net::server_interface<FloodMsg>(nPort)
+		{
+			RegisterHandler(FloodMsg::Ping,
+				[this](std::shared_ptr<net::connection<FloodMsg>> client, net::message<FloodMsg>& msg)
+				{
+					Work();
+					MessageClient(client, msg);
+				});
+			RegisterHandler(FloodMsg::Flood,
+				[this](std::shared_ptr<net::connection<FloodMsg>> /*client*/, net::message<FloodMsg>& /*msg*/)
+				{
+					Work();
+					nFlood++;
+				});
+		}
+
+		uint64_t nFlood = 0;
+
+	protected:
+		bool OnClientConnect(std::shared_ptr<net::connection<FloodMsg>> /*client*/) override
+		{
+			return true;
+		}
+
+	private:
+		void Work()
+		{
+			const auto tEnd = std::chrono::steady_clock::now() + handlerCost;
+			while(std::chrono::steady_clock::now() < tEnd)
+			{
+			}
+		}
+	};
+
+	class ping_client : public net::client_interface<FloodMsg>
+	{
+	public:
+		ping_client(net::latency_histogram& rtt)
+		{
+			RegisterHandler(FloodMsg::Ping,
+				[&rtt](net::message<FloodMsg>& msg)
+				{
+					int64_t nSent = 0;
+					msg >> nSent;
+					const int64_t nNow = std::chrono::steady_clock::now().time_since_epoch().count();
+					rtt.Add(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::duration(nNow - nSent)).count());
+				});
+		}
+
+		void Ping()
+		{
+			net::message<FloodMsg> msg;
+			msg.header.id = FloodMsg::Ping;
+			msg << int64_t(std::chrono::steady_clock::now().time_since_epoch().count());
+			Send(msg);
+		}
+	};
+
+	void Run(std::shared_ptr<const net::rate_limit<FloodMsg>> pLimit)
+	{
+		flood_server server;
+		server.SetRateLimit(pLimit);
+		server.Start();
+
+		net::client_interface<FloodMsg> flooder;
+		flooder.Connect("127.0.0.1", nPort);
+		net::latency_histogram rtt;
+		std::vector<std::unique_ptr<ping_client>> vHonest;
+		for(size_t i = 0; i < nHonest; i++)
+		{
+			vHonest.push_back(std::make_unique<ping_client>(rtt));
+			vHonest.back()->Connect("127.0.0.1", nPort);
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(200));
+		server.Update(-1);
+
+		std::atomic<bool> bRun = true;
+		std::thread thrServer([&]()
+			{
+				while(bRun)
+				{
+					server.UpdateFor(std::chrono::milliseconds(10));
+				}
+			});
+
+		// Keeps at most 1 MB queued on its side, the rest is up to the server
+		std::thread thrFlood([&]()
+			{
+				net::message<FloodMsg> msg;
+				msg.header.id = FloodMsg::Flood;
+				msg.body.resize(64);
+				while(bRun)
+				{
+					if(flooder.IsConnected() && flooder.QueuedBytes() < 1024 * 1024)
+					{
+						flooder.Send(msg);
+					}
+					else
+					{
+						std::this_thread::yield();
+					}
+				}
+			});
+
+		const auto tEnd = std::chrono::steady_clock::now() + std::chrono::seconds(nSeconds);
+		while(std::chrono::steady_clock::now() < tEnd)
+		{
+			for(auto& client : vHonest)
+			{
+				client->Ping();
+				client->Update();
+			}
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		}
+
+		// What the server still has to get through once everyone stops
+		bRun = false;
+		thrFlood.join();
+		thrServer.join();
+		flooder.Disconnect();
+		const uint64_t nHandled = server.nFlood;
+		const auto tDrain = std::chrono::steady_clock::now();
+		server.Update(-1);
+		const double dDrainMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - tDrain).count();
+
+		for(auto& client : vHonest)
+		{
+			client->Update();
+		}
+
+		std::cout << (pLimit ? "limited:   " : "unlimited: ") << rtt.Count() << " pings answered, rtt p50 < "
+			<< rtt.Percentile(0.5) / 1000.0 << " ms, p99 < " << rtt.Percentile(0.99) / 1000.0 << " ms; flood "
+			<< nHandled / nSeconds << " msg/s handled, backlog " << server.nFlood - nHandled << " messages ("
+			<< dDrainMs << " ms to drain)\n";
+
+		for(auto& client : vHonest)
+		{
+			client->Disconnect();
+		}
+		server.Stop();
+	}
+}
+
+void BenchRateLimit()
+{
+	Run(nullptr);
+	Run(std::make_shared<net::rate_limit<FloodMsg>>(2000.0, 1024.0 * 1024.0, 0.1));
+}
@@ -0,0 +1,126 @@
+#include "benchmarks.h"
+
+// Calls answered by the server's Update thread, one at a time waiting for each
+// reply, then pipelined with every call in flight before the first reply is read
+namespace
+{
+	enum class RpcMsg : uint32_t
+	{
+		Add,
+		Ignored,
+		Count
+	};
+
+	constexpr uint16_t nPort = 60103;
+	constexpr int nLockStepCalls = 5000;
+	constexpr int nPipelinedCalls = 100000;
+
+	struct add_request
+	{
+		uint32_t a;
+		uint32_t b;
+	};
+
+	class rpc_server : public net::server_interface<RpcMsg>
+	{
+	public:
+		rpc_server() : net::server_interface<RpcMsg>(nPort)
+		{
+			RegisterHandler<add_request>(RpcMsg::Add,
+				[this](std::shared_ptr<net::connection<RpcMsg>> client, net::message<RpcMsg>& request, const add_request& req)
+				{
+					net::message<RpcMsg> response;
+					response.header.id = RpcMsg::Add;
+					response << uint32_t(req.a + req.b);
+					Reply(client, request, response);
+				});
+		}
+
+	protected:
+		bool OnClientConnect(std::shared_ptr<net::connection<RpcMsg>> /*client*/) override
+		{
+			return true;
+		}
+	};
+
+	net::message<RpcMsg> AddRequest(uint32_t a, uint32_t b)
+	{
+		net::message<RpcMsg> msg;
+		msg.header.id = RpcMsg::Add;
+		msg << add_request{ a, b };
+		return msg;
+	}
+
+	bool Check(std::future<net::message<RpcMsg>>& future, uint32_t nExpected)
+	{
+		net::message<RpcMsg> reply = future.get();
+		uint32_t nSum = 0;
+		reply >> nSum;
+		return nSum == nExpected;
+	}
+}
+
+void BenchRpc()
+{
+	rpc_server server;
+	server.Start();
+
+	std::atomic<bool> bRun = true;
+	std::thread thrUpdate([&]()
+		{
+			while(bRun)
+			{
+				server.UpdateFor(std::chrono::milliseconds(50));
+			}
+		});
+
+	net::client_interface<RpcMsg> client;
+	client.Connect("127.0.0.1", nPort);
+	std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+	int nWrong = 0;
+	auto tStart = std::chrono::steady_clock::now();
+	for(int i = 0; i < nLockStepCalls; i++)
+	{
+		auto future = client.Call(AddRequest(i, 1));
+		nWrong += Check(future, i + 1) ? 0 : 1;
+	}
+	double dSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - tStart).count();
+	std::cout << "lock-step: " << nLockStepCalls << " calls in " << dSeconds * 1000.0 << " ms, "
+		<< nLockStepCalls / dSeconds << " calls/s\n";
+
+	std::vector<std::future<net::message<RpcMsg>>> vFutures;
+	vFutures.reserve(nPipelinedCalls);
+	tStart = std::chrono::steady_clock::now();
+	for(int i = 0; i < nPipelinedCalls; i++)
+	{
+		vFutures.push_back(client.Call(AddRequest(i, 2), std::chrono::seconds(30)));
+	}
+	for(int i = 0; i < nPipelinedCalls; i++)
+	{
+		nWrong += Check(vFutures[i], i + 2) ? 0 : 1;
+	}
+	dSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - tStart).count();
+	std::cout << "pipelined: " << nPipelinedCalls << " calls in " << dSeconds * 1000.0 << " ms, "
+		<< nPipelinedCalls / dSeconds << " calls/s, " << nWrong << " wrong replies\n";
+
+	// Nobody answers this one
+	net::message<RpcMsg> msg;
+	msg.header.id = RpcMsg::Ignored;
+	tStart = std::chrono::steady_clock::now();
+	auto future = client.Call(msg, std::chrono::milliseconds(50));
+	try
+	{
+		future.get();
+		std::cout << "deadline: unexpected reply\n";
+	}
+	catch(net::call_error& e)
+	{
+		std::cout << "deadline: " << e.what() << " after "
+			<< std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - tStart).count() << " ms\n";
+	}
+
+	client.Disconnect();
+	bRun = false;
+	thrUpdate.join();
+}
@@ -0,0 +1,120 @@
+#include "benchmarks.h"
+
+// World of 4096 entities replicated to 8 clients every tick, 3% of the entities
+// move per tick, snapshot bytes against sending the whole world each time
+namespace
+{
+	enum class SnapMsg : uint32_t
+	{
+		Snapshot,
+		Ack,
+		Count
+	};
+
+	constexpr uint16_t nPort = 60104;
+	constexpr size_t nEntities = 4096;
+	constexpr size_t nClients = 8;
+	constexpr int nTicks = 300;
+
+	struct entity
+	{
+		float x, y, z;
+		float yaw;
+		uint32_t nHealth;
+		uint32_t nFlags;
+		uint32_t nPad[2];
+	};
+
+	class snapshot_server : public net::server_interface<SnapMsg>
+	{
+	public:
+		snapshot_server() : net::server_interface<SnapMsg>(nPort)
+		{
+			EnableSnapshots(SnapMsg::Snapshot, SnapMsg::Ack);
+		}
+
+	protected:
+		bool OnClientConnect(std::shared_ptr<net::connection<SnapMsg>> /*client*/) override
+		{
+			return true;
+		}
+	};
+
+	class snapshot_client : public net::client_interface<SnapMsg>
+	{
+	public:
+		snapshot_client()
+		{
+			RegisterHandler(SnapMsg::Snapshot,
+				[this](net::message<SnapMsg>& msg)
+				{
+					receiver.Apply(msg);
+					Send(receiver.Acknowledgement(SnapMsg::Ack));
+				});
+		}
+
+		net::snapshot_receiver<SnapMsg> receiver;
+	};
+}
+
+void BenchSnapshot()
+{
+	snapshot_server server;
+	server.Start();
+
+	std::vector<std::unique_ptr<snapshot_client>> vClients;
+	for(size_t i = 0; i < nClients; i++)
+	{
+		vClients.push_back(std::make_unique<snapshot_client>());
+		vClients.back()->Connect("127.0.0.1", nPort);
+	}
+	std::this_thread::sleep_for(std::chrono::milliseconds(200));
+	server.Update(-1);
+
+	std::vector<entity> vWorld(nEntities);
+	std::mt19937 rng(7);
+	for(auto& e : vWorld)
+	{
+		e = { float(rng() % 1000), float(rng() % 1000), 0.0f, 0.0f, 100, 0, { 0, 0 } };
+	}
+
+	double dBroadcastMs = 0.0;
+	for(int t = 0; t < nTicks; t++)
+	{
+		for(size_t i = 0; i < nEntities * 3 / 100; i++)
+		{
+			entity& e = vWorld[rng() % nEntities];
+			e.x += 1.0f;
+			e.yaw += 0.1f;
+		}
+
+		auto tStart = std::chrono::steady_clock::now();
+		server.BroadcastSnapshot(vWorld.data(), vWorld.size() * sizeof(entity));
+		dBroadcastMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - tStart).count();
+
+		// A 500 Hz tick, acks of the previous tick are usually in by the next
+		std::this_thread::sleep_for(std::chrono::milliseconds(2));
+		for(auto& client : vClients)
+		{
+			client->Update();
+		}
+		server.Update(-1);
+	}
+
+	std::this_thread::sleep_for(std::chrono::milliseconds(200));
+	size_t nInSync = 0;
+	for(auto& client : vClients)
+	{
+		client->Update();
+		const auto& vState = client->receiver.State();
+		nInSync += vState.size() == vWorld.size() * sizeof(entity) &&
+			std::memcmp(vState.data(), vWorld.data(), vState.size()) == 0 ? 1 : 0;
+	}
+
+	const net::snapshot_stats stats = server.SnapshotStats();
+	std::cout << "snapshots: " << stats.nSnapshots << " (" << stats.nFull << " full), "
+		<< (stats.nBytesSent >> 10) << " KB sent vs " << (stats.nBytesFull >> 10) << " KB as full snapshots, "
+		<< double(stats.nBytesFull) / double(std::max<uint64_t>(stats.nBytesSent, 1)) << "x less\n";
+	std::cout << "broadcast cost: " << dBroadcastMs / nTicks << " ms per tick for " << nClients << " clients, "
+		<< nInSync << "/" << nClients << " clients in sync\n";
+}
@@ -0,0 +1,72 @@
+#include "benchmarks.h"
+
+// Upload a payload far bigger than anything we would buffer with SendStream,
+// memory on the server is bounded by the credit window, not the payload
+namespace
+{
+	enum class StreamMsg : uint32_t
+	{
+		Upload,
+		Count
+	};
+
+	constexpr uint16_t nPort = 60101;
+	constexpr uint64_t nPayloadSize = 1024ull * 1024 * 1024;
+
+	class stream_server : public net::server_interface<StreamMsg>
+	{
+	public:
+		stream_server() : net::server_interface<StreamMsg>(nPort)
+		{
+		}
+
+		uint64_t nReceived = 0;
+		size_t nPeakQueued = 0;
+		bool bDone = false;
+
+	protected:
+		bool OnClientConnect(std::shared_ptr<net::connection<StreamMsg>> /*client*/) override
+		{
+			return true;
+		}
+
+		void OnStreamData(std::shared_ptr<net::connection<StreamMsg>> /*client*/, net::message<StreamMsg>& chunk, bool bLast) override
+		{
+			nReceived += chunk.body.size();
+			nPeakQueued = std::max(nPeakQueued, m_deqUpdateBatch.size() + m_qMessagesIn.count());
+			bDone = bLast;
+		}
+	};
+}
+
+void BenchStream()
+{
+	stream_server server;
+	server.Start();
+
+	net::client_interface<StreamMsg> client;
+	client.Connect("127.0.0.1", nPort);
+	std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+	auto tStart = std::chrono::steady_clock::now();
+
+	// Source generates the payload on demand, like reading a file piece by piece
+	uint64_t nProduced = 0;
+	client.SendStream(StreamMsg::Upload, nPayloadSize,
+		[&nProduced](uint8_t* pDst, size_t nMax)
+		{
+			std::memset(pDst, int(nProduced & 0xFF), nMax);
+			nProduced += nMax;
+			return nMax;
+		});
+
+	while(!server.bDone)
+	{
+		server.UpdateFor(std::chrono::milliseconds(100));
+	}
+
+	const double dSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - tStart).count();
+	std::cout << "streamed " << (server.nReceived >> 20) << " MB in " << dSeconds * 1000.0 << " ms, "
+		<< (server.nReceived >> 20) / dSeconds << " MB/s, peak queued chunks " << server.nPeakQueued
+		<< " (window " << (net::nStreamWindow >> 10) << " KB)\n";
+}
@@ -0,0 +1,115 @@
+#include "benchmarks.h"
+
+// 60 Hz server with 16 clients streaming inputs at it, each tick the server
+// answers every input and sends a state update to all. How long ticks take,
+// how late they start and how many run over
+namespace
+{
+	enum class TickMsg : uint32_t
+	{
+		Input,
+		InputAck,
+		State,
+		Count
+	};
+
+	constexpr uint16_t nPort = 60105;
+	constexpr double dTickRate = 60.0;
+	constexpr size_t nClients = 16;
+	constexpr int nSeconds = 3;
+	constexpr size_t nInputsPerTick = 8;
+
+	class tick_server : public net::server_interface<TickMsg>
+	{
+	public:
+		tick_server() : net::server_interface<TickMsg>(nPort)
+		{
+			RegisterHandler(TickMsg::Input,
+				[this](std::shared_ptr<net::connection<TickMsg>> client, net::message<TickMsg>& /*msg*/)
+				{
+					net::message<TickMsg> ack;
+					ack.header.id = TickMsg::InputAck;
+					MessageClient(client, ack);
+					nInputs++;
+				});
+		}
+
+		uint64_t nInputs = 0;
+		double dSimulated = 0.0;
+
+	protected:
+		bool OnClientConnect(std::shared_ptr<net::connection<TickMsg>> /*client*/) override
+		{
+			return true;
+		}
+
+		void OnTick(double dt) override
+		{
+			dSimulated += dt;
+			net::message<TickMsg> state;
+			state.header.id = TickMsg::State;
+			state.body.resize(256);
+			MessageAllClients(state);
+		}
+	};
+}
+
+void BenchTick()
+{
+	tick_server server;
+	server.Start();
+
+	std::vector<std::unique_ptr<net::client_interface<TickMsg>>> vClients;
+	for(size_t i = 0; i < nClients; i++)
+	{
+		vClients.push_back(std::make_unique<net::client_interface<TickMsg>>());
+		vClients.back()->Connect("127.0.0.1", nPort);
+	}
+	std::this_thread::sleep_for(std::chrono::milliseconds(200));
+	server.Update(-1);
+
+	// Clients send a few inputs per tick period and drop what comes back
+	std::atomic<bool> bRun = true;
+	std::atomic<uint64_t> nReceived = 0;
+	std::thread thrClients([&]()
+		{
+			net::message<TickMsg> input;
+			input.header.id = TickMsg::Input;
+			input.body.resize(32);
+			while(bRun)
+			{
+				for(auto& client : vClients)
+				{
+					for(size_t i = 0; i < nInputsPerTick; i++)
+					{
+						client->Send(input);
+					}
+					while(!client->Incoming().empty())
+					{
+						client->Incoming().pop_front();
+						nReceived++;
+					}
+				}
+				std::this_thread::sleep_for(std::chrono::duration<double>(1.0 / dTickRate));
+			}
+		});
+
+	server.SetTickRate(dTickRate);
+	const auto tEnd = std::chrono::steady_clock::now() + std::chrono::seconds(nSeconds);
+	while(std::chrono::steady_clock::now() < tEnd)
+	{
+		server.Tick();
+	}
+	bRun = false;
+	thrClients.join();
+
+	const net::tick_stats& stats = server.TickStats();
+	std::cout << stats.nTicks << " ticks at " << dTickRate << " Hz (" << server.dSimulated << " s simulated), "
+		<< server.nInputs << " inputs handled, " << nReceived << " messages received by clients\n";
+	std::cout << "tick duration: mean " << stats.duration.Mean() << " us, p50 < " << stats.duration.Percentile(0.5)
+		<< " us, p99 < " << stats.duration.Percentile(0.99) << " us, max " << stats.duration.Max() << " us\n";
+	std::cout << "start jitter: mean " << stats.jitter.Mean() << " us, p50 < " << stats.jitter.Percentile(0.5)
+		<< " us, p99 < " << stats.jitter.Percentile(0.99) << " us, max " << stats.jitter.Max() << " us\n";
+	std::cout << "overruns: " << stats.nOverruns << ", budget exhausted: " << stats.nBudgetExhausted << "\n";
+	std::cout << "jitter histogram:\n" << stats.jitter;
+}
@@ -0,0 +1,261 @@
+#include "benchmarks.h"
+
+// Loopback upload over plain TCP, userspace TLS and kernel TLS, then the cost of
+// reconnecting with and without a cached session
+// Needs the project built with NET_USE_TLS and OpenSSL linked
+#ifdef NET_USE_TLS
+
+#include <openssl/evp.h>
+#include <openssl/ec.h>
+#include <openssl/pem.h>
+#include <openssl/x509.h>
+
+namespace
+{
+	enum class TlsMsg : uint32_t
+	{
+		Upload,
+		Welcome,
+		Count
+	};
+
+	constexpr uint16_t nPort = 60102;
+	constexpr uint64_t nPayloadSize = 512ull * 1024 * 1024;
+	constexpr int nReconnects = 20;
+
+	enum class mode
+	{
+		plain,
+		tls,
+		ktls
+	};
+
+	// Throwaway self signed certificate for localhost, PEM encoded
+	struct test_identity
+	{
+		std::string sCert;
+		std::string sKey;
+	};
+
+	std::string ToPem(BIO* bio)
+	{
+		char* pData = nullptr;
+		const long nSize = BIO_get_mem_data(bio, &pData);
+		std::string s(pData, size_t(nSize));
+		BIO_free(bio);
+		return s;
+	}
+
+	test_identity MakeIdentity()
+	{
+		EVP_PKEY* pKey = nullptr;
+		EVP_PKEY_CTX* pCtx = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, nullptr);
+		EVP_PKEY_keygen_init(pCtx);
+		EVP_PKEY_CTX_set_ec_paramgen_curve_nid(pCtx, NID_X9_62_prime256v1);
+		EVP_PKEY_keygen(pCtx, &pKey);
+		EVP_PKEY_CTX_free(pCtx);
+
+		X509* pCert = X509_new();
+		X509_set_version(pCert, 2);
+		ASN1_INTEGER_set(X509_get_serialNumber(pCert), 1);
+		X509_gmtime_adj(X509_getm_notBefore(pCert), 0);
+		X509_gmtime_adj(X509_getm_notAfter(pCert), 24 * 3600);
+		X509_set_pubkey(pCert, pKey);
+		X509_NAME* pName = X509_get_subject_name(pCert);
+		X509_NAME_add_entry_by_txt(pName, "CN", MBSTRING_ASC, reinterpret_cast<const unsigned char*>("localhost"), -1, -1, 0);
+		X509_set_issuer_name(pCert, pName);
+		X509_sign(pCert, pKey, EVP_sha256());
+
+		test_identity id;
+		BIO* bio = BIO_new(BIO_s_mem());
+		PEM_write_bio_X509(bio, pCert);
+		id.sCert = ToPem(bio);
+		bio = BIO_new(BIO_s_mem());
+		PEM_write_bio_PrivateKey(bio, pKey, nullptr, nullptr, 0, nullptr, nullptr);
+		id.sKey = ToPem(bio);
+
+		X509_free(pCert);
+		EVP_PKEY_free(pKey);
+		return id;
+	}
+
+	std::shared_ptr<asio::ssl::context> ServerContext(const test_identity& id)
+	{
+		auto ctx = std::make_shared<asio::ssl::context>(asio::ssl::context::tls_server);
+		ctx->use_certificate_chain(asio::buffer(id.sCert));
+		ctx->use_private_key(asio::buffer(id.sKey), asio::ssl::context::pem);
+		return ctx;
+	}
+
+	std::shared_ptr<asio::ssl::context> ClientContext(const test_identity& id)
+	{
+		auto ctx = std::make_shared<asio::ssl::context>(asio::ssl::context::tls_client);
+		ctx->add_certificate_authority(asio::buffer(id.sCert));
+		ctx->set_verify_mode(asio::ssl::verify_peer);
+		return ctx;
+	}
+
+	class tls_server : public net::server_interface<TlsMsg>
+	{
+	public:
+		tls_server() : net::server_interface<TlsMsg>(nPort)
+		{
+		}
+
+		uint64_t nReceived = 0;
+		bool bDone = false;
+		bool bKernel = false;
+
+		void OnClientValidated(std::shared_ptr<net::connection<TlsMsg>> client) override
+		{
+			Welcome(client);
+		}
+
+		void OnClientResumed(std::shared_ptr<net::connection<TlsMsg>> client) override
+		{
+			Welcome(client);
+		}
+
+	protected:
+		bool OnClientConnect(std::shared_ptr<net::connection<TlsMsg>> client) override
+		{
+			return true;
+		}
+
+		void OnStreamData(std::shared_ptr<net::connection<TlsMsg>> client, net::message<TlsMsg>& chunk, bool bLast) override
+		{
+			nReceived += chunk.body.size();
+			bKernel = client->IsKernelTls();
+			bDone = bLast;
+		}
+
+	private:
+		void Welcome(std::shared_ptr<net::connection<TlsMsg>> client)
+		{
+			net::message<TlsMsg> msg;
+			msg.header.id = TlsMsg::Welcome;
+			client->Send(msg, net::priority::control);
+		}
+	};
+
+	// Wait for the server's welcome, which follows the whole handshake
+	bool WaitWelcome(net::client_interface<TlsMsg>& client)
+	{
+		const auto tGiveUp = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+		while(std::chrono::steady_clock::now() < tGiveUp)
+		{
+			if(client.Incoming().wait_for(std::chrono::milliseconds(50)))
+			{
+				client.Incoming().clear();
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void RunThroughput(const char* sName, mode eMode, const test_identity& id)
+	{
+		tls_server server;
+		if(eMode != mode::plain)
+		{
+			server.EnableTls(ServerContext(id), eMode == mode::ktls);
+		}
+		server.Start();
+
+		net::client_interface<TlsMsg> client;
+		if(eMode != mode::plain)
+		{
+			client.EnableTls(ClientContext(id), eMode == mode::ktls);
+		}
+		client.Connect("localhost", nPort);
+		if(!WaitWelcome(client))
+		{
+			std::cout << sName << ": handshake failed\n";
+			return;
+		}
+
+		auto tStart = std::chrono::steady_clock::now();
+
+		uint64_t nProduced = 0;
+		client.SendStream(TlsMsg::Upload, nPayloadSize,
+			[&nProduced](uint8_t* pDst, size_t nMax)
+			{
+				std::memset(pDst, int(nProduced & 0xFF), nMax);
+				nProduced += nMax;
+				return nMax;
+			});
+
+		while(!server.bDone)
+		{
+			server.UpdateFor(std::chrono::milliseconds(100));
+		}
+
+		const double dSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - tStart).count();
+		std::cout << sName << ": " << (server.nReceived >> 20) << " MB in " << dSeconds * 1000.0 << " ms, "
+			<< (server.nReceived >> 20) / dSeconds << " MB/s";
+		if(eMode == mode::ktls)
+		{
+			std::cout << (client.IsKernelTls() && server.bKernel ? " (kernel offload active)" : " (no kernel TLS here, OpenSSL encrypted in userspace)");
+		}
+		std::cout << "\n";
+	}
+
+	void RunReconnects(const test_identity& id)
+	{
+		tls_server server;
+		server.EnableTls(ServerContext(id));
+		server.Start();
+
+		net::client_interface<TlsMsg> client;
+		client.EnableTls(ClientContext(id));
+
+		for(bool bResume : { false, true })
+		{
+			int nResumed = 0;
+			double dTotalMs = 0.0;
+			for(int i = 0; i < nReconnects; i++)
+			{
+				if(!bResume)
+				{
+					client.ForgetSession();
+				}
+
+				auto tStart = std::chrono::steady_clock::now();
+				client.Connect("localhost", nPort);
+				if(!WaitWelcome(client))
+				{
+					std::cout << "reconnect " << i << " failed\n";
+					return;
+				}
+				dTotalMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - tStart).count();
+				nResumed += client.IsTlsResumed() ? 1 : 0;
+
+				// TLS 1.3 hands out its ticket after the handshake, give it time to arrive
+				std::this_thread::sleep_for(std::chrono::milliseconds(20));
+				client.Disconnect();
+			}
+
+			std::cout << (bResume ? "reconnect, cached session: " : "reconnect, full handshake: ")
+				<< dTotalMs / nReconnects << " ms avg, " << nResumed << "/" << nReconnects << " resumed\n";
+		}
+	}
+}
+
+void BenchTls()
+{
+	const test_identity id = MakeIdentity();
+
+	RunThroughput("plain", mode::plain, id);
+	RunThroughput("tls", mode::tls, id);
+	RunThroughput("ktls", mode::ktls, id);
+	RunReconnects(id);
+}
+
+#else
+
+void BenchTls()
+{
+	std::cout << "built without NET_USE_TLS, skipped\n";
+}
+
+#endif
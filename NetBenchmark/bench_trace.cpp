@@ -0,0 +1,144 @@
+#include "benchmarks.h"
+
+// Ping round trips between a client and the server echoing them back, plain
+// and with lifecycle tracing sampling some or all messages. Built without
+// NET_USE_TRACE only the plain run happens, compare it against a traced build
+// Writes the last traced run to net_trace.json
+namespace
+{
+	enum class TraceMsg : uint32_t
+	{
+		Ping,
+		Count
+	};
+
+	constexpr uint16_t nPort = 60108;
+	constexpr int nPings = 20000;
+	constexpr size_t nInFlight = 16;
+
+	class echo_server : public net::server_interface<TraceMsg>
+	{
+	public:
+		echo_server() : net::server_interface<TraceMsg>(nPort)
+		{
+			RegisterHandler(TraceMsg::Ping,
+				[this](std::shared_ptr<net::connection<TraceMsg>> client, net::message<TraceMsg>& msg)
+				{
+					MessageClient(client, msg);
+				});
+		}
+
+	protected:
+		bool OnClientConnect(std::shared_ptr<net::connection<TraceMsg>> /*client*/) override
+		{
+			return true;
+		}
+	};
+
+	class ping_client : public net::client_interface<TraceMsg>
+	{
+	public:
+		ping_client()
+		{
+			RegisterHandler(TraceMsg::Ping,
+				[this](net::message<TraceMsg>& /*msg*/)
+				{
+					nReceived++;
+				});
+		}
+
+		int nReceived = 0;
+	};
+
+	// Round trips per second, nInFlight pings kept going at once
+	double Run()
+	{
+		echo_server server;
+		server.Start();
+
+		ping_client client;
+		client.Connect("127.0.0.1", nPort);
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		server.Update(-1);
+
+		std::atomic<bool> bRun = true;
+		std::thread thrServer([&]()
+			{
+				while(bRun)
+				{
+					server.UpdateFor(std::chrono::milliseconds(10));
+				}
+			});
+
+		net::message<TraceMsg> msg;
+		msg.header.id = TraceMsg::Ping;
+		msg.body.resize(64);
+
+		const auto tStart = std::chrono::steady_clock::now();
+		int nSent = 0;
+		while(client.nReceived < nPings)
+		{
+			while(nSent < nPings && nSent - client.nReceived < int(nInFlight))
+			{
+				client.Send(msg);
+				nSent++;
+			}
+			client.Update(-1, true);
+		}
+		const double dSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - tStart).count();
+
+		bRun = false;
+		client.Disconnect();
+		thrServer.join();
+		server.Stop();
+		return nPings / dSeconds;
+	}
+}
+
+void BenchTrace()
+{
+	// Best of a few runs each, alternating so drift on the machine hits all the same
+	constexpr int nRounds = 5;
+#ifdef NET_USE_TRACE
+	const uint32_t nSampling[] = { 0, 64, 1 };
+	double dBest[3] = {};
+	for(int r = 0; r < nRounds; r++)
+	{
+		for(size_t i = 0; i < 3; i++)
+		{
+			net::ClearTrace();
+			net::SetTraceSampling(nSampling[i]);
+			dBest[i] = std::max(dBest[i], Run());
+		}
+	}
+	net::SetTraceSampling(0);
+
+	// What a single stamp costs the thread taking it
+	constexpr int nStamps = 1000000;
+	const auto tStamps = std::chrono::steady_clock::now();
+	for(int i = 0; i < nStamps; i++)
+	{
+		NET_TRACE(uint64_t(i + 1), send, 0, 0);
+	}
+	const double dStampNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - tStamps).count() / nStamps;
+	net::ClearTrace();
+
+	// Dump the last run with every message traced
+	net::SetTraceSampling(1);
+	Run();
+	net::SetTraceSampling(0);
+	const auto tDump = std::chrono::steady_clock::now();
+	const bool bDumped = net::DumpTrace("net_trace.json");
+	const double dDumpMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - tDump).count();
+
+	std::cout << "round trips/s: " << dBest[0] << " sampling off, " << dBest[1] << " 1 in 64, " << dBest[2] << " every message\n"
+		<< "stamp: " << dStampNs << " ns, " << (bDumped ? "wrote net_trace.json in " : "could not write net_trace.json, ") << dDumpMs << " ms\n";
+#else
+	double dBest = 0.0;
+	for(int r = 0; r < nRounds; r++)
+	{
+		dBest = std::max(dBest, Run());
+	}
+	std::cout << "round trips/s: " << dBest << " (built without NET_USE_TRACE)\n";
+#endif
+}
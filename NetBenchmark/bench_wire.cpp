@@ -0,0 +1,85 @@
+#include "benchmarks.h"
+
+// Wire order conversion of 16 KB arrays of 16, 32 and 64 bit values: the copy a
+// little endian host does, the vector swap kernel a big endian host uses, and a
+// plain loop of ByteSwap calls to compare it with
+namespace
+{
+	enum class WireMsg : uint32_t
+	{
+		Array
+	};
+
+	constexpr size_t nBytes = 16 * 1024;
+	constexpr int nRounds = 20000;
+
+	template<typename Fn>
+	double GBPerSecond(Fn&& fn)
+	{
+		fn();
+		const auto tStart = std::chrono::steady_clock::now();
+		for(int r = 0; r < nRounds; r++)
+		{
+			fn();
+		}
+		const double dSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - tStart).count();
+		return double(nBytes) * nRounds / dSeconds / 1e9;
+	}
+
+	template<typename V>
+	void Run(const std::vector<uint8_t>& vSrc, std::vector<uint8_t>& vDst)
+	{
+		const size_t nCount = nBytes / sizeof(V);
+
+		const double dCopy = GBPerSecond([&]() { std::memcpy(vDst.data(), vSrc.data(), nBytes); });
+
+		const double dLoop = GBPerSecond([&]()
+			{
+				for(size_t i = 0; i < nCount; i++)
+				{
+					V n;
+					std::memcpy(&n, vSrc.data() + i * sizeof(V), sizeof(V));
+					n = net::ByteSwap(n);
+					std::memcpy(vDst.data() + i * sizeof(V), &n, sizeof(V));
+				}
+			});
+		const std::vector<uint8_t> vExpected = vDst;
+
+		const double dKernel = GBPerSecond([&]() { net::ByteSwapCopy(vDst.data(), vSrc.data(), nCount, sizeof(V)); });
+		const bool bSame = vDst == vExpected;
+
+		// Through a message the way applications would use it
+		std::vector<V> vValues(nCount);
+		std::memcpy(vValues.data(), vSrc.data(), nBytes);
+		net::message<WireMsg> msg;
+		msg.body.reserve(nBytes);
+		const double dMessage = GBPerSecond([&]()
+			{
+				msg.PushArray(vValues.data(), nCount);
+				msg.PopArray(vValues.data(), nCount);
+			});
+
+		std::cout << sizeof(V) * 8 << " bit: copy " << dCopy << " GB/s, swap kernel " << dKernel << " GB/s, ByteSwap loop "
+			<< dLoop << " GB/s" << (bSame ? "" : " (kernel MISMATCH)") << ", message push + pop " << dMessage << " GB/s\n";
+	}
+}
+
+void BenchWire()
+{
+	std::vector<uint8_t> vSrc(nBytes), vDst(nBytes);
+	std::mt19937 rng(3);
+	for(auto& b : vSrc)
+	{
+		b = uint8_t(rng());
+	}
+
+	std::cout << "swap kernel: " << net::WireKernel() << ", host is "
+#ifdef NET_BIG_ENDIAN
+		<< "big endian\n";
+#else
+		<< "little endian\n";
+#endif
+	Run<uint16_t>(vSrc, vDst);
+	Run<uint32_t>(vSrc, vDst);
+	Run<uint64_t>(vSrc, vDst);
+}
@@ -0,0 +1,73 @@
+#include "benchmarks.h"
+
+// Same shape as server_interface::Update with StartWorkers, without the sockets:
+// every client sends a burst, each handler blocks for 100us (think DB lookup)
+namespace
+{
+	constexpr uint32_t nClients = 1000;
+	constexpr uint32_t nMessagesPerClient = 20;
+	constexpr auto handlerCost = std::chrono::microseconds(100);
+
+	struct order_check
+	{
+		std::vector<uint32_t> vNextSeq = std::vector<uint32_t>(nClients, 0);
+		std::atomic<uint32_t> nOutOfOrder{0};
+
+		// Only the worker owning a client touches its slot
+		void Handle(uint32_t nClient, uint32_t nSeq)
+		{
+			std::this_thread::sleep_for(handlerCost);
+			if(vNextSeq[nClient] != nSeq)
+			{
+				nOutOfOrder++;
+			}
+			vNextSeq[nClient] = nSeq + 1;
+		}
+	};
+
+	void Report(const char* name, std::chrono::steady_clock::duration elapsed, uint32_t nOutOfOrder)
+	{
+		const double dSeconds = std::chrono::duration<double>(elapsed).count();
+		const double nTotal = double(nClients) * nMessagesPerClient;
+		std::cout << name << ": " << dSeconds * 1000.0 << " ms, "
+			<< uint64_t(nTotal / dSeconds) << " msg/s, out of order " << nOutOfOrder << "\n";
+	}
+}
+
+void BenchWorkerPool()
+{
+	// Baseline, every handler runs on the Update thread
+	{
+		order_check check;
+		auto tStart = std::chrono::steady_clock::now();
+		for(uint32_t nSeq = 0; nSeq < nMessagesPerClient; nSeq++)
+		{
+			for(uint32_t nClient = 0; nClient < nClients; nClient++)
+			{
+				check.Handle(nClient, nSeq);
+			}
+		}
+		Report("serial     ", std::chrono::steady_clock::now() - tStart, check.nOutOfOrder);
+	}
+
+	for(size_t nThreads : { 4, 16, 64 })
+	{
+		order_check check;
+		auto tStart = std::chrono::steady_clock::now();
+		{
+			net::worker_pool pool(nThreads, 256);
+			for(uint32_t nSeq = 0; nSeq < nMessagesPerClient; nSeq++)
+			{
+				for(uint32_t nClient = 0; nClient < nClients; nClient++)
+				{
+					pool.Submit(nClient, [&check, nClient, nSeq]() { check.Handle(nClient, nSeq); });
+				}
+			}
+			// Destructor drains the shards
+		}
+
+		std::string name = "workers x" + std::to_string(nThreads);
+		name.resize(11, ' ');
+		Report(name.c_str(), std::chrono::steady_clock::now() - tStart, check.nOutOfOrder);
+	}
+}
@@ -0,0 +1,61 @@
+#pragma once
+// Benchmarks run by NetBenchmark, each prints its own results
+
+#include <net_full.h>
+
+// Handler worker pool, 100us handlers spread over 1k clients
+void BenchWorkerPool();
+
+// Control lane ping round trip while bulk transfers fill the connection
+void BenchLanes();
+
+// Large upload through SendStream with credit based flow control
+void BenchStream();
+
+// Upload over plain TCP, userspace TLS and kTLS, reconnects with and without a cached TLS session
+void BenchTls();
+
+// Calls answered one at a time versus pipelined, and a call left to hit its deadline
+void BenchRpc();
+
+// World state to 8 clients per tick as deltas against each client's acknowledged snapshot
+void BenchSnapshot();
+
+// Position publish to nearby clients among 10k, interest grid versus scanning every client
+void BenchInterest();
+
+// Fixed rate tick loop under client input, tick duration, start jitter and overruns
+void BenchTick();
+
+// One client flooding the server while others ping, without and with a per-client rate limit
+void BenchRateLimit();
+
+// Wire order conversion of large arrays, plain copy against the byte swap kernels
+void BenchWire();
+
+// CRC32C kernels, and 64 KB messages with and without per frame CRCs
+void BenchCrc();
+
+// Echoed pings untraced, sampled and fully traced, dumped as Chrome trace JSON
+void BenchTrace();
+
+// Ping round trips and upload throughput through the impairment proxy under several link profiles
+void BenchImpair();
+
+// Compact frame header decode, and small messages with 8 byte and compact headers
+void BenchCompact();
+
+// 5000 scripted client connections from the load generator on 2 threads
+void BenchLoadGen();
+
+// Log lines from 4 threads, formatted in place under a lock against the asynchronous log
+void BenchLog();
+
+// Ping round trips with blocking asio threads and Update against the spinning low latency mode
+void BenchBusyPoll();
+
+// Ping round trips with the server handling messages in an Update thread, on the asio thread and from a notifier poll loop
+void BenchDelivery();
+
+// Server to client messages live, plain and durable, then sent while the client is away and resent from the outbox when it resumes
+void BenchOutbox();
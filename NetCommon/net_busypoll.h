@@ -0,0 +1,110 @@
+#pragma once
+// Low latency mode for hosts with cores to spare
+// With bSpin the asio threads poll their context in a loop instead of sleeping in
+// run(), and Update(.., true) / UpdateFor spin on the inbound queue instead of
+// waiting on its condition variable, so no message waits for a thread to be woken.
+// Every spinning thread keeps a core busy: pin them to cores nothing else runs on
+// SO_BUSY_POLL (Linux) has the kernel poll the device queue on socket reads
+// rather than wait for its interrupt, raising it may need CAP_NET_ADMIN
+
+#include "net_common.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#include <immintrin.h>
+#define NET_CPU_PAUSE() _mm_pause()
+#elif defined(__aarch64__) || defined(__arm__)
+#define NET_CPU_PAUSE() __asm__ __volatile__("yield")
+#else
+#define NET_CPU_PAUSE() ((void)0)
+#endif
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <sys/socket.h>
+#endif
+
+namespace net
+{
+	struct busy_poll
+	{
+		// Spin rather than block, and no Nagle delay on the sockets
+		bool bSpin = false;
+		// Core for the asio thread, pools put thread i on nCpu + i, -1 leaves it to the scheduler
+		int nCpu = -1;
+		// SO_BUSY_POLL on each socket in microseconds, 0 leaves it off, ignored where
+		// the headers have no SO_BUSY_POLL
+		int nSocketPollUs = 0;
+	};
+
+	// Pins the calling thread to one core, false when that isn't possible here
+	inline bool PinThread(int nCpu)
+	{
+#if defined(__linux__)
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(nCpu, &set);
+		return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#elif defined(_WIN32)
+		return nCpu < 64 && SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR(1) << nCpu) != 0;
+#else
+		return false;
+#endif
+	}
+
+	// One round of a spin loop that found nothing: a pause, and every so often a
+	// yield so a thread that does have work gets the core when they share one
+	inline void SpinWait(uint32_t& nSpins)
+	{
+		if((++nSpins & 63) == 0)
+		{
+			std::this_thread::yield();
+		}
+		else
+		{
+			NET_CPU_PAUSE();
+		}
+	}
+
+	// Socket options of the mode, applied to each connection's socket once it is open
+	inline void ApplyBusyPoll(asio::ip::tcp::socket& socket, const busy_poll& opts)
+	{
+		if(opts.bSpin)
+		{
+			asio::error_code ec;
+			socket.set_option(asio::ip::tcp::no_delay(true), ec);
+		}
+		// Older C libraries and other systems have no SO_BUSY_POLL, there it does nothing
+#if defined(__linux__) && defined(SO_BUSY_POLL)
+		if(opts.nSocketPollUs > 0)
+		{
+			const int nUs = opts.nSocketPollUs;
+			setsockopt(socket.native_handle(), SOL_SOCKET, SO_BUSY_POLL, &nUs, sizeof(nUs));
+		}
+#endif
+	}
+
+	// Runs ctx on the calling thread until it is stopped or out of work, as run() does
+	inline void RunContext(asio::io_context& ctx, const busy_poll& opts, int nCpuOffset = 0)
+	{
+		if(opts.nCpu >= 0)
+		{
+			PinThread(opts.nCpu + nCpuOffset);
+		}
+
+		if(!opts.bSpin)
+		{
+			ctx.run();
+			return;
+		}
+
+		uint32_t nSpins = 0;
+		while(!ctx.stopped())
+		{
+			if(ctx.poll() == 0)
+			{
+				SpinWait(nSpins);
+			}
+		}
+	}
+}
@@ -0,0 +1,235 @@
+#pragma once
+// Traffic capture
+// Every frame a connection delivers or writes can be appended, with a timestamp,
+// to memory mapped segment files. capture_reader walks them back for replay
+
+#include "net_common.h"
+#include "net_message.h"
+#include "net_mmap.h"
+
+#include <fstream>
+
+namespace net
+{
+	enum class capture_direction : uint8_t
+	{
+		in,		// received from the remote
+		out		// written to the remote
+	};
+
+	// Start of every segment file
+	struct capture_segment_header
+	{
+		char magic[8];
+		uint64_t nUsed;		// bytes of the file holding records, header included
+		uint64_t nReserved[2];
+	};
+
+	// Start of every record, followed by nSize body bytes padded to 8
+	struct capture_record
+	{
+		uint64_t nTime;			// steady clock, nanoseconds
+		uint32_t nConnection;
+		uint32_t nId;			// message id as its underlying integer
+		uint32_t nSize;
+		capture_direction eDirection;
+		stream_part eStream;
+		uint16_t nReserved;
+	};
+
+	constexpr char sCaptureMagic[8] = { 'N','E','T','C','A','P','0','1' };
+
+	// Segment n of a capture called sBase
+	inline std::string CaptureSegmentPath(const std::string& sBase, uint32_t nSegment)
+	{
+		std::string sIndex = std::to_string(nSegment);
+		return sBase + "." + std::string(sIndex.size() < 6 ? 6 - sIndex.size() : 0, '0') + sIndex + ".netcap";
+	}
+
+	class capture_log
+	{
+	public:
+		// Records go to sBase.000000.netcap, sBase.000001.netcap... each nSegmentSize bytes
+		capture_log(const std::string& sBase, uint64_t nSegmentSize = 256ull * 1024 * 1024)
+			: m_sBase(sBase), m_nSegmentSize(nSegmentSize)
+		{
+			OpenSegment();
+		}
+
+		capture_log(const capture_log&) = delete;
+
+		virtual ~capture_log()
+		{
+			std::scoped_lock lock(m_mux);
+			m_file.Flush();
+		}
+
+	public:
+		template<typename T>
+		void Append(uint32_t nConnection, capture_direction eDirection, const message<T>& msg, stream_part eStream = stream_part::none)
+		{
+			Append(nConnection, eDirection, uint32_t(static_cast<std::underlying_type_t<T>>(msg.header.id)),
+				msg.body.data(), uint32_t(msg.body.size()), eStream);
+		}
+
+		// Copies one record into the mapping, rolls to a new segment when full
+		void Append(uint32_t nConnection, capture_direction eDirection, uint32_t nId,
+			const uint8_t* pBody, uint32_t nSize, stream_part eStream = stream_part::none)
+		{
+			capture_record rec{};
+			rec.nTime = uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::steady_clock::now().time_since_epoch()).count());
+			rec.nConnection = nConnection;
+			rec.nId = nId;
+			rec.nSize = nSize;
+			rec.eDirection = eDirection;
+			rec.eStream = eStream;
+
+			const uint64_t nTotal = sizeof(capture_record) + Padded(nSize);
+
+			std::scoped_lock lock(m_mux);
+			if(!m_file.IsOpen())
+			{
+				return;
+			}
+
+			if(m_nUsed + nTotal > m_file.size())
+			{
+				m_nSegment++;
+				if(!OpenSegment(std::max(m_nSegmentSize, nTotal + sizeof(capture_segment_header))))
+				{
+					return;
+				}
+			}
+
+			uint8_t* p = m_file.data() + m_nUsed;
+			std::memcpy(p, &rec, sizeof(capture_record));
+			if(nSize > 0)
+			{
+				std::memcpy(p + sizeof(capture_record), pBody, nSize);
+			}
+
+			m_nUsed += nTotal;
+			Header()->nUsed = m_nUsed;
+			m_nRecords++;
+		}
+
+		uint64_t RecordCount()
+		{
+			std::scoped_lock lock(m_mux);
+			return m_nRecords;
+		}
+
+	private:
+		static uint64_t Padded(uint64_t n)
+		{
+			return (n + 7) & ~uint64_t(7);
+		}
+
+		capture_segment_header* Header()
+		{
+			return reinterpret_cast<capture_segment_header*>(m_file.data());
+		}
+
+		bool OpenSegment(uint64_t nSize = 0)
+		{
+			m_file.Flush();
+			if(!m_file.Open(CaptureSegmentPath(m_sBase, m_nSegment), nSize ? nSize : m_nSegmentSize))
+			{
+				NET_LOG_ERROR("[CAPTURE] Cannot map ", CaptureSegmentPath(m_sBase, m_nSegment));
+				return false;
+			}
+
+			capture_segment_header hdr{};
+			std::memcpy(hdr.magic, sCaptureMagic, sizeof(hdr.magic));
+			hdr.nUsed = sizeof(capture_segment_header);
+			std::memcpy(m_file.data(), &hdr, sizeof(hdr));
+			m_nUsed = hdr.nUsed;
+			return true;
+		}
+
+	private:
+		std::string m_sBase;
+		uint64_t m_nSegmentSize;
+		uint32_t m_nSegment = 0;
+
+		// Appends come from every asio thread, the lock only covers a memcpy
+		std::mutex m_mux;
+		mapped_file m_file;
+		uint64_t m_nUsed = 0;
+		uint64_t m_nRecords = 0;
+	};
+
+	// One record read back from a capture
+	struct captured_frame
+	{
+		capture_record rec;
+		std::vector<uint8_t> body;
+	};
+
+	// Reads every segment of a capture in order
+	class capture_reader
+	{
+	public:
+		capture_reader(const std::string& sBase)
+			: m_sBase(sBase)
+		{
+			OpenSegment();
+		}
+
+	public:
+		// False once all segments are exhausted
+		bool Next(captured_frame& frame)
+		{
+			while(m_file.is_open())
+			{
+				if(m_nOffset + sizeof(capture_record) <= m_nUsed)
+				{
+					m_file.seekg(std::streamoff(m_nOffset));
+					m_file.read(reinterpret_cast<char*>(&frame.rec), sizeof(capture_record));
+					frame.body.resize(frame.rec.nSize);
+					m_file.read(reinterpret_cast<char*>(frame.body.data()), frame.rec.nSize);
+					m_nOffset += sizeof(capture_record) + ((uint64_t(frame.rec.nSize) + 7) & ~uint64_t(7));
+					if(m_file)
+					{
+						return true;
+					}
+				}
+
+				m_nSegment++;
+				OpenSegment();
+			}
+			return false;
+		}
+
+	private:
+		void OpenSegment()
+		{
+			m_file.close();
+			m_file.clear();
+			m_file.open(CaptureSegmentPath(m_sBase, m_nSegment), std::ios::binary);
+			if(!m_file.is_open())
+			{
+				return;
+			}
+
+			capture_segment_header hdr{};
+			m_file.read(reinterpret_cast<char*>(&hdr), sizeof(hdr));
+			if(!m_file || std::memcmp(hdr.magic, sCaptureMagic, sizeof(hdr.magic)) != 0)
+			{
+				m_file.close();
+				return;
+			}
+
+			m_nUsed = hdr.nUsed;
+			m_nOffset = sizeof(capture_segment_header);
+		}
+
+	private:
+		std::string m_sBase;
+		uint32_t m_nSegment = 0;
+		std::ifstream m_file;
+		uint64_t m_nUsed = 0;
+		uint64_t m_nOffset = 0;
+	};
+}
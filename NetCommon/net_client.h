@@ -4,6 +4,8 @@
 #include "net_message.h"
 #include "net_tsqueue.h"
 #include "net_connection.h"
+#include "net_dispatch.h"
+#include "net_delivery.h"
 
 namespace net
 {
@@ -21,10 +23,17 @@ namespace net
 		}
 	public:
 		// Connect to server with hostname/ip-address and port
+		// Reconnecting presents the ticket of the previous connection, so the
+		// client keeps its ID and can send straight away
 		bool Connect( const std::string& host, const uint16_t port)
 		{
+			// Tidy up a previous connection, this keeps its ticket
+			Disconnect();
+
 			try
 			{
+				m_context.restart();
+
 				// Resolve hostname/ip-adress into tangiable physical address
 				// can throw exception
 				asio::ip::tcp::resolver resolver(m_context);
@@ -36,17 +45,43 @@ namespace net
 					m_context,
 					asio::ip::tcp::socket(m_context), m_qMessageIn);
 
+#ifdef NET_USE_TLS
+				if(m_pTlsContext)
+				{
+					m_connection->EnableTls(m_pTlsContext, m_bKernelTls, host, &m_tlsSessions);
+				}
+#endif
+
 				// Connect to the server
-				m_connection->ConnectToServer(endpoints);
+				m_connection->SetFeatures(m_nFeatures);
+				m_connection->SetDurableCursor(&m_durable);
+				m_connection->SetBusyPoll(m_busyPoll);
+				if(m_nMaxBufferedBytes)
+				{
+					m_connection->SetMaxBufferedBytes(m_nMaxBufferedBytes);
+				}
+				if(m_nChunkSize)
+				{
+					m_connection->SetChunkSize(m_nChunkSize);
+				}
+				if(m_nLaneWeights[0])
+				{
+					m_connection->SetLaneWeights(m_nLaneWeights[0], m_nLaneWeights[1], m_nLaneWeights[2]);
+				}
+				m_connection->ConnectToServer(endpoints, m_ticket);
 
 
 				// Start context thread
-				thrContext = std::thread([this]() {m_context.run();});
+				thrContext = std::thread([this]()
+					{
+						NET_TRACE_THREAD("client asio");
+						RunContext(m_context, m_busyPoll);
+					});
 
 			}
 			catch( std::exception& e)
 			{
-				std::cerr << "Client Exception: " << e.what() << "\n";
+				NET_LOG_ERROR("Client Exception: ", e.what());
 				return false;
 				
 			}
@@ -57,7 +92,7 @@ namespace net
 		// Disconnect from server
 		void Disconnect()
 		{
-			if(IsConnected())
+			if(m_connection)
 			{
 				// ...disconnect from server gracefully
 				m_connection->Disconnect();
@@ -70,10 +105,94 @@ namespace net
 				thrContext.join();
 			}
 
+			if(m_connection)
+			{
+				// Handlers still queued refer to the connection, let them run out
+				// (the close aborts everything pending) before it is destroyed
+				m_context.restart();
+				m_context.run();
+
+				// Remember the ticket for the next Connect
+				m_ticket = m_connection->GetTicket();
+			}
+
 			// Destroy the connection object
-			m_connection.release();
+			m_connection.reset();
+		}
+
+		// Forget the session, the next Connect goes through the full handshake
+		void ForgetSession()
+		{
+			m_ticket = {};
+			m_durable.Reset();
+#ifdef NET_USE_TLS
+			m_tlsSessions.Clear();
+#endif
 		}
+
+#ifdef NET_USE_TLS
+		// Connect over TLS from now on, the server certificate must match the host
+		// given to Connect. TLS sessions are cached per host:port so reconnecting
+		// resumes rather than doing the full TLS handshake
+		// With bKernelOffload Linux encrypts records in the kernel when it can (kTLS)
+		void EnableTls(std::shared_ptr<asio::ssl::context> ctx, bool bKernelOffload = false)
+		{
+			tls_session_cache::Attach(*ctx);
+			m_pTlsContext = std::move(ctx);
+			m_bKernelTls = bKernelOffload;
+		}
+
+		// Whether the current connection resumed a cached TLS session
+		bool IsTlsResumed()
+		{
+			return m_connection && m_connection->IsTlsResumed();
+		}
+
+		// Whether the kernel encrypts what the current connection sends
+		bool IsKernelTls()
+		{
+			return m_connection && m_connection->IsKernelTls();
+		}
+#endif
 		
+		// nFeature bits to ask for from the next Connect on, e.g. nFeatureCrc
+		// With nFeatureDurable a reconnect resuming the session is sent what the
+		// server's outbox holds past the last message received, each message once
+		void SetFeatures(uint32_t nFeatures)
+		{
+			m_nFeatures = nFeatures;
+		}
+
+		// Low latency mode from the next Connect on, see net_busypoll.h
+		// Spinning covers the asio thread and Update with bWait
+		void SetBusyPoll(const busy_poll& opts)
+		{
+			m_busyPoll = opts;
+		}
+
+		// From the next Connect on, see connection::SetMaxBufferedBytes, SetChunkSize
+		// and SetLaneWeights
+		void SetMaxBufferedBytes(uint32_t nBytes)
+		{
+			m_nMaxBufferedBytes = nBytes;
+		}
+
+		void SetChunkSize(uint32_t nBytes)
+		{
+			m_nChunkSize = nBytes;
+		}
+
+		void SetLaneWeights(uint32_t nHigh, uint32_t nNormal, uint32_t nBulk)
+		{
+			m_nLaneWeights = { nHigh, nNormal, nBulk };
+		}
+
+		// nFeature bits the server agreed to
+		uint32_t Features() const
+		{
+			return m_connection ? m_connection->Features() : 0;
+		}
+
 		// If connection is valid to a server
 		bool IsConnected( )
 		{
@@ -84,6 +203,12 @@ namespace net
 			return false;		
 		}
 
+		// Bytes sent and not yet written to the server
+		size_t QueuedBytes() const
+		{
+			return m_connection ? m_connection->QueuedBytes() : 0;
+		}
+
 		// Retrive queue of messages from server
 		tsqueue<owned_message<T>> &Incoming( )
 		{
@@ -91,10 +216,149 @@ namespace net
 		}
 
 		// Send message to server
-		void Send(const message<T>& msg)
+		void Send(const message<T>& msg, priority ePriority = priority::normal)
+		{
+			if (IsConnected())
+				m_connection->Send(msg, ePriority);
+		}
+
+		// Send a request, the future gets the server's reply, see connection::Call
+		std::future<message<T>> Call(const message<T>& msg, std::chrono::milliseconds timeout = std::chrono::milliseconds(0), priority ePriority = priority::normal)
+		{
+			if (!IsConnected())
+				return FailedCall<T>(call_error::reason::not_connected);
+			return m_connection->Call(msg, timeout, ePriority);
+		}
+
+		// Stream nSize bytes to the server without buffering them, see connection::SendStream
+		void SendStream(T id, uint64_t nSize, std::function<size_t(uint8_t*, size_t)> fnRead, priority ePriority = priority::bulk)
 		{
 			if (IsConnected())
-				m_connection->Send(msg);
+				m_connection->SendStream(id, nSize, std::move(fnRead), ePriority);
+		}
+
+		// Handle up to nMaxMessages from the server through the registered handlers
+		void Update(size_t nMaxMessages = -1, bool bWait = false)
+		{
+			if (bWait)
+			{
+				if(m_busyPoll.bSpin)
+				{
+					m_qMessageIn.spin_wait();
+				}
+				else
+				{
+					m_qMessageIn.wait();
+				}
+			}
+
+			if(m_delivery.Active())
+			{
+				m_delivery.Rearm();
+			}
+
+			// Take the batch under one lock, then dispatch without touching the queue
+			m_qMessageIn.drain(m_deqUpdateBatch, nMaxMessages);
+			if(m_delivery.Active() && !m_qMessageIn.empty())
+			{
+				// Left over past nMaxMessages, come back for them
+				m_delivery.Wake();
+			}
+
+			for(auto& msg : m_deqUpdateBatch)
+			{
+				NET_TRACE(msg.msg.nTrace, delivered, msg.remote ? msg.remote->GetID() : 0, msg.msg.header.id);
+				if(msg.eStream != stream_part::none)
+				{
+					// Chunk has been consumed once the handler returns, let the server send more
+					const uint32_t nBytes = uint32_t(msg.msg.body.size());
+					OnStreamData(msg.msg, msg.eStream == stream_part::last);
+					NET_TRACE(msg.msg.nTrace, handled, msg.remote ? msg.remote->GetID() : 0, msg.msg.header.id);
+					if(m_connection)
+					{
+						m_connection->GrantStreamCredit(nBytes);
+					}
+					continue;
+				}
+
+				switch(m_dispatcher.Dispatch(msg.msg))
+				{
+				case dispatch_result::unhandled:
+					OnMessage(msg.msg);
+					break;
+
+				case dispatch_result::bad_size:
+					OnInvalidMessage(msg.msg);
+					break;
+
+				default:
+					break;
+				}
+				NET_TRACE(msg.msg.nTrace, handled, msg.remote ? msg.remote->GetID() : 0, msg.msg.header.id);
+			}
+
+			m_deqUpdateBatch.clear();
+		}
+
+		// Run Update as work on ex whenever messages arrive, see server_interface::DeliverOn
+		// The executor of Context() handles messages on the asio thread. Call before Connect
+		template<typename Executor>
+		void DeliverOn(const Executor& ex)
+		{
+			m_delivery.PostTo(ex, [this]() { Update(); });
+			m_qMessageIn.set_notify([this]() { m_delivery.Wake(); });
+		}
+
+		void DeliverOn(asio::io_context& ctx)
+		{
+			DeliverOn(ctx.get_executor());
+		}
+
+		// Descriptor readable while messages wait, see server_interface::DeliveryNotifier
+		int DeliveryNotifier()
+		{
+			const int nFd = m_delivery.Notifier();
+			if(nFd >= 0)
+			{
+				m_qMessageIn.set_notify([this]() { m_delivery.Wake(); });
+			}
+			return nFd;
+		}
+
+		// Context the connection runs on, its thread is started by Connect
+		asio::io_context& Context()
+		{
+			return m_context;
+		}
+
+		// Register a handler for a single message id, takes priority over OnMessage
+		void RegisterHandler(T id, typename message_dispatcher<T>::handler fn)
+		{
+			m_dispatcher.Register(id, std::move(fn));
+		}
+
+		// Register a handler which receives the body decoded as a fixed Payload
+		template<typename Payload, typename Fn>
+		void RegisterHandler(T id, Fn fn)
+		{
+			m_dispatcher.template Register<Payload>(id, std::move(fn));
+		}
+
+	protected:
+		// Called by Update when message arrives which has no registered handler
+		virtual void OnMessage(message<T>& /*msg*/)
+		{
+		}
+
+		// Called by Update for every chunk of a stream the server sent, bLast is set on the final chunk
+		virtual void OnStreamData(message<T>& /*chunk*/, bool /*bLast*/)
+		{
+		}
+
+		// Called by Update when a registered handler rejected the message body size
+		virtual void OnInvalidMessage(message<T>& msg)
+		{
+			NET_LOG_WARN("Invalid Message: ID: ", int(msg.header.id), " Size: ", msg.header.size);
 		}
 
 	protected:
@@ -107,8 +371,32 @@ namespace net
 		// which handles data transfer
 		std::unique_ptr<connection<T>> m_connection;
 
+		// Ticket from the last connection, presented when reconnecting
+		session_ticket m_ticket;
+		uint32_t m_nFeatures = 0;
+		// Outbox sequences received, kept across connections like the ticket
+		durable_cursor m_durable;
+		busy_poll m_busyPoll;
+		// Link settings for the next connection, 0 leaves the connection's default
+		uint32_t m_nMaxBufferedBytes = 0;
+		uint32_t m_nChunkSize = 0;
+		std::array<uint32_t, 3> m_nLaneWeights{};
+		inbox_delivery m_delivery;
+
+#ifdef NET_USE_TLS
+		std::shared_ptr<asio::ssl::context> m_pTlsContext;
+		bool m_bKernelTls = false;
+		// Outlives every connection, they only point at it
+		tls_session_cache m_tlsSessions;
+#endif
+
 	private:
 		// This is the thread save queue of incoming messages from server
 		tsqueue<owned_message<T>> m_qMessageIn;
+		// Messages taken out by the current Update
+		std::deque<owned_message<T>> m_deqUpdateBatch;
+
+		// Per message id handlers used by Update
+		message_dispatcher<T> m_dispatcher;
 	};
 }
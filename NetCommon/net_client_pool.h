@@ -0,0 +1,485 @@
+#pragma once
+// Client holding many connections, to one server or spread over several
+// The connections share a few asio threads and one inbound queue, Send picks
+// the connection by round robin, by shortest send queue or by a key
+
+#include "net_common.h"
+#include "net_tsqueue.h"
+#include "net_message.h"
+#include "net_connection.h"
+#include "net_dispatch.h"
+#include "net_delivery.h"
+
+#include <algorithm>
+
+namespace net
+{
+	enum class pool_routing
+	{
+		round_robin,
+		least_queued	// fewest bytes waiting to be written
+	};
+
+	struct pool_endpoint
+	{
+		std::string host;
+		uint16_t port;
+	};
+
+	template<typename T>
+	class client_pool
+	{
+	public:
+		client_pool()
+		{}
+
+		virtual ~client_pool()
+		{
+			Disconnect();
+		}
+
+	public:
+		// Open nPerEndpoint connections to every endpoint, run by nThreads asio threads
+		// Reconnecting with the same endpoints presents each connection's previous ticket
+		bool Connect(const std::vector<pool_endpoint>& vEndpoints, size_t nPerEndpoint = 1, size_t nThreads = 2)
+		{
+			Disconnect();
+
+			try
+			{
+				nThreads = std::max<size_t>(nThreads, 1);
+				for(size_t i = 0; i < nThreads; i++)
+				{
+					m_vContexts.push_back(std::make_unique<asio::io_context>());
+					m_vWork.push_back(std::make_unique<work_guard>(m_vContexts.back()->get_executor()));
+				}
+
+				const bool bResume = m_vTickets.size() == vEndpoints.size() * nPerEndpoint;
+				if(!bResume)
+				{
+					m_vTickets.assign(vEndpoints.size() * nPerEndpoint, session_ticket{});
+				}
+
+				asio::ip::tcp::resolver resolver(*m_vContexts[0]);
+				for(const auto& ep : vEndpoints)
+				{
+					auto endpoints = resolver.resolve(ep.host, std::to_string(ep.port));
+					for(size_t n = 0; n < nPerEndpoint; n++)
+					{
+						// Each connection lives on one context, so its handlers never run concurrently
+						const size_t nSlot = m_vConnections.size();
+						asio::io_context& ctx = *m_vContexts[nSlot % nThreads];
+						auto conn = std::make_shared<connection<T>>(
+							connection<T>::owner::client, ctx, asio::ip::tcp::socket(ctx), m_qMessagesIn);
+
+#ifdef NET_USE_TLS
+						if(m_pTlsContext)
+						{
+							conn->EnableTls(m_pTlsContext, m_bKernelTls, ep.host, &m_tlsSessions);
+						}
+#endif
+						conn->SetFeatures(m_nFeatures);
+						conn->SetBusyPoll(m_busyPoll);
+						conn->ConnectToServer(endpoints, m_vTickets[nSlot]);
+						m_vConnections.push_back(conn);
+
+						AddToRing(ep, n, nSlot);
+					}
+				}
+				std::sort(m_vRing.begin(), m_vRing.end());
+
+				for(size_t i = 0; i < m_vContexts.size(); i++)
+				{
+					asio::io_context* pCtx = m_vContexts[i].get();
+					m_vThreads.emplace_back([pCtx, opts = m_busyPoll, i]() { RunContext(*pCtx, opts, int(i)); });
+				}
+			}
+			catch(std::exception& e)
+			{
+				NET_LOG_ERROR("[POOL] Exception: ", e.what());
+				Disconnect();
+				return false;
+			}
+
+			return true;
+		}
+
+		// Close every connection, their tickets are kept for the next Connect
+		void Disconnect()
+		{
+			for(auto& conn : m_vConnections)
+			{
+				conn->Disconnect();
+			}
+
+			m_vWork.clear();
+			for(auto& ctx : m_vContexts)
+			{
+				ctx->stop();
+			}
+			for(auto& thr : m_vThreads)
+			{
+				if(thr.joinable())
+				{
+					thr.join();
+				}
+			}
+
+			// Let the queued closes and aborted handlers run out before anything is destroyed
+			for(auto& ctx : m_vContexts)
+			{
+				ctx->restart();
+				ctx->run();
+			}
+
+			for(size_t i = 0; i < m_vConnections.size(); i++)
+			{
+				m_vTickets[i] = m_vConnections[i]->GetTicket();
+			}
+
+			// Messages hold on to their connection, drop them first
+			m_qMessagesIn.clear();
+			m_vThreads.clear();
+			m_vConnections.clear();
+			m_vRing.clear();
+			m_vContexts.clear();
+		}
+
+		// Forget the sessions, the next Connect goes through the full handshake
+		void ForgetSessions()
+		{
+			m_vTickets.clear();
+#ifdef NET_USE_TLS
+			m_tlsSessions.Clear();
+#endif
+		}
+
+		// nFeature bits to ask for from the next Connect on, see client_interface::SetFeatures
+		// Not nFeatureDurable, the pool keeps no record of what each connection received
+		void SetFeatures(uint32_t nFeatures)
+		{
+			m_nFeatures = nFeatures & ~nFeatureDurable;
+		}
+
+		// Low latency mode from the next Connect on, see client_interface::SetBusyPoll
+		// With nCpu set asio thread i is pinned to core nCpu + i
+		void SetBusyPoll(const busy_poll& opts)
+		{
+			m_busyPoll = opts;
+		}
+
+#ifdef NET_USE_TLS
+		// Connect over TLS from now on, see client_interface::EnableTls
+		void EnableTls(std::shared_ptr<asio::ssl::context> ctx, bool bKernelOffload = false)
+		{
+			tls_session_cache::Attach(*ctx);
+			m_pTlsContext = std::move(ctx);
+			m_bKernelTls = bKernelOffload;
+		}
+#endif
+
+		// How Send chooses a connection, may change at any time
+		void SetRouting(pool_routing eRouting)
+		{
+			m_eRouting = eRouting;
+		}
+
+		size_t Size() const
+		{
+			return m_vConnections.size();
+		}
+
+		size_t ConnectedCount() const
+		{
+			return size_t(std::count_if(m_vConnections.begin(), m_vConnections.end(),
+				[](const auto& conn) { return conn->IsConnected(); }));
+		}
+
+		// The connections in the order Connect opened them, endpoint by endpoint
+		const std::vector<std::shared_ptr<connection<T>>>& Connections() const
+		{
+			return m_vConnections;
+		}
+
+		// Send on the connection the routing policy picks, false when none is connected
+		// Safe from any thread, but not while Connect or Disconnect run
+		bool Send(const message<T>& msg, priority ePriority = priority::normal)
+		{
+			connection<T>* conn = Pick();
+			if(conn == nullptr)
+			{
+				return false;
+			}
+			conn->Send(msg, ePriority);
+			return true;
+		}
+
+		// Send on the connection owning key, the same key keeps the same connection
+		// When a connection drops only its keys move, to the next ones on the ring
+		template<typename K>
+		bool SendKeyed(const K& key, const message<T>& msg, priority ePriority = priority::normal)
+		{
+			connection<T>* conn = PickKeyed(Mix(uint64_t(std::hash<K>{}(key))));
+			if(conn == nullptr)
+			{
+				return false;
+			}
+			conn->Send(msg, ePriority);
+			return true;
+		}
+
+		// Send a request on the connection the routing policy picks, see connection::Call
+		std::future<message<T>> Call(const message<T>& msg, std::chrono::milliseconds timeout = std::chrono::milliseconds(0), priority ePriority = priority::normal)
+		{
+			connection<T>* conn = Pick();
+			if(conn == nullptr)
+			{
+				return FailedCall<T>(call_error::reason::not_connected);
+			}
+			return conn->Call(msg, timeout, ePriority);
+		}
+
+		// Stream to the server on a connection the routing policy picks, see connection::SendStream
+		bool SendStream(T id, uint64_t nSize, std::function<size_t(uint8_t*, size_t)> fnRead, priority ePriority = priority::bulk)
+		{
+			connection<T>* conn = Pick();
+			if(conn == nullptr)
+			{
+				return false;
+			}
+			conn->SendStream(id, nSize, std::move(fnRead), ePriority);
+			return true;
+		}
+
+		// Messages from every connection, remote tells them apart
+		tsqueue<owned_message<T>>& Incoming()
+		{
+			return m_qMessagesIn;
+		}
+
+		// Handle up to nMaxMessages from any connection through the registered handlers
+		void Update(size_t nMaxMessages = -1, bool bWait = false)
+		{
+			if (bWait)
+			{
+				if(m_busyPoll.bSpin)
+				{
+					m_qMessagesIn.spin_wait();
+				}
+				else
+				{
+					m_qMessagesIn.wait();
+				}
+			}
+
+			if(m_delivery.Active())
+			{
+				m_delivery.Rearm();
+			}
+
+			m_qMessagesIn.drain(m_deqUpdateBatch, nMaxMessages);
+			if(m_delivery.Active() && !m_qMessagesIn.empty())
+			{
+				// Left over past nMaxMessages, come back for them
+				m_delivery.Wake();
+			}
+
+			for(auto& msg : m_deqUpdateBatch)
+			{
+				NET_TRACE(msg.msg.nTrace, delivered, msg.remote->GetID(), msg.msg.header.id);
+				if(msg.eStream != stream_part::none)
+				{
+					const uint32_t nBytes = uint32_t(msg.msg.body.size());
+					OnStreamData(msg.remote, msg.msg, msg.eStream == stream_part::last);
+					NET_TRACE(msg.msg.nTrace, handled, msg.remote->GetID(), msg.msg.header.id);
+					msg.remote->GrantStreamCredit(nBytes);
+					continue;
+				}
+
+				switch(m_dispatcher.Dispatch(msg.remote, msg.msg))
+				{
+				case dispatch_result::unhandled:
+					OnMessage(msg.remote, msg.msg);
+					break;
+
+				case dispatch_result::bad_size:
+					OnInvalidMessage(msg.remote, msg.msg);
+					break;
+
+				default:
+					break;
+				}
+				NET_TRACE(msg.msg.nTrace, handled, msg.remote->GetID(), msg.msg.header.id);
+			}
+
+			m_deqUpdateBatch.clear();
+		}
+
+		// Run Update as work on ex whenever messages arrive, see server_interface::DeliverOn
+		// Call before Connect
+		template<typename Executor>
+		void DeliverOn(const Executor& ex)
+		{
+			m_delivery.PostTo(ex, [this]() { Update(); });
+			m_qMessagesIn.set_notify([this]() { m_delivery.Wake(); });
+		}
+
+		void DeliverOn(asio::io_context& ctx)
+		{
+			DeliverOn(ctx.get_executor());
+		}
+
+		// Descriptor readable while messages wait, see server_interface::DeliveryNotifier
+		int DeliveryNotifier()
+		{
+			const int nFd = m_delivery.Notifier();
+			if(nFd >= 0)
+			{
+				m_qMessagesIn.set_notify([this]() { m_delivery.Wake(); });
+			}
+			return nFd;
+		}
+
+		// Register a handler for a single message id, takes priority over OnMessage
+		void RegisterHandler(T id, typename message_dispatcher<T, std::shared_ptr<connection<T>>>::handler fn)
+		{
+			m_dispatcher.Register(id, std::move(fn));
+		}
+
+		// Register a handler which receives the body decoded as a fixed Payload
+		template<typename Payload, typename Fn>
+		void RegisterHandler(T id, Fn fn)
+		{
+			m_dispatcher.template Register<Payload>(id, std::move(fn));
+		}
+
+	protected:
+		// Called by Update when message arrives which has no registered handler
+		virtual void OnMessage(std::shared_ptr<connection<T>> server, message<T>& msg)
+		{
+		}
+
+		// Called by Update for every chunk of a stream a server sent, bLast is set on the final chunk
+		virtual void OnStreamData(std::shared_ptr<connection<T>> server, message<T>& chunk, bool bLast)
+		{
+		}
+
+		// Called by Update when a registered handler rejected the message body size
+		virtual void OnInvalidMessage(std::shared_ptr<connection<T>> server, message<T>& msg)
+		{
+			NET_LOG_WARN("Invalid Message: ID: ", int(msg.header.id), " Size: ", msg.header.size);
+		}
+
+	private:
+		connection<T>* Pick()
+		{
+			const size_t nSize = m_vConnections.size();
+			if(m_eRouting == pool_routing::least_queued)
+			{
+				connection<T>* pBest = nullptr;
+				size_t nBest = SIZE_MAX;
+				for(auto& conn : m_vConnections)
+				{
+					if(conn->IsConnected() && conn->QueuedBytes() < nBest)
+					{
+						pBest = conn.get();
+						nBest = conn->QueuedBytes();
+					}
+				}
+				return pBest;
+			}
+
+			// Round robin, skipping connections that have gone
+			for(size_t i = 0; i < nSize; i++)
+			{
+				connection<T>* conn = m_vConnections[m_nNext++ % nSize].get();
+				if(conn->IsConnected())
+				{
+					return conn;
+				}
+			}
+			return nullptr;
+		}
+
+		connection<T>* PickKeyed(uint64_t nHash)
+		{
+			if(m_vRing.empty())
+			{
+				return nullptr;
+			}
+
+			// First point at or after the key, wrapping, that belongs to a live connection
+			auto it = std::lower_bound(m_vRing.begin(), m_vRing.end(), std::make_pair(nHash, size_t(0)));
+			for(size_t i = 0; i < m_vRing.size(); i++, it++)
+			{
+				if(it == m_vRing.end())
+				{
+					it = m_vRing.begin();
+				}
+				connection<T>* conn = m_vConnections[it->second].get();
+				if(conn->IsConnected())
+				{
+					return conn;
+				}
+			}
+			return nullptr;
+		}
+
+		// Ring points come from the endpoint and its connection number, not the slot,
+		// so keys stay put on the endpoints a changed pool still has
+		void AddToRing(const pool_endpoint& ep, size_t nConnection, size_t nSlot)
+		{
+			const uint64_t nBase = uint64_t(std::hash<std::string>{}(ep.host + ":" + std::to_string(ep.port) + "#" + std::to_string(nConnection)));
+			for(uint64_t r = 0; r < nRingPoints; r++)
+			{
+				m_vRing.push_back({ Mix(nBase + r), nSlot });
+			}
+		}
+
+		// splitmix64 finaliser, std::hash of an integer is often the integer itself
+		static uint64_t Mix(uint64_t x)
+		{
+			x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+			x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+			return x ^ (x >> 31);
+		}
+
+	private:
+		using work_guard = asio::executor_work_guard<asio::io_context::executor_type>;
+
+		// Points per connection on the hash ring, more spread keys more evenly
+		static constexpr uint64_t nRingPoints = 64;
+
+		// Contexts outlive the connections using them
+		std::vector<std::unique_ptr<asio::io_context>> m_vContexts;
+		std::vector<std::unique_ptr<work_guard>> m_vWork;
+		std::vector<std::thread> m_vThreads;
+		std::vector<std::shared_ptr<connection<T>>> m_vConnections;
+
+		// Tickets of the previous connections, by slot
+		std::vector<session_ticket> m_vTickets;
+
+		// Sorted (point, slot) pairs for SendKeyed
+		std::vector<std::pair<uint64_t, size_t>> m_vRing;
+		std::atomic<pool_routing> m_eRouting = pool_routing::round_robin;
+		std::atomic<size_t> m_nNext = 0;
+		uint32_t m_nFeatures = 0;
+		busy_poll m_busyPoll;
+		inbox_delivery m_delivery;
+
+#ifdef NET_USE_TLS
+		std::shared_ptr<asio::ssl::context> m_pTlsContext;
+		bool m_bKernelTls = false;
+		// Outlives every connection, they only point at it
+		tls_session_cache m_tlsSessions;
+#endif
+
+		// Shared by every connection of the pool
+		tsqueue<owned_message<T>> m_qMessagesIn;
+		// Messages taken out by the current Update
+		std::deque<owned_message<T>> m_deqUpdateBatch;
+
+		// Per message id handlers used by Update
+		message_dispatcher<T, std::shared_ptr<connection<T>>> m_dispatcher;
+	};
+}
@@ -3,6 +3,8 @@
 #include <memory>
 #include <thread>
 #include <mutex>
+#include <condition_variable>
+#include <atomic>
 #include <deque>
 #include <vector>
 #include <optional>
@@ -10,6 +12,14 @@
 #include <algorithm>
 #include <chrono>
 #include <cstdint>
+#include <cstring>
+#include <array>
+#include <functional>
+#include <stdexcept>
+#include <any>
+#include <random>
+#include <unordered_map>
+#include <future>
 
 #ifdef  _WIN32
 #define _WINT32_WINNT 0x0A00 //Windows 10 onwards
@@ -21,6 +31,11 @@
 #include <asio/ts/buffer.hpp>
 #include <asio/ts/internet.hpp>
 
+// TLS transport, see net_tls.h
+#ifdef NET_USE_TLS
+#include <asio/ssl.hpp>
+#endif
+
 
 
 
@@ -3,6 +3,14 @@
 #include "net_tsqueue.h"
 #include "net_message.h"
 #include "net_server.h"
+#include "net_capture.h"
+#include "net_tls.h"
+#include "net_handoff.h"
+#include "net_rpc.h"
+#include "net_ratelimit.h"
+#include "net_crc.h"
+#include "net_busypoll.h"
+#include "net_outbox.h"
 
 namespace net
 {
@@ -20,8 +28,17 @@ namespace net
 			client		
 		};
 
+		// Frame part a read was waiting for, see Freeze
+		enum class read_stage
+		{
+			header,
+			body,
+			fragment,
+			credit
+		};
+
 		connection( owner parent, asio::io_context& asioContext, asio::ip::tcp::socket socket, tsqueue<owned_message<T>>& qIn)
-			: m_asioContext(asioContext), m_socket(std::move(socket)), m_qMessagesIn(qIn)
+			: m_asioContext(asioContext), m_socket(std::move(socket)), m_qMessagesIn(qIn), m_timerCalls(asioContext), m_timerRate(asioContext)
 		{
 			m_nOwnerType = parent;
 
@@ -30,9 +47,10 @@ namespace net
 			{
 				// Connection Server->Client, construct random data for client
 				// to transform and send back
-				m_nHandshakeOut = uint64_t(std::chrono::system_clock::now().time_since_epoch().count());
+				const uint64_t nChallenge = uint64_t(std::chrono::system_clock::now().time_since_epoch().count());
+				m_nHandshakeOut = WireOrder(nChallenge);
 				// Pre-calculate the result
-				m_nHandshakeCheck = scramble(m_nHandshakeOut);
+				m_nHandshakeCheck = scramble(nChallenge);
 			}
 			else
 			{
@@ -61,29 +79,44 @@ namespace net
 					//start listening
 					//ReadHeader();
 
-					// A client has attempted to connect to the server
-					// write out the handshake data to be validated
-					WriteValidation();
+					StartTls([this, server]()
+						{
+							// A client has attempted to connect to the server
+							// write out the handshake data to be validated
+							WriteValidation();
 
-					// Next, issue a task to sit and wait async for validation data
-					// to be sent back from the client
-					ReadValidation(server);
+							// Next, issue a task to sit and wait async for validation data
+							// to be sent back from the client
+							ReadValidation(server);
+						});
 				}
 			}
 		}
 
-		void ConnectToServer(const asio::ip::tcp::resolver::results_type& endpoints) //clients only
+		// A ticket from an earlier connection lets the client skip the challenge,
+		// it may start sending as soon as the socket is connected
+		void ConnectToServer(const asio::ip::tcp::resolver::results_type& endpoints, const session_ticket& ticket = {}) //clients only
 		{
 			// Onlyclients can connect
 			if(m_nOwnerType == owner::client)
 			{
+				m_ticket = ticket;
+
 				// Request asio to attempt to connect to an endpoint
 				asio::async_connect(m_socket, endpoints,
-					[this](std::error_code ec, asio::ip::tcp::endpoint endpoint)
+					[this](std::error_code ec, asio::ip::tcp::endpoint /*endpoint*/)
 					{
 						if(!ec)
 						{
-							ReadValidation();
+							ApplyBusyPoll(m_socket, m_busyPoll);
+							StartTls([this]()
+								{
+									if(m_ticket.nToken != 0)
+									{
+										WriteResume();
+									}
+									ReadValidation();
+								});
 							// Primed and ready to listen from messages 
 							// From the server
 							//ReadHeader();					
@@ -94,245 +127,1865 @@ namespace net
 
 		void Disconnect()
 		{
+			asio::post(m_asioContext, [this, self = Self()]()
+				{
+#ifdef NET_USE_TLS
+					// OpenSSL stops resuming sessions whose connection was not shut down,
+					// hanging up on purpose should not cost the next reconnect a full handshake
+					if(SSL* ssl = TlsHandle())
+					{
+						SSL_set_quiet_shutdown(ssl, 1);
+						SSL_shutdown(ssl);
+					}
+#endif
+					m_socket.close();
 
+					// Nothing answers the pending calls now, and armed timers would hold
+					// up the owner draining the context until they expire
+					m_timerCalls.cancel();
+					m_bCallTimerSet = false;
+					m_timerRate.cancel();
+					m_calls.FailAll(call_error::reason::closed);
+				});
 		} //server client
+
+		// Ticket the server issued for this connection, empty until validated
+		// Client side it is only safe to read once the asio thread is stopped
+		const session_ticket& GetTicket() const
+		{
+			return m_ticket;
+		}
 		bool IsConnected() const
 		{
 			return m_socket.is_open();
 		}
 
+		// Bytes passed to Send and not yet written, safe from any thread
+		size_t QueuedBytes() const
+		{
+			return m_nQueuedBytesOut;
+		}
+
 
 	public:
-		void Send( const message<T>& msg)
+		void Send( const message<T>& msg, priority ePriority = priority::normal)
 		{
+			m_nQueuedBytesOut += sizeof(wire_header) + msg.body.size();
+
 			// send a job to asio context, async
 			asio::post(m_asioContext, 
-				[this, msg]()
+				[this, self = Self(), msg = Traced(msg), ePriority]() mutable
 				{
+					NET_TRACE(msg.nTrace, queued, m_id, msg.header.id);
+
 					//in case asio is already writting or not
 					//to avoid another workload and possible conflicts
-					bool bWritingMessage = !m_qMessagesOut.empty();
-					m_qMessagesOut.push_back(msg);
-					if(!bWritingMessage)
-					{
-						WriteHeader();
-					}
+					m_qLanesOut[size_t(ePriority)].push_back({ std::move(msg), 0 });
+					StartWriting();
 				});
 		}
 
-	private:
-		// ASYNC - Prime context ready to read a message header
-		void ReadHeader()
+		// Send a record of the server's outbox, the body is written from the mapped
+		// segment as it is, never copied into a message
+		void SendMapped(const outbox_entry& entry)
 		{
-			// header has fixed size
-			asio::async_read(m_socket, 
-				asio::buffer(&m_msgTemporaryIn.header, sizeof(message_header<T>)),
-				[this](std::error_code ec, std::size_t lenght)
+			m_nQueuedBytesOut += sizeof(wire_header) + entry.nSize;
+			asio::post(m_asioContext,
+				[this, self = Self(), entry]()
 				{
-					if(!ec)
-					{
-						//check if there is message body
-						if(m_msgTemporaryIn.header.size > 0)
-						{
-							m_msgTemporaryIn.body.resize(m_msgTemporaryIn.header.size);
-							ReadBody();
-						}
-						else
-						{
-							AddToIncomingMessageQueue();
-						}
-					}
-					else
+					outbound out;
+					out.msg.header.id = T(entry.nId);
+					out.msg.header.size = entry.nSize;
+					out.msg.nCall = entry.nCall;
+					out.nSeq = entry.nSeq;
+					out.pSegment = entry.pSegment;
+					out.pMapped = entry.pBody;
+					out.nMapped = entry.nSize;
+					m_qLanesOut[size_t(entry.ePriority)].push_back(std::move(out));
+					StartWriting();
+				});
+		}
+
+		// Send msg as a request, the future gets the reply once the remote answers with Reply
+		// Calls are pipelined, send as many as needed before waiting on any of them
+		// The future throws call_error when the timeout passes first or the connection
+		// is destroyed, a zero timeout waits for as long as the connection lives
+		std::future<message<T>> Call(message<T> msg, std::chrono::milliseconds timeout = std::chrono::milliseconds(0), priority ePriority = priority::normal)
+		{
+			std::promise<message<T>> promise;
+			std::future<message<T>> future = promise.get_future();
+
+			m_nQueuedBytesOut += sizeof(wire_header) + msg.body.size();
+			NET_TRACE_SAMPLE(msg.nTrace);
+			NET_TRACE(msg.nTrace, send, m_id, msg.header.id);
+			asio::post(m_asioContext,
+				[this, self = Self(), msg = std::move(msg), timeout, ePriority, promise = std::move(promise)]() mutable
+				{
+					NET_TRACE(msg.nTrace, queued, m_id, msg.header.id);
+					msg.nCall = m_calls.Add(std::move(promise), timeout);
+					ArmCallTimer();
+					m_qLanesOut[size_t(ePriority)].push_back({ std::move(msg), 0 });
+					StartWriting();
+				});
+			return future;
+		}
+
+		// Answer a request received from the remote, a request that was not a Call
+		// gets the response as a plain message
+		void Reply(const message<T>& request, message<T> response, priority ePriority = priority::normal)
+		{
+			response.nCall = request.nCall != 0 ? request.nCall | nCallReply : 0;
+			Send(response, ePriority);
+		}
+
+		// Corked, Send only queues and nothing but control frames is written until
+		// Flush, which writes everything queued as few, large writes
+		void SetCorked(bool bCorked)
+		{
+			asio::post(m_asioContext,
+				[this, self = Self(), bCorked]()
+				{
+					m_bCorked = bCorked;
+					StartWriting();
+				});
+		}
+
+		// Write what is queued now, corked or not
+		void Flush()
+		{
+			asio::post(m_asioContext,
+				[this, self = Self()]()
+				{
+					if(!m_bWritingMessage && m_bValidated)
 					{
-						//force close socket
-						std::cout<< "[" <<m_id<< "] Read Header Fail.\n";
-						m_socket.close();
+						WriteFrame();
 					}
 				});
 		}
-		
-		// ASYNC - Prime context ready to read a message body
-		void ReadBody()
+
+		// Largest body written as a single frame, bigger bodies are split so
+		// higher priority messages can overtake them. Safe from any thread, takes
+		// effect from the next frame written
+		void SetChunkSize(uint32_t nBytes)
 		{
-			//we know the size of the data we need to read
-			asio::async_read(m_socket, 
-				asio::buffer(m_msgTemporaryIn.body.data(), m_msgTemporaryIn.body.size()),
-				[this](std::error_code ec, std::size_t length)
-			{						
-				if (!ec)
+			asio::post(m_asioContext,
+				[this, self = Self(), nBytes]()
 				{
-					AddToIncomingMessageQueue();
-				}
-				else
-				{				
-					std::cout << "[" << m_id << "] Read Body Fail.\n";
-					m_socket.close();
-				}
-			});
+					m_nChunkSize = std::clamp<uint32_t>(nBytes, 1, nFrameSizeMask - sizeof(uint32_t) - sizeof(uint64_t));
+				});
+		}
 
+		// Send nSize bytes pulled from fnRead as a stream of chunks
+		// fnRead(dst, nMax) fills dst and returns the bytes written, it is called on the
+		// asio thread only while the receiver has credit left, so the payload is never
+		// fully buffered on either side. Returning less than asked ends the stream early
+		void SendStream(T id, uint64_t nSize, std::function<size_t(uint8_t*, size_t)> fnRead, priority ePriority = priority::bulk)
+		{
+			asio::post(m_asioContext,
+				[this, self = Self(), id, nSize, fnRead = std::move(fnRead), ePriority]() mutable
+				{
+					m_deqStreamsOut.push_back({ id, nSize, 0, std::move(fnRead), ePriority });
+					PumpStreams();
+				});
 		}
 
-		void AddToIncomingMessageQueue()
+		// Receiver side, called once a stream chunk has been consumed so the sender
+		// may send nBytes more
+		void GrantStreamCredit(uint32_t nBytes)
 		{
-			if( m_nOwnerType == owner::server)
+			asio::post(m_asioContext,
+				[this, self = Self(), nBytes]()
+				{
+					m_nStreamBytesIn -= std::min(m_nStreamBytesIn, nBytes);
+
+					outbound grant;
+					grant.nFrameFlags = nFrameCredit;
+					grant.msg << nBytes;
+					m_qLanesOut[size_t(priority::control)].push_back(std::move(grant));
+					StartWriting();
+				});
+		}
+
+		// Hard cap on a single incoming frame plus the messages still being
+		// reassembled from fragments, a peer exceeding it is disconnected rather than
+		// buffered. Whole messages waiting in the owner's queue are not counted, a
+		// peer sending faster than Update drains them is held back by SetRateLimit
+		// Safe from any thread
+		void SetMaxBufferedBytes(uint32_t nBytes)
+		{
+			asio::post(m_asioContext,
+				[this, self = Self(), nBytes]()
+				{
+					m_nMaxBufferedBytes = nBytes;
+				});
+		}
+
+		// Record every frame received and written to log, null stops recording
+		// Set before the connection starts reading
+		void SetCapture(std::shared_ptr<capture_log> log)
+		{
+			m_pCapture = std::move(log);
+		}
+
+		// Limit what the remote may send, null for no limit. Over the limit the
+		// connection stops reading until it is back under
+		// Set before the connection starts reading
+		void SetRateLimit(std::shared_ptr<const rate_limit<T>> pLimit)
+		{
+			m_rateIn.Configure(std::move(pLimit));
+		}
+
+		// nFeature bits to ask the server for, or on the server the ones clients may have
+		// Set before ConnectToClient / ConnectToServer
+		void SetFeatures(uint32_t nFeatures)
+		{
+			m_nFeaturesWanted = nFeatures;
+		}
+
+		// Client side, where durable delivery keeps track of the outbox sequences received
+		// Set before ConnectToServer, the cursor outlives the connection
+		void SetDurableCursor(durable_cursor* pCursor)
+		{
+			m_pDurable = pCursor;
+		}
+
+		// Socket options of the low latency mode, applied now when the socket is
+		// open, otherwise once it has connected
+		void SetBusyPoll(const busy_poll& opts)
+		{
+			m_busyPoll = opts;
+			if(m_socket.is_open())
 			{
-				m_qMessagesIn.push_back({this->shared_from_this(), m_msgTemporaryIn});
+				ApplyBusyPoll(m_socket, m_busyPoll);
 			}
-			else
+		}
+
+		// nFeature bits in use, agreed in the handshake
+		uint32_t Features() const
+		{
+			return m_nFeatures;
+		}
+
+		// Server side, whether the handshake has settled the client's session (and
+		// Features), safe from any thread
+		bool IsAdmitted() const
+		{
+			return m_bAdmitted;
+		}
+
+		// Server side, broadcasts sent before the handshake settled whether the client
+		// is durable. The server holds its session lock around both
+		void HoldBroadcast(const message<T>& msg, priority ePriority)
+		{
+			m_vHeldBroadcasts.push_back({ msg, ePriority });
+		}
+
+		// Marks the client admitted, returns what was held for it
+		std::vector<std::pair<message<T>, priority>> Admitted()
+		{
+			m_bAdmitted = true;
+			return std::exchange(m_vHeldBroadcasts, {});
+		}
+
+		// Times reading stopped for the rate limit
+		uint64_t RatePauses() const
+		{
+			return m_nRatePauses;
+		}
+
+		// Relative share of the link for high, normal and bulk lanes,
+		// the control lane is always served first. Safe from any thread
+		void SetLaneWeights(uint32_t nHigh, uint32_t nNormal, uint32_t nBulk)
+		{
+			asio::post(m_asioContext,
+				[this, self = Self(), nHigh, nNormal, nBulk]()
+				{
+					m_nLaneWeight = { 0, std::max(nHigh, 1u), std::max(nNormal, 1u), std::max(nBulk, 1u) };
+				});
+		}
+
+#ifdef NET_USE_TLS
+		// Run TLS under the framework's own handshake, set before ConnectToClient / ConnectToServer
+		// bKernelOffload uses ktls_stream so Linux can move record encryption into the kernel,
+		// otherwise asio::ssl::stream encrypts in userspace
+		// Clients check the server certificate against sHost and, given pSessions,
+		// resume the session cached for sHost:port
+		void EnableTls(std::shared_ptr<asio::ssl::context> ctx, bool bKernelOffload = false,
+			const std::string& sHost = {}, tls_session_cache* pSessions = nullptr)
+		{
+			m_pTlsContext = std::move(ctx);
+			m_bKernelTls = bKernelOffload;
+			m_sTlsHost = sHost;
+			m_pTlsSessions = pSessions;
+		}
+
+		// Whether the TLS handshake resumed a cached session
+		bool IsTlsResumed()
+		{
+			SSL* ssl = TlsHandle();
+			return ssl != nullptr && SSL_session_reused(ssl) == 1;
+		}
+
+		// Whether the kernel encrypts what this connection sends
+		bool IsKernelTls() const
+		{
+			return m_pKtls && m_pKtls->IsKernelSend();
+		}
+#endif
+
+	public:
+		// Handoff to another process, server side, all of these run on the asio thread
+		// Stop at the next frame boundary: a write in flight completes, the pending read
+		// is cancelled and whatever it had taken off the socket is kept for the next owner
+		// False when the connection cannot move (not validated, closed or TLS)
+		bool Freeze()
+		{
+			if(!m_bValidated || !m_socket.is_open() || IsTls())
 			{
-				//clients have only one connection
-				m_qMessagesIn.push_back({nullptr, m_msgTemporaryIn});
+				return false;
 			}
 
-			// Reg another task for asio context to perfrom here
-			// wait to read another header
-			ReadHeader();
+			m_bFreezing = true;
+			if(!m_bWritingMessage)
+			{
+				CancelRead();
+			}
+			return true;
 		}
 
-		// ASYNC - Prime context to write a message header
-		void WriteHeader()
+		// Both directions stopped, or the socket went away meanwhile
+		bool IsFrozen() const
 		{
-			asio::async_write(m_socket, asio::buffer(&m_qMessagesOut.front().header, sizeof(message_header<T>)),
-				[this](std::error_code ec, std::size_t length)
-				
+			return !m_socket.is_open() || (m_bReadParked && !m_bWritingMessage);
+		}
+
+		// Undo Freeze when the handoff did not happen
+		void Thaw()
+		{
+			if(!m_bFreezing)
+			{
+				return;
+			}
+
+			m_bFreezing = false;
+			if(m_bReadParked)
+			{
+				m_bReadParked = false;
+				m_vInboundPrefix = std::move(m_vPartialIn);
+				ReadHeader();
+			}
+			StartWriting();
+		}
+
+		// State for the next owner of a frozen connection, the socket travels separately
+		// Streams still producing chunks (SendStream) are not carried over,
+		// chunks already queued are
+		void Export(handoff_buffer& out) const
+		{
+			out.Put(m_id);
+			out.Put(m_ticket);
+			out.Put(m_nStreamBytesIn);
+			out.Put(m_nStreamCredit);
+			out.PutBytes(m_vPartialIn);
+			for(size_t i = 0; i < nPriorityLanes; i++)
+			{
+				out.Put(uint64_t(m_qLanesOut[i].size()));
+				out.Put(uint64_t(m_nLaneOffset[i]));
+				for(const auto& o : m_qLanesOut[i])
 				{
-					if(!ec)
+					if(o.pSegment)
 					{
-						if(m_qMessagesOut.front().body.size()>0)
-						{
-							WriteBody();
-						}
-						else
-						{
-							//pop out of queue and check for more messages 
-							m_qMessagesOut.pop_front();
-							if(!m_qMessagesOut.empty())
-							{
-								WriteHeader();
-							}
-						}
+						// The next owner maps the outbox itself, the body travels as a copy
+						message<T> msg = o.msg;
+						msg.body.assign(o.pMapped, o.pMapped + o.nMapped);
+						out.PutMessage(msg);
 					}
 					else
 					{
-						//force close socket
-						std::cout<< "[" <<m_id<< "] Write Header Fail.\n";
-						m_socket.close();
-					}			
-				});
+						out.PutMessage(o.msg);
+					}
+					out.Put(o.nFrameFlags);
+					out.Put(o.nSeq);
+					out.Put(o.nChunk);
+				}
+				out.PutMessage(m_msgReassembly[i]);
+			}
 		}
 
-		// ASYNC - Prime context to write a message body
-		void WriteBody()
+		// New process, rebuild from Export's output and carry on where the old owner stopped
+		bool Adopt(handoff_buffer& in)
 		{
-			asio::async_write(m_socket,
-				asio::buffer(m_qMessagesOut.front().body.data(), m_qMessagesOut.front().body.size()),
-				[this](std::error_code ec, std::size_t length)
+			bool bOk = in.Get(m_id) && in.Get(m_ticket) && in.Get(m_nStreamBytesIn) &&
+				in.Get(m_nStreamCredit) && in.GetBytes(m_vInboundPrefix);
+			for(size_t i = 0; i < nPriorityLanes && bOk; i++)
 			{
-				if(!ec)
+				uint64_t nCount = 0;
+				uint64_t nOffset = 0;
+				bOk = in.Get(nCount) && in.Get(nOffset);
+				m_nLaneOffset[i] = size_t(nOffset);
+				for(uint64_t n = 0; n < nCount && bOk; n++)
 				{
-					//pop out of queue and check for more messages 
-					m_qMessagesOut.pop_front();
-
-					if(!m_qMessagesOut.empty())
+					outbound o;
+					bOk = in.GetMessage(o.msg) && in.Get(o.nFrameFlags) && in.Get(o.nSeq) && in.Get(o.nChunk);
+					if(o.nFrameFlags == 0)
 					{
-						WriteHeader();
+						m_nQueuedBytesOut += sizeof(wire_header) + o.msg.body.size();
 					}
+					m_qLanesOut[i].push_back(std::move(o));
 				}
-				else
-				{
-					//force close socket
-					std::cout<< "[" <<m_id<< "] Write Body Fail.\n";
-					m_socket.close();
-				}
-			});
+				bOk = bOk && in.GetMessage(m_msgReassembly[i]);
+			}
+
+			if(!bOk)
+			{
+				return false;
+			}
+
+			m_nFeatures = m_ticket.nFeatures;
+			m_bAdmitted = true;
+			m_bValidated = true;
+			ReadHeader();
+			StartWriting();
+			return true;
 		}
-		
-		// "Encrypt" data, temp
-		uint64_t scramble(uint64_t nInput)
+
+		asio::ip::tcp::socket::native_handle_type NativeHandle()
 		{
-			uint64_t out = nInput ^ 0xAAAADDDDAAAADDDD;
-			out = (out & 0xF0F0F0F0F0F0F0 ) >>  4 | (out & 0x0F0F0F0F0F0F0F ) << 4;
-			return out ^ 0xA16AD2D5AAA3DD47;						 
+			return m_socket.native_handle();
 		}
 
-		// Async 
-		void WriteValidation()
+	private:
+		bool IsTls() const
 		{
-			asio::async_write(m_socket, 
-				asio::buffer(&m_nHandshakeOut, sizeof(uint64_t)),
-				[this](std::error_code ec, std::size_t lenght)
+#ifdef NET_USE_TLS
+			return m_pTls || m_pKtls;
+#else
+			return false;
+#endif
+		}
+
+		void CancelRead()
+		{
+			if(m_bRatePaused)
 			{
-				if(!ec)
+				// No read to cancel, park where the next one would have started
+				m_bRatePaused = false;
+				m_timerRate.cancel();
+				Park(read_stage::header, 0);
+			}
+			else if(!m_bReadParked)
+			{
+				asio::error_code ec;
+				m_socket.cancel(ec);
+			}
+		}
+
+		// Reads stop here while freezing, the bytes of the unfinished frame are kept
+		// so the next owner reads them again before the socket
+		void Park(read_stage eStage, size_t nRead, size_t nLane = 0, size_t nOffset = 0)
+		{
+			auto Append = [this](const void* pData, size_t nSize)
+			{
+				const uint8_t* p = static_cast<const uint8_t*>(pData);
+				m_vPartialIn.insert(m_vPartialIn.end(), p, p + nSize);
+			};
+
+			// Compact headers are kept as read, m_hdrIn holds them decoded
+			const bool bCompact = (m_nFeatures & nFeatureCompact) != 0;
+			m_vPartialIn.clear();
+			if(eStage == read_stage::header)
+			{
+				Append(bCompact ? static_cast<const void*>(m_compactIn.data()) : &m_hdrIn, nRead);
+			}
+			else
+			{
+				// Frame header as it came off the wire
+				Append(bCompact ? static_cast<const void*>(m_compactIn.data()) : &m_hdrIn, bCompact ? m_nCompactIn : sizeof(m_hdrIn));
+
+				// What was read of the frame's contents, then of its CRC
+				auto AppendRead = [&](const void* pData, size_t nSize)
 				{
-					// Validation data sent, client should sit and wait
-					// for a response(or a closure)
-					if( m_nOwnerType == owner::client)
+					Append(pData, std::min(nRead, nSize));
+					if(nRead > nSize)
 					{
-						ReadHeader();
+						Append(&m_nCrcIn, nRead - nSize);
 					}
+				};
+
+				switch(eStage)
+				{
+				case read_stage::body:
+					AppendRead(m_msgTemporaryIn.body.data(), m_msgTemporaryIn.body.size());
+					if(m_eStreamIn != stream_part::none)
+					{
+						// Counted again when the header is read again
+						m_nStreamBytesIn -= std::min(m_nStreamBytesIn, uint32_t(m_msgTemporaryIn.body.size()));
+					}
+					break;
+
+				case read_stage::fragment:
+					AppendRead(m_msgReassembly[nLane].body.data() + nOffset, m_msgReassembly[nLane].body.size() - nOffset);
+					m_msgReassembly[nLane].body.resize(nOffset);
+					break;
+
+				default:
+					AppendRead(&m_nCreditIn, sizeof(m_nCreditIn));
+					break;
 				}
-				else
-				{					
-					m_socket.close();
-				}
-			});	
-		}
+			}
 
+			// Leftovers of an earlier owner not read yet follow
+			Append(m_vInboundPrefix.data(), m_vInboundPrefix.size());
+			m_vInboundPrefix.clear();
+			m_bReadParked = true;
+		}
 
-		void ReadValidation( net::server_interface<T>* server = nullptr)
+		// ASYNC - TLS handshake when enabled, fnThen starts the framework's handshake
+		// on top of it
+		void StartTls(std::function<void()> fnThen)
 		{
-			// read the bites of data into handshakeIn
-			asio::async_read(m_socket, 
-				asio::buffer(&m_nHandshakeIn, sizeof(uint64_t)),
-				[this, server](std::error_code ec, std::size_t lenght)
+#ifdef NET_USE_TLS
+			if(m_pTlsContext)
 			{
-				if(!ec)
+				const bool bClient = m_nOwnerType == owner::client;
+				try
 				{
-					if( m_nOwnerType == owner::server)
+					if(m_bKernelTls)
 					{
-						if(m_nHandshakeIn == m_nHandshakeCheck)
-						{
-							// Client has provited valid solution
-							std::cout << "Client Validated" << std::endl;
-							server->OnClientValidated(this->shared_from_this());		
-
-							// Sit and wait to receive data now
-							ReadHeader();
-						}
-						else
-						{
-							// Client gave incorrect data, so disconnect
-							// Can add client to ban list or counter in the future
-							std::cout << "Client Disconnected (Fail Validation)\n";
-							m_socket.close();						
-						}
+						m_pKtls = std::make_unique<ktls_stream>(m_socket, *m_pTlsContext);
 					}
 					else
 					{
-						// Connection is client, solve puzzle
-						m_nHandshakeOut = scramble(m_nHandshakeIn);
-						// Write the result
-						WriteValidation();
+						m_pTls = std::make_unique<asio::ssl::stream<asio::ip::tcp::socket&>>(m_socket, *m_pTlsContext);
 					}
 				}
-				else
+				catch(std::exception& e)
 				{
-					std::cout<<"Client Disconnected (ReadValidation)\n";
+					NET_LOG_WARN("[", m_id, "] TLS Setup Fail: ", e.what());
 					m_socket.close();
+					return;
 				}
-			});	
-		}
-
-	protected:
-		// Responsible for ASIO
-		// Each connection has a unique socket to a remote
-		asio::ip::tcp::socket m_socket;
-
-		// Context shared with thew whole asio instance(server will have multiple connections)
-		asio::io_context& m_asioContext;
 
-		// Queue hold all messages to be send to remote side of this connection
-		tsqueue<message<T>> m_qMessagesOut;
+				if(bClient)
+				{
+					PrepareTlsClient(TlsHandle());
+				}
+
+				auto fnDone = [this, fnThen](std::error_code ec)
+				{
+					if(!ec)
+					{
+						fnThen();
+					}
+					else
+					{
+						NET_LOG_WARN("[", m_id, "] TLS Handshake Fail: ", ec.message());
+						m_socket.close();
+					}
+				};
+
+				const auto eType = bClient ? asio::ssl::stream_base::client : asio::ssl::stream_base::server;
+				if(m_pKtls)
+				{
+					m_pKtls->async_handshake(eType, fnDone);
+				}
+				else
+				{
+					m_pTls->async_handshake(eType, fnDone);
+				}
+				return;
+			}
+#endif
+			fnThen();
+		}
+
+#ifdef NET_USE_TLS
+		SSL* TlsHandle()
+		{
+			return m_pKtls ? m_pKtls->native_handle() : (m_pTls ? m_pTls->native_handle() : nullptr);
+		}
+
+		// Server name for SNI and certificate checks, and the cached session to resume
+		void PrepareTlsClient(SSL* ssl)
+		{
+			if(!m_sTlsHost.empty())
+			{
+				asio::error_code ec;
+				asio::ip::make_address(m_sTlsHost, ec);
+				if(ec)
+				{
+					SSL_set_tlsext_host_name(ssl, m_sTlsHost.c_str());
+					SSL_set1_host(ssl, m_sTlsHost.c_str());
+				}
+				else
+				{
+					X509_VERIFY_PARAM_set1_ip_asc(SSL_get0_param(ssl), m_sTlsHost.c_str());
+				}
+			}
+
+			if(m_pTlsSessions)
+			{
+				asio::error_code ec;
+				const auto endpoint = m_socket.remote_endpoint(ec);
+				m_sTlsSessionKey = m_sTlsHost + ":" + std::to_string(endpoint.port());
+				m_pTlsSessions->Prepare(ssl, &m_sTlsSessionKey);
+			}
+		}
+#endif
+
+		// The server may drop its last reference while work for a connection is queued
+		// or in flight, so that work holds one. Client connections are not shared and
+		// their owner drains the context before destroying them
+		std::shared_ptr<connection<T>> Self()
+		{
+			return m_nOwnerType == owner::server ? this->shared_from_this() : nullptr;
+		}
+
+		template<typename Handler>
+		auto KeepAlive(Handler&& handler)
+		{
+			return [self = Self(), h = std::forward<Handler>(handler)](std::error_code ec, std::size_t length) mutable
+			{
+				h(ec, length);
+			};
+		}
+
+		// Every read and write goes through these so the TLS stream, when there is
+		// one, sits between the framing and the socket
+		template<typename MutableBuffers, typename Handler>
+		void AsyncRead(const MutableBuffers& buffers, Handler&& handlerIn)
+		{
+			auto handler = KeepAlive(std::forward<Handler>(handlerIn));
+			if(!m_vInboundPrefix.empty())
+			{
+				// Bytes a previous owner already took off the socket come first
+				size_t nPrefix = 0;
+				std::vector<asio::mutable_buffer> vRest;
+				for(auto it = asio::buffer_sequence_begin(buffers); it != asio::buffer_sequence_end(buffers); ++it)
+				{
+					asio::mutable_buffer b = *it;
+					const size_t nCopy = std::min(b.size(), m_vInboundPrefix.size() - nPrefix);
+					std::memcpy(b.data(), m_vInboundPrefix.data() + nPrefix, nCopy);
+					nPrefix += nCopy;
+					b += nCopy;
+					if(b.size() > 0)
+					{
+						vRest.push_back(b);
+					}
+				}
+				m_vInboundPrefix.erase(m_vInboundPrefix.begin(), m_vInboundPrefix.begin() + nPrefix);
+
+				if(vRest.empty())
+				{
+					asio::post(m_asioContext, [h = std::move(handler), nPrefix]() mutable
+						{
+							h(std::error_code(), nPrefix);
+						});
+				}
+				else
+				{
+					asio::async_read(m_socket, vRest,
+						[h = std::move(handler), nPrefix](std::error_code ec, std::size_t length) mutable
+						{
+							h(ec, nPrefix + length);
+						});
+				}
+				return;
+			}
+
+#ifdef NET_USE_TLS
+			if(m_pKtls)
+			{
+				asio::async_read(*m_pKtls, buffers, std::move(handler));
+				return;
+			}
+			if(m_pTls)
+			{
+				asio::async_read(*m_pTls, buffers, std::move(handler));
+				return;
+			}
+#endif
+			asio::async_read(m_socket, buffers, std::move(handler));
+		}
+
+		template<typename ConstBuffers, typename Handler>
+		void AsyncWrite(const ConstBuffers& buffers, Handler&& handlerIn)
+		{
+			auto handler = KeepAlive(std::forward<Handler>(handlerIn));
+#ifdef NET_USE_TLS
+			if(m_pKtls || m_pTls)
+			{
+				// TLS writes one buffer at a time, each its own record, so header and
+				// body are gathered first rather than sending an 8 byte record per frame
+				if(std::distance(asio::buffer_sequence_begin(buffers), asio::buffer_sequence_end(buffers)) > 1)
+				{
+					m_vTlsWrite.resize(asio::buffer_size(buffers));
+					asio::buffer_copy(asio::buffer(m_vTlsWrite), buffers);
+					WriteTls(asio::buffer(m_vTlsWrite), std::move(handler));
+				}
+				else
+				{
+					WriteTls(buffers, std::move(handler));
+				}
+				return;
+			}
+#endif
+			asio::async_write(m_socket, buffers, std::move(handler));
+		}
+
+#ifdef NET_USE_TLS
+		template<typename ConstBuffers, typename Handler>
+		void WriteTls(const ConstBuffers& buffers, Handler&& handler)
+		{
+			if(m_pKtls)
+			{
+				asio::async_write(*m_pKtls, buffers, std::forward<Handler>(handler));
+			}
+			else
+			{
+				asio::async_write(*m_pTls, buffers, std::forward<Handler>(handler));
+			}
+		}
+#endif
+
+		// Copy of msg for the asio thread, sampled for tracing
+		message<T> Traced(const message<T>& msg)
+		{
+			message<T> out = msg;
+			NET_TRACE_SAMPLE(out.nTrace);
+			NET_TRACE(out.nTrace, send, m_id, out.header.id);
+			return out;
+		}
+
+		// Messages queue up until the handshake is done, the ticket must be the
+		// first thing the client reads after the challenge
+		void StartWriting()
+		{
+			if(!m_bWritingMessage && m_bValidated && (!m_bCorked || !m_qLanesOut[size_t(priority::control)].empty()))
+			{
+				WriteFrame();
+			}
+		}
+
+		// ASYNC - Prime context ready to read a message header
+		void ReadHeader()
+		{
+			if(m_bFreezing)
+			{
+				Park(read_stage::header, 0);
+				return;
+			}
+
+			// Over the rate limit, leave the rest in the socket until the buckets refill
+			const auto wait = m_rateIn.Wait();
+			if(wait > std::chrono::steady_clock::duration::zero())
+			{
+				m_bRatePaused = true;
+				m_nRatePauses++;
+				m_timerRate.expires_after(wait);
+				m_timerRate.async_wait([this](std::error_code ec)
+					{
+						// Aborted by a freeze or the connection is gone, this may no longer exist
+						if(ec)
+						{
+							return;
+						}
+
+						m_bRatePaused = false;
+						ReadHeader();
+					});
+				return;
+			}
+
+			if(m_nFeatures & nFeatureCompact)
+			{
+				ReadCompactHeader();
+				return;
+			}
+
+			// header has fixed size
+			AsyncRead(
+				asio::buffer(&m_hdrIn, sizeof(wire_header)),
+				[this](std::error_code ec, std::size_t lenght)
+				{
+					if(!ec)
+					{
+						OnHeader(sizeof(wire_header));
+					}
+					else if(m_bFreezing && ec == asio::error::operation_aborted)
+					{
+						Park(read_stage::header, lenght);
+					}
+					else
+					{
+						//force close socket
+						NET_LOG_INFO("[", m_id, "] Read Header Fail.");
+						m_socket.close();
+					}
+				});
+		}
+
+		// ASYNC - Compact header, the shortest one it can be first, the rest once the
+		// tag says how long it is. Small frames take a single read
+		void ReadCompactHeader()
+		{
+			AsyncRead(
+				asio::buffer(m_compactIn.data(), compact_header::nMinSize),
+				[this](std::error_code ec, std::size_t lenght)
+				{
+					if(!ec)
+					{
+						m_nCompactIn = compact_header::Size(m_compactIn[0]);
+						if(m_nCompactIn == compact_header::nMinSize)
+						{
+							OnCompactHeader();
+							return;
+						}
+						if(m_bFreezing)
+						{
+							Park(read_stage::header, compact_header::nMinSize);
+							return;
+						}
+
+						AsyncRead(
+							asio::buffer(m_compactIn.data() + compact_header::nMinSize, m_nCompactIn - compact_header::nMinSize),
+							[this](std::error_code ec, std::size_t lenght)
+							{
+								if(!ec)
+								{
+									OnCompactHeader();
+								}
+								else if(m_bFreezing && ec == asio::error::operation_aborted)
+								{
+									Park(read_stage::header, compact_header::nMinSize + lenght);
+								}
+								else
+								{
+									NET_LOG_INFO("[", m_id, "] Read Header Fail.");
+									m_socket.close();
+								}
+							});
+					}
+					else if(m_bFreezing && ec == asio::error::operation_aborted)
+					{
+						Park(read_stage::header, lenght);
+					}
+					else
+					{
+						NET_LOG_INFO("[", m_id, "] Read Header Fail.");
+						m_socket.close();
+					}
+				});
+		}
+
+		// Back to the 8 byte form the rest of the reader and the CRC work with
+		void OnCompactHeader()
+		{
+			if(!compact_header::Decode(m_compactIn.data(), m_hdrIn))
+			{
+				NET_LOG_WARN("[", m_id, "] Bad Frame Header.");
+				m_socket.close();
+				return;
+			}
+			OnHeader(m_nCompactIn);
+		}
+
+		// A frame header is in m_hdrIn, read what follows it
+		void OnHeader(size_t nHeaderBytes)
+		{
+			m_msgTemporaryIn.header = FromWire<T>(m_hdrIn);
+			const uint32_t nRawSize = m_msgTemporaryIn.header.size;
+			const uint32_t nLength = nRawSize & nFrameSizeMask;
+			const bool bLast = (nRawSize & nFrameLast) != 0;
+
+			// Never trust the size field with an allocation
+			if(nLength > m_nMaxBufferedBytes)
+			{
+				NET_LOG_WARN("[", m_id, "] Frame Too Large (", nLength, " bytes).");
+				m_socket.close();
+				return;
+			}
+
+			m_rateIn.ChargeBytes(nHeaderBytes + nLength);
+			m_msgTemporaryIn.header.size = nLength;
+			m_eStreamIn = stream_part::none;
+			m_bCallIn = (nRawSize & nFrameCall) != 0;
+
+			if(m_bCallIn && nLength < sizeof(uint32_t))
+			{
+				NET_LOG_WARN("[", m_id, "] Bad Call Frame.");
+				m_socket.close();
+				return;
+			}
+
+#ifdef NET_USE_TRACE
+			// Sampled as its first frame arrives, the reassembly carries it past later fragments
+			const size_t nTraceLane = (nRawSize & nFrameLaneMask) >> nFrameLaneShift;
+			if(!(nRawSize & nFrameCredit) && !((nRawSize & nFrameFragment) && !m_msgReassembly[nTraceLane].body.empty()))
+			{
+				NET_TRACE_SAMPLE(m_msgTemporaryIn.nTrace);
+				NET_TRACE(m_msgTemporaryIn.nTrace, header, m_id, m_msgTemporaryIn.header.id);
+			}
+#endif
+
+			if(nRawSize & nFrameCredit)
+			{
+				ReadCredit();
+			}
+			else if(nRawSize & nFrameStream)
+			{
+				// Receiver must not be sent more than the credit it handed out
+				m_nStreamBytesIn += nLength;
+				if(m_nStreamBytesIn > nStreamWindow)
+				{
+					NET_LOG_WARN("[", m_id, "] Stream Credit Exceeded.");
+					m_socket.close();
+					return;
+				}
+
+				m_eStreamIn = bLast ? stream_part::last : stream_part::chunk;
+				m_msgTemporaryIn.body.resize(nLength);
+				ReadBody();
+			}
+			else if(nRawSize & nFrameFragment)
+			{
+				// Part of a larger message, append it to its lane's reassembly
+				ReadFragment((nRawSize & nFrameLaneMask) >> nFrameLaneShift, nLength, bLast);
+			}
+			//check if there is message body
+			else if(nLength > 0)
+			{
+				m_msgTemporaryIn.body.resize(nLength);
+				ReadBody();
+			}
+			else if(m_nFeatures & nFeatureCrc)
+			{
+				// Nothing but the CRC to read
+				m_msgTemporaryIn.body.clear();
+				ReadBody();
+			}
+			else
+			{
+				m_msgTemporaryIn.body.clear();
+				AddToIncomingMessageQueue();
+			}
+		}
+		
+		// ASYNC - Prime context ready to read a message body
+		void ReadBody()
+		{
+			if(m_bFreezing)
+			{
+				Park(read_stage::body, 0);
+				return;
+			}
+
+			//we know the size of the data we need to read
+			ReadFrameData(m_msgTemporaryIn.body.data(), m_msgTemporaryIn.body.size(),
+				[this](std::error_code ec, std::size_t length)
+			{						
+				if (!ec)
+				{
+					if(CheckCrc(m_msgTemporaryIn.body.data(), m_msgTemporaryIn.body.size()))
+					{
+						AddToIncomingMessageQueue();
+					}
+				}
+				else if(m_bFreezing && ec == asio::error::operation_aborted)
+				{
+					Park(read_stage::body, length);
+				}
+				else
+				{				
+					NET_LOG_INFO("[", m_id, "] Read Body Fail.");
+					m_socket.close();
+				}
+			});
+
+		}
+
+		// ASYNC - Read one fragment straight onto the end of the partially received message
+		void ReadFragment(size_t nLane, uint32_t nLength, bool bLast)
+		{
+			size_t nBuffered = nLength;
+			for(const auto& m : m_msgReassembly)
+			{
+				nBuffered += m.body.size();
+			}
+
+			if(nBuffered > m_nMaxBufferedBytes)
+			{
+				NET_LOG_WARN("[", m_id, "] Message Too Large (", nBuffered, " bytes buffered).");
+				m_socket.close();
+				return;
+			}
+
+			message<T>& msg = m_msgReassembly[nLane];
+			const size_t nOffset = msg.body.size();
+			if(m_bFreezing)
+			{
+				Park(read_stage::fragment, 0, nLane, nOffset);
+				return;
+			}
+
+			msg.header.id = m_msgTemporaryIn.header.id;
+			msg.body.resize(nOffset + nLength);
+#ifdef NET_USE_TRACE
+			if(nOffset == 0)
+			{
+				msg.nTrace = m_msgTemporaryIn.nTrace;
+			}
+#endif
+
+			ReadFrameData(msg.body.data() + nOffset, nLength,
+				[this, nLane, nOffset, bLast](std::error_code ec, std::size_t length)
+			{
+				if(!ec)
+				{
+					const message<T>& msgPart = m_msgReassembly[nLane];
+					if(!CheckCrc(msgPart.body.data() + nOffset, msgPart.body.size() - nOffset))
+					{
+						return;
+					}
+
+					if(bLast)
+					{
+						// Whole message is here, deliver it like any other
+						m_msgTemporaryIn.body = std::move(m_msgReassembly[nLane].body);
+						m_msgTemporaryIn.header.size = uint32_t(m_msgTemporaryIn.body.size());
+#ifdef NET_USE_TRACE
+						m_msgTemporaryIn.nTrace = m_msgReassembly[nLane].nTrace;
+#endif
+						m_msgReassembly[nLane].body.clear();
+						AddToIncomingMessageQueue();
+					}
+					else
+					{
+						ReadHeader();
+					}
+				}
+				else if(m_bFreezing && ec == asio::error::operation_aborted)
+				{
+					Park(read_stage::fragment, length, nLane, nOffset);
+				}
+				else
+				{
+					NET_LOG_INFO("[", m_id, "] Read Fragment Fail.");
+					m_socket.close();
+				}
+			});
+		}
+
+		// ASYNC - Read a credit grant from the receiver of our streams
+		void ReadCredit()
+		{
+			if(m_bFreezing)
+			{
+				Park(read_stage::credit, 0);
+				return;
+			}
+
+			ReadFrameData(&m_nCreditIn, sizeof(uint32_t),
+				[this](std::error_code ec, std::size_t length)
+			{
+				if(!ec)
+				{
+					if(!CheckCrc(&m_nCreditIn, sizeof(uint32_t)))
+					{
+						return;
+					}
+					m_nStreamCredit += WireOrder(m_nCreditIn);
+					PumpStreams();
+					ReadHeader();
+				}
+				else if(m_bFreezing && ec == asio::error::operation_aborted)
+				{
+					Park(read_stage::credit, length);
+				}
+				else
+				{
+					NET_LOG_INFO("[", m_id, "] Read Credit Fail.");
+					m_socket.close();
+				}
+			});
+		}
+
+		// ASYNC - Read nSize bytes of the current frame, and its CRC when agreed on
+		template<typename Handler>
+		void ReadFrameData(void* pData, size_t nSize, Handler&& handler)
+		{
+			if(m_nFeatures & nFeatureCrc)
+			{
+				const std::array<asio::mutable_buffer, 2> buffers = {
+					asio::buffer(pData, nSize), asio::buffer(&m_nCrcIn, sizeof(m_nCrcIn)) };
+				AsyncRead(buffers, std::forward<Handler>(handler));
+			}
+			else
+			{
+				AsyncRead(asio::buffer(pData, nSize), std::forward<Handler>(handler));
+			}
+		}
+
+		// The frame just read against its CRC, closes the connection when they differ
+		bool CheckCrc(const void* pData, size_t nSize)
+		{
+			if(!(m_nFeatures & nFeatureCrc))
+			{
+				return true;
+			}
+
+			uint32_t nState = Crc32cUpdate(~0u, &m_hdrIn, sizeof(m_hdrIn));
+			nState = Crc32cUpdate(nState, pData, nSize);
+			if(~nState != WireOrder(m_nCrcIn))
+			{
+				NET_LOG_WARN("[", m_id, "] Frame CRC Mismatch (id ", int(m_msgTemporaryIn.header.id), ", ", nSize, " bytes).");
+				m_socket.close();
+				return false;
+			}
+			return true;
+		}
+
+		void AddToIncomingMessageQueue()
+		{
+			m_msgTemporaryIn.nCall = 0;
+			if(m_bCallIn)
+			{
+				// Call ID is the last thing in the message
+				const size_t nBody = m_msgTemporaryIn.body.size() - sizeof(uint32_t);
+				std::memcpy(&m_msgTemporaryIn.nCall, m_msgTemporaryIn.body.data() + nBody, sizeof(uint32_t));
+				m_msgTemporaryIn.nCall = WireOrder(m_msgTemporaryIn.nCall);
+				m_msgTemporaryIn.body.resize(nBody);
+				m_msgTemporaryIn.header.size = uint32_t(nBody);
+			}
+
+			// Before it, the outbox sequence of a message from a durable server
+			if(m_nOwnerType == owner::client && (m_nFeatures & nFeatureDurable) && m_eStreamIn == stream_part::none)
+			{
+				if(m_msgTemporaryIn.body.size() < sizeof(uint64_t))
+				{
+					NET_LOG_WARN("[", m_id, "] Missing Outbox Sequence");
+					m_socket.close();
+					return;
+				}
+
+				const size_t nBody = m_msgTemporaryIn.body.size() - sizeof(uint64_t);
+				uint64_t nSeq = 0;
+				std::memcpy(&nSeq, m_msgTemporaryIn.body.data() + nBody, sizeof(uint64_t));
+				m_msgTemporaryIn.body.resize(nBody);
+				m_msgTemporaryIn.header.size = uint32_t(nBody);
+
+				// Sent again after a reconnect, delivered the first time
+				nSeq = WireOrder(nSeq);
+				if(nSeq != 0 && m_pDurable && !m_pDurable->Accept(nSeq))
+				{
+					ReadHeader();
+					return;
+				}
+			}
+
+			if(m_pCapture)
+			{
+				m_pCapture->Append(m_id, capture_direction::in, m_msgTemporaryIn, m_eStreamIn);
+			}
+
+			// Replies go straight to the waiting caller, not through the queue
+			if(m_msgTemporaryIn.nCall & nCallReply)
+			{
+				NET_TRACE(m_msgTemporaryIn.nTrace, delivered, m_id, m_msgTemporaryIn.header.id);
+				m_calls.Complete(m_msgTemporaryIn.nCall & ~nCallReply, m_msgTemporaryIn);
+				ReadHeader();
+				return;
+			}
+
+			m_rateIn.ChargeMessage(m_msgTemporaryIn.header.id);
+			NET_TRACE(m_msgTemporaryIn.nTrace, inbox, m_id, m_msgTemporaryIn.header.id);
+			if( m_nOwnerType == owner::server)
+			{
+				m_qMessagesIn.push_back({this->shared_from_this(), m_msgTemporaryIn, m_eStreamIn});
+			}
+			else
+			{
+				// A client_interface has only one connection, pooled connections are
+				// shared so the pool can tell them apart
+				m_qMessagesIn.push_back({this->weak_from_this().lock(), m_msgTemporaryIn, m_eStreamIn});
+			}
+
+			// Reg another task for asio context to perfrom here
+			// wait to read another header
+			ReadHeader();
+		}
+
+		// Turn the front stream into chunk frames while the receiver has credit left
+		// Runs on the asio thread, when credit runs out it resumes from ReadCredit
+		void PumpStreams()
+		{
+			while(!m_deqStreamsOut.empty())
+			{
+				outbound_stream& st = m_deqStreamsOut.front();
+				const uint32_t nLength = uint32_t(std::min<uint64_t>(st.nSize - st.nQueued, std::min(m_nChunkSize, nStreamWindow)));
+				if(nLength > m_nStreamCredit)
+				{
+					break;
+				}
+
+				outbound chunk;
+				chunk.msg.header.id = st.id;
+				chunk.msg.body.resize(nLength);
+				const size_t nRead = std::min<size_t>(st.fnRead(chunk.msg.body.data(), nLength), nLength);
+				chunk.msg.body.resize(nRead);
+				chunk.msg.header.size = uint32_t(nRead);
+
+				st.nQueued += nRead;
+				m_nStreamCredit -= uint32_t(nRead);
+
+				// A short read ends the stream early
+				const bool bLast = nRead < nLength || st.nQueued == st.nSize;
+				chunk.nFrameFlags = nFrameStream | (uint32_t(st.ePriority) << nFrameLaneShift) | (bLast ? nFrameLast : 0);
+				m_qLanesOut[size_t(st.ePriority)].push_back(std::move(chunk));
+
+				if(bLast)
+				{
+					m_deqStreamsOut.pop_front();
+				}
+			}
+
+			StartWriting();
+		}
+
+		// Pick the lane to write from next, -1 when all are empty
+		// control is strict priority, the other lanes use smooth weighted round robin
+		// so each gets frames in proportion to its weight
+		// nIndex skips the messages of each lane already planned into the write
+		int NextLane(const std::array<size_t, nPriorityLanes>& nIndex)
+		{
+			if(nIndex[size_t(priority::control)] < m_qLanesOut[size_t(priority::control)].size())
+			{
+				return int(priority::control);
+			}
+
+			int nBest = -1;
+			int32_t nTotal = 0;
+			for(size_t i = 1; i < nPriorityLanes; i++)
+			{
+				if(nIndex[i] < m_qLanesOut[i].size())
+				{
+					m_nLaneCurrent[i] += int32_t(m_nLaneWeight[i]);
+					nTotal += int32_t(m_nLaneWeight[i]);
+					if(nBest < 0 || m_nLaneCurrent[i] > m_nLaneCurrent[nBest])
+					{
+						nBest = int(i);
+					}
+				}
+			}
+
+			if(nBest > 0)
+			{
+				m_nLaneCurrent[nBest] -= nTotal;
+			}
+			return nBest;
+		}
+
+		// ASYNC - Prime context to write the next frames, header and body (or a chunk of it)
+		// of each. Frames are picked lane by lane as always, small ones are gathered into
+		// one write up to a chunk's worth of bytes or nMaxBatchFrames
+		void WriteFrame()
+		{
+			if(m_bFreezing)
+			{
+				// Writer stops at a frame boundary, now the read can be cancelled
+				m_bWritingMessage = false;
+				CancelRead();
+				return;
+			}
+
+			// Plan on copies of the lane cursors, the lanes only move once written
+			std::array<size_t, nPriorityLanes> nIndex{};
+			std::array<size_t, nPriorityLanes> nOffset = m_nLaneOffset;
+			size_t nBytes = 0;
+			const bool bSeqs = m_nOwnerType == owner::server && (m_nFeatures & nFeatureDurable);
+			m_vFramesOut.clear();
+			while(m_vFramesOut.size() < nMaxBatchFrames && (m_vFramesOut.empty() || nBytes < m_nChunkSize))
+			{
+				const int nLane = NextLane(nIndex);
+				if(nLane < 0)
+				{
+					break;
+				}
+
+				outbound& out = m_qLanesOut[nLane][nIndex[nLane]];
+				const message<T>& msg = out.msg;
+				if(out.nChunk == 0)
+				{
+					// Stream chunks and credit grants are already sized to a single frame
+					out.nChunk = out.nFrameFlags != 0 ? uint32_t(std::max<size_t>(out.Size(), 1)) : m_nChunkSize;
+				}
+				const uint32_t nLength = uint32_t(std::min<size_t>(out.Size() - nOffset[nLane], out.nChunk));
+
+				frame_out f{ out, size_t(nLane), nOffset[nLane], nLength, { msg.header.id, nLength }, {}, {}, 0, false, 0, false, 0, 0 };
+				if(out.nFrameFlags != 0)
+				{
+					f.hdr.size |= out.nFrameFlags;
+				}
+				else if(out.Size() > out.nChunk)
+				{
+					f.hdr.size |= nFrameFragment | (uint32_t(nLane) << nFrameLaneShift);
+					if(f.nOffset + nLength == out.Size())
+					{
+						f.hdr.size |= nFrameLast;
+					}
+				}
+
+				if(f.nOffset == 0)
+				{
+					NET_TRACE(msg.nTrace, write, m_id, msg.header.id);
+				}
+
+				// Outbox sequence and call ID ride at the end of the message's last frame
+				const bool bLast = f.nOffset + nLength == out.Size();
+				f.bSeq = bSeqs && out.nFrameFlags == 0 && bLast;
+				if(f.bSeq)
+				{
+					f.hdr.size += uint32_t(sizeof(uint64_t));
+					f.nSeqWire = WireOrder(out.nSeq);
+				}
+				f.bCall = msg.nCall != 0 && bLast;
+				if(f.bCall)
+				{
+					f.hdr.size = (f.hdr.size + uint32_t(sizeof(uint32_t))) | nFrameCall;
+					f.nCallWire = WireOrder(msg.nCall);
+				}
+				f.wire = ToWire(f.hdr);
+				f.nCompact = (m_nFeatures & nFeatureCompact) ? uint8_t(compact_header::Encode(f.compact.data(), f.wire)) : 0;
+
+				if(m_nFeatures & nFeatureCrc)
+				{
+					uint32_t nState = Crc32cUpdate(~0u, &f.wire, sizeof(f.wire));
+					nState = Crc32cUpdate(nState, out.Data() + f.nOffset, nLength);
+					if(f.bSeq)
+					{
+						nState = Crc32cUpdate(nState, &f.nSeqWire, sizeof(uint64_t));
+					}
+					if(f.bCall)
+					{
+						nState = Crc32cUpdate(nState, &f.nCallWire, sizeof(uint32_t));
+					}
+					f.nCrcWire = WireOrder(~nState);
+				}
+				m_vFramesOut.push_back(f);
+
+				nBytes += (f.nCompact ? f.nCompact : sizeof(wire_header)) + nLength;
+				nOffset[nLane] += nLength;
+				if(nOffset[nLane] >= out.Size())
+				{
+					nIndex[nLane]++;
+					nOffset[nLane] = 0;
+				}
+			}
+
+			if(m_vFramesOut.empty())
+			{
+				m_bWritingMessage = false;
+				return;
+			}
+			m_bWritingMessage = true;
+
+			// Headers live in m_vFramesOut, which no longer grows
+			m_vBuffersOut.clear();
+			for(const frame_out& f : m_vFramesOut)
+			{
+				if(f.nCompact)
+				{
+					m_vBuffersOut.push_back(asio::buffer(f.compact.data(), f.nCompact));
+				}
+				else
+				{
+					m_vBuffersOut.push_back(asio::buffer(&f.wire, sizeof(wire_header)));
+				}
+				if(f.nLength > 0)
+				{
+					m_vBuffersOut.push_back(asio::buffer(f.out.Data() + f.nOffset, f.nLength));
+				}
+				if(f.bSeq)
+				{
+					m_vBuffersOut.push_back(asio::buffer(&f.nSeqWire, sizeof(uint64_t)));
+				}
+				if(f.bCall)
+				{
+					m_vBuffersOut.push_back(asio::buffer(&f.nCallWire, sizeof(uint32_t)));
+				}
+				if(m_nFeatures & nFeatureCrc)
+				{
+					m_vBuffersOut.push_back(asio::buffer(&f.nCrcWire, sizeof(uint32_t)));
+				}
+			}
+
+			AsyncWrite(m_vBuffersOut,
+				[this](std::error_code ec, std::size_t /*length*/)
+				{
+					if(!ec)
+					{
+						for(const frame_out& f : m_vFramesOut)
+						{
+							const size_t nLane = f.nLane;
+							m_nLaneOffset[nLane] += f.nLength;
+							if(m_nLaneOffset[nLane] >= m_qLanesOut[nLane].front().Size())
+							{
+								const outbound& out = m_qLanesOut[nLane].front();
+								if(m_pCapture && !(out.nFrameFlags & nFrameCredit))
+								{
+									m_pCapture->Append(m_id, capture_direction::out, uint32_t(static_cast<std::underlying_type_t<T>>(out.msg.header.id)),
+										out.Data(), uint32_t(out.Size()),
+										(out.nFrameFlags & nFrameStream) ? ((out.nFrameFlags & nFrameLast) ? stream_part::last : stream_part::chunk) : stream_part::none);
+								}
+
+								if(out.nFrameFlags == 0)
+								{
+									m_nQueuedBytesOut -= sizeof(wire_header) + out.Size();
+								}
+								NET_TRACE(out.msg.nTrace, written, m_id, out.msg.header.id);
+
+								//pop out of queue and check for more messages 
+								m_qLanesOut[nLane].pop_front();
+								m_nLaneOffset[nLane] = 0;
+							}
+						}
+						WriteFrame();
+					}
+					else
+					{
+						//force close socket
+						NET_LOG_INFO("[", m_id, "] Write Frame Fail.");
+						m_bWritingMessage = false;
+						m_socket.close();
+					}
+				});
+		}
+
+		// Keep the call timer set for the earliest deadline, runs on the asio thread
+		void ArmCallTimer()
+		{
+			std::chrono::steady_clock::time_point tNext;
+			if(!m_calls.NextDeadline(tNext) || (m_bCallTimerSet && m_tCallTimer <= tNext))
+			{
+				return;
+			}
+
+			m_bCallTimerSet = true;
+			m_tCallTimer = tNext;
+			m_timerCalls.expires_at(tNext);
+			m_timerCalls.async_wait([this](std::error_code ec)
+				{
+					// Aborted when rearmed for an earlier deadline or the connection is gone,
+					// this may no longer exist
+					if(ec)
+					{
+						return;
+					}
+
+					m_bCallTimerSet = false;
+					m_calls.Expire(std::chrono::steady_clock::now());
+					ArmCallTimer();
+				});
+		}
+
+		// "Encrypt" data, temp
+		uint64_t scramble(uint64_t nInput)
+		{
+			uint64_t out = nInput ^ 0xAAAADDDDAAAADDDD;
+			out = (out & 0xF0F0F0F0F0F0F0 ) >>  4 | (out & 0x0F0F0F0F0F0F0F ) << 4;
+			return out ^ 0xA16AD2D5AAA3DD47;						 
+		}
+
+		// Async 
+		void WriteValidation()
+		{
+			// A client's answer is followed by the features it asks for
+			m_nFeaturesOut = WireOrder(uint64_t(m_nFeaturesWanted));
+			const std::array<asio::const_buffer, 2> buffers = {
+				asio::buffer(&m_nHandshakeOut, sizeof(uint64_t)),
+				asio::buffer(&m_nFeaturesOut, m_nOwnerType == owner::client ? sizeof(uint64_t) : 0) };
+			AsyncWrite(
+				buffers,
+				[this](std::error_code ec, std::size_t /*lenght*/)
+			{
+				if(!ec)
+				{
+					// Validation data sent, client should sit and wait
+					// for its ticket (or a closure)
+					if( m_nOwnerType == owner::client)
+					{
+						ReadTicket();
+					}
+				}
+				else
+				{					
+					m_socket.close();
+				}
+			});	
+		}
+
+		// ASYNC - Client presents its ticket instead of answering the challenge
+		void WriteResume()
+		{
+			m_resumeOut.nMagic = WireOrder(nResumeMagic);
+			m_resumeOut.ticket = WireOrder(m_ticket);
+			m_resumeOut.nFeatures = WireOrder(uint64_t(m_nFeaturesWanted));
+			// Asking for durable delivery, the last outbox sequence received follows
+			m_nAckedOut = WireOrder(m_pDurable ? m_pDurable->nContiguous : 0);
+			const std::array<asio::const_buffer, 2> buffers = {
+				asio::buffer(&m_resumeOut, sizeof(resume_request)),
+				asio::buffer(&m_nAckedOut, (m_nFeaturesWanted & nFeatureDurable) ? sizeof(uint64_t) : 0) };
+			AsyncWrite(
+				buffers,
+				[this](std::error_code ec, std::size_t /*length*/)
+			{
+				if(!ec)
+				{
+					// Optimistically start sending, if the server refuses the
+					// ticket it closes the socket and the client has to reconnect
+					// Asking for features means waiting for the ticket to see which it got
+					if(m_nFeaturesWanted == 0)
+					{
+						m_bValidated = true;
+						StartWriting();
+					}
+				}
+				else
+				{
+					m_socket.close();
+				}
+			});
+		}
+
+		// ASYNC - Server sends the ticket once the client is validated or resumed
+		void WriteTicket()
+		{
+			// A durable client is told the oldest outbox sequence it can still get
+			m_ticketOut = WireOrder(m_ticket);
+			m_nFirstSeqWire = WireOrder(m_nFirstSeq);
+			const std::array<asio::const_buffer, 2> buffers = {
+				asio::buffer(&m_ticketOut, sizeof(session_ticket)),
+				asio::buffer(&m_nFirstSeqWire, (m_nFeatures & nFeatureDurable) ? sizeof(uint64_t) : 0) };
+			AsyncWrite(
+				buffers,
+				[this](std::error_code ec, std::size_t /*length*/)
+			{
+				if(!ec)
+				{
+					m_bValidated = true;
+					StartWriting();
+				}
+				else
+				{
+					m_socket.close();
+				}
+			});
+		}
+
+		// ASYNC - Client reads its (new) ticket, after that normal frames follow
+		void ReadTicket()
+		{
+			AsyncRead(
+				asio::buffer(&m_ticketIn, sizeof(session_ticket)),
+				[this](std::error_code ec, std::size_t /*length*/)
+			{
+				if(!ec)
+				{
+					// The server's outbox starts over with a new session
+					if(m_pDurable && m_ticket.nToken == 0)
+					{
+						m_pDurable->Reset();
+					}
+
+					m_ticket = WireOrder(m_ticketIn);
+					m_nFeatures = m_ticket.nFeatures & m_nFeaturesWanted;
+					m_id = m_ticket.nID;
+					if(m_nFeatures & nFeatureDurable)
+					{
+						ReadFirstSeq();
+						return;
+					}
+					m_bValidated = true;
+					StartWriting();
+					ReadHeader();
+				}
+				else
+				{
+					// A refused ticket ends up here, forget it so the next connect
+					// goes through the challenge
+					NET_LOG_INFO("Client Disconnected (ReadTicket)");
+					m_ticket = {};
+					m_socket.close();
+				}
+			});
+		}
+
+		// ASYNC - Client reads the oldest outbox sequence following a durable ticket
+		void ReadFirstSeq()
+		{
+			AsyncRead(
+				asio::buffer(&m_nFirstSeqWire, sizeof(uint64_t)),
+				[this](std::error_code ec, std::size_t /*length*/)
+			{
+				if(!ec)
+				{
+					// What went before it is gone, waiting for it would hold the cursor back
+					if(m_pDurable)
+					{
+						m_pDurable->Skip(WireOrder(m_nFirstSeqWire));
+					}
+					m_bValidated = true;
+					StartWriting();
+					ReadHeader();
+				}
+				else
+				{
+					NET_LOG_INFO("Client Disconnected (ReadFirstSeq)");
+					m_socket.close();
+				}
+			});
+		}
+
+		// ASYNC - Server reads the ticket following the resume magic
+		void ReadResume(net::server_interface<T>* server)
+		{
+			AsyncRead(
+				asio::buffer(&m_ticketIn, sizeof(session_ticket)),
+				[this, server](std::error_code ec, std::size_t /*length*/)
+			{
+				if(!ec)
+				{
+					ReadFeatures(server, true);
+				}
+				else
+				{
+					NET_LOG_INFO("Client Disconnected (Fail Resume)");
+					m_socket.close();
+				}
+			});
+		}
+
+		// ASYNC - Server reads the features the client asks for, then issues its ticket
+		// or renews the one it presented
+		void ReadFeatures(net::server_interface<T>* server, bool bResume)
+		{
+			AsyncRead(
+				asio::buffer(&m_nFeaturesIn, sizeof(uint64_t)),
+				[this, server, bResume](std::error_code ec, std::size_t /*length*/)
+			{
+				if(ec)
+				{
+					NET_LOG_INFO("Client Disconnected (ReadFeatures)");
+					m_socket.close();
+					return;
+				}
+
+				const uint32_t nAsked = uint32_t(WireOrder(m_nFeaturesIn));
+				m_nFeatures = nAsked & m_nFeaturesWanted;
+				if(bResume && (nAsked & nFeatureDurable))
+				{
+					ReadAcked(server);
+				}
+				else
+				{
+					Admit(server, bResume, 0);
+				}
+			});
+		}
+
+		// ASYNC - Server reads the last outbox sequence a resuming durable client got
+		void ReadAcked(net::server_interface<T>* server)
+		{
+			AsyncRead(
+				asio::buffer(&m_nAckedIn, sizeof(uint64_t)),
+				[this, server](std::error_code ec, std::size_t /*length*/)
+			{
+				if(ec)
+				{
+					NET_LOG_INFO("Client Disconnected (ReadAcked)");
+					m_socket.close();
+					return;
+				}
+				Admit(server, true, WireOrder(m_nAckedIn));
+			});
+		}
+
+		// Server side end of the handshake, issues the client its ticket or renews the
+		// one it presented, then sends what its outbox holds after nAcked
+		void Admit(net::server_interface<T>* server, bool bResume, uint64_t nAcked)
+		{
+			if(bResume)
+			{
+				if(!server->ResumeSession(this->shared_from_this(), WireOrder(m_ticketIn), m_ticket))
+				{
+					NET_LOG_INFO("Client Disconnected (Fail Resume)");
+					m_socket.close();
+					return;
+				}
+				m_id = m_ticket.nID;
+				NET_LOG_INFO("[", m_id, "] Client Resumed");
+			}
+			else
+			{
+				// Client has provited valid solution
+				NET_LOG_INFO("Client Validated");
+				m_ticket = server->IssueSession(this->shared_from_this());
+			}
+
+			// Queued now and written once the ticket is, as is anything the handlers
+			// below send
+			m_nFirstSeq = server->AdmitSession(this->shared_from_this(), bResume, nAcked);
+
+			if(bResume)
+			{
+				server->OnClientResumed(this->shared_from_this());
+			}
+			else
+			{
+				server->OnClientValidated(this->shared_from_this());
+			}
+
+			// Hand over the ticket, then sit and wait to receive data
+			m_ticket.nFeatures = m_nFeatures;
+			WriteTicket();
+			ReadHeader();
+		}
+
+		void ReadValidation( net::server_interface<T>* server = nullptr)
+		{
+			// read the bites of data into handshakeIn
+			AsyncRead(
+				asio::buffer(&m_nHandshakeIn, sizeof(uint64_t)),
+				[this, server](std::error_code ec, std::size_t /*lenght*/)
+			{
+				if(!ec)
+				{
+					m_nHandshakeIn = WireOrder(m_nHandshakeIn);
+					if( m_nOwnerType == owner::server)
+					{
+						if(m_nHandshakeIn == m_nHandshakeCheck)
+						{
+							// The features it asks for follow the answer
+							ReadFeatures(server, false);
+						}
+						else if(m_nHandshakeIn == nResumeMagic)
+						{
+							// Reconnecting client, its ticket follows
+							ReadResume(server);
+						}
+						else
+						{
+							// Client gave incorrect data, so disconnect
+							// Can add client to ban list or counter in the future
+							NET_LOG_WARN("Client Disconnected (Fail Validation)");
+							m_socket.close();						
+						}
+					}
+					else if(m_ticket.nToken != 0)
+					{
+						// Already presented a ticket, the challenge is not needed
+						ReadTicket();
+					}
+					else
+					{
+						// Connection is client, solve puzzle
+						m_nHandshakeOut = WireOrder(scramble(m_nHandshakeIn));
+						// Write the result
+						WriteValidation();
+					}
+				}
+				else
+				{
+					NET_LOG_INFO("Client Disconnected (ReadValidation)");
+					m_socket.close();
+				}
+			});	
+		}
+
+	protected:
+		// Responsible for ASIO
+		// Each connection has a unique socket to a remote
+		asio::ip::tcp::socket m_socket;
+
+		// Context shared with thew whole asio instance(server will have multiple connections)
+		asio::io_context& m_asioContext;
+
+		// Message waiting to be written, nFrameFlags is non zero for frames the
+		// connection generates itself (stream chunks, credit grants)
+		struct outbound
+		{
+			message<T> msg;
+			uint32_t nFrameFlags = 0;
+			// Frame size fixed when its first frame is planned, 0 until then, so a new
+			// chunk size cannot change how a message already under way is split
+			uint32_t nChunk = 0;
+			// Outbox sequence, sent after the body when nFeatureDurable is agreed
+			uint64_t nSeq = 0;
+			// Set for outbox records (SendMapped), the body is in the mapping and not in msg
+			std::shared_ptr<const outbox_segment> pSegment = nullptr;
+			const uint8_t* pMapped = nullptr;
+			uint32_t nMapped = 0;
+
+			const uint8_t* Data() const
+			{
+				return pSegment ? pMapped : msg.body.data();
+			}
+
+			size_t Size() const
+			{
+				return pSegment ? nMapped : msg.body.size();
+			}
+		};
+
+		struct outbound_stream
+		{
+			T id;
+			uint64_t nSize;
+			uint64_t nQueued;
+			std::function<size_t(uint8_t*, size_t)> fnRead;
+			priority ePriority;
+		};
+
+		// Queues hold all messages to be send to remote side of this connection,
+		// one per priority, only touched from the asio context
+		std::array<std::deque<outbound>, nPriorityLanes> m_qLanesOut;
+		// Bytes of each lane's front message already written
+		std::array<size_t, nPriorityLanes> m_nLaneOffset{};
+		// Weighted round robin state, index 0 (control) is not weighted
+		std::array<uint32_t, nPriorityLanes> m_nLaneWeight{ 0, 8, 4, 1 };
+		std::array<int32_t, nPriorityLanes> m_nLaneCurrent{};
+		uint32_t m_nChunkSize = 64 * 1024;
+		bool m_bWritingMessage = false;
+		// Hold lane frames back until Flush, the control lane still goes straight out
+		bool m_bCorked = false;
+		// Size of the messages in the lanes, stream chunks and credit grants not included
+		std::atomic<size_t> m_nQueuedBytesOut = 0;
+		// Frames of the write in flight, headers may differ from the message header when chunked
+		struct frame_out
+		{
+			const outbound& out;
+			size_t nLane;
+			size_t nOffset;
+			uint32_t nLength;
+			message_header<T> hdr;
+			wire_header wire;
+			// Header as sent when compact headers are agreed on, the CRC still covers wire
+			std::array<uint8_t, compact_header::nMaxSize> compact;
+			uint8_t nCompact;
+			bool bCall;
+			uint32_t nCallWire;
+			bool bSeq;
+			uint64_t nSeqWire;
+			uint32_t nCrcWire;
+		};
+		static constexpr size_t nMaxBatchFrames = 32;
+		std::vector<frame_out> m_vFramesOut;
+		std::vector<asio::const_buffer> m_vBuffersOut;
+
+		// Outgoing streams, only the front one is producing chunks
+		std::deque<outbound_stream> m_deqStreamsOut;
+		// Stream bytes the remote is still willing to receive
+		uint32_t m_nStreamCredit = nStreamWindow;
 
 		// This queue hold all messages that have been received from the remote side
 		// of this connection, It isa reference as the 'owner' of this connection is
@@ -340,14 +1993,98 @@ namespace net
 		tsqueue<owned_message<T>>& m_qMessagesIn;
 
 		message<T> m_msgTemporaryIn;
+		// Header of the frame being read, as it came off the wire
+		wire_header m_hdrIn{};
+		// Compact header of the frame being read, decoded into m_hdrIn once whole
+		std::array<uint8_t, compact_header::nDecodeSize> m_compactIn{};
+		size_t m_nCompactIn = 0;
+		// Fragmented messages being received, one per sending lane
+		std::array<message<T>, nPriorityLanes> m_msgReassembly;
+		// Whether the frame being read is a stream chunk
+		stream_part m_eStreamIn = stream_part::none;
+		// Stream bytes received but not yet handed back as credit
+		uint32_t m_nStreamBytesIn = 0;
+		uint32_t m_nCreditIn = 0;
+		// CRC trailing the frame being read
+		uint32_t m_nCrcIn = 0;
+		uint32_t m_nMaxBufferedBytes = 64 * 1024 * 1024;
+
+		// Optional traffic recording, shared by every connection of the owner
+		std::shared_ptr<capture_log> m_pCapture;
 		// "Owner" dices how some of the connection behaves
 		owner m_nOwnerType = owner::server;
 		uint32_t m_id = 0;
 
-		// Handshake Validation
+		// Handshake Validation, Out is kept in wire order ready to write
 		uint64_t m_nHandshakeOut = 0;
 		uint64_t m_nHandshakeIn = 0;
 		uint64_t m_nHandshakeCheck = 0;
+		// Nothing but handshake data is written until this is set
+		bool m_bValidated = false;
+
+		// Session resumption
+		struct resume_request
+		{
+			uint64_t nMagic;
+			session_ticket ticket;
+			uint64_t nFeatures;
+		};
+		resume_request m_resumeOut{};
+		session_ticket m_ticket{};
+		session_ticket m_ticketIn{};
+		session_ticket m_ticketOut{};
+
+		// Frame features asked for (client) or allowed (server), and those agreed on
+		uint32_t m_nFeaturesWanted = 0;
+		uint32_t m_nFeatures = 0;
+		busy_poll m_busyPoll;
+		uint64_t m_nFeaturesOut = 0;
+		uint64_t m_nFeaturesIn = 0;
+		// Durable delivery, the client's record of what it received is its owner's
+		durable_cursor* m_pDurable = nullptr;
+		uint64_t m_nAckedOut = 0;
+		uint64_t m_nAckedIn = 0;
+		uint64_t m_nFirstSeq = 0;
+		uint64_t m_nFirstSeqWire = 0;
+		// Server side, the session is settled and Features final
+		std::atomic<bool> m_bAdmitted = false;
+		std::vector<std::pair<message<T>, priority>> m_vHeldBroadcasts;
+
+		// Calls waiting for a reply and the timer expiring them
+		call_table<T> m_calls;
+		asio::steady_timer m_timerCalls;
+		std::chrono::steady_clock::time_point m_tCallTimer;
+		bool m_bCallTimerSet = false;
+		// Whether the message being read ends in a call ID
+		bool m_bCallIn = false;
+
+		// Inbound rate limit, reading waits on the timer while over it
+		rate_limiter<T> m_rateIn;
+		asio::steady_timer m_timerRate;
+		bool m_bRatePaused = false;
+		std::atomic<uint64_t> m_nRatePauses = 0;
+
+		// Handoff to another process
+		bool m_bFreezing = false;
+		bool m_bReadParked = false;
+		// Bytes of the unfinished frame when the read was parked
+		std::vector<uint8_t> m_vPartialIn;
+		// Read before the socket, the unfinished frame of a previous owner
+		std::vector<uint8_t> m_vInboundPrefix;
+
+#ifdef NET_USE_TLS
+		// TLS settings, the streams exist once the socket is connected
+		// Declared after m_socket so they are destroyed before it
+		std::shared_ptr<asio::ssl::context> m_pTlsContext;
+		bool m_bKernelTls = false;
+		std::string m_sTlsHost;
+		std::string m_sTlsSessionKey;
+		tls_session_cache* m_pTlsSessions = nullptr;
+		std::unique_ptr<asio::ssl::stream<asio::ip::tcp::socket&>> m_pTls;
+		std::unique_ptr<ktls_stream> m_pKtls;
+		// Frame gathered into one buffer for a single TLS record
+		std::vector<uint8_t> m_vTlsWrite;
+#endif
 	};
 
 }
@@ -0,0 +1,240 @@
+#pragma once
+// CRC32C (Castagnoli), the checksum frames carry when both ends agree to it
+// SSE4.2 has an instruction for it, with PCLMUL large buffers run as three
+// interleaved streams joined at the end. Otherwise a slicing by 8 table
+// On x86-64 the instructions are used whenever the CPU has them, whatever the
+// build targets, the table would cost a third of the throughput
+
+#include "net_common.h"
+#include "net_wire.h"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <nmmintrin.h>
+#include <wmmintrin.h>
+#define NET_CRC_X86
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define NET_CRC_TARGET
+#else
+#define NET_CRC_TARGET __attribute__((target("sse4.2,pclmul")))
+#endif
+#elif defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#define NET_CRC_ARM
+#endif
+
+namespace net
+{
+	// Reflected polynomial
+	constexpr uint32_t nCrc32cPoly = 0x82F63B78;
+
+	// a * b modulo the polynomial, bit 31 being x^0
+	inline uint32_t Crc32cMultiply(uint32_t a, uint32_t b)
+	{
+		uint32_t m = 1u << 31;
+		uint32_t p = 0;
+		for(;;)
+		{
+			if(a & m)
+			{
+				p ^= b;
+				if((a & (m - 1)) == 0)
+				{
+					break;
+				}
+			}
+			m >>= 1;
+			b = (b & 1) ? (b >> 1) ^ nCrc32cPoly : b >> 1;
+		}
+		return p;
+	}
+
+	// x^n modulo the polynomial
+	inline uint32_t Crc32cXPow(uint64_t n)
+	{
+		uint32_t p = 1u << 31;
+		uint32_t xSquared = 1u << 30;
+		while(n)
+		{
+			if(n & 1)
+			{
+				p = Crc32cMultiply(xSquared, p);
+			}
+			xSquared = Crc32cMultiply(xSquared, xSquared);
+			n >>= 1;
+		}
+		return p;
+	}
+
+#if defined(NET_CRC_X86)
+	// Whether this CPU has SSE4.2 and PCLMUL, checked once
+	inline bool Crc32cHardware()
+	{
+		static const bool bHardware = []()
+		{
+#if defined(_MSC_VER)
+			int nInfo[4];
+			__cpuid(nInfo, 1);
+			return (nInfo[2] & (1 << 20)) != 0 && (nInfo[2] & (1 << 1)) != 0;
+#else
+			return __builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("pclmul");
+#endif
+		}();
+		return bHardware;
+	}
+#endif
+
+	// Name of the implementation in use
+	inline const char* Crc32cKernel()
+	{
+#if defined(NET_CRC_X86)
+		return Crc32cHardware() ? "sse4.2 + pclmul" : "table";
+#elif defined(NET_CRC_ARM)
+		return "armv8 crc";
+#else
+		return "table";
+#endif
+	}
+
+	// Slicing by 8, eight bytes per step through eight tables
+	inline uint32_t Crc32cUpdateTable(uint32_t nState, const uint8_t* p, size_t n)
+	{
+		static const auto tables = []()
+		{
+			std::array<std::array<uint32_t, 256>, 8> t{};
+			for(uint32_t i = 0; i < 256; i++)
+			{
+				uint32_t c = i;
+				for(int k = 0; k < 8; k++)
+				{
+					c = (c & 1) ? (c >> 1) ^ nCrc32cPoly : c >> 1;
+				}
+				t[0][i] = c;
+			}
+			for(uint32_t i = 0; i < 256; i++)
+			{
+				for(size_t k = 1; k < 8; k++)
+				{
+					t[k][i] = (t[k - 1][i] >> 8) ^ t[0][t[k - 1][i] & 0xFF];
+				}
+			}
+			return t;
+		}();
+
+		while(n >= 8)
+		{
+			uint32_t lo, hi;
+			std::memcpy(&lo, p, 4);
+			std::memcpy(&hi, p + 4, 4);
+#ifdef NET_BIG_ENDIAN
+			lo = ByteSwap(lo);
+			hi = ByteSwap(hi);
+#endif
+			lo ^= nState;
+			nState = tables[7][lo & 0xFF] ^ tables[6][(lo >> 8) & 0xFF] ^ tables[5][(lo >> 16) & 0xFF] ^ tables[4][lo >> 24] ^
+				tables[3][hi & 0xFF] ^ tables[2][(hi >> 8) & 0xFF] ^ tables[1][(hi >> 16) & 0xFF] ^ tables[0][hi >> 24];
+			p += 8;
+			n -= 8;
+		}
+		while(n--)
+		{
+			nState = (nState >> 8) ^ tables[0][(nState ^ *p++) & 0xFF];
+		}
+		return nState;
+	}
+
+#if defined(NET_CRC_X86)
+	NET_CRC_TARGET inline uint32_t Crc32cUpdateHw(uint32_t nState, const uint8_t* p, size_t n)
+	{
+		uint64_t c = nState;
+		while(n >= 8)
+		{
+			uint64_t v;
+			std::memcpy(&v, p, 8);
+			c = _mm_crc32_u64(c, v);
+			p += 8;
+			n -= 8;
+		}
+		uint32_t c32 = uint32_t(c);
+		while(n--)
+		{
+			c32 = _mm_crc32_u8(c32, *p++);
+		}
+		return c32;
+	}
+#elif defined(NET_CRC_ARM)
+	inline uint32_t Crc32cUpdateHw(uint32_t nState, const uint8_t* p, size_t n)
+	{
+		while(n >= 8)
+		{
+			uint64_t v;
+			std::memcpy(&v, p, 8);
+			nState = __crc32cd(nState, v);
+			p += 8;
+			n -= 8;
+		}
+		while(n--)
+		{
+			nState = __crc32cb(nState, *p++);
+		}
+		return nState;
+	}
+#endif
+
+#if defined(NET_CRC_X86)
+	// One crc32 instruction waits on the last, three independent streams keep the
+	// unit busy. Each of nCrcFoldBlock bytes, the first two are then shifted past
+	// the blocks after them and folded in
+	constexpr size_t nCrcFoldBlock = 1024;
+
+	// nState times x^(8n) where k is x^(8n - 33)
+	NET_CRC_TARGET inline uint32_t Crc32cShift(uint32_t nState, uint32_t k)
+	{
+		const __m128i r = _mm_clmulepi64_si128(_mm_cvtsi32_si128(int(nState)), _mm_cvtsi32_si128(int(k)), 0);
+		return uint32_t(_mm_crc32_u64(0, uint64_t(_mm_cvtsi128_si64(r))));
+	}
+
+	NET_CRC_TARGET inline uint32_t Crc32cUpdateFold(uint32_t nState, const uint8_t* p, size_t n)
+	{
+		static const uint32_t kOne = Crc32cXPow(8 * nCrcFoldBlock - 33);
+		static const uint32_t kTwo = Crc32cXPow(8 * 2 * nCrcFoldBlock - 33);
+
+		while(n >= 3 * nCrcFoldBlock)
+		{
+			uint64_t c0 = nState, c1 = 0, c2 = 0;
+			for(size_t i = 0; i < nCrcFoldBlock; i += 8)
+			{
+				uint64_t v0, v1, v2;
+				std::memcpy(&v0, p + i, 8);
+				std::memcpy(&v1, p + nCrcFoldBlock + i, 8);
+				std::memcpy(&v2, p + 2 * nCrcFoldBlock + i, 8);
+				c0 = _mm_crc32_u64(c0, v0);
+				c1 = _mm_crc32_u64(c1, v1);
+				c2 = _mm_crc32_u64(c2, v2);
+			}
+			nState = Crc32cShift(uint32_t(c0), kTwo) ^ Crc32cShift(uint32_t(c1), kOne) ^ uint32_t(c2);
+			p += 3 * nCrcFoldBlock;
+			n -= 3 * nCrcFoldBlock;
+		}
+		return Crc32cUpdateHw(nState, p, n);
+	}
+#endif
+
+	// Running CRC, start from ~0 and finish with ~ (see Crc32c)
+	inline uint32_t Crc32cUpdate(uint32_t nState, const void* pData, size_t n)
+	{
+		const uint8_t* p = static_cast<const uint8_t*>(pData);
+#if defined(NET_CRC_X86)
+		return Crc32cHardware() ? Crc32cUpdateFold(nState, p, n) : Crc32cUpdateTable(nState, p, n);
+#elif defined(NET_CRC_ARM)
+		return Crc32cUpdateHw(nState, p, n);
+#else
+		return Crc32cUpdateTable(nState, p, n);
+#endif
+	}
+
+	inline uint32_t Crc32c(const void* pData, size_t n)
+	{
+		return ~Crc32cUpdate(~0u, pData, n);
+	}
+}
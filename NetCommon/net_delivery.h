@@ -0,0 +1,122 @@
+#pragma once
+// Inbound messages delivered into the application's own event loop
+// Rather than a thread blocked in Update, Update runs as work on an executor the
+// application gives (DeliverOn), or a descriptor becomes readable for an epoll
+// loop the application runs itself, which then calls Update (DeliveryNotifier)
+// Arrivals are coalesced, one wake covers everything queued until Update drains
+// The descriptor is an eventfd on Linux and a pipe on other POSIX systems
+
+#include "net_common.h"
+
+#ifdef __linux__
+#include <sys/eventfd.h>
+#include <unistd.h>
+#elif !defined(_WIN32)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace net
+{
+	class inbox_delivery
+	{
+	public:
+		inbox_delivery() = default;
+		inbox_delivery(const inbox_delivery&) = delete;
+
+		~inbox_delivery()
+		{
+#ifndef _WIN32
+			for(int nFd : m_nFd)
+			{
+				if(nFd >= 0)
+				{
+					close(nFd);
+				}
+			}
+#endif
+		}
+
+		// Post fnUpdate to ex whenever messages arrive
+		template<typename Executor>
+		void PostTo(const Executor& ex, std::function<void()> fnUpdate)
+		{
+			m_fnPost = [ex, fnUpdate = std::move(fnUpdate)]() { asio::post(ex, fnUpdate); };
+		}
+
+		// Descriptor readable while messages wait, -1 where there is none (Windows)
+		int Notifier()
+		{
+#ifdef __linux__
+			if(m_nFd[0] < 0)
+			{
+				m_nFd[0] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+			}
+#elif !defined(_WIN32)
+			if(m_nFd[0] < 0 && pipe(m_nFd) == 0)
+			{
+				for(int nFd : m_nFd)
+				{
+					fcntl(nFd, F_SETFL, fcntl(nFd, F_GETFL) | O_NONBLOCK);
+					fcntl(nFd, F_SETFD, FD_CLOEXEC);
+				}
+			}
+#endif
+			return m_nFd[0];
+		}
+
+		bool Active() const
+		{
+			return m_fnPost || m_nFd[0] >= 0;
+		}
+
+		// Something was queued, wakes the application unless a wake is still pending
+		void Wake()
+		{
+			if(m_bPending.exchange(true, std::memory_order_acq_rel))
+			{
+				return;
+			}
+
+			if(m_fnPost)
+			{
+				m_fnPost();
+			}
+#ifndef _WIN32
+			if(m_nFd[0] >= 0)
+			{
+#ifdef __linux__
+				const uint64_t nOne = 1;
+				[[maybe_unused]] ssize_t n = write(m_nFd[0], &nOne, sizeof(nOne));
+#else
+				const uint8_t nOne = 1;
+				[[maybe_unused]] ssize_t n = write(m_nFd[1], &nOne, sizeof(nOne));
+#endif
+			}
+#endif
+		}
+
+		// Update is about to drain the inbox, anything queued from here on wakes again
+		// The descriptor is emptied first, a Wake landing in between then still
+		// leaves it readable rather than have its count swallowed
+		void Rearm()
+		{
+#ifndef _WIN32
+			if(m_nFd[0] >= 0)
+			{
+				uint64_t nCount;
+				while(read(m_nFd[0], &nCount, sizeof(nCount)) > 0)
+				{
+				}
+			}
+#endif
+			m_bPending.store(false, std::memory_order_seq_cst);
+		}
+
+	private:
+		std::function<void()> m_fnPost;
+		// eventfd in [0] on Linux, the read and write ends of a pipe elsewhere
+		int m_nFd[2] = { -1, -1 };
+		std::atomic<bool> m_bPending = false;
+	};
+}
@@ -0,0 +1,136 @@
+#pragma once
+// Per message id handler registry
+// replaces the hand written switch(msg.header.id) in OnMessage
+
+#include "net_common.h"
+#include "net_message.h"
+
+namespace net
+{
+	// Number of slots in the dispatch table for message type T
+	// If the enum declares a trailing 'Count' enumerator the table is sized exactly,
+	// otherwise the first 256 ids can be registered
+	template<typename T, typename = void>
+	struct message_id_count
+	{
+		static constexpr size_t value = 256;
+	};
+
+	template<typename T>
+	struct message_id_count<T, std::void_t<decltype(T::Count)>>
+	{
+		static constexpr size_t value = size_t(T::Count);
+	};
+
+	enum class dispatch_result
+	{
+		handled,
+		unhandled,	// no handler registered for this id
+		bad_size	// handler expects a fixed payload and body size does not match
+	};
+
+	// Args are the leading handler arguments, server passes the remote connection,
+	// client passes nothing
+	template<typename T, typename... Args>
+	class message_dispatcher
+	{
+	public:
+		using handler = std::function<void(Args..., message<T>&)>;
+
+		static constexpr size_t nTableSize = message_id_count<T>::value;
+
+		// Body size for handlers that accept any payload
+		static constexpr uint32_t nAnySize = UINT32_MAX;
+
+	public:
+		// Raw handler, receives the whole message
+		void Register(T id, handler fn)
+		{
+			Set(id, std::move(fn), nAnySize);
+		}
+
+		// Typed handler, the body must hold exactly one Payload which is decoded
+		// before the handler runs: fn(Args..., const Payload&)
+		// Handlers answering a Call also take the request: fn(Args..., message<T>&, const Payload&)
+		// Scalars are decoded from wire order as operator>> does, structs are copied
+		// as they are, so their layout and byte order are those of the host
+		template<typename Payload, typename Fn>
+		void Register(T id, Fn fn)
+		{
+			// Same requirement as message<T>::operator<<
+			static_assert(std::is_standard_layout<Payload>::value, "Payload is too complex to be decoded from message");
+
+			Set(id, [fn = std::move(fn)](Args... args, message<T>& msg)
+				{
+					Payload payload;
+					if constexpr(bWireScalar<Payload>)
+					{
+						CopyFromWire(&payload, msg.body.data(), 1);
+					}
+					else
+					{
+						std::memcpy(&payload, msg.body.data(), sizeof(Payload));
+					}
+					if constexpr(std::is_invocable_v<Fn&, Args..., message<T>&, const Payload&>)
+					{
+						fn(args..., msg, payload);
+					}
+					else
+					{
+						fn(args..., payload);
+					}
+				}, uint32_t(sizeof(Payload)));
+		}
+
+		void Unregister(T id)
+		{
+			Set(id, nullptr, nAnySize);
+		}
+
+		// Single indexed lookup, size is validated before the handler is invoked
+		dispatch_result Dispatch(Args... args, message<T>& msg) const
+		{
+			const size_t nIndex = Index(msg.header.id);
+			if(nIndex >= nTableSize || !m_table[nIndex].fn)
+			{
+				return dispatch_result::unhandled;
+			}
+
+			const entry& e = m_table[nIndex];
+			if(e.nSize != nAnySize && msg.body.size() != e.nSize)
+			{
+				return dispatch_result::bad_size;
+			}
+
+			e.fn(args..., msg);
+			return dispatch_result::handled;
+		}
+
+	private:
+		static constexpr size_t Index(T id)
+		{
+			return size_t(static_cast<std::underlying_type_t<T>>(id));
+		}
+
+		void Set(T id, handler fn, uint32_t nSize)
+		{
+			const size_t nIndex = Index(id);
+			if(nIndex >= nTableSize)
+			{
+				throw std::out_of_range("message id outside of dispatch table");
+			}
+
+			m_table[nIndex] = { std::move(fn), nSize };
+		}
+
+	private:
+		struct entry
+		{
+			handler fn;
+			uint32_t nSize = nAnySize;
+		};
+
+		// Dense table indexed by the underlying enum value
+		std::array<entry, nTableSize> m_table{};
+	};
+}
@@ -1,8 +1,10 @@
 #pragma once
 
 #include "net_common.h"
+#include "net_log.h"
 #include "net_tsqueue.h"
 #include "net_message.h"
 #include "net_client.h"
 #include "net_server.h"
-#include "net_connection.h"
\ No newline at end of file
+#include "net_connection.h"
+#include "net_client_pool.h"
\ No newline at end of file
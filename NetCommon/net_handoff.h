@@ -0,0 +1,216 @@
+#pragma once
+// Zero downtime restart
+// A running server hands its listening socket and its validated connections to
+// a newer process over a Unix socket, descriptors travel as SCM_RIGHTS and the
+// connection state (ID, ticket, queued output, partly read frames) as bytes
+// Passing descriptors is POSIX only, handoff_buffer is portable
+
+#include "net_common.h"
+#include "net_message.h"
+
+#ifndef _WIN32
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+namespace net
+{
+	// Flat byte buffer for the state carried across, both processes run the
+	// same build so values are copied as they are in memory
+	class handoff_buffer
+	{
+	public:
+		template<typename P>
+		void Put(const P& value)
+		{
+			static_assert(std::is_trivially_copyable<P>::value, "Value cannot be copied into a handoff buffer");
+			const uint8_t* p = reinterpret_cast<const uint8_t*>(&value);
+			m_vData.insert(m_vData.end(), p, p + sizeof(P));
+		}
+
+		void PutBytes(const uint8_t* pData, size_t nSize)
+		{
+			Put(uint64_t(nSize));
+			m_vData.insert(m_vData.end(), pData, pData + nSize);
+		}
+
+		void PutBytes(const std::vector<uint8_t>& v)
+		{
+			PutBytes(v.data(), v.size());
+		}
+
+		template<typename T>
+		void PutMessage(const message<T>& msg)
+		{
+			Put(msg.header);
+			Put(msg.nCall);
+			PutBytes(msg.body);
+		}
+
+		// Gets fail once the buffer runs out, the value is left untouched
+		template<typename P>
+		bool Get(P& value)
+		{
+			static_assert(std::is_trivially_copyable<P>::value, "Value cannot be copied out of a handoff buffer");
+			if(m_nRead + sizeof(P) > m_vData.size())
+			{
+				return false;
+			}
+			std::memcpy(&value, m_vData.data() + m_nRead, sizeof(P));
+			m_nRead += sizeof(P);
+			return true;
+		}
+
+		bool GetBytes(std::vector<uint8_t>& v)
+		{
+			uint64_t nSize = 0;
+			if(!Get(nSize) || m_nRead + nSize > m_vData.size())
+			{
+				return false;
+			}
+			v.assign(m_vData.begin() + m_nRead, m_vData.begin() + m_nRead + size_t(nSize));
+			m_nRead += size_t(nSize);
+			return true;
+		}
+
+		template<typename T>
+		bool GetMessage(message<T>& msg)
+		{
+			return Get(msg.header) && Get(msg.nCall) && GetBytes(msg.body);
+		}
+
+		std::vector<uint8_t>& data()
+		{
+			return m_vData;
+		}
+
+		const std::vector<uint8_t>& data() const
+		{
+			return m_vData;
+		}
+
+		void clear()
+		{
+			m_vData.clear();
+			m_nRead = 0;
+		}
+
+	private:
+		std::vector<uint8_t> m_vData;
+		size_t m_nRead = 0;
+	};
+
+#ifndef _WIN32
+	// Start of every unit on the handoff socket, the descriptors ride with it
+	struct handoff_frame
+	{
+		uint64_t nSize;
+		uint32_t nDescriptors;
+		uint32_t nReserved;
+	};
+
+	constexpr uint32_t nHandoffMaxDescriptors = 16;
+
+	// Blocking, write one buffer with descriptors attached, the sender keeps its copies
+	inline bool SendHandoff(int nSocket, const handoff_buffer& payload, const std::vector<int>& vDescriptors)
+	{
+		if(vDescriptors.size() > nHandoffMaxDescriptors)
+		{
+			return false;
+		}
+
+		handoff_frame frame{ payload.data().size(), uint32_t(vDescriptors.size()), 0 };
+
+		iovec iov{ &frame, sizeof(frame) };
+		msghdr msg{};
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+
+		alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int) * nHandoffMaxDescriptors)];
+		if(!vDescriptors.empty())
+		{
+			msg.msg_control = control;
+			msg.msg_controllen = CMSG_SPACE(sizeof(int) * vDescriptors.size());
+			cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+			cmsg->cmsg_level = SOL_SOCKET;
+			cmsg->cmsg_type = SCM_RIGHTS;
+			cmsg->cmsg_len = CMSG_LEN(sizeof(int) * vDescriptors.size());
+			std::memcpy(CMSG_DATA(cmsg), vDescriptors.data(), sizeof(int) * vDescriptors.size());
+		}
+
+		// The frame header is tiny, a short write here means the socket is broken
+		if(::sendmsg(nSocket, &msg, 0) != ssize_t(sizeof(frame)))
+		{
+			return false;
+		}
+
+		size_t nSent = 0;
+		while(nSent < payload.data().size())
+		{
+			const ssize_t n = ::send(nSocket, payload.data().data() + nSent, payload.data().size() - nSent, 0);
+			if(n <= 0)
+			{
+				return false;
+			}
+			nSent += size_t(n);
+		}
+		return true;
+	}
+
+	// Blocking, read one unit, received descriptors are owned by the caller
+	inline bool ReceiveHandoff(int nSocket, handoff_buffer& payload, std::vector<int>& vDescriptors)
+	{
+		handoff_frame frame{};
+		alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int) * nHandoffMaxDescriptors)];
+
+		iovec iov{ &frame, sizeof(frame) };
+		msghdr msg{};
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+
+		if(::recvmsg(nSocket, &msg, MSG_WAITALL) != ssize_t(sizeof(frame)))
+		{
+			return false;
+		}
+
+		vDescriptors.clear();
+		for(cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg, cmsg))
+		{
+			if(cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+			{
+				const size_t nCount = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+				const size_t nFirst = vDescriptors.size();
+				vDescriptors.resize(nFirst + nCount);
+				std::memcpy(vDescriptors.data() + nFirst, CMSG_DATA(cmsg), sizeof(int) * nCount);
+			}
+		}
+
+		payload.clear();
+		payload.data().resize(size_t(frame.nSize));
+		size_t nRead = 0;
+		while(nRead < payload.data().size())
+		{
+			const ssize_t n = ::recv(nSocket, payload.data().data() + nRead, payload.data().size() - nRead, 0);
+			if(n <= 0)
+			{
+				break;
+			}
+			nRead += size_t(n);
+		}
+
+		if(nRead < payload.data().size() || vDescriptors.size() != frame.nDescriptors)
+		{
+			for(int fd : vDescriptors)
+			{
+				::close(fd);
+			}
+			vDescriptors.clear();
+			return false;
+		}
+		return true;
+	}
+#endif
+}
@@ -0,0 +1,360 @@
+#pragma once
+// Userspace stand-in for a WAN link between clients and a server on one box
+// impairment_proxy accepts TCP connections, connects each to the real server and
+// forwards both ways through a simulated link: latency with jitter, a bandwidth
+// cap, lost and reordered segments. Over TCP the application never sees a loss or
+// a reordering, only the stall: a lost segment arrives a retransmission timeout
+// late, a reordered one a little late, and nothing behind either is delivered
+// before it
+
+#include "net_common.h"
+#include "net_log.h"
+
+namespace net
+{
+	// The link in one direction, both directions get the same
+	struct impairment
+	{
+		std::chrono::microseconds latency{ 0 };			// one way
+		std::chrono::microseconds jitter{ 0 };			// each segment up to this much earlier or later
+		double dBytesPerSecond = 0.0;					// 0 for no cap
+		double dLoss = 0.0;								// fraction of segments lost
+		double dReorder = 0.0;							// fraction of segments overtaken by later ones
+		std::chrono::microseconds retransmit{ 200000 };	// what a loss costs, Linux's minimum RTO
+		std::chrono::microseconds reorder{ 2000 };		// how far behind a reordered segment is
+		size_t nSegment = 1448;							// payload of one packet
+		size_t nQueue = 64 * 1024;						// bytes the bottleneck holds waiting for the cap
+		size_t nWindow = 4 * 1024 * 1024;				// bytes in flight at most, the receive window
+	};
+
+	class impairment_proxy
+	{
+	public:
+		// Socket receive buffer of the proxy's sockets, small so data waits in the link
+		static constexpr size_t nReceiveBuffer = 64 * 1024;
+
+		// Listens on nPort, every connection is forwarded to sHost:nTargetPort
+		impairment_proxy(uint16_t nPort, const std::string& sHost, uint16_t nTargetPort, const impairment& link, uint32_t nSeed = 1)
+			: m_acceptor(m_context), m_nPort(nPort), m_sHost(sHost), m_nTargetPort(nTargetPort), m_link(link), m_rng(nSeed)
+		{
+		}
+
+		impairment_proxy(const impairment_proxy&) = delete;
+
+		virtual ~impairment_proxy()
+		{
+			Stop();
+		}
+
+		bool Start()
+		{
+			try
+			{
+				asio::ip::tcp::resolver resolver(m_context);
+				m_target = *resolver.resolve(m_sHost, std::to_string(m_nTargetPort)).begin();
+
+				const asio::ip::tcp::endpoint endpoint(asio::ip::tcp::v4(), m_nPort);
+				m_acceptor.open(endpoint.protocol());
+				m_acceptor.set_option(asio::ip::tcp::acceptor::reuse_address(true));
+				m_acceptor.bind(endpoint);
+				m_acceptor.listen();
+
+				Accept();
+				m_thread = std::thread([this]() { m_context.run(); });
+			}
+			catch(std::exception& e)
+			{
+				NET_LOG_ERROR("[PROXY] Exception: ", e.what());
+				return false;
+			}
+			return true;
+		}
+
+		void Stop()
+		{
+			m_context.stop();
+			if(m_thread.joinable())
+			{
+				m_thread.join();
+			}
+		}
+
+		// Applies to data read from now on, what is in flight keeps its timing
+		void SetImpairment(const impairment& link)
+		{
+			asio::post(m_context, [this, link]() { m_link = link; });
+		}
+
+		uint64_t Segments() const
+		{
+			return m_nSegments;
+		}
+
+		uint64_t Lost() const
+		{
+			return m_nLost;
+		}
+
+		uint64_t Reordered() const
+		{
+			return m_nReordered;
+		}
+
+	private:
+		using clock = std::chrono::steady_clock;
+
+		// One direction of a session, read from src and written to dst on schedule
+		struct pipe
+		{
+			pipe(asio::io_context& context, asio::ip::tcp::socket& src, asio::ip::tcp::socket& dst)
+				: src(src), dst(dst), timer(context), timerRead(context)
+			{
+			}
+
+			struct segment
+			{
+				clock::time_point tDeliver;
+				std::vector<uint8_t> data;
+			};
+
+			asio::ip::tcp::socket& src;
+			asio::ip::tcp::socket& dst;
+			asio::steady_timer timer;
+			asio::steady_timer timerRead;
+			std::array<uint8_t, 64 * 1024> buffer;
+			std::deque<segment> deqInFlight;
+			std::vector<uint8_t> vWrite;
+			size_t nInFlight = 0;
+			clock::time_point tLinkFree{};
+			clock::time_point tLastDeliver{};
+			bool bReading = false;
+			bool bWriting = false;
+			bool bEnded = false;
+		};
+
+		struct session
+		{
+			session(asio::io_context& context, asio::ip::tcp::socket socket)
+				: client(std::move(socket)), server(context), up(context, client, server), down(context, server, client)
+			{
+			}
+
+			void Close()
+			{
+				asio::error_code ec;
+				client.close(ec);
+				server.close(ec);
+				up.timer.cancel();
+				up.timerRead.cancel();
+				down.timer.cancel();
+				down.timerRead.cancel();
+			}
+
+			asio::ip::tcp::socket client;
+			asio::ip::tcp::socket server;
+			pipe up;
+			pipe down;
+		};
+
+		void Accept()
+		{
+			m_acceptor.async_accept(
+				[this](std::error_code ec, asio::ip::tcp::socket socket)
+				{
+					if(!ec)
+					{
+						auto s = std::make_shared<session>(m_context, std::move(socket));
+						s->server.async_connect(m_target,
+							[this, s](std::error_code ec)
+							{
+								if(ec)
+								{
+									NET_LOG_WARN("[PROXY] Connect Fail: ", ec.message());
+									s->Close();
+									return;
+								}
+
+								// The link decides when bytes leave, not Nagle, and what queues up
+								// is the link's, not the kernel's
+								asio::error_code ecOption;
+								for(auto* sock : { &s->client, &s->server })
+								{
+									sock->set_option(asio::ip::tcp::no_delay(true), ecOption);
+									sock->set_option(asio::socket_base::receive_buffer_size(int(nReceiveBuffer)), ecOption);
+								}
+								Read(s, s->up);
+								Read(s, s->down);
+							});
+					}
+					Accept();
+				});
+		}
+
+		// Read while less than a window is in flight and the bottleneck queue has room,
+		// writes resume reading as they drain, the link as it catches up
+		void Read(std::shared_ptr<session> s, pipe& p)
+		{
+			if(p.bReading || p.bEnded || p.nInFlight >= m_link.nWindow)
+			{
+				return;
+			}
+
+			if(m_link.dBytesPerSecond > 0.0)
+			{
+				const auto tQueue = std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(double(m_link.nQueue) / m_link.dBytesPerSecond));
+				if(p.tLinkFree - tQueue > clock::now())
+				{
+					p.bReading = true;
+					p.timerRead.expires_at(p.tLinkFree - tQueue);
+					p.timerRead.async_wait(
+						[this, s, &p](std::error_code ec)
+						{
+							p.bReading = false;
+							if(!ec)
+							{
+								Read(s, p);
+							}
+						});
+					return;
+				}
+			}
+
+			p.bReading = true;
+			p.src.async_read_some(asio::buffer(p.buffer),
+				[this, s, &p](std::error_code ec, std::size_t length)
+				{
+					p.bReading = false;
+					if(ec)
+					{
+						if(ec != asio::error::eof)
+						{
+							s->Close();
+							return;
+						}
+
+						// Pass the end on once everything before it is delivered
+						p.bEnded = true;
+						Schedule(s, p);
+						return;
+					}
+
+					Send(p, length);
+					Schedule(s, p);
+					Read(s, p);
+				});
+		}
+
+		// Cut what was read into segments and work out when each comes out of the link
+		void Send(pipe& p, size_t nLength)
+		{
+			const clock::time_point tNow = clock::now();
+			for(size_t nOffset = 0; nOffset < nLength; nOffset += m_link.nSegment)
+			{
+				const size_t nBytes = std::min(m_link.nSegment, nLength - nOffset);
+
+				// Serialised onto the link behind what is already going out
+				clock::time_point tSent = std::max(tNow, p.tLinkFree);
+				if(m_link.dBytesPerSecond > 0.0)
+				{
+					tSent += std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(double(nBytes) / m_link.dBytesPerSecond));
+				}
+				p.tLinkFree = tSent;
+
+				clock::time_point tArrive = tSent + m_link.latency;
+				if(m_link.jitter.count() > 0)
+				{
+					std::uniform_int_distribution<int64_t> jitter(-m_link.jitter.count(), m_link.jitter.count());
+					tArrive = std::max(tSent, tArrive + std::chrono::microseconds(jitter(m_rng)));
+				}
+
+				std::uniform_real_distribution<double> chance(0.0, 1.0);
+				if(m_link.dLoss > 0.0 && chance(m_rng) < m_link.dLoss)
+				{
+					tArrive += m_link.retransmit;
+					m_nLost++;
+				}
+				else if(m_link.dReorder > 0.0 && chance(m_rng) < m_link.dReorder)
+				{
+					tArrive += m_link.reorder;
+					m_nReordered++;
+				}
+
+				// TCP hands bytes over in order, later segments wait for earlier ones
+				p.tLastDeliver = std::max(p.tLastDeliver, tArrive);
+				p.deqInFlight.push_back({ p.tLastDeliver, std::vector<uint8_t>(p.buffer.begin() + nOffset, p.buffer.begin() + nOffset + nBytes) });
+				p.nInFlight += nBytes;
+				m_nSegments++;
+			}
+		}
+
+		// Write segments as they come due, all that are due in one write
+		void Schedule(std::shared_ptr<session> s, pipe& p)
+		{
+			if(p.bWriting)
+			{
+				return;
+			}
+
+			if(p.deqInFlight.empty())
+			{
+				if(p.bEnded)
+				{
+					asio::error_code ec;
+					p.dst.shutdown(asio::ip::tcp::socket::shutdown_send, ec);
+				}
+				return;
+			}
+
+			p.bWriting = true;
+			p.timer.expires_at(p.deqInFlight.front().tDeliver);
+			p.timer.async_wait(
+				[this, s, &p](std::error_code ec)
+				{
+					if(ec)
+					{
+						p.bWriting = false;
+						return;
+					}
+
+					const clock::time_point tNow = clock::now();
+					p.vWrite.clear();
+					while(!p.deqInFlight.empty() && p.deqInFlight.front().tDeliver <= tNow)
+					{
+						const auto& data = p.deqInFlight.front().data;
+						p.vWrite.insert(p.vWrite.end(), data.begin(), data.end());
+						p.deqInFlight.pop_front();
+					}
+
+					asio::async_write(p.dst, asio::buffer(p.vWrite),
+						[this, s, &p](std::error_code ec, std::size_t length)
+						{
+							p.bWriting = false;
+							if(ec)
+							{
+								s->Close();
+								return;
+							}
+
+							p.nInFlight -= length;
+							Schedule(s, p);
+							Read(s, p);
+						});
+				});
+		}
+
+		asio::io_context m_context;
+		asio::ip::tcp::acceptor m_acceptor;
+		std::thread m_thread;
+		asio::ip::tcp::endpoint m_target;
+
+		const uint16_t m_nPort;
+		const std::string m_sHost;
+		const uint16_t m_nTargetPort;
+		impairment m_link;
+		std::mt19937 m_rng;
+
+		std::atomic<uint64_t> m_nSegments = 0;
+		std::atomic<uint64_t> m_nLost = 0;
+		std::atomic<uint64_t> m_nReordered = 0;
+	};
+}
@@ -0,0 +1,267 @@
+#pragma once
+// Interest management
+// Positions of clients in a uniform grid, so a message meant for everyone near
+// a point only looks at the few cells around it instead of every connection
+// Each client may also keep an interest set, the others within its radius,
+// refreshed as they move with enter / leave reported for what changed
+
+#include "net_common.h"
+
+#include <cmath>
+
+namespace net
+{
+	struct interest_pos
+	{
+		float x = 0.0f;
+		float y = 0.0f;
+		float z = 0.0f;
+	};
+
+	// Not thread safe, the owner guards it
+	class interest_grid
+	{
+	public:
+		// Cells are fCellSize wide, about the usual query radius works best
+		// In 2D z is ignored
+		interest_grid(float fCellSize, bool b3D = false)
+			: m_fCellSize(std::max(fCellSize, 0.001f)), m_b3D(b3D)
+		{}
+
+		virtual ~interest_grid()
+		{}
+
+	public:
+		// Insert or move nID, only touches the cells when it crosses into another
+		void Set(uint32_t nID, const interest_pos& pos)
+		{
+			const uint64_t nCell = CellOf(pos);
+			auto it = m_mapEntries.find(nID);
+			if(it != m_mapEntries.end())
+			{
+				entry& e = it->second;
+				if(e.nCell == nCell)
+				{
+					m_mapCells[nCell][e.nSlot].pos = pos;
+					return;
+				}
+				RemoveFromCell(e);
+				e.nCell = nCell;
+				AddToCell(nID, e, pos);
+				return;
+			}
+
+			entry& e = m_mapEntries[nID];
+			e.nCell = nCell;
+			AddToCell(nID, e, pos);
+		}
+
+		void Remove(uint32_t nID)
+		{
+			auto it = m_mapEntries.find(nID);
+			if(it != m_mapEntries.end())
+			{
+				RemoveFromCell(it->second);
+				m_mapEntries.erase(it);
+			}
+		}
+
+		bool Contains(uint32_t nID) const
+		{
+			return m_mapEntries.count(nID) != 0;
+		}
+
+		bool Position(uint32_t nID, interest_pos& pos) const
+		{
+			auto it = m_mapEntries.find(nID);
+			if(it == m_mapEntries.end())
+			{
+				return false;
+			}
+			pos = m_mapCells.at(it->second.nCell)[it->second.nSlot].pos;
+			return true;
+		}
+
+		size_t Size() const
+		{
+			return m_mapEntries.size();
+		}
+
+		// fn(nID) for everything within fRadius of pos
+		template<typename Fn>
+		void Query(const interest_pos& pos, float fRadius, Fn&& fn) const
+		{
+			const float fRadiusSq = fRadius * fRadius;
+			const int32_t x0 = Coord(pos.x - fRadius), x1 = Coord(pos.x + fRadius);
+			const int32_t y0 = Coord(pos.y - fRadius), y1 = Coord(pos.y + fRadius);
+			const int32_t z0 = m_b3D ? Coord(pos.z - fRadius) : 0, z1 = m_b3D ? Coord(pos.z + fRadius) : 0;
+
+			for(int32_t cz = z0; cz <= z1; cz++)
+			{
+				for(int32_t cy = y0; cy <= y1; cy++)
+				{
+					for(int32_t cx = x0; cx <= x1; cx++)
+					{
+						auto it = m_mapCells.find(Key(cx, cy, cz));
+						if(it == m_mapCells.end())
+						{
+							continue;
+						}
+
+						for(const slot& s : it->second)
+						{
+							const float dx = s.pos.x - pos.x;
+							const float dy = s.pos.y - pos.y;
+							const float dz = m_b3D ? s.pos.z - pos.z : 0.0f;
+							if(dx * dx + dy * dy + dz * dz <= fRadiusSq)
+							{
+								fn(s.nID);
+							}
+						}
+					}
+				}
+			}
+		}
+
+	private:
+		struct slot
+		{
+			uint32_t nID;
+			interest_pos pos;
+		};
+
+		struct entry
+		{
+			uint64_t nCell = 0;
+			size_t nSlot = 0;	// index in its cell
+		};
+
+		int32_t Coord(float f) const
+		{
+			return int32_t(std::floor(f / m_fCellSize));
+		}
+
+		static uint64_t Key(int32_t x, int32_t y, int32_t z)
+		{
+			// 21 bits per axis, plenty for any world that fits a float
+			return (uint64_t(uint32_t(x) & 0x1FFFFF) << 42) | (uint64_t(uint32_t(y) & 0x1FFFFF) << 21) | uint64_t(uint32_t(z) & 0x1FFFFF);
+		}
+
+		uint64_t CellOf(const interest_pos& pos) const
+		{
+			return Key(Coord(pos.x), Coord(pos.y), m_b3D ? Coord(pos.z) : 0);
+		}
+
+		void AddToCell(uint32_t nID, entry& e, const interest_pos& pos)
+		{
+			auto& vCell = m_mapCells[e.nCell];
+			e.nSlot = vCell.size();
+			vCell.push_back({ nID, pos });
+		}
+
+		// Swap with the cell's last slot, so the moved entry needs its index fixed
+		void RemoveFromCell(const entry& e)
+		{
+			auto it = m_mapCells.find(e.nCell);
+			auto& vCell = it->second;
+			if(e.nSlot + 1 != vCell.size())
+			{
+				vCell[e.nSlot] = vCell.back();
+				m_mapEntries[vCell[e.nSlot].nID].nSlot = e.nSlot;
+			}
+			vCell.pop_back();
+			if(vCell.empty())
+			{
+				m_mapCells.erase(it);
+			}
+		}
+
+	private:
+		float m_fCellSize;
+		bool m_b3D;
+		std::unordered_map<uint64_t, std::vector<slot>> m_mapCells;
+		std::unordered_map<uint32_t, entry> m_mapEntries;
+	};
+
+	// Interest sets on top of a grid: who each subscriber can currently see
+	// Not thread safe, the owner guards it
+	class interest_sets
+	{
+	public:
+		// Subscriber nID follows everything within fRadius of itself, it must be in the grid
+		void Subscribe(uint32_t nID, float fRadius)
+		{
+			m_mapSubscribers[nID].fRadius = fRadius;
+		}
+
+		void Unsubscribe(uint32_t nID)
+		{
+			m_mapSubscribers.erase(nID);
+		}
+
+		// IDs nID currently sees, sorted, as of the last Refresh
+		const std::vector<uint32_t>& Of(uint32_t nID) const
+		{
+			static const std::vector<uint32_t> vNone;
+			auto it = m_mapSubscribers.find(nID);
+			return it != m_mapSubscribers.end() ? it->second.vVisible : vNone;
+		}
+
+		// Requery every subscriber, fnEnter(nID, nOther) / fnLeave(nID, nOther) for
+		// the changes only. Anything that left the grid leaves every set
+		template<typename Enter, typename Leave>
+		void Refresh(const interest_grid& grid, Enter&& fnEnter, Leave&& fnLeave)
+		{
+			for(auto& s : m_mapSubscribers)
+			{
+				const uint32_t nID = s.first;
+				subscriber& sub = s.second;
+
+				m_vScratch.clear();
+				interest_pos pos;
+				if(grid.Position(nID, pos))
+				{
+					grid.Query(pos, sub.fRadius, [this, nID](uint32_t nOther)
+						{
+							if(nOther != nID)
+							{
+								m_vScratch.push_back(nOther);
+							}
+						});
+					std::sort(m_vScratch.begin(), m_vScratch.end());
+				}
+
+				// Walk both sorted sets once
+				auto itOld = sub.vVisible.begin();
+				auto itNew = m_vScratch.begin();
+				while(itOld != sub.vVisible.end() || itNew != m_vScratch.end())
+				{
+					if(itNew == m_vScratch.end() || (itOld != sub.vVisible.end() && *itOld < *itNew))
+					{
+						fnLeave(nID, *itOld++);
+					}
+					else if(itOld == sub.vVisible.end() || *itNew < *itOld)
+					{
+						fnEnter(nID, *itNew++);
+					}
+					else
+					{
+						++itOld;
+						++itNew;
+					}
+				}
+				sub.vVisible.swap(m_vScratch);
+			}
+		}
+
+	private:
+		struct subscriber
+		{
+			float fRadius = 0.0f;
+			std::vector<uint32_t> vVisible;
+		};
+
+		std::unordered_map<uint32_t, subscriber> m_mapSubscribers;
+		std::vector<uint32_t> m_vScratch;
+	};
+}
@@ -0,0 +1,467 @@
+#pragma once
+// Load generator, thousands of client connections on a few asio threads
+// Every connection goes through the usual validation handshake, then follows a
+// load_script: data messages at a rate with sizes drawn from a distribution, and
+// pings the server echoes back for round trip times. Stats are kept per
+// connection and for the whole run
+
+#include "net_common.h"
+#include "net_tsqueue.h"
+#include "net_message.h"
+#include "net_connection.h"
+#include "net_tick.h"
+
+#include <random>
+
+namespace net
+{
+	// What each connection does once the server answers it
+	struct load_script
+	{
+		double dMessagesPerSecond = 10.0;				// data messages per connection, 0 for none
+		bool bPoisson = true;							// random gaps averaging the rate, false for a fixed interval
+		std::vector<std::pair<size_t, double>> vBodySizes;		// data body sizes and their weights, none for 64 bytes
+		std::chrono::milliseconds pingInterval{ 1000 };	// per connection, 0 for no pings after the first
+		priority ePriority = priority::normal;			// lane of the data, pings go on control
+		double dConnectsPerSecond = 1000.0;				// how fast connections are opened, 0 for all at once
+		uint32_t nFeatures = 0;							// nFeature bits to ask the server for
+	};
+
+	struct load_connection_stats
+	{
+		bool bReady = false;		// its first ping came back, the handshake is done
+		bool bConnected = false;	// socket still open when the run stopped
+		double dReadyMs = 0.0;		// from connecting to the first echo
+		uint64_t nSent = 0;
+		uint64_t nBytesSent = 0;
+		uint64_t nPings = 0;
+		uint64_t nPongs = 0;
+		latency_histogram rtt;		// us, the first ping not included
+	};
+
+	struct load_stats
+	{
+		size_t nConnections = 0;
+		size_t nOpened = 0;
+		size_t nReady = 0;
+		size_t nConnected = 0;
+		uint64_t nSent = 0;
+		uint64_t nBytesSent = 0;
+		uint64_t nReceived = 0;
+		uint64_t nBytesReceived = 0;
+		uint64_t nPongs = 0;
+		double dSeconds = 0.0;
+		latency_histogram ready;	// us, connecting to first echo
+		latency_histogram rtt;		// us, every ping but the first of each connection
+	};
+
+	// Data goes out as idData, pings as idPing which the server must send back as
+	// they came, body and all
+	template<typename T>
+	class load_generator
+	{
+	public:
+		load_generator(T idData, T idPing)
+			: m_idData(idData), m_idPing(idPing)
+		{}
+
+		virtual ~load_generator()
+		{
+			Stop();
+		}
+
+	public:
+		// Open nConnections to the server at the script's connect rate, run by nThreads asio threads
+		bool Start(const std::string& sHost, uint16_t nPort, size_t nConnections, const load_script& script = {}, size_t nThreads = 2)
+		{
+			Stop();
+			m_script = script;
+
+			// Cumulative weights, a uniform draw picks the size
+			if(m_script.vBodySizes.empty())
+			{
+				m_script.vBodySizes.push_back({ 64, 1.0 });
+			}
+			m_vSizeWeights.clear();
+			double dTotal = 0.0;
+			for(const auto& s : m_script.vBodySizes)
+			{
+				dTotal += std::max(s.second, 0.0);
+				m_vSizeWeights.push_back(dTotal);
+			}
+			if(m_vSizeWeights.empty() || dTotal <= 0.0)
+			{
+				m_script.vBodySizes = { { 0, 1.0 } };
+				m_vSizeWeights = { 1.0 };
+			}
+
+			try
+			{
+				nThreads = std::max<size_t>(nThreads, 1);
+				for(size_t i = 0; i < nThreads; i++)
+				{
+					m_vContexts.push_back(std::make_unique<asio::io_context>());
+					m_vWork.push_back(std::make_unique<work_guard>(m_vContexts.back()->get_executor()));
+				}
+
+				asio::ip::tcp::resolver resolver(*m_vContexts[0]);
+				m_endpoints = resolver.resolve(sHost, std::to_string(nPort));
+
+				// Each connection lives on one context, so its handlers never run concurrently
+				for(size_t i = 0; i < nConnections; i++)
+				{
+					m_vClients.push_back(std::make_unique<client>(*m_vContexts[i % nThreads], uint32_t(i)));
+				}
+
+				m_tStart = std::chrono::steady_clock::now();
+				m_bRunning = true;
+				m_timerRamp = std::make_unique<asio::steady_timer>(*m_vContexts[0]);
+				asio::post(*m_vContexts[0], [this]() { Ramp(); });
+
+				for(auto& ctx : m_vContexts)
+				{
+					asio::io_context* pCtx = ctx.get();
+					m_vThreads.emplace_back([pCtx]() { pCtx->run(); });
+				}
+				m_thrCollect = std::thread([this]() { Collect(); });
+			}
+			catch(std::exception& e)
+			{
+				NET_LOG_ERROR("[LOAD] Exception: ", e.what());
+				Stop();
+				return false;
+			}
+
+			return true;
+		}
+
+		// Counters so far, safe from any thread while running
+		// The histograms are only filled in by Stop
+		load_stats Progress() const
+		{
+			load_stats stats;
+			stats.nConnections = m_vClients.size();
+			stats.nOpened = m_nOpened;
+			stats.nReady = m_nReady;
+			stats.nSent = m_nSent;
+			stats.nBytesSent = m_nBytesSent;
+			stats.nReceived = m_nReceived;
+			stats.nBytesReceived = m_nBytesReceived;
+			stats.nPongs = m_nPongs;
+			stats.dSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - m_tStart).count();
+			return stats;
+		}
+
+		// Close every connection and return the totals, ConnectionStats holds the rest
+		load_stats Stop()
+		{
+			if(m_vContexts.empty())
+			{
+				return m_statsLast;
+			}
+
+			m_bRunning = false;
+			if(m_thrCollect.joinable())
+			{
+				m_thrCollect.join();
+			}
+
+			m_vWork.clear();
+			for(auto& ctx : m_vContexts)
+			{
+				ctx->stop();
+			}
+			for(auto& thr : m_vThreads)
+			{
+				if(thr.joinable())
+				{
+					thr.join();
+				}
+			}
+
+			// Nothing runs now, timers and connections can be touched from here
+			load_stats stats = Progress();
+			m_vStats.clear();
+			if(m_timerRamp)
+			{
+				m_timerRamp->cancel();
+			}
+			for(auto& c : m_vClients)
+			{
+				c->timerSend.cancel();
+				c->timerPing.cancel();
+				c->stats.bConnected = c->conn && c->conn->IsConnected();
+				stats.nConnected += c->stats.bConnected;
+				if(c->conn)
+				{
+					c->conn->Disconnect();
+				}
+				m_vStats.push_back(c->stats);
+			}
+			stats.ready = m_ready;
+			stats.rtt = m_rtt;
+
+			// Let the queued closes and aborted handlers run out before anything is destroyed
+			for(auto& ctx : m_vContexts)
+			{
+				ctx->restart();
+				ctx->run();
+			}
+
+			// Messages hold on to their connection, drop them first
+			m_qMessagesIn.clear();
+			m_vThreads.clear();
+			m_vClients.clear();
+			m_timerRamp.reset();
+			m_vContexts.clear();
+
+			m_nOpened = 0;
+			m_nReady = 0;
+			m_nSent = 0;
+			m_nBytesSent = 0;
+			m_nReceived = 0;
+			m_nBytesReceived = 0;
+			m_nPongs = 0;
+			m_ready.Clear();
+			m_rtt.Clear();
+			m_statsLast = stats;
+			return stats;
+		}
+
+		// Per connection stats of the last run, in the order they were opened, filled in by Stop
+		const std::vector<load_connection_stats>& ConnectionStats() const
+		{
+			return m_vStats;
+		}
+
+	private:
+		// Marks a ping body from the rest of the traffic with the same ID
+		static constexpr uint32_t nPingMagic = 0x474E4950;
+
+		struct client
+		{
+			client(asio::io_context& ctx, uint32_t nIndex)
+				: ctx(ctx), timerSend(ctx), timerPing(ctx), rng(nIndex + 1), nIndex(nIndex)
+			{}
+
+			asio::io_context& ctx;
+			std::shared_ptr<connection<T>> conn;
+			asio::steady_timer timerSend;
+			asio::steady_timer timerPing;
+			std::minstd_rand rng;
+			const uint32_t nIndex;
+			std::chrono::steady_clock::time_point tConnect;
+			// Sent counts are written on the asio thread, the rest by the collector
+			load_connection_stats stats;
+		};
+
+		// Open the connections due by now, then come back for more
+		void Ramp()
+		{
+			const size_t nTotal = m_vClients.size();
+			size_t nDue = nTotal;
+			if(m_script.dConnectsPerSecond > 0.0)
+			{
+				const double dElapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - m_tStart).count();
+				nDue = std::min(nTotal, size_t(dElapsed * m_script.dConnectsPerSecond) + 1);
+			}
+
+			for(size_t i = m_nOpened; i < nDue; i++)
+			{
+				client& c = *m_vClients[i];
+				asio::post(c.ctx, [this, &c]() { Open(c); });
+			}
+			m_nOpened = nDue;
+
+			if(nDue < nTotal)
+			{
+				m_timerRamp->expires_after(std::chrono::milliseconds(10));
+				m_timerRamp->async_wait([this](std::error_code ec)
+					{
+						if(!ec)
+						{
+							Ramp();
+						}
+					});
+			}
+		}
+
+		// Runs on the client's context
+		void Open(client& c)
+		{
+			c.conn = std::make_shared<connection<T>>(connection<T>::owner::client, c.ctx, asio::ip::tcp::socket(c.ctx), m_qMessagesIn);
+			c.conn->SetFeatures(m_script.nFeatures);
+			c.tConnect = std::chrono::steady_clock::now();
+			c.conn->ConnectToServer(m_endpoints);
+
+			// Held back until the handshake is done, its echo starts the script
+			SendPing(c);
+		}
+
+		void SendPing(client& c)
+		{
+			message<T> msg;
+			msg.header.id = m_idPing;
+			msg << int64_t(std::chrono::steady_clock::now().time_since_epoch().count()) << c.nIndex << nPingMagic;
+			c.conn->Send(msg, priority::control);
+			c.stats.nPings++;
+		}
+
+		void SendData(client& c)
+		{
+			std::uniform_real_distribution<double> draw(0.0, m_vSizeWeights.back());
+			const size_t nPick = size_t(std::upper_bound(m_vSizeWeights.begin(), m_vSizeWeights.end(), draw(c.rng)) - m_vSizeWeights.begin());
+			const size_t nBody = m_script.vBodySizes[std::min(nPick, m_vSizeWeights.size() - 1)].first;
+
+			message<T> msg;
+			msg.header.id = m_idData;
+			msg.body.resize(nBody);
+			msg.header.size = uint32_t(nBody);
+			c.conn->Send(msg, m_script.ePriority);
+
+			c.stats.nSent++;
+			c.stats.nBytesSent += nBody;
+			m_nSent.fetch_add(1, std::memory_order_relaxed);
+			m_nBytesSent.fetch_add(nBody, std::memory_order_relaxed);
+		}
+
+		// Next data message, gaps add up from the last deadline so a late handler does not lower the rate
+		void ScheduleSend(client& c, bool bFirst)
+		{
+			if(m_script.dMessagesPerSecond <= 0.0)
+			{
+				return;
+			}
+
+			const double dGap = m_script.bPoisson ? std::exponential_distribution<double>(m_script.dMessagesPerSecond)(c.rng) : 1.0 / m_script.dMessagesPerSecond;
+			const auto gap = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(dGap));
+			c.timerSend.expires_at((bFirst ? std::chrono::steady_clock::now() : c.timerSend.expiry()) + gap);
+			c.timerSend.async_wait([this, &c](std::error_code ec)
+				{
+					if(ec || !c.conn->IsConnected())
+					{
+						return;
+					}
+					SendData(c);
+					ScheduleSend(c, false);
+				});
+		}
+
+		// Connections start at a random point in the interval so they do not ping in step
+		void SchedulePing(client& c, bool bFirst)
+		{
+			if(m_script.pingInterval.count() <= 0)
+			{
+				return;
+			}
+
+			std::chrono::steady_clock::duration gap = m_script.pingInterval;
+			if(bFirst)
+			{
+				gap = std::chrono::steady_clock::duration(std::uniform_int_distribution<int64_t>(0, gap.count())(c.rng));
+			}
+			c.timerPing.expires_at((bFirst ? std::chrono::steady_clock::now() : c.timerPing.expiry()) + gap);
+			c.timerPing.async_wait([this, &c](std::error_code ec)
+				{
+					if(ec || !c.conn->IsConnected())
+					{
+						return;
+					}
+					SendPing(c);
+					SchedulePing(c, false);
+				});
+		}
+
+		// Everything the server sends lands here, echoed pings are timed
+		void Collect()
+		{
+			std::deque<owned_message<T>> deqBatch;
+			while(m_bRunning)
+			{
+				if(!m_qMessagesIn.wait_for(std::chrono::milliseconds(10)))
+				{
+					continue;
+				}
+				m_qMessagesIn.drain(deqBatch);
+				const auto tNow = std::chrono::steady_clock::now();
+
+				for(auto& m : deqBatch)
+				{
+					m_nReceived.fetch_add(1, std::memory_order_relaxed);
+					m_nBytesReceived.fetch_add(m.msg.body.size(), std::memory_order_relaxed);
+					if(m.msg.header.id != m_idPing || m.msg.body.size() != sizeof(int64_t) + 2 * sizeof(uint32_t))
+					{
+						continue;
+					}
+
+					uint32_t nMagic = 0, nIndex = 0;
+					int64_t nSent = 0;
+					m.msg >> nMagic >> nIndex >> nSent;
+					if(nMagic != nPingMagic || nIndex >= m_vClients.size())
+					{
+						continue;
+					}
+
+					client& c = *m_vClients[nIndex];
+					c.stats.nPongs++;
+					m_nPongs.fetch_add(1, std::memory_order_relaxed);
+					const double dUs = std::chrono::duration<double, std::micro>(tNow.time_since_epoch() - std::chrono::steady_clock::duration(nSent)).count();
+					if(c.stats.bReady)
+					{
+						c.stats.rtt.Add(dUs);
+						m_rtt.Add(dUs);
+						continue;
+					}
+
+					// First echo, the handshake went through and the script can start
+					c.stats.bReady = true;
+					c.stats.dReadyMs = std::chrono::duration<double, std::milli>(tNow - c.tConnect).count();
+					m_ready.Add(c.stats.dReadyMs * 1000.0);
+					m_nReady++;
+					asio::post(c.ctx, [this, &c]()
+						{
+							ScheduleSend(c, true);
+							SchedulePing(c, true);
+						});
+				}
+				deqBatch.clear();
+			}
+		}
+
+	private:
+		using work_guard = asio::executor_work_guard<asio::io_context::executor_type>;
+
+		const T m_idData;
+		const T m_idPing;
+		load_script m_script;
+		std::vector<double> m_vSizeWeights;
+
+		// Contexts outlive the connections and timers using them
+		std::vector<std::unique_ptr<asio::io_context>> m_vContexts;
+		std::vector<std::unique_ptr<work_guard>> m_vWork;
+		std::vector<std::thread> m_vThreads;
+		asio::ip::tcp::resolver::results_type m_endpoints;
+		std::vector<std::unique_ptr<client>> m_vClients;
+		std::unique_ptr<asio::steady_timer> m_timerRamp;
+		std::chrono::steady_clock::time_point m_tStart;
+
+		// Shared by every connection, drained by the collector
+		tsqueue<owned_message<T>> m_qMessagesIn;
+		std::thread m_thrCollect;
+		std::atomic<bool> m_bRunning = false;
+
+		std::atomic<size_t> m_nOpened = 0;
+		std::atomic<size_t> m_nReady = 0;
+		std::atomic<uint64_t> m_nSent = 0;
+		std::atomic<uint64_t> m_nBytesSent = 0;
+		std::atomic<uint64_t> m_nReceived = 0;
+		std::atomic<uint64_t> m_nBytesReceived = 0;
+		std::atomic<uint64_t> m_nPongs = 0;
+		// Collector only
+		latency_histogram m_ready;
+		latency_histogram m_rtt;
+
+		std::vector<load_connection_stats> m_vStats;
+		load_stats m_statsLast;
+	};
+}
@@ -0,0 +1,476 @@
+#pragma once
+// Asynchronous logging for the framework and applications
+// NET_LOG_INFO("[", nID, "] Read Header Fail.") copies its arguments into a ring
+// owned by the calling thread and returns, a background thread formats them with
+// operator<< and writes the line out, so asio handlers never wait on the console
+// Levels below NET_LOG_LEVEL are compiled out, SetLogLevel filters the rest at run time
+// String literals are kept by pointer, any other char pointer or char array is copied
+// into a std::string. A const char array is taken for a literal, so pass only literals
+// or arrays that live for the whole program that way, anything else as a std::string
+
+#include "net_common.h"
+#include <sstream>
+
+// Lowest level compiled in: 0 trace, 1 debug, 2 info, 3 warn, 4 error, 5 none
+#ifndef NET_LOG_LEVEL
+#define NET_LOG_LEVEL 1
+#endif
+
+namespace net
+{
+	enum class log_level : uint8_t
+	{
+		trace,
+		debug,
+		info,
+		warn,
+		error,
+		off
+	};
+
+	// How an argument is held until it is formatted, const char arrays (literals) by
+	// pointer, other C strings and char buffers copied since they may be gone or
+	// overwritten by then, the rest by value
+	template<typename A>
+	using log_arg_t = std::conditional_t<std::is_array_v<std::remove_reference_t<A>> &&
+		std::is_same_v<std::remove_extent_t<std::remove_reference_t<A>>, const char>, const char*,
+		std::conditional_t<std::is_same_v<std::decay_t<A>, const char*> || std::is_same_v<std::decay_t<A>, char*>, std::string, std::decay_t<A>>>;
+
+	// One line waiting to be formatted, its arguments live in place when they fit
+	// and on the heap when not
+	struct log_record
+	{
+		static constexpr size_t nArgBytes = 96;
+
+		int64_t nTime;
+		void (*fnWrite)(std::ostream&, unsigned char*);
+		log_level eLevel;
+		alignas(std::max_align_t) unsigned char args[nArgBytes];
+	};
+
+	template<typename Tuple>
+	struct log_args
+	{
+		static constexpr bool bInline = sizeof(Tuple) <= log_record::nArgBytes && alignof(Tuple) <= alignof(std::max_align_t);
+
+		template<typename... Args>
+		static void Store(unsigned char* p, Args&&... args)
+		{
+			if constexpr(bInline)
+			{
+				new(p) Tuple(std::forward<Args>(args)...);
+			}
+			else
+			{
+				Tuple* pTuple = new Tuple(std::forward<Args>(args)...);
+				std::memcpy(p, &pTuple, sizeof(pTuple));
+			}
+		}
+
+		// Formats the arguments, then destroys them
+		static void Write(std::ostream& os, unsigned char* p)
+		{
+			Tuple* pTuple;
+			if constexpr(bInline)
+			{
+				pTuple = std::launder(reinterpret_cast<Tuple*>(p));
+			}
+			else
+			{
+				std::memcpy(&pTuple, p, sizeof(pTuple));
+			}
+
+			std::apply([&os](const auto&... a) { (os << ... << a); }, *pTuple);
+
+			if constexpr(bInline)
+			{
+				pTuple->~Tuple();
+			}
+			else
+			{
+				delete pTuple;
+			}
+		}
+	};
+
+	// Single producer single consumer ring, its thread fills it and the log thread
+	// empties it, when full new lines are counted and dropped rather than waited on
+	class log_ring
+	{
+	public:
+		static constexpr size_t nCapacity = 1024;
+
+		// Slot for the next line, nullptr while the ring is full
+		log_record* Claim()
+		{
+			const uint64_t nHead = m_nHead.load(std::memory_order_relaxed);
+			if(nHead - m_nTail.load(std::memory_order_acquire) >= nCapacity)
+			{
+				return nullptr;
+			}
+			return &m_records[nHead % nCapacity];
+		}
+
+		// Hands the claimed slot over to the log thread, true when the ring was empty
+		// before it. The fence pairs with the one in log_registry::Drain, so either the
+		// log thread sees this line or we see its tail and whether it is parked
+		bool Publish()
+		{
+			const uint64_t nHead = m_nHead.load(std::memory_order_relaxed);
+			m_nHead.store(nHead + 1, std::memory_order_release);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			return m_nTail.load(std::memory_order_relaxed) == nHead;
+		}
+
+		uint64_t Head() const
+		{
+			return m_nHead.load(std::memory_order_acquire);
+		}
+
+		uint64_t Tail() const
+		{
+			return m_nTail.load(std::memory_order_acquire);
+		}
+
+		log_record& At(uint64_t i)
+		{
+			return m_records[i % nCapacity];
+		}
+
+		// Slots up to nTail are written out and free again
+		void Release(uint64_t nTail)
+		{
+			m_nTail.store(nTail, std::memory_order_release);
+		}
+
+		std::atomic<uint64_t> nDropped = 0;
+
+		// Its thread has exited, the next new thread takes the ring over
+		bool bFree = false;
+
+	private:
+		alignas(64) std::atomic<uint64_t> m_nHead = 0;
+		alignas(64) std::atomic<uint64_t> m_nTail = 0;
+		std::array<log_record, nCapacity> m_records;
+	};
+
+	// Rings of every thread that logged and the thread writing them out
+	class log_registry
+	{
+	public:
+		// Never destroyed, the log thread is stopped at exit and anything logged
+		// after that, from static destructors say, is written straight away
+		static log_registry& Get()
+		{
+			static log_registry* pRegistry = new log_registry();
+			return *pRegistry;
+		}
+
+		void SetLevel(log_level eLevel)
+		{
+			m_eLevel.store(eLevel, std::memory_order_relaxed);
+		}
+
+		bool Enabled(log_level eLevel) const
+		{
+			return eLevel >= m_eLevel.load(std::memory_order_relaxed);
+		}
+
+		// Where formatted lines go, by default errors to std::cerr and the rest to std::cout
+		void SetSink(std::function<void(log_level, const std::string&)> fnSink)
+		{
+			std::scoped_lock lock(m_muxSink);
+			m_fnSink = std::move(fnSink);
+		}
+
+		template<typename... Args>
+		void Push(log_level eLevel, Args&&... args)
+		{
+			if(m_bStopped.load(std::memory_order_acquire))
+			{
+				std::ostringstream os;
+				(os << ... << args);
+				std::scoped_lock lock(m_muxSink);
+				Write(eLevel, os.str());
+				FlushSink();
+				return;
+			}
+
+			log_ring& ring = Ring();
+			log_record* pRecord = ring.Claim();
+			if(!pRecord)
+			{
+				ring.nDropped.fetch_add(1, std::memory_order_relaxed);
+				return;
+			}
+
+			using args_t = log_args<std::tuple<log_arg_t<Args>...>>;
+			pRecord->nTime = std::chrono::steady_clock::now().time_since_epoch().count();
+			pRecord->fnWrite = &args_t::Write;
+			pRecord->eLevel = eLevel;
+			args_t::Store(pRecord->args, std::forward<Args>(args)...);
+			if(ring.Publish() && m_bParked.load(std::memory_order_relaxed))
+			{
+				Wake();
+			}
+		}
+
+		// Blocks until every line logged so far has been written out
+		void Flush()
+		{
+			std::vector<std::pair<std::shared_ptr<log_ring>, uint64_t>> vWait;
+			{
+				std::scoped_lock lock(m_mux);
+				for(auto& pRing : m_vRings)
+				{
+					vWait.emplace_back(pRing, pRing->Head());
+				}
+			}
+
+			for(auto& [pRing, nHead] : vWait)
+			{
+				while(pRing->Tail() < nHead && !m_bStopped.load(std::memory_order_acquire))
+				{
+					std::this_thread::sleep_for(std::chrono::milliseconds(1));
+				}
+			}
+		}
+
+	private:
+		log_registry()
+		{
+			m_thrWriter = std::thread([this]() { Run(); });
+			std::atexit([]() { Get().Stop(); });
+		}
+
+		log_ring& Ring()
+		{
+			// Hands the ring back when the thread exits
+			struct owner
+			{
+				std::shared_ptr<log_ring> pRing;
+
+				~owner()
+				{
+					if(pRing)
+					{
+						log_registry& registry = Get();
+						std::scoped_lock lock(registry.m_mux);
+						pRing->bFree = true;
+					}
+				}
+			};
+			thread_local owner ring;
+
+			if(!ring.pRing)
+			{
+				std::scoped_lock lock(m_mux);
+				auto it = std::find_if(m_vRings.begin(), m_vRings.end(), [](const auto& p) { return p->bFree; });
+				if(it != m_vRings.end())
+				{
+					ring.pRing = *it;
+					ring.pRing->bFree = false;
+				}
+				else
+				{
+					ring.pRing = std::make_shared<log_ring>();
+					m_vRings.push_back(ring.pRing);
+				}
+			}
+			return *ring.pRing;
+		}
+
+		void Run()
+		{
+			while(!m_bQuit.load(std::memory_order_acquire))
+			{
+				if(Drain())
+				{
+					continue;
+				}
+
+				// Nothing to write, park until a thread finds its ring empty and wakes us.
+				// Look once more after raising the flag, a line published before it is
+				// seen here, one published after it sees the flag
+				m_bParked.store(true, std::memory_order_relaxed);
+				if(!Drain())
+				{
+					std::unique_lock lock(m_muxWake);
+					m_cvWake.wait(lock, [this]() { return m_bWake || m_bQuit.load(std::memory_order_acquire); });
+					m_bWake = false;
+				}
+				m_bParked.store(false, std::memory_order_relaxed);
+			}
+		}
+
+		void Wake()
+		{
+			{
+				std::scoped_lock lock(m_muxWake);
+				m_bWake = true;
+			}
+			m_cvWake.notify_one();
+		}
+
+		// Writes out what the rings hold, oldest line first across threads, false when there was nothing
+		bool Drain()
+		{
+			{
+				std::scoped_lock lock(m_mux);
+				m_vDrain = m_vRings;
+			}
+
+			// Pairs with log_ring::Publish, orders the last Release and m_bParked before the heads are read
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+
+			m_vPending.clear();
+			m_vHeads.resize(m_vDrain.size());
+			uint64_t nDropped = 0;
+			for(size_t r = 0; r < m_vDrain.size(); r++)
+			{
+				log_ring& ring = *m_vDrain[r];
+				m_vHeads[r] = ring.Head();
+				for(uint64_t i = ring.Tail(); i < m_vHeads[r]; i++)
+				{
+					m_vPending.push_back(&ring.At(i));
+				}
+				nDropped += ring.nDropped.exchange(0, std::memory_order_relaxed);
+			}
+
+			if(m_vPending.empty() && nDropped == 0)
+			{
+				return false;
+			}
+
+			std::stable_sort(m_vPending.begin(), m_vPending.end(), [](const log_record* a, const log_record* b) { return a->nTime < b->nTime; });
+
+			std::scoped_lock lock(m_muxSink);
+			for(log_record* pRecord : m_vPending)
+			{
+				m_os.str("");
+				pRecord->fnWrite(m_os, pRecord->args);
+				Write(pRecord->eLevel, m_os.str());
+			}
+			if(nDropped)
+			{
+				Write(log_level::warn, "[LOG] " + std::to_string(nDropped) + " lines dropped, logged faster than they could be written");
+			}
+			FlushSink();
+
+			// Only now, so Flush returning means the lines are out
+			for(size_t r = 0; r < m_vDrain.size(); r++)
+			{
+				m_vDrain[r]->Release(m_vHeads[r]);
+			}
+			m_vDrain.clear();
+			return true;
+		}
+
+		// m_muxSink held
+		void Write(log_level eLevel, const std::string& sLine)
+		{
+			if(m_fnSink)
+			{
+				m_fnSink(eLevel, sLine);
+			}
+			else
+			{
+				(eLevel >= log_level::error ? std::cerr : std::cout) << sLine << '\n';
+			}
+		}
+
+		// m_muxSink held, std::cerr is unbuffered but std::cout is flushed once a batch
+		void FlushSink()
+		{
+			if(!m_fnSink)
+			{
+				std::cout.flush();
+			}
+		}
+
+		// Called at exit, whatever is still in the rings is written before the process goes
+		void Stop()
+		{
+			m_bQuit.store(true, std::memory_order_release);
+			Wake();
+			if(m_thrWriter.joinable())
+			{
+				m_thrWriter.join();
+			}
+			Drain();
+			m_bStopped.store(true, std::memory_order_release);
+			Drain();
+		}
+
+		std::mutex m_mux;
+		std::vector<std::shared_ptr<log_ring>> m_vRings;
+
+		std::atomic<log_level> m_eLevel = log_level::info;
+		std::atomic<bool> m_bQuit = false;
+		std::atomic<bool> m_bStopped = false;
+		std::thread m_thrWriter;
+
+		// The log thread sleeps on m_cvWake while every ring is empty
+		std::atomic<bool> m_bParked = false;
+		std::mutex m_muxWake;
+		std::condition_variable m_cvWake;
+		bool m_bWake = false;
+
+		// Log thread only
+		std::vector<std::shared_ptr<log_ring>> m_vDrain;
+		std::vector<uint64_t> m_vHeads;
+		std::vector<log_record*> m_vPending;
+
+		std::mutex m_muxSink;
+		std::function<void(log_level, const std::string&)> m_fnSink;
+		std::ostringstream m_os;
+	};
+
+	inline void SetLogLevel(log_level eLevel)
+	{
+		log_registry::Get().SetLevel(eLevel);
+	}
+
+	inline void SetLogSink(std::function<void(log_level, const std::string&)> fnSink)
+	{
+		log_registry::Get().SetSink(std::move(fnSink));
+	}
+
+	inline void FlushLog()
+	{
+		log_registry::Get().Flush();
+	}
+}
+
+#define NET_LOG(eLevel, ...) \
+	do { if(net::log_registry::Get().Enabled(eLevel)) net::log_registry::Get().Push(eLevel, __VA_ARGS__); } while(0)
+
+#if NET_LOG_LEVEL <= 0
+#define NET_LOG_TRACE(...) NET_LOG(net::log_level::trace, __VA_ARGS__)
+#else
+#define NET_LOG_TRACE(...) do {} while(0)
+#endif
+
+#if NET_LOG_LEVEL <= 1
+#define NET_LOG_DEBUG(...) NET_LOG(net::log_level::debug, __VA_ARGS__)
+#else
+#define NET_LOG_DEBUG(...) do {} while(0)
+#endif
+
+#if NET_LOG_LEVEL <= 2
+#define NET_LOG_INFO(...) NET_LOG(net::log_level::info, __VA_ARGS__)
+#else
+#define NET_LOG_INFO(...) do {} while(0)
+#endif
+
+#if NET_LOG_LEVEL <= 3
+#define NET_LOG_WARN(...) NET_LOG(net::log_level::warn, __VA_ARGS__)
+#else
+#define NET_LOG_WARN(...) do {} while(0)
+#endif
+
+#if NET_LOG_LEVEL <= 4
+#define NET_LOG_ERROR(...) NET_LOG(net::log_level::error, __VA_ARGS__)
+#else
+#define NET_LOG_ERROR(...) do {} while(0)
+#endif
@@ -1,5 +1,8 @@
 #pragma once
 #include "net_common.h"
+#include "net_wire.h"
+#include "net_trace.h"
+#include "net_log.h"
 
 namespace net
 {
@@ -12,11 +15,178 @@ namespace net
 		uint32_t size = 0;	//concurent in 32/64 bit system
 	};
 
+	// The header as it goes on the wire, both fields little endian whatever T is
+	struct wire_header
+	{
+		uint32_t id;
+		uint32_t size;
+	};
+
+	template<typename T>
+	wire_header ToWire(const message_header<T>& hdr)
+	{
+		static_assert(sizeof(T) <= sizeof(uint32_t), "Message IDs must fit 32 bits");
+		return { WireOrder(uint32_t(static_cast<std::underlying_type_t<T>>(hdr.id))), WireOrder(hdr.size) };
+	}
+
+	template<typename T>
+	message_header<T> FromWire(const wire_header& hdr)
+	{
+		message_header<T> out;
+		out.id = T(static_cast<std::underlying_type_t<T>>(WireOrder(hdr.id)));
+		out.size = WireOrder(hdr.size);
+		return out;
+	}
+
+	// Outbound priority class chosen per Send, each class is a separate queue
+	// control always goes first, the rest share the link by weight
+	enum class priority : uint8_t
+	{
+		control,
+		high,
+		normal,
+		bulk
+	};
+
+	constexpr size_t nPriorityLanes = 4;
+
+	// Bodies bigger than the connection chunk size are sent as several frames so
+	// higher priority frames can be written in between, the top bits of the size
+	// field on the wire mark such fragments and the framework's own frames:
+	// [31] fragment of a larger message, [30] last fragment or last stream chunk,
+	// [29..28] lane, [27] stream chunk, [26] stream credit grant,
+	// [25] call ID follows the body, [24..0] frame length
+	constexpr uint32_t nFrameFragment = 0x80000000;
+	constexpr uint32_t nFrameLast = 0x40000000;
+	constexpr uint32_t nFrameLaneMask = 0x30000000;
+	constexpr uint32_t nFrameLaneShift = 28;
+	constexpr uint32_t nFrameStream = 0x08000000;
+	constexpr uint32_t nFrameCredit = 0x04000000;
+	constexpr uint32_t nFrameCall = 0x02000000;
+	constexpr uint32_t nFrameSizeMask = 0x01FFFFFF;
+
+	// Call IDs with this bit set are replies, the rest name the request
+	constexpr uint32_t nCallReply = 0x80000000;
+
+	// Bytes of stream chunks a sender may have in flight before the receiver
+	// hands back credit, both sides start from this window
+	constexpr uint32_t nStreamWindow = 1024 * 1024;
+
+	// Issued by the server once a client is validated, presenting it on reconnect
+	// skips the challenge and restores the old client ID
+	struct session_ticket
+	{
+		uint32_t nID = 0;
+		uint32_t nFeatures = 0;	// nFeature bits the server agreed to for this connection
+		uint64_t nToken = 0;	// 0 means no ticket
+	};
+
+	inline session_ticket WireOrder(const session_ticket& ticket)
+	{
+		return { WireOrder(ticket.nID), WireOrder(ticket.nFeatures), WireOrder(ticket.nToken) };
+	}
+
+	// Sent by a client in place of the challenge answer, followed by its ticket
+	constexpr uint64_t nResumeMagic = 0x4E4554524553554DULL;
+
+	// Optional frame features, the client asks for a set after its answer or ticket,
+	// the server answers with those it allows in the session ticket
+	// Crc: every frame is followed by the CRC32C of its header and contents
+	constexpr uint32_t nFeatureCrc = 0x00000001;
+	// Compact: frame headers are sent as compact_header below instead of the 8 byte wire_header
+	constexpr uint32_t nFeatureCompact = 0x00000002;
+	// Durable: each message from the server ends in its 8 byte outbox sequence (0 for none),
+	// after the body and before a call ID, and a resuming client sends the last one it got.
+	// Needs a server with EnableOutbox, see net_outbox.h
+	constexpr uint32_t nFeatureDurable = 0x00000004;
+
+	// Variable length frame header, 3 to 9 bytes, 3 for the usual small frame
+	// A tag byte, then the rarer flag bits of the size field when any are set, then
+	// the ID and the frame length in as few little endian bytes as they need
+	// Tag: [7..6] length bytes - 1, [5..4] ID bytes - 1, [3] flags byte follows,
+	// [2] call ID follows the body, [1..0] length bits above the length bytes
+	// Flags byte: bits [31..26] of the size field
+	// Up to 1 KB with an ID under 256 is 3 bytes, read in one go, 256 KB takes 4
+	struct compact_header
+	{
+		static constexpr size_t nMinSize = 3;
+		static constexpr size_t nMaxSize = 9;
+		// Decode loads whole words, this much has to be readable from the start
+		static constexpr size_t nDecodeSize = nMaxSize + 1;
+
+		// Bytes in the header starting with this tag
+		static size_t Size(uint8_t nTag)
+		{
+			return size_t(1) + ((nTag >> 3) & 1) + ((nTag >> 4) & 3) + 1 + (nTag >> 6) + 1;
+		}
+
+		// Writes hdr to p, which has room for nMaxSize, returns the bytes used
+		static size_t Encode(uint8_t* p, const wire_header& hdr)
+		{
+			const uint32_t nId = WireOrder(hdr.id);
+			const uint32_t nSize = WireOrder(hdr.size);
+			const uint32_t nFlags = nSize >> 26;
+			const uint32_t nLength = nSize & nFrameSizeMask;
+			const size_t nIdBytes = size_t(1) + (nId > 0xFF) + (nId > 0xFFFF) + (nId > 0xFFFFFF);
+			const size_t nLengthBytes = size_t(1) + (nLength >= (1u << 10)) + (nLength >= (1u << 18));
+
+			p[0] = uint8_t(((nLengthBytes - 1) << 6) | ((nIdBytes - 1) << 4) | (nFlags ? 0x08 : 0) | ((nSize & nFrameCall) ? 0x04 : 0) | (nLength >> (8 * nLengthBytes)));
+			size_t n = 1;
+			if(nFlags)
+			{
+				p[n++] = uint8_t(nFlags);
+			}
+			const uint32_t nIdWire = WireOrder(nId);
+			const uint32_t nLengthWire = WireOrder(nLength);
+			std::memcpy(p + n, &nIdWire, nIdBytes);
+			n += nIdBytes;
+			std::memcpy(p + n, &nLengthWire, nLengthBytes);
+			return n + nLengthBytes;
+		}
+
+		// Reads a whole header from p back into the wire_header it stands for, false
+		// when it is malformed. Loads four bytes per field whatever their length and
+		// masks off the rest, so no branch on the lengths
+		static bool Decode(const uint8_t* p, wire_header& hdr)
+		{
+			const uint8_t nTag = p[0];
+			const size_t nHasFlags = (nTag >> 3) & 1;
+			const size_t nIdBytes = ((nTag >> 4) & 3) + 1;
+			const size_t nLengthBytes = (nTag >> 6) + 1;
+
+			uint32_t nId, nLength;
+			std::memcpy(&nId, p + 1 + nHasFlags, sizeof(uint32_t));
+			std::memcpy(&nLength, p + 1 + nHasFlags + nIdBytes, sizeof(uint32_t));
+			nId = WireOrder(nId) & uint32_t((uint64_t(1) << (8 * nIdBytes)) - 1);
+			nLength = uint32_t(((uint64_t(WireOrder(nLength)) & ((uint64_t(1) << (8 * nLengthBytes)) - 1)) | (uint64_t(nTag & 0x03) << (8 * nLengthBytes))));
+			const uint32_t nFlags = p[1] & (0u - uint32_t(nHasFlags));
+
+			hdr.id = WireOrder(nId);
+			hdr.size = WireOrder(nLength | (uint32_t(nTag & 0x04) << 23) | (nFlags << 26));
+			return nLengthBytes < 4 && nFlags < 0x40 && nLength <= nFrameSizeMask;
+		}
+	};
+
+	// Marks messages which are pieces of a stream rather than whole messages
+	enum class stream_part : uint8_t
+	{
+		none,
+		chunk,
+		last
+	};
+
 	template <typename T>
 	struct message
 	{
 		message_header<T> header{};
 		std::vector<uint8_t> body;
+		// Correlation ID of a request or its reply, 0 for plain messages
+		// Not part of the header, it is written after the body of the last frame
+		uint32_t nCall = 0;
+#ifdef NET_USE_TRACE
+		// Lifecycle trace this message was sampled into, 0 when it is not traced
+		uint64_t nTrace = 0;
+#endif
 
 		size_t size() const
 		{
@@ -31,6 +201,9 @@ namespace net
 		}
 	
 		// Pushes any POD-like data into message buffer,
+		// integers, enums and floats go in wire order, structs are copied as they are
+		// so only push structs of single bytes or push their fields one by one
+		// where hosts of either byte order talk to each other
 		template <typename DataType>
 		friend message<T>& operator << (message<T>& msg, const DataType& data)
 		{
@@ -44,7 +217,15 @@ namespace net
 			msg.body.resize(msg.body.size() + sizeof(DataType));
 
 			// Physically copy the data into the newly allocated vector space
-			std::memcpy(msg.body.data() + i, &data, sizeof(DataType));	
+			if constexpr(bWireScalar<DataType>)
+			{
+				const DataType wire = WireOrder(data);
+				std::memcpy(msg.body.data() + i, &wire, sizeof(DataType));
+			}
+			else
+			{
+				std::memcpy(msg.body.data() + i, &data, sizeof(DataType));
+			}
 
 			// Recalculate message size of the header
 			msg.header.size = msg.size();
@@ -65,6 +246,10 @@ namespace net
 		
 			// Physically copy the data from the vector into the user variable
 			std::memcpy(&data, msg.body.data() + i , sizeof(DataType));
+			if constexpr(bWireScalar<DataType>)
+			{
+				data = WireOrder(data);
+			}
 
 			// Shrink the vector to remove read bytes, and reset and position
 			msg.body.resize(i);
@@ -75,6 +260,26 @@ namespace net
 			// Returns the target message so it can be chained
 			return msg;
 		}
+
+		// Push nCount values in one go, in wire order, popped again with PopArray
+		template <typename DataType>
+		void PushArray(const DataType* pData, size_t nCount)
+		{
+			const size_t i = body.size();
+			body.resize(i + nCount * sizeof(DataType));
+			CopyToWire(body.data() + i, pData, nCount);
+			header.size = uint32_t(size());
+		}
+
+		// Pop the last nCount values pushed, same order as they went in
+		template <typename DataType>
+		void PopArray(DataType* pData, size_t nCount)
+		{
+			const size_t i = body.size() - nCount * sizeof(DataType);
+			CopyFromWire(pData, body.data() + i, nCount);
+			body.resize(i);
+			header.size = uint32_t(size());
+		}
 	};
 
 	// forward declare the connection
@@ -87,6 +292,7 @@ namespace net
 	{
 		std::shared_ptr<connection<T>> remote = nullptr;
 		message<T> msg;
+		stream_part eStream = stream_part::none;
 	
 		//friendly string maker
 		friend std::ostream& operator<<(std::ostream& os, const owned_message<T>& msg)
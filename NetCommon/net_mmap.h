@@ -0,0 +1,166 @@
+#pragma once
+// Memory mapped file, used for append only logs that must cost little more
+// than a memcpy on the hot path
+
+#include "net_common.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace net
+{
+	class mapped_file
+	{
+	public:
+		mapped_file() = default;
+		mapped_file(const mapped_file&) = delete;
+
+		virtual ~mapped_file()
+		{
+			Close();
+		}
+
+	public:
+		// Open or create sPath, grows the file to at least nSize and maps all of it
+		// read/write. Existing contents are kept
+		bool Open(const std::string& sPath, uint64_t nSize)
+		{
+			Close();
+
+#ifdef _WIN32
+			m_hFile = CreateFileA(sPath.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ,
+				nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+			if(m_hFile == INVALID_HANDLE_VALUE)
+			{
+				return false;
+			}
+
+			LARGE_INTEGER nExisting{};
+			GetFileSizeEx(m_hFile, &nExisting);
+			nSize = std::max<uint64_t>(nSize, uint64_t(nExisting.QuadPart));
+
+			m_hMapping = CreateFileMappingA(m_hFile, nullptr, PAGE_READWRITE,
+				DWORD(nSize >> 32), DWORD(nSize & 0xFFFFFFFF), nullptr);
+			if(m_hMapping == nullptr)
+			{
+				Close();
+				return false;
+			}
+
+			m_pData = static_cast<uint8_t*>(MapViewOfFile(m_hMapping, FILE_MAP_ALL_ACCESS, 0, 0, size_t(nSize)));
+			if(m_pData == nullptr)
+			{
+				Close();
+				return false;
+			}
+#else
+			m_nFile = ::open(sPath.c_str(), O_RDWR | O_CREAT, 0644);
+			if(m_nFile < 0)
+			{
+				return false;
+			}
+
+			struct stat st{};
+			::fstat(m_nFile, &st);
+			nSize = std::max<uint64_t>(nSize, uint64_t(st.st_size));
+			if(::ftruncate(m_nFile, off_t(nSize)) != 0)
+			{
+				Close();
+				return false;
+			}
+
+			void* p = ::mmap(nullptr, size_t(nSize), PROT_READ | PROT_WRITE, MAP_SHARED, m_nFile, 0);
+			if(p == MAP_FAILED)
+			{
+				Close();
+				return false;
+			}
+			m_pData = static_cast<uint8_t*>(p);
+#endif
+			m_nSize = nSize;
+			return true;
+		}
+
+		// Ask the OS to write dirty pages back, the mapping stays valid
+		void Flush()
+		{
+			if(m_pData == nullptr)
+			{
+				return;
+			}
+#ifdef _WIN32
+			FlushViewOfFile(m_pData, 0);
+#else
+			::msync(m_pData, size_t(m_nSize), MS_ASYNC);
+#endif
+		}
+
+		void Close()
+		{
+#ifdef _WIN32
+			if(m_pData != nullptr)
+			{
+				UnmapViewOfFile(m_pData);
+			}
+			if(m_hMapping != nullptr)
+			{
+				CloseHandle(m_hMapping);
+				m_hMapping = nullptr;
+			}
+			if(m_hFile != INVALID_HANDLE_VALUE)
+			{
+				CloseHandle(m_hFile);
+				m_hFile = INVALID_HANDLE_VALUE;
+			}
+#else
+			if(m_pData != nullptr)
+			{
+				::munmap(m_pData, size_t(m_nSize));
+			}
+			if(m_nFile >= 0)
+			{
+				::close(m_nFile);
+				m_nFile = -1;
+			}
+#endif
+			m_pData = nullptr;
+			m_nSize = 0;
+		}
+
+		bool IsOpen() const
+		{
+			return m_pData != nullptr;
+		}
+
+		uint8_t* data()
+		{
+			return m_pData;
+		}
+
+		const uint8_t* data() const
+		{
+			return m_pData;
+		}
+
+		uint64_t size() const
+		{
+			return m_nSize;
+		}
+
+	private:
+		uint8_t* m_pData = nullptr;
+		uint64_t m_nSize = 0;
+#ifdef _WIN32
+		HANDLE m_hFile = INVALID_HANDLE_VALUE;
+		HANDLE m_hMapping = nullptr;
+#else
+		int m_nFile = -1;
+#endif
+	};
+}
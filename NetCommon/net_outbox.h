@@ -0,0 +1,489 @@
+#pragma once
+// Durable outbox
+// With nFeatureDurable agreed, whatever the server sends a client through
+// MessageClient or MessageAllClients is first appended to memory mapped segment
+// files of that client's own, sDir/<id>.<segment>.netbox, under a sequence number
+// that travels after the message body. Frames are written to the socket straight
+// from the mapped pages. A client which drops and resumes its session sends the
+// last sequence it got, and the server sends it everything after that again,
+// including what was sent to it while it was away
+// Retention is bounded, each client keeps its newest nMaxSegments segments, and its
+// files go when its session expires. They outlive the process, a server opening
+// the same directory (after a handoff say) carries on from them
+
+#include "net_common.h"
+#include "net_message.h"
+#include "net_mmap.h"
+
+#include <charconv>
+#include <filesystem>
+#include <set>
+
+namespace net
+{
+	// Start of every segment file
+	struct outbox_segment_header
+	{
+		char magic[8];
+		uint64_t nUsed;		// bytes of the file holding records, header included
+		uint64_t nFirstSeq;	// 0 while there are no records
+		uint64_t nLastSeq;
+	};
+
+	// Start of every record, followed by nSize body bytes padded to 8
+	struct outbox_record
+	{
+		uint64_t nSeq;
+		uint32_t nId;		// message id as its underlying integer
+		uint32_t nSize;
+		uint32_t nCall;
+		priority ePriority;
+		uint8_t nReserved[3];
+	};
+
+	constexpr char sOutboxMagic[8] = { 'N','E','T','B','O','X','0','1' };
+
+	// Segment n of client nClient's outbox
+	inline std::string OutboxSegmentPath(const std::string& sDir, uint32_t nClient, uint32_t nSegment)
+	{
+		std::string sIndex = std::to_string(nSegment);
+		return sDir + "/" + std::to_string(nClient) + "." + std::string(sIndex.size() < 6 ? 6 - sIndex.size() : 0, '0') + sIndex + ".netbox";
+	}
+
+	// Reads the client and segment back from the name of a segment file, false for
+	// any other file
+	inline bool ParseOutboxSegmentName(const std::string& sName, uint32_t& nClient, uint32_t& nSegment)
+	{
+		const std::string sExtension = ".netbox";
+		const size_t nDot = sName.find('.');
+		if(nDot == std::string::npos || sName.size() <= nDot + 1 + sExtension.size() ||
+			sName.compare(sName.size() - sExtension.size(), sExtension.size(), sExtension) != 0)
+		{
+			return false;
+		}
+
+		const char* pEnd = sName.data() + sName.size() - sExtension.size();
+		const auto client = std::from_chars(sName.data(), sName.data() + nDot, nClient);
+		const auto segment = std::from_chars(sName.data() + nDot + 1, pEnd, nSegment);
+		return client.ec == std::errc() && client.ptr == sName.data() + nDot &&
+			segment.ec == std::errc() && segment.ptr == pEnd;
+	}
+
+	// Frames written from a segment hold on to it, so it stays mapped while they
+	// are in flight even once retention has deleted its file
+	struct outbox_segment
+	{
+		uint32_t nIndex = 0;
+		mapped_file file;
+
+		outbox_segment_header* Header() const
+		{
+			return reinterpret_cast<outbox_segment_header*>(const_cast<uint8_t*>(file.data()));
+		}
+	};
+
+	// A record in the outbox, the body points into its segment's mapping
+	struct outbox_entry
+	{
+		uint64_t nSeq;
+		uint32_t nId;
+		uint32_t nCall;
+		priority ePriority;
+		const uint8_t* pBody;
+		uint32_t nSize;
+		std::shared_ptr<const outbox_segment> pSegment;
+	};
+
+	// Client side, the sequences received so far, so that what the server sends
+	// again after a reconnect is not delivered twice
+	struct durable_cursor
+	{
+		// Every sequence up to this one has arrived, sent when resuming
+		uint64_t nContiguous = 0;
+		// Arrived past a gap, lanes overtake each other
+		std::set<uint64_t> setAhead;
+
+		// False when nSeq was delivered before
+		bool Accept(uint64_t nSeq)
+		{
+			if(nSeq <= nContiguous || !setAhead.insert(nSeq).second)
+			{
+				return false;
+			}
+			Advance();
+			return true;
+		}
+
+		// The server holds nothing before nFirst anymore, gaps below it stay gaps
+		void Skip(uint64_t nFirst)
+		{
+			if(nFirst > nContiguous + 1)
+			{
+				nContiguous = nFirst - 1;
+				setAhead.erase(setAhead.begin(), setAhead.lower_bound(nFirst));
+				Advance();
+			}
+		}
+
+		void Reset()
+		{
+			nContiguous = 0;
+			setAhead.clear();
+		}
+
+	private:
+		void Advance()
+		{
+			while(!setAhead.empty() && *setAhead.begin() == nContiguous + 1)
+			{
+				nContiguous++;
+				setAhead.erase(setAhead.begin());
+			}
+		}
+	};
+
+	// Segments of one client, oldest first
+	class client_outbox
+	{
+	public:
+		// vRecovered are the segments of this client an earlier process left behind
+		client_outbox(const std::string& sDir, uint32_t nClient, uint64_t nSegmentSize, uint32_t nMaxSegments, std::vector<uint32_t> vRecovered = {})
+			: m_sDir(sDir), m_nClient(nClient), m_nSegmentSize(nSegmentSize), m_nMaxSegments(std::max<uint32_t>(nMaxSegments, 1))
+		{
+			Recover(std::move(vRecovered));
+		}
+
+		client_outbox(const client_outbox&) = delete;
+
+		// Copies one record into the mapping, returns its sequence or 0 when it could not be stored
+		uint64_t Append(uint32_t nId, const uint8_t* pBody, uint32_t nSize, uint32_t nCall, priority ePriority, outbox_entry& entry)
+		{
+			const uint64_t nTotal = sizeof(outbox_record) + Padded(nSize);
+			if(m_deqSegments.empty() || m_deqSegments.back()->Header()->nUsed + nTotal > m_deqSegments.back()->file.size())
+			{
+				if(!NewSegment(std::max(m_nSegmentSize, nTotal + sizeof(outbox_segment_header))))
+				{
+					return 0;
+				}
+			}
+
+			outbox_segment& seg = *m_deqSegments.back();
+			outbox_segment_header* pHeader = seg.Header();
+			outbox_record rec{};
+			rec.nSeq = m_nNextSeq++;
+			rec.nId = nId;
+			rec.nSize = nSize;
+			rec.nCall = nCall;
+			rec.ePriority = ePriority;
+
+			uint8_t* p = seg.file.data() + pHeader->nUsed;
+			std::memcpy(p, &rec, sizeof(outbox_record));
+			if(nSize > 0)
+			{
+				std::memcpy(p + sizeof(outbox_record), pBody, nSize);
+			}
+
+			// Only counted once the bytes are in, a crash mid record leaves it out
+			pHeader->nFirstSeq = pHeader->nFirstSeq ? pHeader->nFirstSeq : rec.nSeq;
+			pHeader->nLastSeq = rec.nSeq;
+			pHeader->nUsed += nTotal;
+
+			entry = { rec.nSeq, nId, nCall, ePriority, p + sizeof(outbox_record), nSize, m_deqSegments.back() };
+			return rec.nSeq;
+		}
+
+		// Every record after nAfter, oldest first
+		void Since(uint64_t nAfter, std::vector<outbox_entry>& out) const
+		{
+			for(const auto& pSeg : m_deqSegments)
+			{
+				const outbox_segment_header* pHeader = pSeg->Header();
+				if(pHeader->nLastSeq <= nAfter)
+				{
+					continue;
+				}
+
+				for(uint64_t nOffset = sizeof(outbox_segment_header); nOffset + sizeof(outbox_record) <= pHeader->nUsed; )
+				{
+					outbox_record rec;
+					std::memcpy(&rec, pSeg->file.data() + nOffset, sizeof(outbox_record));
+					if(rec.nSeq > nAfter)
+					{
+						out.push_back({ rec.nSeq, rec.nId, rec.nCall, rec.ePriority, pSeg->file.data() + nOffset + sizeof(outbox_record), rec.nSize, pSeg });
+					}
+					nOffset += sizeof(outbox_record) + Padded(rec.nSize);
+				}
+			}
+		}
+
+		// Oldest sequence still held, the next one when there is none
+		uint64_t First() const
+		{
+			for(const auto& pSeg : m_deqSegments)
+			{
+				if(pSeg->Header()->nFirstSeq != 0)
+				{
+					return pSeg->Header()->nFirstSeq;
+				}
+			}
+			return m_nNextSeq;
+		}
+
+		// Segments the client has received all of are not needed anymore
+		void Trim(uint64_t nAcked)
+		{
+			while(m_deqSegments.size() > 1 && m_deqSegments.front()->Header()->nLastSeq <= nAcked)
+			{
+				DropFront();
+			}
+		}
+
+		// Deletes every segment, sequences start over
+		void Clear()
+		{
+			while(!m_deqSegments.empty())
+			{
+				DropFront();
+			}
+			m_nNextSeq = 1;
+		}
+
+	private:
+		static uint64_t Padded(uint64_t n)
+		{
+			return (n + 7) & ~uint64_t(7);
+		}
+
+		bool NewSegment(uint64_t nSize)
+		{
+			if(!m_deqSegments.empty())
+			{
+				m_deqSegments.back()->file.Flush();
+			}
+
+			auto pSeg = std::make_shared<outbox_segment>();
+			pSeg->nIndex = m_deqSegments.empty() ? m_nNextIndex : m_deqSegments.back()->nIndex + 1;
+			const std::string sPath = OutboxSegmentPath(m_sDir, m_nClient, pSeg->nIndex);
+			if(!pSeg->file.Open(sPath, nSize))
+			{
+				NET_LOG_ERROR("[OUTBOX] Cannot map ", sPath);
+				return false;
+			}
+
+			outbox_segment_header hdr{};
+			std::memcpy(hdr.magic, sOutboxMagic, sizeof(hdr.magic));
+			hdr.nUsed = sizeof(outbox_segment_header);
+			std::memcpy(pSeg->file.data(), &hdr, sizeof(hdr));
+			m_deqSegments.push_back(std::move(pSeg));
+
+			while(m_deqSegments.size() > m_nMaxSegments)
+			{
+				DropFront();
+			}
+			return true;
+		}
+
+		void DropFront()
+		{
+			m_nNextIndex = m_deqSegments.front()->nIndex + 1;
+			std::error_code ec;
+			std::filesystem::remove(OutboxSegmentPath(m_sDir, m_nClient, m_deqSegments.front()->nIndex), ec);
+			m_deqSegments.pop_front();
+		}
+
+		// Maps the segments an earlier process left behind
+		void Recover(std::vector<uint32_t> vIndex)
+		{
+			std::sort(vIndex.begin(), vIndex.end());
+
+			for(uint32_t nIndex : vIndex)
+			{
+				auto pSeg = std::make_shared<outbox_segment>();
+				pSeg->nIndex = nIndex;
+				if(!pSeg->file.Open(OutboxSegmentPath(m_sDir, m_nClient, nIndex), 0) || pSeg->file.size() < sizeof(outbox_segment_header) ||
+					std::memcmp(pSeg->Header()->magic, sOutboxMagic, sizeof(sOutboxMagic)) != 0 || pSeg->Header()->nUsed > pSeg->file.size())
+				{
+					continue;
+				}
+				m_nNextSeq = std::max(m_nNextSeq, pSeg->Header()->nLastSeq + 1);
+				m_deqSegments.push_back(std::move(pSeg));
+			}
+
+			while(m_deqSegments.size() > m_nMaxSegments)
+			{
+				DropFront();
+			}
+		}
+
+	private:
+		std::string m_sDir;
+		uint32_t m_nClient;
+		uint64_t m_nSegmentSize;
+		uint32_t m_nMaxSegments;
+		std::deque<std::shared_ptr<outbox_segment>> m_deqSegments;
+		uint32_t m_nNextIndex = 0;
+		uint64_t m_nNextSeq = 1;
+	};
+
+	// Outboxes of every client of a server
+	// The connection a client is on attaches to its outbox, records are handed to
+	// it as they are appended, from the appending thread with the outbox locked
+	class durable_outbox
+	{
+	public:
+		using sink = std::function<void(const outbox_entry&)>;
+
+		// Each client gets segments of nSegmentSize bytes and keeps the newest nMaxSegments
+		durable_outbox(const std::string& sDir, uint64_t nSegmentSize = 1024 * 1024, uint32_t nMaxSegments = 4)
+			: m_sDir(sDir), m_nSegmentSize(nSegmentSize), m_nMaxSegments(nMaxSegments)
+		{
+			std::error_code ec;
+			std::filesystem::create_directories(m_sDir, ec);
+			Rescan();
+		}
+
+		durable_outbox(const durable_outbox&) = delete;
+
+		// Looks up what an earlier process left in the directory, once here rather than
+		// by every client. Again when taking over from a process that kept writing to it
+		void Rescan()
+		{
+			std::scoped_lock lock(m_mux);
+			m_mapRecovered.clear();
+			std::error_code ec;
+			for(const auto& file : std::filesystem::directory_iterator(m_sDir, ec))
+			{
+				uint32_t nClient = 0;
+				uint32_t nSegment = 0;
+				if(ParseOutboxSegmentName(file.path().filename().string(), nClient, nSegment) && m_mapClients.count(nClient) == 0)
+				{
+					m_mapRecovered[nClient].push_back(nSegment);
+				}
+			}
+		}
+
+		// Stores msg for nClient and hands it to the connection attached, if any
+		template<typename T>
+		uint64_t Append(uint32_t nClient, const message<T>& msg, priority ePriority)
+		{
+			std::scoped_lock lock(m_mux);
+			client& c = Get(nClient);
+			outbox_entry entry;
+			const uint64_t nSeq = c.outbox.Append(uint32_t(static_cast<std::underlying_type_t<T>>(msg.header.id)),
+				msg.body.data(), uint32_t(msg.body.size()), msg.nCall, ePriority, entry);
+			if(nSeq != 0 && c.fnSink)
+			{
+				c.fnSink(entry);
+			}
+			return nSeq;
+		}
+
+		// pOwner is now nClient's connection: it is handed every record after nAcked,
+		// then everything appended from here on. Segments nAcked covers are deleted
+		// Returns the oldest sequence held, the client cannot get anything before it
+		uint64_t Attach(uint32_t nClient, const void* pOwner, sink fnSink, uint64_t nAcked)
+		{
+			std::scoped_lock lock(m_mux);
+			client& c = Get(nClient);
+			c.outbox.Trim(nAcked);
+
+			std::vector<outbox_entry> vEntries;
+			c.outbox.Since(nAcked, vEntries);
+			for(const auto& entry : vEntries)
+			{
+				fnSink(entry);
+			}
+
+			c.pOwner = pOwner;
+			c.fnSink = std::move(fnSink);
+			return c.outbox.First();
+		}
+
+		// As Attach, for a connection that already has everything sent before (handed over)
+		void Reattach(uint32_t nClient, const void* pOwner, sink fnSink)
+		{
+			std::scoped_lock lock(m_mux);
+			client& c = Get(nClient);
+			c.pOwner = pOwner;
+			c.fnSink = std::move(fnSink);
+		}
+
+		// pOwner is gone, records are only stored until another connection attaches
+		void Detach(uint32_t nClient, const void* pOwner)
+		{
+			std::scoped_lock lock(m_mux);
+			auto it = m_mapClients.find(nClient);
+			if(it != m_mapClients.end() && it->second->pOwner == pOwner)
+			{
+				it->second->pOwner = nullptr;
+				it->second->fnSink = nullptr;
+			}
+		}
+
+		// nClient's session is over, delete its segments
+		void Forget(uint32_t nClient)
+		{
+			std::scoped_lock lock(m_mux);
+			auto it = m_mapClients.find(nClient);
+			if(it != m_mapClients.end())
+			{
+				it->second->outbox.Clear();
+				m_mapClients.erase(it);
+			}
+
+			// Left by an earlier process and never mapped
+			auto itRecovered = m_mapRecovered.find(nClient);
+			if(itRecovered != m_mapRecovered.end())
+			{
+				std::error_code ec;
+				for(uint32_t nSegment : itRecovered->second)
+				{
+					std::filesystem::remove(OutboxSegmentPath(m_sDir, nClient, nSegment), ec);
+				}
+				m_mapRecovered.erase(itRecovered);
+			}
+		}
+
+	private:
+		struct client
+		{
+			client(const std::string& sDir, uint32_t nClient, uint64_t nSegmentSize, uint32_t nMaxSegments, std::vector<uint32_t> vRecovered)
+				: outbox(sDir, nClient, nSegmentSize, nMaxSegments, std::move(vRecovered))
+			{
+			}
+
+			client_outbox outbox;
+			const void* pOwner = nullptr;
+			sink fnSink;
+		};
+
+		// m_mux held
+		client& Get(uint32_t nClient)
+		{
+			auto& pClient = m_mapClients[nClient];
+			if(!pClient)
+			{
+				std::vector<uint32_t> vRecovered;
+				auto it = m_mapRecovered.find(nClient);
+				if(it != m_mapRecovered.end())
+				{
+					vRecovered = std::move(it->second);
+					m_mapRecovered.erase(it);
+				}
+				pClient = std::make_unique<client>(m_sDir, nClient, m_nSegmentSize, m_nMaxSegments, std::move(vRecovered));
+			}
+			return *pClient;
+		}
+
+	private:
+		std::string m_sDir;
+		uint64_t m_nSegmentSize;
+		uint32_t m_nMaxSegments;
+
+		// Appends come from every thread sending, the lock covers a memcpy and a post
+		std::mutex m_mux;
+		std::unordered_map<uint32_t, std::unique_ptr<client>> m_mapClients;
+		// Segment indices found on disk for clients not in m_mapClients yet
+		std::unordered_map<uint32_t, std::vector<uint32_t>> m_mapRecovered;
+	};
+}
@@ -0,0 +1,52 @@
+#pragma once
+// Cryptographically secure random bytes, for session tokens and anything else a
+// peer must not be able to guess. OpenSSL's generator when built with
+// NET_USE_TLS, otherwise the operating system's
+
+#include "net_common.h"
+
+#if defined(NET_USE_TLS)
+#include <openssl/rand.h>
+#elif defined(_WIN32)
+#include <windows.h>
+#include <bcrypt.h>
+#pragma comment(lib, "bcrypt.lib")
+#elif defined(__linux__)
+#include <sys/random.h>
+#include <cerrno>
+#else
+#include <stdlib.h>
+#endif
+
+namespace net
+{
+	// Fills p with n random bytes, false if the generator failed
+	inline bool SecureRandom(void* p, size_t n)
+	{
+#if defined(NET_USE_TLS)
+		return RAND_bytes(static_cast<unsigned char*>(p), int(n)) == 1;
+#elif defined(_WIN32)
+		return BCRYPT_SUCCESS(BCryptGenRandom(nullptr, static_cast<PUCHAR>(p), ULONG(n), BCRYPT_USE_SYSTEM_PREFERRED_RNG));
+#elif defined(__linux__)
+		uint8_t* pOut = static_cast<uint8_t*>(p);
+		while(n > 0)
+		{
+			const ssize_t nGot = getrandom(pOut, n, 0);
+			if(nGot < 0)
+			{
+				if(errno == EINTR)
+				{
+					continue;
+				}
+				return false;
+			}
+			pOut += nGot;
+			n -= size_t(nGot);
+		}
+		return true;
+#else
+		arc4random_buf(p, n);
+		return true;
+#endif
+	}
+}
@@ -0,0 +1,165 @@
+#pragma once
+// Inbound rate limiting
+// Token buckets for messages and bytes per second. A connection over its limit
+// stops reading until the buckets refill, so the excess waits in the kernel
+// and TCP slows the sender down, instead of piling up in the message queue
+
+#include "net_common.h"
+
+namespace net
+{
+	// Tokens refill at dRate per second up to dBurst. Taking more than is there
+	// leaves the bucket in debt, which must be paid back before the next take
+	class token_bucket
+	{
+	public:
+		using clock = std::chrono::steady_clock;
+
+		// A rate of 0 never limits
+		token_bucket(double dRate = 0.0, double dBurst = 0.0)
+			: m_dRate(dRate), m_dBurst(std::max(dBurst, dRate > 0.0 ? 1.0 : 0.0)), m_dTokens(m_dBurst)
+		{}
+
+	public:
+		void Take(double dAmount, clock::time_point tNow)
+		{
+			if(m_dRate > 0.0)
+			{
+				Refill(tNow);
+				m_dTokens -= dAmount;
+			}
+		}
+
+		// How long until the debt is paid back, zero when there is none
+		clock::duration Wait(clock::time_point tNow)
+		{
+			if(m_dRate <= 0.0)
+			{
+				return clock::duration::zero();
+			}
+
+			Refill(tNow);
+			if(m_dTokens >= 0.0)
+			{
+				return clock::duration::zero();
+			}
+			return std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(-m_dTokens / m_dRate)) + clock::duration(1);
+		}
+
+	private:
+		void Refill(clock::time_point tNow)
+		{
+			if(m_tLast != clock::time_point{})
+			{
+				m_dTokens = std::min(m_dBurst, m_dTokens + m_dRate * std::chrono::duration<double>(tNow - m_tLast).count());
+			}
+			m_tLast = tNow;
+		}
+
+	private:
+		double m_dRate;
+		double m_dBurst;
+		double m_dTokens;
+		clock::time_point m_tLast{};
+	};
+
+	// Limits for connections, shared by all of them. Each connection keeps its own
+	// buckets. Configure before handing it to the server, it is not changed afterwards
+	template<typename T>
+	class rate_limit
+	{
+	public:
+		// 0 leaves that side unlimited, bursts of dBurstSeconds worth are let through
+		rate_limit(double dMessagesPerSecond, double dBytesPerSecond, double dBurstSeconds = 1.0)
+			: m_dMessagesPerSecond(dMessagesPerSecond), m_dBytesPerSecond(dBytesPerSecond),
+			m_dBurstSeconds(std::max(dBurstSeconds, 0.0))
+		{}
+
+	public:
+		// Messages of id count as dCost messages, 1 unless set
+		void SetCost(T id, double dCost)
+		{
+			m_mapCosts[id] = std::max(dCost, 0.0);
+		}
+
+		double Cost(T id) const
+		{
+			auto it = m_mapCosts.find(id);
+			return it != m_mapCosts.end() ? it->second : 1.0;
+		}
+
+		token_bucket MessageBucket() const
+		{
+			return token_bucket(m_dMessagesPerSecond, m_dMessagesPerSecond * m_dBurstSeconds);
+		}
+
+		token_bucket ByteBucket() const
+		{
+			return token_bucket(m_dBytesPerSecond, m_dBytesPerSecond * m_dBurstSeconds);
+		}
+
+	private:
+		double m_dMessagesPerSecond;
+		double m_dBytesPerSecond;
+		double m_dBurstSeconds;
+		std::unordered_map<T, double> m_mapCosts;
+	};
+
+	// One connection's buckets, only touched from its asio thread
+	template<typename T>
+	class rate_limiter
+	{
+	public:
+		using clock = std::chrono::steady_clock;
+
+		void Configure(std::shared_ptr<const rate_limit<T>> pLimit)
+		{
+			m_pLimit = std::move(pLimit);
+			if(m_pLimit)
+			{
+				m_bucketMessages = m_pLimit->MessageBucket();
+				m_bucketBytes = m_pLimit->ByteBucket();
+			}
+		}
+
+		bool Enabled() const
+		{
+			return m_pLimit != nullptr;
+		}
+
+		// A frame of nBytes came off the wire
+		void ChargeBytes(size_t nBytes)
+		{
+			if(m_pLimit)
+			{
+				m_bucketBytes.Take(double(nBytes), clock::now());
+			}
+		}
+
+		// A whole message of id was delivered
+		void ChargeMessage(T id)
+		{
+			if(m_pLimit)
+			{
+				m_bucketMessages.Take(m_pLimit->Cost(id), clock::now());
+			}
+		}
+
+		// How long reading must wait, zero to carry on
+		clock::duration Wait()
+		{
+			if(!m_pLimit)
+			{
+				return clock::duration::zero();
+			}
+
+			const clock::time_point tNow = clock::now();
+			return std::max(m_bucketMessages.Wait(tNow), m_bucketBytes.Wait(tNow));
+		}
+
+	private:
+		std::shared_ptr<const rate_limit<T>> m_pLimit;
+		token_bucket m_bucketMessages;
+		token_bucket m_bucketBytes;
+	};
+}
@@ -0,0 +1,196 @@
+#pragma once
+// Replays the inbound side of a capture against a running server
+// One client connection per captured connection, all sharing a few asio threads
+
+#include "net_common.h"
+#include "net_tsqueue.h"
+#include "net_message.h"
+#include "net_connection.h"
+#include "net_capture.h"
+
+#include <map>
+
+namespace net
+{
+	struct replay_stats
+	{
+		size_t nSessions = 0;
+		uint64_t nFramesSent = 0;
+		uint64_t nBytesSent = 0;
+		uint64_t nFramesSkipped = 0;	// stream chunks, replayed only as whole messages
+		double dSeconds = 0.0;
+		double dMaxLagMs = 0.0;			// worst delay behind the captured schedule
+	};
+
+	template<typename T>
+	class capture_replay
+	{
+	public:
+		capture_replay(const std::string& sCaptureBase)
+			: m_sCaptureBase(sCaptureBase)
+		{
+		}
+
+		virtual ~capture_replay()
+		{
+			Stop();
+		}
+
+	public:
+		// dSpeed 1.0 keeps original timing, 10.0 runs ten times faster, 0 sends as fast as possible
+		replay_stats Run(const std::string& host, const uint16_t port, double dSpeed = 1.0, size_t nThreads = 2)
+		{
+			replay_stats stats;
+
+			// First pass, find every connection that sent something
+			std::map<uint32_t, size_t> mapSessions;
+			{
+				capture_reader reader(m_sCaptureBase);
+				captured_frame frame;
+				while(reader.Next(frame))
+				{
+					if(frame.rec.eDirection == capture_direction::in && mapSessions.count(frame.rec.nConnection) == 0)
+					{
+						const size_t nIndex = mapSessions.size();
+						mapSessions[frame.rec.nConnection] = nIndex;
+					}
+				}
+			}
+			stats.nSessions = mapSessions.size();
+
+			try
+			{
+				nThreads = std::max<size_t>(nThreads, 1);
+				for(size_t i = 0; i < nThreads; i++)
+				{
+					m_vContexts.push_back(std::make_unique<asio::io_context>());
+					m_vWork.push_back(std::make_unique<work_guard>(m_vContexts.back()->get_executor()));
+				}
+
+				asio::ip::tcp::resolver resolver(*m_vContexts[0]);
+				auto endpoints = resolver.resolve(host, std::to_string(port));
+
+				// Each connection lives on one context, so its handlers never run concurrently
+				for(size_t i = 0; i < mapSessions.size(); i++)
+				{
+					asio::io_context& ctx = *m_vContexts[i % nThreads];
+					m_vConnections.push_back(std::make_unique<connection<T>>(
+						connection<T>::owner::client, ctx, asio::ip::tcp::socket(ctx), m_qMessagesIn));
+					m_vConnections.back()->ConnectToServer(endpoints);
+				}
+
+				for(auto& ctx : m_vContexts)
+				{
+					asio::io_context* pCtx = ctx.get();
+					m_vThreads.emplace_back([pCtx]() { pCtx->run(); });
+				}
+			}
+			catch(std::exception& e)
+			{
+				NET_LOG_ERROR("[REPLAY] Exception: ", e.what());
+				Stop();
+				return stats;
+			}
+
+			// Let the validation handshakes finish before the first frame goes out
+			std::this_thread::sleep_for(std::chrono::milliseconds(500));
+
+			// Second pass, send every inbound frame on its session's connection
+			capture_reader reader(m_sCaptureBase);
+			captured_frame frame;
+			bool bFirst = true;
+			uint64_t nCaptureStart = 0;
+			const auto tStart = std::chrono::steady_clock::now();
+
+			while(reader.Next(frame))
+			{
+				if(frame.rec.eDirection != capture_direction::in)
+				{
+					continue;
+				}
+
+				if(frame.rec.eStream != stream_part::none)
+				{
+					stats.nFramesSkipped++;
+					continue;
+				}
+
+				if(bFirst)
+				{
+					nCaptureStart = frame.rec.nTime;
+					bFirst = false;
+				}
+
+				if(dSpeed > 0.0)
+				{
+					const auto tDue = tStart + std::chrono::nanoseconds(uint64_t(double(frame.rec.nTime - nCaptureStart) / dSpeed));
+					const auto tNow = std::chrono::steady_clock::now();
+					if(tNow < tDue)
+					{
+						std::this_thread::sleep_until(tDue);
+					}
+					else
+					{
+						stats.dMaxLagMs = std::max(stats.dMaxLagMs, std::chrono::duration<double, std::milli>(tNow - tDue).count());
+					}
+				}
+
+				message<T> msg;
+				msg.header.id = T(frame.rec.nId);
+				msg.body = std::move(frame.body);
+				msg.header.size = uint32_t(msg.body.size());
+
+				stats.nBytesSent += msg.body.size();
+				m_vConnections[mapSessions[frame.rec.nConnection]]->Send(msg);
+				stats.nFramesSent++;
+
+				// Replies are not interesting here, keep them from piling up
+				if((stats.nFramesSent & 0x3FF) == 0)
+				{
+					m_qMessagesIn.clear();
+				}
+			}
+
+			stats.dSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - tStart).count();
+
+			// Give the last frames time to leave before the caller tears the connections down
+			std::this_thread::sleep_for(std::chrono::milliseconds(500));
+			return stats;
+		}
+
+		void Stop()
+		{
+			m_vWork.clear();
+			for(auto& ctx : m_vContexts)
+			{
+				ctx->stop();
+			}
+			for(auto& thr : m_vThreads)
+			{
+				if(thr.joinable())
+				{
+					thr.join();
+				}
+			}
+
+			m_vThreads.clear();
+			m_vConnections.clear();
+			m_vContexts.clear();
+			m_qMessagesIn.clear();
+		}
+
+	private:
+		using work_guard = asio::executor_work_guard<asio::io_context::executor_type>;
+
+		std::string m_sCaptureBase;
+
+		// Contexts outlive the connections using them
+		std::vector<std::unique_ptr<asio::io_context>> m_vContexts;
+		std::vector<std::unique_ptr<work_guard>> m_vWork;
+		std::vector<std::thread> m_vThreads;
+		std::vector<std::unique_ptr<connection<T>>> m_vConnections;
+
+		// Shared by every replayed connection, only drained
+		tsqueue<owned_message<T>> m_qMessagesIn;
+	};
+}
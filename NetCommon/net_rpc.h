@@ -0,0 +1,157 @@
+#pragma once
+// Request / reply on top of message<T>
+// A request carries a call ID in its frame, the reply carries the same ID with
+// nCallReply set, so any number of calls can be in flight on one connection
+// and replies may come back in any order
+
+#include "net_common.h"
+#include "net_message.h"
+
+#include <map>
+
+namespace net
+{
+	// What a call's future throws when no reply came
+	class call_error : public std::runtime_error
+	{
+	public:
+		enum class reason
+		{
+			timed_out,
+			not_connected,
+			closed		// connection went away with the call pending
+		};
+
+		call_error(reason eReason)
+			: std::runtime_error(eReason == reason::timed_out ? "call timed out" :
+				eReason == reason::not_connected ? "not connected" : "connection closed"),
+			m_eReason(eReason)
+		{}
+
+		reason why() const
+		{
+			return m_eReason;
+		}
+
+	private:
+		reason m_eReason;
+	};
+
+	// Future that has already failed, for calls that cannot be sent
+	template<typename T>
+	std::future<message<T>> FailedCall(call_error::reason eReason)
+	{
+		std::promise<message<T>> promise;
+		promise.set_exception(std::make_exception_ptr(call_error(eReason)));
+		return promise.get_future();
+	}
+
+	// Calls a connection is waiting on, only touched from its asio thread
+	template<typename T>
+	class call_table
+	{
+	public:
+		using clock = std::chrono::steady_clock;
+
+		call_table() = default;
+		call_table(const call_table&) = delete;
+
+		virtual ~call_table()
+		{
+			FailAll(call_error::reason::closed);
+		}
+
+	public:
+		// Register a call, a zero timeout never expires, returns its ID
+		uint32_t Add(std::promise<message<T>> promise, std::chrono::milliseconds timeout)
+		{
+			do
+			{
+				m_nLastID = (m_nLastID + 1) & ~nCallReply;
+			} while(m_nLastID == 0 || m_mapPending.count(m_nLastID) != 0);
+
+			pending& p = m_mapPending[m_nLastID];
+			p.promise = std::move(promise);
+			p.itDeadline = m_mapDeadlines.end();
+			if(timeout.count() > 0)
+			{
+				p.itDeadline = m_mapDeadlines.emplace(clock::now() + timeout, m_nLastID);
+			}
+			return m_nLastID;
+		}
+
+		// Hand the reply to its caller, false for calls that already expired
+		bool Complete(uint32_t nCall, message<T>& reply)
+		{
+			auto it = m_mapPending.find(nCall);
+			if(it == m_mapPending.end())
+			{
+				return false;
+			}
+
+			reply.nCall = 0;
+			it->second.promise.set_value(std::move(reply));
+			Remove(it);
+			return true;
+		}
+
+		// Fail every call whose deadline is before tNow
+		void Expire(clock::time_point tNow)
+		{
+			while(!m_mapDeadlines.empty() && m_mapDeadlines.begin()->first <= tNow)
+			{
+				auto it = m_mapPending.find(m_mapDeadlines.begin()->second);
+				it->second.promise.set_exception(std::make_exception_ptr(call_error(call_error::reason::timed_out)));
+				Remove(it);
+			}
+		}
+
+		void FailAll(call_error::reason eReason)
+		{
+			for(auto& p : m_mapPending)
+			{
+				p.second.promise.set_exception(std::make_exception_ptr(call_error(eReason)));
+			}
+			m_mapPending.clear();
+			m_mapDeadlines.clear();
+		}
+
+		// Earliest deadline, false when no pending call has one
+		bool NextDeadline(clock::time_point& tNext) const
+		{
+			if(m_mapDeadlines.empty())
+			{
+				return false;
+			}
+			tNext = m_mapDeadlines.begin()->first;
+			return true;
+		}
+
+		size_t Size() const
+		{
+			return m_mapPending.size();
+		}
+
+	private:
+		struct pending
+		{
+			std::promise<message<T>> promise;
+			typename std::multimap<clock::time_point, uint32_t>::iterator itDeadline;
+		};
+
+		void Remove(typename std::unordered_map<uint32_t, pending>::iterator it)
+		{
+			if(it->second.itDeadline != m_mapDeadlines.end())
+			{
+				m_mapDeadlines.erase(it->second.itDeadline);
+			}
+			m_mapPending.erase(it);
+		}
+
+	private:
+		std::unordered_map<uint32_t, pending> m_mapPending;
+		// Deadline order, for expiring without a scan
+		std::multimap<clock::time_point, uint32_t> m_mapDeadlines;
+		uint32_t m_nLastID = 0;
+	};
+}
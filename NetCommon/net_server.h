@@ -4,6 +4,17 @@
 #include "net_tsqueue.h"
 #include "net_message.h"
 #include "net_connection.h"
+#include "net_dispatch.h"
+#include "net_workerpool.h"
+#include "net_capture.h"
+#include "net_handoff.h"
+#include "net_snapshot.h"
+#include "net_interest.h"
+#include "net_tick.h"
+#include "net_ratelimit.h"
+#include "net_delivery.h"
+#include "net_outbox.h"
+#include "net_random.h"
 
 namespace net
 {
@@ -11,8 +22,10 @@ namespace net
 	class server_interface
 	{
 	public:
+		// The port is bound by Start, unless the listening socket is taken over
+		// from a running server (StartFromHandoff)
 		server_interface(uint16_t port)
-			: m_asioAcceptor(m_asioContext, asio::ip::tcp::endpoint(asio::ip::tcp::v4(), port))
+			: m_asioAcceptor(m_asioContext), m_nPort(port)
 		{
 		
 		}
@@ -20,31 +33,60 @@ namespace net
 		virtual ~server_interface()
 		{
 			Stop();
+
+			// Connections hold sockets and timers of the context, which is destroyed first,
+			// messages not handled yet hold connections
+			m_qMessagesIn.clear();
+			m_deqUpdateBatch.clear();
+			{
+				std::scoped_lock lock(m_muxInterest);
+				m_mapPositioned.clear();
+				m_pInterestGrid.reset();
+				m_interestSets = interest_sets();
+			}
+			std::scoped_lock lock(m_muxConnections);
+			m_deqConnections.clear();
 		}
 
 		bool Start()
 		{
 			try
 			{
+				if(!m_asioAcceptor.is_open())
+				{
+					const asio::ip::tcp::endpoint endpoint(asio::ip::tcp::v4(), m_nPort);
+					m_asioAcceptor.open(endpoint.protocol());
+					m_asioAcceptor.set_option(asio::ip::tcp::acceptor::reuse_address(true));
+					m_asioAcceptor.bind(endpoint);
+					m_asioAcceptor.listen();
+				}
+
 				//impodtant order of commands
 				WaitForClientConnection();
 
 				// Launch the asio context in its own thread
-				m_threadContext = std::thread([this](){m_asioContext.run();});			
+				m_threadContext = std::thread([this]()
+					{
+						NET_TRACE_THREAD("server asio");
+						RunContext(m_asioContext, m_busyPoll);
+					});			
 			}
 			catch( std::exception& e)
 			{
 				// Something prohibited the server from listening 
-				std::cerr << "[SERVER] Exception: " << e.what() << "\n";
+				NET_LOG_ERROR("[SERVER] Exception: ", e.what());
 				return false;
 			}
 
-			std::cout << "[SERVER] Started!\n";
+			NET_LOG_INFO("[SERVER] Started!");
 			return true;
 		}
 
 		void Stop()
 		{
+			// Let handlers already handed to workers finish
+			StopWorkers();
+
 			// Request the context to close
 			m_asioContext.stop();
 
@@ -54,7 +96,7 @@ namespace net
 				m_threadContext.join();
 			}
 
-			std::cout << "[SERVER] Stopped!\n";
+			NET_LOG_INFO("[SERVER] Stopped!");
 		}
 
 		// ASYNC - instruct asio to wait for connection
@@ -66,7 +108,7 @@ namespace net
 				if(!ec)
 				{
 					// remote_endpoint gives the ip of the client
-					std::cout << "[SERVER] New connection: " << socket.remote_endpoint() << "\n";
+					NET_LOG_INFO("[SERVER] New connection: ", socket.remote_endpoint());
 
 					// Create a new connection to handle this client 
 					std::shared_ptr<connection<T>> newconn = 
@@ -77,23 +119,45 @@ namespace net
 					if( OnClientConnect(newconn))
 					{
 						// Connection allowed, so add to container of new connections
+						newconn->SetCapture(m_pCapture);
+						newconn->SetFeatures(m_nFeatures | (m_pOutbox ? nFeatureDurable : 0));
+						newconn->SetBusyPoll(m_busyPoll);
+						ApplyLinkSettings(newconn);
+#ifdef NET_USE_TLS
+						if(m_pTlsContext)
+						{
+							newconn->EnableTls(m_pTlsContext, m_bKernelTls);
+						}
+#endif
+						std::scoped_lock lock(m_muxConnections);
+						newconn->SetRateLimit(m_pRateLimit);
+						// Under the lock SetTickRate switches under, so it is corked or in the deque for it
+						if(m_bTicking)
+						{
+							newconn->SetCorked(true);
+						}
 						m_deqConnections.push_back(std::move(newconn));
 
 						// Issue a task to the connection's
 						// asio context to sit and wait for bytes to arrive!
 						m_deqConnections.back()->ConnectToClient(this, nIDCounter++);
 
-						std::cout<< "[" << m_deqConnections.back()->GetID() << "] Connection Approved\n";
+						NET_LOG_INFO("[", m_deqConnections.back()->GetID(), "] Connection Approved");
 					}
 					else
 					{
-						std::cout << "[-----] Connection Denied\n";
+						NET_LOG_INFO("[-----] Connection Denied");
 					}
 				}
+				else if(ec == asio::error::operation_aborted)
+				{
+					// Accepting was cancelled (handoff), the listening socket is no longer ours
+					return;
+				}
 				else
 				{
 					// Error during acceptance
-					std::cerr << "[SERVER] New Connection Error: " << ec.message() << "\n";
+					NET_LOG_ERROR("[SERVER] New Connection Error: ", ec.message());
 				}
 
 				// Prime the asio context with more work to wait for another 
@@ -103,50 +167,117 @@ namespace net
 		}
 	
 		// ASYNC - instruct asio to wait for connection
-		void MessageClient(std::shared_ptr<connection<T>> client, const message<T>& msg)
+		void MessageClient(std::shared_ptr<connection<T>> client, const message<T>& msg, priority ePriority = priority::normal)
 		{
-			if(client && client->IsConnected())
+			if(client && m_pOutbox && (client->Features() & nFeatureDurable))
+			{
+				// The outbox hands it to the client's connection, or keeps it until the client resumes
+				m_pOutbox->Append(client->GetID(), msg, ePriority);
+				if(!client->IsConnected())
+				{
+					// Messaging a client that is away does not make it lost again
+					std::scoped_lock lock(m_muxConnections);
+					auto it = std::find(m_deqConnections.begin(), m_deqConnections.end(), client);
+					if(it != m_deqConnections.end())
+					{
+						ClientLost(client);
+						m_deqConnections.erase(it);
+					}
+				}
+			}
+			else if(client && client->IsConnected())
 			{
-				client->Send(msg);
+				client->Send(msg, ePriority);
 			}
 			else
 			{
 				//if client disconnected between
-				OnClientDisconnect(client);
-				client.reset();
+				std::scoped_lock lock(m_muxConnections);
+				if(client)
+				{
+					ClientLost(client);
+				}
 				m_deqConnections.erase(std::remove(m_deqConnections.begin(), m_deqConnections.end(), client), m_deqConnections.end());
+				client.reset();
 			}
 		}
 
+		// Answer a Call from client, response reaches the future the client is waiting on
+		void Reply(std::shared_ptr<connection<T>> client, const message<T>& request, message<T> response, priority ePriority = priority::normal)
+		{
+			response.nCall = request.nCall != 0 ? request.nCall | nCallReply : 0;
+			MessageClient(client, response, ePriority);
+		}
+
 		// Send message to all clients
-		void MessageAllClients(const message<T>& msg, std::shared_ptr<connection<T>> pIgnoreClient = nullptr )
+		void MessageAllClients(const message<T>& msg, std::shared_ptr<connection<T>> pIgnoreClient = nullptr, priority ePriority = priority::normal)
 		{
 			bool bInvalidClientExist = false;
+			std::vector<std::shared_ptr<connection<T>>> vLost;
+
+			std::scoped_lock lock(m_muxConnections);
+
+			// With an outbox AdmitSession settles a client under the session lock as well,
+			// so this broadcast was either held for it or finds it admitted
+			std::unique_lock lockSessions(m_muxSessions, std::defer_lock);
+			if(m_pOutbox)
+			{
+				lockSessions.lock();
+			}
 
 			for( auto& client : m_deqConnections)
 			{
 				// Check client is connected
 				if(client && client->IsConnected())
 				{
-					if(client != pIgnoreClient)
+					if(client == pIgnoreClient)
+					{
+					}
+					else if(m_pOutbox && !client->IsAdmitted())
+					{
+						// Whether it is durable is not known yet, it gets this once that is
+						client->HoldBroadcast(msg, ePriority);
+					}
+					else if(!(m_pOutbox && (client->Features() & nFeatureDurable)))
 					{
-						client->Send(msg);		
+						// Durable clients get it through their outbox below
+						client->Send(msg, ePriority);		
 					}				
 				}	
 				else
 				{
 					// The client couldn't be contacted, so assume it has disconencted
-					OnClientDisconnect(client);
+					if(client)
+					{
+						vLost.push_back(client);
+					}
 					client.reset();
 					bInvalidClientExist = true;
 				}
 			}
 
+			// Durable clients, connected or away
+			if(m_pOutbox)
+			{
+				for(const auto& s : m_mapSessions)
+				{
+					if(s.second.bDurable && !(pIgnoreClient && pIgnoreClient->GetID() == s.first))
+					{
+						m_pOutbox->Append(s.first, msg, ePriority);
+					}
+				}
+				lockSessions.unlock();
+			}
+
+			for(auto& client : vLost)
+			{
+				ClientLost(client);
+			}
+
 			if(bInvalidClientExist)
 			{
 				m_deqConnections.erase(
-					m_deqConnections.erase(
-						std::remove(m_deqConnections.begin(), m_deqConnections.end(), nullptr), m_deqConnections.end()));							
+					std::remove(m_deqConnections.begin(), m_deqConnections.end(), nullptr), m_deqConnections.end());
 			}
 		}
 
@@ -154,64 +285,1261 @@ namespace net
 		{
 			if (bWait) 
 			{
-				m_qMessagesIn.wait();
+				if(m_busyPoll.bSpin)
+				{
+					m_qMessagesIn.spin_wait();
+				}
+				else
+				{
+					m_qMessagesIn.wait();
+				}
+			}
+
+			if(m_delivery.Active())
+			{
+				m_delivery.Rearm();
 			}
 
 			// Let user handle when messages are handled
 			// setting size_t to -1, sets it to the max number ofmessages
+			// The batch is taken under one lock, dispatch then runs without touching the queue
+			m_qMessagesIn.drain(m_deqUpdateBatch, nMaxMessages);
+			if(m_delivery.Active() && !m_qMessagesIn.empty())
+			{
+				// Left over past nMaxMessages, come back for them
+				m_delivery.Wake();
+			}
+
+			for(auto& msg : m_deqUpdateBatch)
+			{
+				// Messages without a remote only wake Update up
+				if(!msg.remote)
+				{
+					continue;
+				}
+
+				// Pass to message handler, or to the worker owning this client
+				if(m_pWorkers && msg.remote)
+				{
+					const uint32_t nKey = msg.remote->GetID();
+					m_pWorkers->Submit(nKey, [this, msg = std::move(msg)]() mutable
+						{
+							DispatchIncoming(msg);
+						});
+				}
+				else
+				{
+					DispatchIncoming(msg);
+				}
+			}
 
-			size_t nMessageCount = 0;
-			while( nMessageCount < nMaxMessages && !m_qMessagesIn.empty())
+			m_deqUpdateBatch.clear();
+
+#ifndef _WIN32
+			if(m_bHandoffRequested)
 			{
-				// Grab the front message
-				auto msg = m_qMessagesIn.pop_front();
+				if(m_asioContext.get_executor().running_in_this_thread())
+				{
+					// Handing off waits on the asio thread, so it can't be done from it
+					NET_LOG_WARN("[SERVER] Handoff needs Update off the asio thread");
+					m_bHandoffRequested = false;
+					m_sockHandoff.reset();
+					WaitForHandoff();
+				}
+				else
+				{
+					HandOff();
+				}
+			}
+#endif
+		}
 
-				// Pass to message handler
-				OnMessage(msg.remote, msg.msg);
+		// Run Update as work on ex whenever messages arrive, instead of from a thread
+		// waiting in it: ex is an io_context the application runs alongside its own
+		// timers and sockets, or a strand, anything running one handler at a time
+		// The executor of Context() handles messages on the asio thread itself, with
+		// no handoff between threads, but handlers then hold up the network while they run
+		// Call before Start, the server has to outlive the work posted to ex
+		template<typename Executor>
+		void DeliverOn(const Executor& ex)
+		{
+			m_delivery.PostTo(ex, [this]() { Update(); });
+			m_qMessagesIn.set_notify([this]() { m_delivery.Wake(); });
+		}
 
-				nMessageCount++;
-			}		
+		void DeliverOn(asio::io_context& ctx)
+		{
+			DeliverOn(ctx.get_executor());
 		}
 
-	public:
-		// Called when a client is validated
-		virtual void OnClientValidated(std::shared_ptr<connection<T>> client)
+		// Descriptor (eventfd on Linux) readable while messages wait, for an epoll or
+		// poll loop the application runs itself, which calls Update when it fires
+		// -1 on Windows. Call before Start
+		int DeliveryNotifier()
 		{
+			const int nFd = m_delivery.Notifier();
+			if(nFd >= 0)
+			{
+				m_qMessagesIn.set_notify([this]() { m_delivery.Wake(); });
+			}
+			return nFd;
 		}
 
-	protected:
-		// Called when client connects, can veto the connection by returning false
-		virtual bool OnClientConnect(std::shared_ptr<connection<T>> client)
+		// Context the connections run on, its thread is started by Start
+		asio::io_context& Context()
 		{
-			return false;
+			return m_asioContext;
 		}
 
-		// Called when a client appears to disconnected
-		virtual void OnClientDisconnect(std::shared_ptr<connection<T>> client)
+		// As Update with bWait, but returns false without handling anything
+		// if no message arrived within timeout
+		template<typename Rep, typename Period>
+		bool UpdateFor(const std::chrono::duration<Rep, Period>& timeout, size_t nMaxMessages = -1)
 		{
+			if(!(m_busyPoll.bSpin ? m_qMessagesIn.spin_for(timeout) : m_qMessagesIn.wait_for(timeout)))
+			{
+				return false;
+			}
 
+			Update(nMaxMessages, false);
+			return true;
 		}
 
-		// Called when message arrives
-		virtual void OnMessage( std::shared_ptr<connection<T>> client, message<T>& msg)
+		// Run the server at a fixed rate with Tick in place of Update: each tick handles
+		// inbound messages for up to budget (half the period when zero), calls OnTick,
+		// then writes everything sent during the tick in as few writes as possible
+		// Until then sends go out straight away. dHz of 0 goes back to that
+		void SetTickRate(double dHz, std::chrono::microseconds budget = std::chrono::microseconds(0))
 		{
-		
+			const bool bTicking = dHz > 0.0;
+			if(bTicking)
+			{
+				m_tickPeriod = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(1.0 / dHz));
+				m_tickBudget = budget.count() > 0 ? std::chrono::duration_cast<std::chrono::steady_clock::duration>(budget) : m_tickPeriod / 2;
+				m_tNextTick = std::chrono::steady_clock::now();
+				m_tLastTick = m_tNextTick;
+			}
+
+			// Connections accepted meanwhile read the flag under this lock too
+			std::scoped_lock lock(m_muxConnections);
+			m_bTicking = bTicking;
+			for(auto& client : m_deqConnections)
+			{
+				client->SetCorked(bTicking);
+			}
 		}
 
-	protected:
-		// Thread safe queuee of incomming message packets
-		tsqueue<owned_message<T>> m_qMessagesIn;
+		// Wait for the next tick and run it
+		void Tick()
+		{
+			using clock = std::chrono::steady_clock;
 
-		// Container of active validated connections
-		std::deque<std::shared_ptr<connection<T>>> m_deqConnections;
+			std::this_thread::sleep_until(m_tNextTick);
 
-		// Order of declaration is imporant, as its also order of initialisation
-		asio::io_context m_asioContext;
-		std::thread m_threadContext;
+			const clock::time_point tStart = clock::now();
+			m_tickStats.jitter.Add(std::chrono::duration<double, std::micro>(tStart - m_tNextTick).count());
 
-		//the address from whom the server will listen for connections
-		// needs an asio context
-		asio::ip::tcp::acceptor m_asioAcceptor;
+			// Inbound, in batches so the budget is checked often
+			const clock::time_point tBudgetEnd = tStart + m_tickBudget;
+			while(!m_qMessagesIn.empty())
+			{
+				if(clock::now() >= tBudgetEnd)
+				{
+					m_tickStats.nBudgetExhausted++;
+					break;
+				}
+				Update(nTickBatch, false);
+			}
+
+			OnTick(std::chrono::duration<double>(tStart - m_tLastTick).count());
+			m_tLastTick = tStart;
+
+			// Everything the tick sent leaves now
+			{
+				std::scoped_lock lock(m_muxConnections);
+				for(auto& client : m_deqConnections)
+				{
+					if(client)
+					{
+						client->Flush();
+					}
+				}
+			}
+
+			const clock::time_point tEnd = clock::now();
+			m_tickStats.duration.Add(std::chrono::duration<double, std::micro>(tEnd - tStart).count());
+			m_tickStats.nTicks++;
+
+			// An overrun starts the next tick at once, but never tries to catch up
+			// on more than one missed tick
+			m_tNextTick += m_tickPeriod;
+			if(tEnd > m_tNextTick)
+			{
+				m_tickStats.nOverruns++;
+				m_tNextTick = std::max(m_tNextTick, tEnd - m_tickPeriod);
+			}
+		}
+
+		// Duration, start jitter and overruns of the ticks so far
+		const tick_stats& TickStats() const
+		{
+			return m_tickStats;
+		}
+
+		void ResetTickStats()
+		{
+			m_tickStats = tick_stats{};
+		}
+
+		// Limit what each client accepted from now on may send, e.g.
+		//   auto limit = std::make_shared<net::rate_limit<T>>(1000, 1024 * 1024);
+		//   limit->SetCost(T::Expensive, 10);
+		//   SetRateLimit(limit);
+		// A client over its limit is not read from until it is back under, so one
+		// flooding client cannot fill the message queue. Null removes the limit
+		// Safe while running, the accept handler copies it under the same lock
+		void SetRateLimit(std::shared_ptr<const rate_limit<T>> pLimit)
+		{
+			std::scoped_lock lock(m_muxConnections);
+			m_pRateLimit = std::move(pLimit);
+		}
+
+		// Record all traffic of connections accepted from now on into
+		// sBase.NNNNNN.netcap segment files, call before Start
+		void EnableCapture(const std::string& sBase, uint64_t nSegmentSize = 256ull * 1024 * 1024)
+		{
+			m_pCapture = std::make_shared<capture_log>(sBase, nSegmentSize);
+		}
+
+		// Keep what is sent to clients asking for nFeatureDurable in memory mapped
+		// segment files under sDir, see net_outbox.h. MessageClient and MessageAllClients
+		// then reach a client that is away too, when it resumes it is sent whatever it
+		// missed. Kept for as long as the session is (SetSessionGracePeriod), at most the
+		// newest nMaxSegments segments of each client. Call before Start
+		void EnableOutbox(const std::string& sDir, uint64_t nSegmentSize = 1024 * 1024, uint32_t nMaxSegments = 4)
+		{
+			m_pOutbox = std::make_unique<durable_outbox>(sDir, nSegmentSize, nMaxSegments);
+		}
+
+		// Replicate a flat state with BroadcastSnapshot: each client is sent the bytes
+		// that changed since the snapshot it last acknowledged, as idSnapshot messages
+		// Clients apply them with snapshot_receiver and answer with its Acknowledgement
+		// under idAck, which the server handles itself. nHistory snapshots are kept
+		// as bases, a client further behind than that gets a full snapshot
+		void EnableSnapshots(T idSnapshot, T idAck, size_t nHistory = 32)
+		{
+			m_pSnapshots = std::make_unique<snapshot_replicator<T>>(idSnapshot, nHistory);
+			m_dispatcher.Register(idAck,
+				[this](std::shared_ptr<connection<T>> client, message<T>& msg)
+				{
+					uint32_t nSequence = 0;
+					if(msg.body.size() == sizeof(nSequence))
+					{
+						msg >> nSequence;
+						m_pSnapshots->Acknowledge(client->GetID(), nSequence);
+					}
+				});
+		}
+
+		// Send the state of this tick to all clients, in place of MessageAllClients
+		void BroadcastSnapshot(const void* pState, size_t nSize, priority ePriority = priority::normal)
+		{
+			if(!m_pSnapshots)
+			{
+				return;
+			}
+
+			m_pSnapshots->Push(pState, nSize);
+
+			bool bInvalidClientExist = false;
+			std::scoped_lock lock(m_muxConnections);
+			for(auto& client : m_deqConnections)
+			{
+				if(client && client->IsConnected())
+				{
+					client->Send(m_pSnapshots->MessageFor(client->GetID()), ePriority);
+				}
+				else
+				{
+					if(client)
+					{
+						ClientLost(client);
+					}
+					client.reset();
+					bInvalidClientExist = true;
+				}
+			}
+
+			if(bInvalidClientExist)
+			{
+				m_deqConnections.erase(
+					std::remove(m_deqConnections.begin(), m_deqConnections.end(), nullptr), m_deqConnections.end());
+			}
+		}
+
+		// Track client positions in a grid of fCellSize cells (about the usual radius),
+		// for MessageNearby and interest sets. b3D takes z into account
+		void EnableInterest(float fCellSize, bool b3D = false)
+		{
+			std::scoped_lock lock(m_muxInterest);
+			m_pInterestGrid = std::make_unique<interest_grid>(fCellSize, b3D);
+		}
+
+		// Where client is now, call whenever it moves
+		void SetClientPosition(std::shared_ptr<connection<T>> client, const interest_pos& pos)
+		{
+			std::scoped_lock lock(m_muxInterest);
+			if(m_pInterestGrid && client)
+			{
+				m_pInterestGrid->Set(client->GetID(), pos);
+				m_mapPositioned[client->GetID()] = client;
+			}
+		}
+
+		// Send msg to every positioned client within fRadius of pos, in place of
+		// MessageAllClients for anything only nearby clients care about
+		void MessageNearby(const interest_pos& pos, float fRadius, const message<T>& msg,
+			std::shared_ptr<connection<T>> pIgnoreClient = nullptr, priority ePriority = priority::normal)
+		{
+			std::scoped_lock lock(m_muxInterest);
+			if(!m_pInterestGrid)
+			{
+				return;
+			}
+
+			m_vInterestGone.clear();
+			m_pInterestGrid->Query(pos, fRadius, [&](uint32_t nID)
+				{
+					const auto& client = m_mapPositioned[nID];
+					if(!client->IsConnected())
+					{
+						m_vInterestGone.push_back(nID);
+					}
+					else if(client != pIgnoreClient)
+					{
+						client->Send(msg, ePriority);
+					}
+				});
+
+			// Lost for good once ClientLost sees them, until then they are just not placed
+			for(uint32_t nID : m_vInterestGone)
+			{
+				m_pInterestGrid->Remove(nID);
+				m_mapPositioned.erase(nID);
+			}
+		}
+
+		// Keep an interest set for client, the clients within fRadius of it, refreshed
+		// by UpdateInterest. A radius of 0 or less drops the set
+		void SetClientInterest(std::shared_ptr<connection<T>> client, float fRadius)
+		{
+			std::scoped_lock lock(m_muxInterest);
+			if(fRadius > 0.0f)
+			{
+				m_interestSets.Subscribe(client->GetID(), fRadius);
+			}
+			else
+			{
+				m_interestSets.Unsubscribe(client->GetID());
+			}
+		}
+
+		// IDs of the clients in client's interest set, as of the last UpdateInterest
+		std::vector<uint32_t> ClientInterest(std::shared_ptr<connection<T>> client)
+		{
+			std::scoped_lock lock(m_muxInterest);
+			return m_interestSets.Of(client->GetID());
+		}
+
+		// Requery every interest set after clients moved, typically once per tick
+		// OnInterestEnter / OnInterestLeave are called for the changes only
+		void UpdateInterest()
+		{
+			struct change
+			{
+				std::shared_ptr<connection<T>> client;
+				std::shared_ptr<connection<T>> other;
+				uint32_t nOther;
+			};
+			std::vector<change> vEnter, vLeave;
+
+			{
+				std::scoped_lock lock(m_muxInterest);
+				if(!m_pInterestGrid)
+				{
+					return;
+				}
+
+				auto Find = [this](uint32_t nID)
+				{
+					auto it = m_mapPositioned.find(nID);
+					return it != m_mapPositioned.end() ? it->second : nullptr;
+				};
+				m_interestSets.Refresh(*m_pInterestGrid,
+					[&](uint32_t nID, uint32_t nOther) { vEnter.push_back({ Find(nID), Find(nOther), nOther }); },
+					[&](uint32_t nID, uint32_t nOther) { vLeave.push_back({ Find(nID), nullptr, nOther }); });
+			}
+
+			// Hooks may send, or move clients, so they run unlocked
+			for(auto& c : vLeave)
+			{
+				if(c.client)
+				{
+					OnInterestLeave(c.client, c.nOther);
+				}
+			}
+			for(auto& c : vEnter)
+			{
+				if(c.client && c.other)
+				{
+					OnInterestEnter(c.client, c.other);
+				}
+			}
+		}
+
+		// Bytes sent as snapshots against what full snapshots would have cost
+		snapshot_stats SnapshotStats()
+		{
+			return m_pSnapshots ? m_pSnapshots->Stats() : snapshot_stats{};
+		}
+
+#ifndef _WIN32
+		// Let a newer process take over this server: it connects to the Unix socket
+		// at sPath and the next Update hands it the listening socket and all validated
+		// connections, after which IsHandedOff is true and this server is done
+		// TLS connections and connections still in the handshake are closed instead,
+		// their clients reconnect (and resume) to the new process
+		void EnableHandoff(const std::string& sPath)
+		{
+			::unlink(sPath.c_str());
+			m_pHandoffAcceptor = std::make_unique<asio::local::stream_protocol::acceptor>(
+				m_asioContext, asio::local::stream_protocol::endpoint(sPath));
+			WaitForHandoff();
+		}
+
+		// Start by taking over the server listening for a handoff at sPath rather than
+		// binding the port. Clients of the old process stay connected and keep their
+		// IDs, sessions and queued output. False if there was nothing to take over
+		bool StartFromHandoff(const std::string& sPath)
+		{
+			try
+			{
+				asio::local::stream_protocol::socket sockHandoff(m_asioContext);
+				asio::error_code ec;
+				sockHandoff.connect(asio::local::stream_protocol::endpoint(sPath), ec);
+				if(ec)
+				{
+					NET_LOG_INFO("[SERVER] No server to take over at ", sPath);
+					return false;
+				}
+				const int nSocket = sockHandoff.native_handle();
+
+				handoff_buffer state;
+				std::vector<int> vDescriptors;
+				if(!ReceiveHandoff(nSocket, state, vDescriptors) || vDescriptors.size() != 1)
+				{
+					throw std::runtime_error("no listening socket in handoff");
+				}
+				m_asioAcceptor.assign(asio::ip::tcp::v4(), vDescriptors[0]);
+
+				// The old process wrote its outbox up to the handoff
+				if(m_pOutbox)
+				{
+					m_pOutbox->Rescan();
+				}
+
+				uint64_t nSessions = 0;
+				uint64_t nConnections = 0;
+				if(!state.Get(nIDCounter) || !state.Get(nSessions))
+				{
+					throw std::runtime_error("handoff state truncated");
+				}
+
+				// Read whole before any of it is kept
+				const auto tNow = std::chrono::steady_clock::now();
+				std::vector<std::pair<uint32_t, session_record>> vSessions;
+				for(uint64_t i = 0; i < nSessions; i++)
+				{
+					uint32_t nID = 0;
+					session_record rec;
+					int64_t nGraceMs = 0;
+					if(!state.Get(nID) || !state.Get(rec.nToken) || !state.Get(nGraceMs) || !state.Get(rec.bDurable))
+					{
+						throw std::runtime_error("handoff state truncated");
+					}
+					rec.tExpires = nGraceMs < 0 ? std::chrono::steady_clock::time_point::max() : tNow + std::chrono::milliseconds(nGraceMs);
+					vSessions.emplace_back(nID, std::move(rec));
+				}
+				if(!state.Get(nConnections))
+				{
+					throw std::runtime_error("handoff state truncated");
+				}
+
+				{
+					std::scoped_lock lock(m_muxSessions);
+					for(auto& s : vSessions)
+					{
+						m_mapSessions[s.first] = std::move(s.second);
+					}
+				}
+
+				for(uint64_t i = 0; i < nConnections; i++)
+				{
+					if(!ReceiveHandoff(nSocket, state, vDescriptors) || vDescriptors.size() != 1)
+					{
+						throw std::runtime_error("handoff ended early");
+					}
+
+					auto newconn = std::make_shared<connection<T>>(connection<T>::owner::server, m_asioContext,
+						asio::ip::tcp::socket(m_asioContext, asio::ip::tcp::v4(), vDescriptors[0]), m_qMessagesIn);
+					newconn->SetCapture(m_pCapture);
+					{
+						std::scoped_lock lock(m_muxConnections);
+						newconn->SetRateLimit(m_pRateLimit);
+					}
+					newconn->SetBusyPoll(m_busyPoll);
+					ApplyLinkSettings(newconn);
+
+					std::vector<uint8_t> vAppState;
+					if(!newconn->Adopt(state) || !state.GetBytes(vAppState))
+					{
+						NET_LOG_WARN("[-----] Handoff Connection Dropped");
+						continue;
+					}
+
+					// Its lanes came along, only what is sent from now on is handed over
+					if(m_pOutbox && (newconn->Features() & nFeatureDurable))
+					{
+						m_pOutbox->Reattach(newconn->GetID(), newconn.get(), OutboxSink(newconn));
+					}
+
+					OnHandoffImport(newconn, vAppState);
+					std::scoped_lock lock(m_muxConnections);
+					if(m_bTicking)
+					{
+						newconn->SetCorked(true);
+					}
+					m_deqConnections.push_back(std::move(newconn));
+				}
+
+				NET_LOG_INFO("[SERVER] Took over ", nConnections, " connections");
+			}
+			catch(std::exception& e)
+			{
+				NET_LOG_ERROR("[SERVER] Handoff Exception: ", e.what());
+				return false;
+			}
+
+			return Start();
+		}
+
+		// This server gave its sockets to a newer process, stop calling Update
+		bool IsHandedOff() const
+		{
+			return m_bHandedOff;
+		}
+#endif
+
+		// nFeature bits clients connecting from now on may have, e.g. nFeatureCrc
+		// Each gets those it asks for and is allowed, see connection::Features
+		void SetFeatures(uint32_t nFeatures)
+		{
+			// nFeatureDurable comes with EnableOutbox
+			m_nFeatures = nFeatures & ~nFeatureDurable;
+		}
+
+		// Low latency mode, see net_busypoll.h, call before Start
+		// Spinning covers the asio thread and Update with bWait or UpdateFor, the
+		// thread calling those can be pinned with PinThread
+		void SetBusyPoll(const busy_poll& opts)
+		{
+			m_busyPoll = opts;
+		}
+
+		// For connections accepted from now on, see connection::SetMaxBufferedBytes,
+		// SetChunkSize and SetLaneWeights, call before Start
+		void SetMaxBufferedBytes(uint32_t nBytes)
+		{
+			m_nMaxBufferedBytes = nBytes;
+		}
+
+		void SetChunkSize(uint32_t nBytes)
+		{
+			m_nChunkSize = nBytes;
+		}
+
+		void SetLaneWeights(uint32_t nHigh, uint32_t nNormal, uint32_t nBulk)
+		{
+			m_nLaneWeights = { nHigh, nNormal, nBulk };
+		}
+
+#ifdef NET_USE_TLS
+		// Accept only TLS from connections made from now on, call before Start
+		// With bKernelOffload Linux encrypts records in the kernel when it can (kTLS)
+		void EnableTls(std::shared_ptr<asio::ssl::context> ctx, bool bKernelOffload = false)
+		{
+			m_pTlsContext = std::move(ctx);
+			m_bKernelTls = bKernelOffload;
+		}
+#endif
+
+		// Run handlers on nThreads workers instead of the thread calling Update
+		// Messages from one client keep their order, different clients run in parallel,
+		// so handlers must guard any state they share between clients
+		// Update blocks once a worker has nShardCapacity messages waiting
+		void StartWorkers(size_t nThreads, size_t nShardCapacity = 1024)
+		{
+			StopWorkers();
+			m_pWorkers = std::make_unique<worker_pool>(nThreads, nShardCapacity);
+		}
+
+		// Finish queued handlers and go back to running them inside Update
+		void StopWorkers()
+		{
+			if(m_pWorkers)
+			{
+				m_pWorkers->Stop();
+				m_pWorkers.reset();
+			}
+		}
+
+		// Register a handler for a single message id, takes priority over OnMessage
+		void RegisterHandler(T id, typename message_dispatcher<T, std::shared_ptr<connection<T>>>::handler fn)
+		{
+			m_dispatcher.Register(id, std::move(fn));
+		}
+
+		// Register a handler which receives the body decoded as a fixed Payload,
+		// messages with a different body size go to OnInvalidMessage instead
+		template<typename Payload, typename Fn>
+		void RegisterHandler(T id, Fn fn)
+		{
+			m_dispatcher.template Register<Payload>(id, std::move(fn));
+		}
+
+	protected:
+		void DispatchIncoming(owned_message<T>& msg)
+		{
+			NET_TRACE(msg.msg.nTrace, delivered, msg.remote->GetID(), msg.msg.header.id);
+			if(msg.eStream == stream_part::none)
+			{
+				DispatchMessage(msg.remote, msg.msg);
+				NET_TRACE(msg.msg.nTrace, handled, msg.remote->GetID(), msg.msg.header.id);
+				return;
+			}
+
+			// Chunk has been consumed once the handler returns, let the client send more
+			const uint32_t nBytes = uint32_t(msg.msg.body.size());
+			OnStreamData(msg.remote, msg.msg, msg.eStream == stream_part::last);
+			NET_TRACE(msg.msg.nTrace, handled, msg.remote->GetID(), msg.msg.header.id);
+			msg.remote->GrantStreamCredit(nBytes);
+		}
+
+		void DispatchMessage(std::shared_ptr<connection<T>> client, message<T>& msg)
+		{
+			switch(m_dispatcher.Dispatch(client, msg))
+			{
+			case dispatch_result::unhandled:
+				OnMessage(client, msg);
+				break;
+
+			case dispatch_result::bad_size:
+				OnInvalidMessage(client, msg);
+				break;
+
+			default:
+				break;
+			}
+		}
+
+	public:
+		// Called when a client is validated
+		virtual void OnClientValidated(std::shared_ptr<connection<T>> /*client*/)
+		{
+		}
+
+		// Called when a client reconnected with a valid ticket and got its old ID back,
+		// its session state is still available
+		virtual void OnClientResumed(std::shared_ptr<connection<T>> /*client*/)
+		{
+		}
+
+		// How long a disconnected client's ticket and session state are kept
+		void SetSessionGracePeriod(std::chrono::seconds grace)
+		{
+			std::scoped_lock lock(m_muxSessions);
+			m_sessionGrace = grace;
+		}
+
+		// Application data kept with the client's session, survives a resumed reconnect
+		void SetSessionState(uint32_t nID, std::any state)
+		{
+			std::scoped_lock lock(m_muxSessions);
+			auto it = m_mapSessions.find(nID);
+			if(it != m_mapSessions.end())
+			{
+				it->second.state = std::move(state);
+			}
+		}
+
+		std::any GetSessionState(uint32_t nID)
+		{
+			std::scoped_lock lock(m_muxSessions);
+			auto it = m_mapSessions.find(nID);
+			return it != m_mapSessions.end() ? it->second.state : std::any();
+		}
+
+		// Called by a connection once it passed validation, on the asio thread
+		session_ticket IssueSession(std::shared_ptr<connection<T>> client)
+		{
+			std::scoped_lock lock(m_muxSessions);
+			PurgeSessions();
+
+			session_ticket ticket;
+			ticket.nID = client->GetID();
+			ticket.nToken = NewToken();
+			m_mapSessions[ticket.nID] = { ticket.nToken, std::chrono::steady_clock::time_point::max(), {} };
+			return ticket;
+		}
+
+		// Called by a connection presenting a ticket, on the asio thread
+		// On success the old ID is kept, a fresh token goes into renewed and
+		// any connection still holding that ID is dropped
+		bool ResumeSession(std::shared_ptr<connection<T>> client, const session_ticket& ticket, session_ticket& renewed)
+		{
+			{
+				std::scoped_lock lock(m_muxSessions);
+				PurgeSessions();
+
+				auto it = m_mapSessions.find(ticket.nID);
+				if(it == m_mapSessions.end() || ticket.nToken == 0 || it->second.nToken != ticket.nToken)
+				{
+					return false;
+				}
+
+				renewed.nID = ticket.nID;
+				renewed.nToken = NewToken();
+				it->second.nToken = renewed.nToken;
+				it->second.tExpires = std::chrono::steady_clock::time_point::max();
+			}
+
+			{
+				// The server may not have noticed the old connection is gone
+				std::scoped_lock lock(m_muxConnections);
+				for(auto& old : m_deqConnections)
+				{
+					if(old && old != client && old->GetID() == ticket.nID)
+					{
+						// Its session carries on with the new connection, no grace period
+						old->Disconnect();
+						DropClientState(old);
+						OnClientDisconnect(old);
+						old.reset();
+					}
+				}
+				m_deqConnections.erase(
+					std::remove(m_deqConnections.begin(), m_deqConnections.end(), nullptr), m_deqConnections.end());
+			}
+
+			return true;
+		}
+
+		// Called by a connection once its session is settled, on the asio thread
+		// Marks it admitted and hands it the broadcasts held for it meanwhile. With
+		// nFeatureDurable a new session starts with an empty outbox, a resumed one is
+		// sent what it has not received. Returns the oldest sequence its outbox holds
+		uint64_t AdmitSession(std::shared_ptr<connection<T>> client, bool bResume, uint64_t nAcked)
+		{
+			const bool bDurable = m_pOutbox && (client->Features() & nFeatureDurable);
+			if(bDurable && !bResume)
+			{
+				// Segments left by an earlier process for the same ID are not this client's
+				m_pOutbox->Forget(client->GetID());
+			}
+
+			{
+				std::scoped_lock lock(m_muxSessions);
+				bool bWasDurable = false;
+				auto it = m_mapSessions.find(client->GetID());
+				if(it != m_mapSessions.end())
+				{
+					bWasDurable = it->second.bDurable;
+					it->second.bDurable = bDurable;
+				}
+				if(bWasDurable && !bDurable)
+				{
+					m_pOutbox->Forget(client->GetID());
+				}
+
+				// In the order they were broadcast, ahead of anything broadcast after
+				// A session that already was durable had them appended to its outbox
+				for(auto& held : client->Admitted())
+				{
+					if(!bDurable)
+					{
+						client->Send(held.first, held.second);
+					}
+					else if(!bWasDurable)
+					{
+						m_pOutbox->Append(client->GetID(), held.first, held.second);
+					}
+				}
+			}
+
+			if(!bDurable)
+			{
+				return 0;
+			}
+			return m_pOutbox->Attach(client->GetID(), client.get(), OutboxSink(client), nAcked);
+		}
+
+	protected:
+		// Called when client connects, can veto the connection by returning false
+		virtual bool OnClientConnect(std::shared_ptr<connection<T>> /*client*/)
+		{
+			return false;
+		}
+
+		// Called when a client appears to disconnected
+		virtual void OnClientDisconnect(std::shared_ptr<connection<T>> /*client*/)
+		{
+
+		}
+
+	private:
+		// Client found disconnected, its session now has a grace period to resume in
+		void ClientLost(std::shared_ptr<connection<T>> client)
+		{
+			DropClientState(client);
+
+			{
+				std::scoped_lock lock(m_muxSessions);
+				auto it = m_mapSessions.find(client->GetID());
+				if(it != m_mapSessions.end())
+				{
+					it->second.tExpires = std::chrono::steady_clock::now() + m_sessionGrace;
+				}
+			}
+
+			OnClientDisconnect(client);
+		}
+
+		// What the server keeps for client's connection, as opposed to its session
+		void DropClientState(std::shared_ptr<connection<T>> client)
+		{
+			// A resumed client starts over from a full snapshot
+			if(m_pSnapshots)
+			{
+				m_pSnapshots->Forget(client->GetID());
+			}
+
+			// and reports its position again
+			{
+				std::scoped_lock lock(m_muxInterest);
+				if(m_pInterestGrid)
+				{
+					m_pInterestGrid->Remove(client->GetID());
+				}
+				m_mapPositioned.erase(client->GetID());
+				m_interestSets.Unsubscribe(client->GetID());
+			}
+
+			// Its outbox keeps what is sent until it resumes
+			if(m_pOutbox)
+			{
+				m_pOutbox->Detach(client->GetID(), client.get());
+			}
+		}
+
+		// Whichever of them were set, the rest keep the connection's defaults
+		void ApplyLinkSettings(const std::shared_ptr<connection<T>>& client)
+		{
+			if(m_nMaxBufferedBytes)
+			{
+				client->SetMaxBufferedBytes(m_nMaxBufferedBytes);
+			}
+			if(m_nChunkSize)
+			{
+				client->SetChunkSize(m_nChunkSize);
+			}
+			if(m_nLaneWeights[0])
+			{
+				client->SetLaneWeights(m_nLaneWeights[0], m_nLaneWeights[1], m_nLaneWeights[2]);
+			}
+		}
+
+		// Hands outbox records to client while it lives
+		static durable_outbox::sink OutboxSink(const std::shared_ptr<connection<T>>& client)
+		{
+			return [wpClient = std::weak_ptr<connection<T>>(client)](const outbox_entry& entry)
+			{
+				if(auto pClient = wpClient.lock())
+				{
+					pClient->SendMapped(entry);
+				}
+			};
+		}
+
+#ifndef _WIN32
+		// ASYNC - wait for one newer process, the handoff itself runs in Update
+		void WaitForHandoff()
+		{
+			m_pHandoffAcceptor->async_accept(
+				[this](std::error_code ec, asio::local::stream_protocol::socket socket)
+				{
+					if(!ec)
+					{
+						NET_LOG_INFO("[SERVER] Handoff requested");
+						m_sockHandoff = std::make_unique<asio::local::stream_protocol::socket>(std::move(socket));
+						m_bHandoffRequested = true;
+
+						// Wake Update if it is waiting
+						m_qMessagesIn.push_back({});
+					}
+				});
+		}
+
+		// Run fn on the asio thread and wait for its result
+		template<typename Fn>
+		auto RunOnContext(Fn fn)
+		{
+			std::packaged_task<decltype(fn())()> task(std::move(fn));
+			auto result = task.get_future();
+			asio::post(m_asioContext, [&task]() { task(); });
+			return result.get();
+		}
+
+		// On the Update thread, handlers are not running anywhere else
+		void HandOff()
+		{
+			m_bHandoffRequested = false;
+			StopWorkers();
+
+			// Once every read is parked the context may run dry, keep its thread alive
+			auto work = asio::make_work_guard(m_asioContext);
+
+			// Stop accepting and bring every connection to a frame boundary
+			std::vector<std::shared_ptr<connection<T>>> vMoving = RunOnContext([this]()
+				{
+					std::vector<std::shared_ptr<connection<T>>> v;
+					m_asioAcceptor.cancel();
+					std::scoped_lock lock(m_muxConnections);
+					for(auto& client : m_deqConnections)
+					{
+						if(client && client->Freeze())
+						{
+							v.push_back(client);
+						}
+					}
+					return v;
+				});
+
+			const auto tGiveUp = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+			while(!RunOnContext([&vMoving]()
+				{
+					return std::all_of(vMoving.begin(), vMoving.end(), [](auto& c) { return c->IsFrozen(); });
+				}))
+			{
+				if(std::chrono::steady_clock::now() > tGiveUp)
+				{
+					// A peer not reading keeps a write in flight, carry on without the handoff
+					NET_LOG_ERROR("[SERVER] Handoff Timed Out");
+					RunOnContext([this, &vMoving]()
+						{
+							for(auto& client : vMoving)
+							{
+								client->Thaw();
+							}
+							WaitForClientConnection();
+							m_sockHandoff.reset();
+							WaitForHandoff();
+							return true;
+						});
+					return;
+				}
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			}
+
+			// Handle what already arrived, replies queue up in the frozen connections
+			m_qMessagesIn.drain(m_deqUpdateBatch);
+			for(auto& msg : m_deqUpdateBatch)
+			{
+				if(msg.remote)
+				{
+					DispatchIncoming(msg);
+				}
+			}
+			m_deqUpdateBatch.clear();
+
+			// Ship everything from the asio thread, it has nothing else to do meanwhile
+			m_bHandedOff = RunOnContext([this, &vMoving]() { return SendHandoffState(vMoving); });
+			if(m_bHandedOff)
+			{
+				NET_LOG_INFO("[SERVER] Handed off ", vMoving.size(), " connections");
+				OnHandedOff();
+			}
+		}
+
+		// Runs on the asio thread, closes this server's copies once they are sent
+		bool SendHandoffState(std::vector<std::shared_ptr<connection<T>>>& vMoving)
+		{
+			asio::error_code ec;
+			m_sockHandoff->non_blocking(false, ec);
+			const int nSocket = m_sockHandoff->native_handle();
+
+			// Moving connections which closed while freezing are left out
+			vMoving.erase(std::remove_if(vMoving.begin(), vMoving.end(),
+				[](auto& c) { return !c->IsConnected(); }), vMoving.end());
+
+			handoff_buffer state;
+			state.Put(nIDCounter);
+			{
+				std::scoped_lock lock(m_muxSessions);
+				const auto tNow = std::chrono::steady_clock::now();
+				state.Put(uint64_t(m_mapSessions.size()));
+				for(auto& s : m_mapSessions)
+				{
+					state.Put(s.first);
+					state.Put(s.second.nToken);
+					state.Put(s.second.tExpires == std::chrono::steady_clock::time_point::max() ? int64_t(-1) :
+						int64_t(std::chrono::duration_cast<std::chrono::milliseconds>(s.second.tExpires - tNow).count()));
+					state.Put(s.second.bDurable);
+				}
+			}
+			state.Put(uint64_t(vMoving.size()));
+
+			bool bOk = SendHandoff(nSocket, state, { int(m_asioAcceptor.native_handle()) });
+			for(auto& client : vMoving)
+			{
+				if(!bOk)
+				{
+					break;
+				}
+
+				state.clear();
+				client->Export(state);
+				std::vector<uint8_t> vAppState;
+				OnHandoffExport(client, vAppState);
+				state.PutBytes(vAppState);
+				bOk = SendHandoff(nSocket, state, { int(client->NativeHandle()) });
+			}
+
+			if(!bOk)
+			{
+				// The new process cannot have started with a partial handoff
+				NET_LOG_ERROR("[SERVER] Handoff Failed");
+				for(auto& client : vMoving)
+				{
+					client->Thaw();
+				}
+				WaitForClientConnection();
+				m_sockHandoff.reset();
+				WaitForHandoff();
+				return false;
+			}
+
+			// The new process holds its own descriptors, closing ours does not end anything
+			m_asioAcceptor.close(ec);
+			m_pHandoffAcceptor->close(ec);
+			m_sockHandoff.reset();
+			std::scoped_lock lock(m_muxConnections);
+			for(auto& client : m_deqConnections)
+			{
+				if(client)
+				{
+					client->Disconnect();
+				}
+			}
+			m_deqConnections.clear();
+			return true;
+		}
+#endif
+
+		// Drops sessions whose grace period ran out, m_muxSessions must be held
+		void PurgeSessions()
+		{
+			const auto tNow = std::chrono::steady_clock::now();
+			if(tNow < m_tNextPurge)
+			{
+				return;
+			}
+			m_tNextPurge = tNow + std::chrono::seconds(1);
+
+			for(auto it = m_mapSessions.begin(); it != m_mapSessions.end(); )
+			{
+				if(it->second.tExpires >= tNow)
+				{
+					++it;
+					continue;
+				}
+
+				if(m_pOutbox && it->second.bDurable)
+				{
+					m_pOutbox->Forget(it->first);
+				}
+				it = m_mapSessions.erase(it);
+			}
+		}
+
+		// Tokens stand in for the challenge, so they come from a secure generator
+		// If it fails the client gets no ticket, 0 never resumes
+		uint64_t NewToken()
+		{
+			uint64_t nToken = 0;
+			while(nToken == 0)
+			{
+				if(!SecureRandom(&nToken, sizeof(nToken)))
+				{
+					NET_LOG_ERROR("[SERVER] No secure random bytes for a session token");
+					return 0;
+				}
+			}
+			return nToken;
+		}
+
+	protected:
+		// Called when message arrives which has no registered handler
+		virtual void OnMessage( std::shared_ptr<connection<T>> /*client*/, message<T>& /*msg*/)
+		{
+		
+		}
+
+		// Called for every chunk of a stream the client sent with SendStream,
+		// in order, bLast is set on the final chunk
+		virtual void OnStreamData(std::shared_ptr<connection<T>> /*client*/, message<T>& /*chunk*/, bool /*bLast*/)
+		{
+
+		}
+
+		// Handoff, application state of one client to carry to the new process
+		virtual void OnHandoffExport(std::shared_ptr<connection<T>> /*client*/, std::vector<uint8_t>& /*state*/)
+		{
+		}
+
+		// Handoff, new process, client rebuilt with the state OnHandoffExport wrote
+		virtual void OnHandoffImport(std::shared_ptr<connection<T>> /*client*/, const std::vector<uint8_t>& /*state*/)
+		{
+		}
+
+		// Handoff, old process, the new process now owns every socket
+		virtual void OnHandedOff()
+		{
+		}
+
+		// Once per tick, dt is the seconds since the previous tick started
+		virtual void OnTick(double /*dt*/)
+		{
+		}
+
+		// Interest, other came within client's radius
+		virtual void OnInterestEnter(std::shared_ptr<connection<T>> /*client*/, std::shared_ptr<connection<T>> /*other*/)
+		{
+		}
+
+		// Interest, the client with ID nOther left client's radius or disconnected
+		virtual void OnInterestLeave(std::shared_ptr<connection<T>> /*client*/, uint32_t /*nOther*/)
+		{
+		}
+
+		// Called when a registered handler rejected the message body size
+		virtual void OnInvalidMessage(std::shared_ptr<connection<T>> client, message<T>& msg)
+		{
+			NET_LOG_WARN("[", client->GetID(), "] Invalid Message: ID: ", int(msg.header.id), " Size: ", msg.header.size);
+		}
+
+	protected:
+		// Thread safe queuee of incomming message packets
+		tsqueue<owned_message<T>> m_qMessagesIn;
+		// Messages taken out by the current Update, only touched by the Update thread
+		std::deque<owned_message<T>> m_deqUpdateBatch;
+
+		// Per message id handlers
+		message_dispatcher<T, std::shared_ptr<connection<T>>> m_dispatcher;
+
+		// Container of active validated connections
+		std::deque<std::shared_ptr<connection<T>>> m_deqConnections;
+		// Accept runs on the asio thread and handlers may run on workers,
+		// recursive so OnClientDisconnect can message other clients
+		std::recursive_mutex m_muxConnections;
+
+		// Sessions of validated clients by ID, kept for the grace period after a
+		// disconnect so the client can resume
+		struct session_record
+		{
+			uint64_t nToken = 0;
+			std::chrono::steady_clock::time_point tExpires;
+			std::any state;
+			// Has an outbox, see EnableOutbox
+			bool bDurable = false;
+		};
+		std::unordered_map<uint32_t, session_record> m_mapSessions;
+		std::mutex m_muxSessions;
+		std::chrono::seconds m_sessionGrace{ 30 };
+		std::chrono::steady_clock::time_point m_tNextPurge;
+
+		// Optional traffic recording handed to every new connection
+		std::shared_ptr<capture_log> m_pCapture;
+		// Durable delivery, null until EnableOutbox
+		std::unique_ptr<durable_outbox> m_pOutbox;
+		// Inbound limit handed to every new connection
+		std::shared_ptr<const rate_limit<T>> m_pRateLimit;
+		// Frame features new connections may agree to
+		uint32_t m_nFeatures = 0;
+		// Low latency mode of the asio thread, Update and every connection
+		busy_poll m_busyPoll;
+		// Link settings for new connections, 0 leaves the connection's default
+		uint32_t m_nMaxBufferedBytes = 0;
+		uint32_t m_nChunkSize = 0;
+		std::array<uint32_t, 3> m_nLaneWeights{};
+		// Wakes the application's own loop when messages arrive, see DeliverOn
+		inbox_delivery m_delivery;
+
+#ifdef NET_USE_TLS
+		// Set up every new connection for TLS when not null
+		std::shared_ptr<asio::ssl::context> m_pTlsContext;
+		bool m_bKernelTls = false;
+#endif
+
+		// Tick loop, see SetTickRate
+		static constexpr size_t nTickBatch = 64;
+		std::atomic<bool> m_bTicking = false;
+		std::chrono::steady_clock::duration m_tickPeriod{};
+		std::chrono::steady_clock::duration m_tickBudget{};
+		std::chrono::steady_clock::time_point m_tNextTick;
+		std::chrono::steady_clock::time_point m_tLastTick;
+		tick_stats m_tickStats;
+
+		// Client positions, null until EnableInterest, and the interest sets
+		std::unique_ptr<interest_grid> m_pInterestGrid;
+		interest_sets m_interestSets;
+		// Connections of the clients in the grid, by ID
+		std::unordered_map<uint32_t, std::shared_ptr<connection<T>>> m_mapPositioned;
+		std::vector<uint32_t> m_vInterestGone;
+		std::mutex m_muxInterest;
+
+		// Snapshot history and acknowledgements, null until EnableSnapshots
+		std::unique_ptr<snapshot_replicator<T>> m_pSnapshots;
+
+		// Optional handler threads, null runs handlers inside Update
+		std::unique_ptr<worker_pool> m_pWorkers;
+
+		// Order of declaration is imporant, as its also order of initialisation
+		asio::io_context m_asioContext;
+		std::thread m_threadContext;
+
+		//the address from whom the server will listen for connections
+		// needs an asio context
+		asio::ip::tcp::acceptor m_asioAcceptor;
+
+#ifndef _WIN32
+		// Handoff to a newer process, see EnableHandoff, declared after the context they use
+		std::unique_ptr<asio::local::stream_protocol::acceptor> m_pHandoffAcceptor;
+		std::unique_ptr<asio::local::stream_protocol::socket> m_sockHandoff;
+		std::atomic<bool> m_bHandoffRequested{ false };
+		bool m_bHandedOff = false;
+#endif
+
+		uint16_t m_nPort;
 
 		// Clients will be intentifed in the 'wider system' via an ID
 		// clients have unique ips, but we avoid sending those across to other clients
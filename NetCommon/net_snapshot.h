@@ -0,0 +1,375 @@
+#pragma once
+// Snapshot replication
+// The server keeps the last few snapshots of a flat (POD) state and, for each
+// client, the newest one it acknowledged. Each client is sent only the bytes
+// that changed since that one, or the whole state when it has nothing usable
+// (just joined, fell too far behind, or the state changed size)
+
+#include "net_common.h"
+#include "net_message.h"
+
+#include <map>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define NET_SNAPSHOT_SSE2
+#endif
+
+namespace net
+{
+	// Trails every snapshot message body, popped off first
+	struct snapshot_header
+	{
+		uint32_t nSequence;
+		uint32_t nBase;			// snapshot the delta applies to, 0 for a full snapshot
+		uint32_t nSize;			// size of the whole state
+		uint32_t nReserved;
+	};
+
+	// Granularity of the comparison, a changed byte sends its whole block
+	constexpr size_t nSnapshotBlock = 16;
+
+	inline bool SnapshotBlockEqual(const uint8_t* a, const uint8_t* b)
+	{
+#ifdef NET_SNAPSHOT_SSE2
+		const __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a));
+		const __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b));
+		return _mm_movemask_epi8(_mm_cmpeq_epi8(va, vb)) == 0xFFFF;
+#else
+		uint64_t a0, a1, b0, b1;
+		std::memcpy(&a0, a, 8);
+		std::memcpy(&a1, a + 8, 8);
+		std::memcpy(&b0, b, 8);
+		std::memcpy(&b1, b + 8, 8);
+		return ((a0 ^ b0) | (a1 ^ b1)) == 0;
+#endif
+	}
+
+	// Append the runs of state that differ from base, both nSize bytes long
+	// Each run is { uint32 offset, uint32 length, length bytes of state }, in wire order
+	inline void EncodeSnapshotDelta(const uint8_t* pBase, const uint8_t* pState, size_t nSize, std::vector<uint8_t>& vOut)
+	{
+		auto Run = [&](size_t nStart, size_t nEnd)
+		{
+			const uint32_t nRun[2] = { uint32_t(nStart), uint32_t(nEnd - nStart) };
+			const size_t i = vOut.size();
+			vOut.resize(i + sizeof(nRun) + (nEnd - nStart));
+			CopyToWire(vOut.data() + i, nRun, 2);
+			std::memcpy(vOut.data() + i + sizeof(nRun), pState + nStart, nEnd - nStart);
+		};
+
+		const size_t nBlocks = nSize / nSnapshotBlock;
+		size_t nRunStart = SIZE_MAX;
+		for(size_t b = 0; b < nBlocks; b++)
+		{
+			const size_t nOffset = b * nSnapshotBlock;
+			const bool bSame = SnapshotBlockEqual(pBase + nOffset, pState + nOffset);
+			if(!bSame && nRunStart == SIZE_MAX)
+			{
+				nRunStart = nOffset;
+			}
+			else if(bSame && nRunStart != SIZE_MAX)
+			{
+				Run(nRunStart, nOffset);
+				nRunStart = SIZE_MAX;
+			}
+		}
+
+		// The tail shorter than a block joins the last run or makes its own
+		const size_t nTail = nBlocks * nSnapshotBlock;
+		const bool bTailSame = std::memcmp(pBase + nTail, pState + nTail, nSize - nTail) == 0;
+		if(nRunStart != SIZE_MAX)
+		{
+			Run(nRunStart, bTailSame ? nTail : nSize);
+		}
+		else if(!bTailSame)
+		{
+			Run(nTail, nSize);
+		}
+	}
+
+	// Overwrite the runs in vState, false if the delta does not fit it
+	inline bool ApplySnapshotDelta(std::vector<uint8_t>& vState, const uint8_t* pDelta, size_t nDelta)
+	{
+		size_t i = 0;
+		while(i < nDelta)
+		{
+			uint32_t nRun[2];
+			if(nDelta - i < sizeof(nRun))
+			{
+				return false;
+			}
+			CopyFromWire(nRun, pDelta + i, 2);
+			i += sizeof(nRun);
+
+			if(nRun[1] > nDelta - i || size_t(nRun[0]) + nRun[1] > vState.size())
+			{
+				return false;
+			}
+			std::memcpy(vState.data() + nRun[0], pDelta + i, nRun[1]);
+			i += nRun[1];
+		}
+		return true;
+	}
+
+	struct snapshot_stats
+	{
+		uint64_t nSnapshots = 0;	// messages sent, across all clients
+		uint64_t nFull = 0;			// of which whole snapshots
+		uint64_t nBytesSent = 0;	// snapshot bodies as sent
+		uint64_t nBytesFull = 0;	// what whole snapshots every time would have been
+	};
+
+	// Server side, the history of snapshots and what each client has acknowledged
+	// Safe to use from several threads
+	template<typename T>
+	class snapshot_replicator
+	{
+	public:
+		snapshot_replicator(T idSnapshot, size_t nHistory = 32)
+			: m_idSnapshot(idSnapshot), m_nHistory(std::max<size_t>(nHistory, 1))
+		{}
+
+		virtual ~snapshot_replicator()
+		{}
+
+	public:
+		// Record the next snapshot, returns its sequence number
+		uint32_t Push(const void* pState, size_t nSize)
+		{
+			std::scoped_lock lock(m_mux);
+			if(++m_nSequence == 0)
+			{
+				m_nSequence = 1;
+			}
+
+			if(m_deqHistory.size() >= m_nHistory)
+			{
+				// Reuse the oldest buffer
+				m_deqHistory.push_back(std::move(m_deqHistory.front()));
+				m_deqHistory.pop_front();
+			}
+			else
+			{
+				m_deqHistory.emplace_back();
+			}
+
+			snapshot& s = m_deqHistory.back();
+			s.nSequence = m_nSequence;
+			s.vState.assign(static_cast<const uint8_t*>(pState), static_cast<const uint8_t*>(pState) + nSize);
+			return m_nSequence;
+		}
+
+		// Message taking nClient from its acknowledged snapshot to the newest one
+		message<T> MessageFor(uint32_t nClient)
+		{
+			std::scoped_lock lock(m_mux);
+
+			message<T> msg;
+			msg.header.id = m_idSnapshot;
+			if(m_deqHistory.empty())
+			{
+				return msg;
+			}
+
+			const snapshot& newest = m_deqHistory.back();
+			snapshot_header hdr{ newest.nSequence, 0, uint32_t(newest.vState.size()), 0 };
+
+			const snapshot* pBase = nullptr;
+			auto itAck = m_mapAcked.find(nClient);
+			if(itAck != m_mapAcked.end())
+			{
+				pBase = Find(itAck->second);
+			}
+
+			if(pBase != nullptr && pBase->vState.size() == newest.vState.size())
+			{
+				EncodeSnapshotDelta(pBase->vState.data(), newest.vState.data(), newest.vState.size(), msg.body);
+				hdr.nBase = pBase->nSequence;
+			}
+
+			// A delta touching most of the state costs more than the state itself
+			if(hdr.nBase == 0 || msg.body.size() >= newest.vState.size())
+			{
+				msg.body = newest.vState;
+				hdr.nBase = 0;
+				m_stats.nFull++;
+			}
+
+			m_stats.nSnapshots++;
+			m_stats.nBytesSent += msg.body.size();
+			m_stats.nBytesFull += newest.vState.size();
+
+			// Field by field so it reads the same on either byte order
+			msg << hdr.nSequence << hdr.nBase << hdr.nSize << hdr.nReserved;
+			return msg;
+		}
+
+		// nClient holds snapshot nSequence, 0 means it holds nothing usable
+		void Acknowledge(uint32_t nClient, uint32_t nSequence)
+		{
+			std::scoped_lock lock(m_mux);
+			if(nSequence == 0)
+			{
+				m_mapAcked.erase(nClient);
+				return;
+			}
+
+			// Acks may overtake each other on the worker pool, keep the newest
+			auto it = m_mapAcked.find(nClient);
+			if(it == m_mapAcked.end() || int32_t(nSequence - it->second) > 0)
+			{
+				m_mapAcked[nClient] = nSequence;
+			}
+		}
+
+		// Next snapshot for nClient is a full one
+		void Forget(uint32_t nClient)
+		{
+			std::scoped_lock lock(m_mux);
+			m_mapAcked.erase(nClient);
+		}
+
+		snapshot_stats Stats()
+		{
+			std::scoped_lock lock(m_mux);
+			return m_stats;
+		}
+
+	private:
+		struct snapshot
+		{
+			uint32_t nSequence = 0;
+			std::vector<uint8_t> vState;
+		};
+
+		const snapshot* Find(uint32_t nSequence) const
+		{
+			for(const auto& s : m_deqHistory)
+			{
+				if(s.nSequence == nSequence)
+				{
+					return &s;
+				}
+			}
+			return nullptr;
+		}
+
+	private:
+		T m_idSnapshot;
+		size_t m_nHistory;
+
+		std::mutex m_mux;
+		uint32_t m_nSequence = 0;
+		std::deque<snapshot> m_deqHistory;
+		// Client ID -> newest snapshot it acknowledged
+		std::unordered_map<uint32_t, uint32_t> m_mapAcked;
+		snapshot_stats m_stats;
+	};
+
+	// Client side, rebuilds the state from what snapshot_replicator sent and keeps
+	// the snapshots a delta may still be based on
+	template<typename T>
+	class snapshot_receiver
+	{
+	public:
+		snapshot_receiver(size_t nHistory = 32)
+			: m_nHistory(std::max<size_t>(nHistory, 1))
+		{}
+
+		virtual ~snapshot_receiver()
+		{}
+
+	public:
+		// Take in a snapshot message, false if it could not be applied
+		// Either way send Acknowledgement() back to the server afterwards
+		bool Apply(message<T>& msg)
+		{
+			snapshot_header hdr{};
+			if(msg.body.size() < sizeof(hdr))
+			{
+				return false;
+			}
+			msg >> hdr.nReserved >> hdr.nSize >> hdr.nBase >> hdr.nSequence;
+
+			std::vector<uint8_t> vState;
+			if(hdr.nBase == 0)
+			{
+				if(msg.body.size() != hdr.nSize)
+				{
+					return false;
+				}
+				vState = std::move(msg.body);
+			}
+			else
+			{
+				auto it = m_mapHistory.find(hdr.nBase);
+				if(it == m_mapHistory.end() || it->second.size() != hdr.nSize)
+				{
+					// Ask for a full one
+					m_nAck = 0;
+					return false;
+				}
+				vState = it->second;
+				if(!ApplySnapshotDelta(vState, msg.body.data(), msg.body.size()))
+				{
+					m_nAck = 0;
+					return false;
+				}
+			}
+
+			// Bases the server may still use are at most nHistory old
+			m_mapHistory[hdr.nSequence] = std::move(vState);
+			m_nLatest = hdr.nSequence;
+			m_nAck = hdr.nSequence;
+			while(m_mapHistory.size() > m_nHistory)
+			{
+				m_mapHistory.erase(Oldest());
+			}
+			return true;
+		}
+
+		// The newest state, empty until the first snapshot arrives
+		const std::vector<uint8_t>& State() const
+		{
+			static const std::vector<uint8_t> vNone;
+			auto it = m_mapHistory.find(m_nLatest);
+			return it != m_mapHistory.end() ? it->second : vNone;
+		}
+
+		uint32_t Sequence() const
+		{
+			return m_nLatest;
+		}
+
+		// Ack for the server, idAck being the id it expects acks under
+		message<T> Acknowledgement(T idAck) const
+		{
+			message<T> msg;
+			msg.header.id = idAck;
+			msg << m_nAck;
+			return msg;
+		}
+
+	private:
+		// Sequence numbers wrap, oldest is the one furthest behind the latest
+		typename std::map<uint32_t, std::vector<uint8_t>>::iterator Oldest()
+		{
+			auto itOldest = m_mapHistory.begin();
+			for(auto it = m_mapHistory.begin(); it != m_mapHistory.end(); ++it)
+			{
+				if(uint32_t(m_nLatest - it->first) > uint32_t(m_nLatest - itOldest->first))
+				{
+					itOldest = it;
+				}
+			}
+			return itOldest;
+		}
+
+	private:
+		size_t m_nHistory;
+		std::map<uint32_t, std::vector<uint8_t>> m_mapHistory;
+		uint32_t m_nLatest = 0;
+		uint32_t m_nAck = 0;
+	};
+}
@@ -0,0 +1,105 @@
+#pragma once
+// Fixed rate tick loop instrumentation
+// How long ticks take, how late they start, and how often they overrun
+
+#include "net_common.h"
+
+#include <cmath>
+
+namespace net
+{
+	// Counts of microsecond values in power of two buckets:
+	// bucket 0 is under 1us, bucket i is [2^(i-1), 2^i) us, the last one everything above
+	class latency_histogram
+	{
+	public:
+		static constexpr size_t nBuckets = 24;
+
+		void Add(double dMicroseconds)
+		{
+			size_t i = 0;
+			if(dMicroseconds >= 1.0)
+			{
+				i = std::min<size_t>(size_t(std::log2(dMicroseconds)) + 1, nBuckets - 1);
+			}
+			m_nCounts[i]++;
+			m_nTotal++;
+			m_dSum += dMicroseconds;
+			m_dMax = std::max(m_dMax, dMicroseconds);
+		}
+
+		uint64_t Count() const
+		{
+			return m_nTotal;
+		}
+
+		double Mean() const
+		{
+			return m_nTotal > 0 ? m_dSum / double(m_nTotal) : 0.0;
+		}
+
+		double Max() const
+		{
+			return m_dMax;
+		}
+
+		// Upper edge of the bucket holding the fraction dP (0..1) of values
+		double Percentile(double dP) const
+		{
+			const uint64_t nWanted = uint64_t(std::ceil(dP * double(m_nTotal)));
+			uint64_t nSeen = 0;
+			for(size_t i = 0; i < nBuckets; i++)
+			{
+				nSeen += m_nCounts[i];
+				if(nSeen >= nWanted && nSeen > 0)
+				{
+					return std::min(UpperEdge(i), m_dMax);
+				}
+			}
+			return m_dMax;
+		}
+
+		const std::array<uint64_t, nBuckets>& Buckets() const
+		{
+			return m_nCounts;
+		}
+
+		static double UpperEdge(size_t i)
+		{
+			return std::ldexp(1.0, int(i));
+		}
+
+		void Clear()
+		{
+			*this = latency_histogram();
+		}
+
+		// One line per non empty bucket
+		friend std::ostream& operator<<(std::ostream& os, const latency_histogram& h)
+		{
+			for(size_t i = 0; i < nBuckets; i++)
+			{
+				if(h.m_nCounts[i] > 0)
+				{
+					os << "  < " << UpperEdge(i) << " us: " << h.m_nCounts[i] << "\n";
+				}
+			}
+			return os;
+		}
+
+	private:
+		std::array<uint64_t, nBuckets> m_nCounts{};
+		uint64_t m_nTotal = 0;
+		double m_dSum = 0.0;
+		double m_dMax = 0.0;
+	};
+
+	struct tick_stats
+	{
+		uint64_t nTicks = 0;
+		uint64_t nOverruns = 0;			// ticks that did not finish within their period
+		uint64_t nBudgetExhausted = 0;	// ticks that left inbound messages for the next one
+		latency_histogram duration;		// start to end of each tick, us
+		latency_histogram jitter;		// how late each tick started, us
+	};
+}
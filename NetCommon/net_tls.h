@@ -0,0 +1,310 @@
+#pragma once
+// Optional TLS transport, compiled in with NET_USE_TLS (needs OpenSSL)
+// Contexts for either side, a client side session cache so reconnects resume
+// instead of doing the full handshake, and a stream that leaves record
+// encryption to the kernel (kTLS) where Linux and OpenSSL support it
+
+#include "net_common.h"
+
+#ifdef NET_USE_TLS
+
+#include <map>
+
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+
+namespace net
+{
+	// Server context presenting the PEM certificate chain and private key files
+	inline std::shared_ptr<asio::ssl::context> MakeServerTlsContext(const std::string& sCertChainFile, const std::string& sPrivateKeyFile)
+	{
+		auto ctx = std::make_shared<asio::ssl::context>(asio::ssl::context::tls_server);
+		ctx->set_options(asio::ssl::context::default_workarounds | asio::ssl::context::no_sslv2 |
+			asio::ssl::context::no_sslv3 | asio::ssl::context::no_tlsv1 | asio::ssl::context::no_tlsv1_1);
+		ctx->use_certificate_chain_file(sCertChainFile);
+		ctx->use_private_key_file(sPrivateKeyFile, asio::ssl::context::pem);
+		return ctx;
+	}
+
+	// Client context verifying the server against sCAFile, or the system's
+	// trusted roots when empty
+	inline std::shared_ptr<asio::ssl::context> MakeClientTlsContext(const std::string& sCAFile = {})
+	{
+		auto ctx = std::make_shared<asio::ssl::context>(asio::ssl::context::tls_client);
+		ctx->set_options(asio::ssl::context::default_workarounds | asio::ssl::context::no_sslv2 |
+			asio::ssl::context::no_sslv3 | asio::ssl::context::no_tlsv1 | asio::ssl::context::no_tlsv1_1);
+		if(sCAFile.empty())
+		{
+			ctx->set_default_verify_paths();
+		}
+		else
+		{
+			ctx->load_verify_file(sCAFile);
+		}
+		ctx->set_verify_mode(asio::ssl::verify_peer);
+		return ctx;
+	}
+
+	// Client side store of the sessions (TLS 1.3 tickets or 1.2 session data)
+	// servers handed out, one per server key, presented again on the next handshake
+	class tls_session_cache
+	{
+	public:
+		tls_session_cache() = default;
+		tls_session_cache(const tls_session_cache&) = delete;
+
+		virtual ~tls_session_cache()
+		{
+			Clear();
+		}
+
+	public:
+		// Let ctx hand new sessions to a cache, OpenSSL's own store is not used
+		static void Attach(asio::ssl::context& ctx)
+		{
+			SSL_CTX_set_session_cache_mode(ctx.native_handle(), SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+			SSL_CTX_sess_set_new_cb(ctx.native_handle(), &tls_session_cache::OnNewSession);
+		}
+
+		// Before the handshake: offer the session cached for *pKey and keep any new
+		// one under it. The cache and *pKey must outlive ssl
+		void Prepare(SSL* ssl, const std::string* pKey)
+		{
+			SSL_set_ex_data(ssl, CacheIndex(), this);
+			SSL_set_ex_data(ssl, KeyIndex(), const_cast<std::string*>(pKey));
+
+			std::scoped_lock lock(m_mux);
+			auto it = m_mapSessions.find(*pKey);
+			if(it != m_mapSessions.end())
+			{
+				SSL_set_session(ssl, it->second);
+			}
+		}
+
+		void Clear()
+		{
+			std::scoped_lock lock(m_mux);
+			for(auto& s : m_mapSessions)
+			{
+				SSL_SESSION_free(s.second);
+			}
+			m_mapSessions.clear();
+		}
+
+		size_t Size()
+		{
+			std::scoped_lock lock(m_mux);
+			return m_mapSessions.size();
+		}
+
+	private:
+		static int CacheIndex()
+		{
+			static const int nIndex = SSL_get_ex_new_index(0, nullptr, nullptr, nullptr, nullptr);
+			return nIndex;
+		}
+
+		static int KeyIndex()
+		{
+			static const int nIndex = SSL_get_ex_new_index(0, nullptr, nullptr, nullptr, nullptr);
+			return nIndex;
+		}
+
+		// Runs on the asio thread, returning 1 keeps the reference OpenSSL passed in
+		static int OnNewSession(SSL* ssl, SSL_SESSION* session)
+		{
+			tls_session_cache* pCache = static_cast<tls_session_cache*>(SSL_get_ex_data(ssl, CacheIndex()));
+			const std::string* pKey = static_cast<const std::string*>(SSL_get_ex_data(ssl, KeyIndex()));
+			if(pCache == nullptr || pKey == nullptr || !SSL_SESSION_is_resumable(session))
+			{
+				return 0;
+			}
+
+			std::scoped_lock lock(pCache->m_mux);
+			SSL_SESSION*& slot = pCache->m_mapSessions[*pKey];
+			if(slot != nullptr)
+			{
+				SSL_SESSION_free(slot);
+			}
+			slot = session;
+			return 1;
+		}
+
+	private:
+		std::mutex m_mux;
+		std::map<std::string, SSL_SESSION*> m_mapSessions;
+	};
+
+	// TLS directly on the socket descriptor rather than through asio's memory BIOs,
+	// which is what lets OpenSSL hand the record layer to the kernel (SSL_OP_ENABLE_KTLS)
+	// Once offloaded, SSL_read and SSL_write are plain recv and send on the socket
+	// Without kernel support it still works, OpenSSL encrypts in userspace
+	// Meets asio's AsyncReadStream and AsyncWriteStream so asio::async_read/write compose on it
+	class ktls_stream
+	{
+	public:
+		using executor_type = asio::ip::tcp::socket::executor_type;
+
+		ktls_stream(asio::ip::tcp::socket& socket, asio::ssl::context& ctx)
+			: m_socket(socket), m_ssl(SSL_new(ctx.native_handle()))
+		{
+			if(m_ssl == nullptr)
+			{
+				throw std::runtime_error("SSL_new failed");
+			}
+
+#ifdef SSL_OP_ENABLE_KTLS
+			SSL_set_options(m_ssl, SSL_OP_ENABLE_KTLS);
+#endif
+			// Retries may continue a partial write from wherever asio moved the buffer
+			SSL_set_mode(m_ssl, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+			m_socket.non_blocking(true);
+			SSL_set_fd(m_ssl, int(m_socket.native_handle()));
+		}
+
+		ktls_stream(const ktls_stream&) = delete;
+
+		virtual ~ktls_stream()
+		{
+			SSL_free(m_ssl);
+		}
+
+	public:
+		SSL* native_handle()
+		{
+			return m_ssl;
+		}
+
+		executor_type get_executor()
+		{
+			return m_socket.get_executor();
+		}
+
+		// Whether records are encrypted / decrypted by the kernel, valid after the handshake
+		bool IsKernelSend() const
+		{
+			return BIO_get_ktls_send(SSL_get_wbio(m_ssl)) != 0;
+		}
+
+		bool IsKernelReceive() const
+		{
+			return BIO_get_ktls_recv(SSL_get_rbio(m_ssl)) != 0;
+		}
+
+		template<typename Handler>
+		void async_handshake(asio::ssl::stream_base::handshake_type type, Handler&& handler)
+		{
+			if(type == asio::ssl::stream_base::client)
+			{
+				SSL_set_connect_state(m_ssl);
+			}
+			else
+			{
+				SSL_set_accept_state(m_ssl);
+			}
+
+			Perform([this]() { return SSL_do_handshake(m_ssl); },
+				[h = std::forward<Handler>(handler)](const asio::error_code& ec, size_t) mutable { h(ec); });
+		}
+
+		template<typename MutableBufferSequence, typename ReadHandler>
+		void async_read_some(const MutableBufferSequence& buffers, ReadHandler&& handler)
+		{
+			const asio::mutable_buffer b = First<asio::mutable_buffer>(buffers);
+			Perform([this, b]()
+				{
+					size_t nRead = 0;
+					return SSL_read_ex(m_ssl, b.data(), b.size(), &nRead) == 1 ? int(nRead) : -1;
+				}, std::forward<ReadHandler>(handler), b.size() == 0);
+		}
+
+		template<typename ConstBufferSequence, typename WriteHandler>
+		void async_write_some(const ConstBufferSequence& buffers, WriteHandler&& handler)
+		{
+			const asio::const_buffer b = First<asio::const_buffer>(buffers);
+			Perform([this, b]()
+				{
+					size_t nWritten = 0;
+					return SSL_write_ex(m_ssl, b.data(), b.size(), &nWritten) == 1 ? int(nWritten) : -1;
+				}, std::forward<WriteHandler>(handler), b.size() == 0);
+		}
+
+	private:
+		template<typename Buffer, typename Sequence>
+		static Buffer First(const Sequence& buffers)
+		{
+			for(auto it = asio::buffer_sequence_begin(buffers); it != asio::buffer_sequence_end(buffers); ++it)
+			{
+				if(Buffer(*it).size() > 0)
+				{
+					return Buffer(*it);
+				}
+			}
+			return Buffer();
+		}
+
+		// Run fnOp until it completes, waiting on the socket whenever OpenSSL wants to
+		// read or write. fnOp returns the bytes moved (or 1 for the handshake), <= 0 on failure
+		// The handler never runs inside the initiating call
+		template<typename Op, typename Handler>
+		void Perform(Op fnOp, Handler&& handler, bool bEmpty = false)
+		{
+			if(bEmpty)
+			{
+				Complete(std::forward<Handler>(handler), asio::error_code(), 0);
+				return;
+			}
+
+			ERR_clear_error();
+			const int nResult = fnOp();
+			if(nResult > 0)
+			{
+				Complete(std::forward<Handler>(handler), asio::error_code(), size_t(nResult));
+				return;
+			}
+
+			const int nError = SSL_get_error(m_ssl, nResult);
+			if(nError == SSL_ERROR_WANT_READ || nError == SSL_ERROR_WANT_WRITE)
+			{
+				m_socket.async_wait(nError == SSL_ERROR_WANT_READ ? asio::ip::tcp::socket::wait_read : asio::ip::tcp::socket::wait_write,
+					[this, fnOp = std::move(fnOp), h = std::forward<Handler>(handler)](const asio::error_code& ec) mutable
+					{
+						if(ec)
+						{
+							h(ec, 0);
+						}
+						else
+						{
+							Perform(std::move(fnOp), std::move(h));
+						}
+					});
+			}
+			else if(nError == SSL_ERROR_ZERO_RETURN || (nError == SSL_ERROR_SYSCALL && ERR_peek_error() == 0))
+			{
+				// Peer closed the connection
+				Complete(std::forward<Handler>(handler), asio::error::eof, 0);
+			}
+			else
+			{
+				Complete(std::forward<Handler>(handler),
+					asio::error_code(int(ERR_get_error()), asio::error::get_ssl_category()), 0);
+			}
+		}
+
+		template<typename Handler>
+		void Complete(Handler&& handler, const asio::error_code& ec, size_t nBytes)
+		{
+			asio::post(m_socket.get_executor(),
+				[h = std::forward<Handler>(handler), ec, nBytes]() mutable
+				{
+					h(ec, nBytes);
+				});
+		}
+
+	private:
+		asio::ip::tcp::socket& m_socket;
+		SSL* m_ssl;
+	};
+}
+
+#endif // NET_USE_TLS
@@ -0,0 +1,375 @@
+#pragma once
+// Per message lifecycle tracing, compiled in with NET_USE_TRACE
+// A sampled message is stamped at every stage it goes through into a ring
+// owned by the stamping thread, DumpTrace writes the rings out as Chrome trace
+// JSON (chrome://tracing or ui.perfetto.dev), one track per message
+// Without NET_USE_TRACE the NET_TRACE macros expand to nothing and messages
+// carry no trace ID
+
+#include "net_common.h"
+
+#ifdef NET_USE_TRACE
+
+#include <fstream>
+
+namespace net
+{
+	// Outbound: send (Send called) -> queued (in its lane on the asio thread)
+	//   -> write (first frame handed to the socket) -> written (last frame written)
+	// Inbound: header (first header read) -> inbox (queued for Update)
+	//   -> delivered (Update took it) -> handled (handler returned)
+	enum class trace_stage : uint8_t
+	{
+		send,
+		queued,
+		write,
+		written,
+		header,
+		inbox,
+		delivered,
+		handled
+	};
+
+	// Name of the span from a stage to the next
+	inline const char* TraceSpanName(trace_stage eStage)
+	{
+		switch(eStage)
+		{
+		case trace_stage::send: return "post";
+		case trace_stage::queued: return "lane";
+		case trace_stage::write: return "write";
+		case trace_stage::header: return "read";
+		case trace_stage::inbox: return "inbox";
+		case trace_stage::delivered: return "handler";
+		default: return "";
+		}
+	}
+
+	// Writes s as the inside of a JSON string, thread names come from the caller
+	inline void TraceJsonEscape(std::ostream& os, const std::string& s)
+	{
+		for(char c : s)
+		{
+			switch(c)
+			{
+			case '"': os << "\\\""; break;
+			case '\\': os << "\\\\"; break;
+			case '\n': os << "\\n"; break;
+			case '\r': os << "\\r"; break;
+			case '\t': os << "\\t"; break;
+			default:
+				if(static_cast<unsigned char>(c) < 0x20)
+				{
+					const char* sHex = "0123456789abcdef";
+					os << "\\u00" << sHex[(c >> 4) & 0xF] << sHex[c & 0xF];
+				}
+				else
+				{
+					os << c;
+				}
+			}
+		}
+	}
+
+	// Fixed size ring only its thread writes to, the oldest stamps are overwritten
+	// Fields are relaxed atomics so a dump can read while the owner writes, the
+	// writer announces a slot in m_nWriting before touching it, so the reader can
+	// drop the stamps that may have been overwritten while it read them
+	class trace_ring
+	{
+	public:
+		static constexpr size_t nCapacity = 16384;
+
+		struct event
+		{
+			std::atomic<uint64_t> nTrace{ 0 };
+			std::atomic<int64_t> nTime{ 0 };
+			std::atomic<uint32_t> nConn{ 0 };
+			std::atomic<uint32_t> nMsgId{ 0 };
+			std::atomic<uint8_t> eStage{ 0 };
+		};
+
+		struct stamp
+		{
+			uint64_t nTrace;
+			int64_t nTime;
+			uint32_t nConn;
+			uint32_t nMsgId;
+			trace_stage eStage;
+			uint32_t nThread;
+		};
+
+		trace_ring(uint32_t nThread) : m_nThread(nThread)
+		{
+		}
+
+		void Push(uint64_t nTrace, trace_stage eStage, uint32_t nConn, uint32_t nMsgId)
+		{
+			const uint64_t nHead = m_nHead.load(std::memory_order_relaxed);
+			m_nWriting.store(nHead + 1, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_release);
+			event& e = m_events[nHead % nCapacity];
+			e.nTrace.store(nTrace, std::memory_order_relaxed);
+			e.nTime.store(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count(), std::memory_order_relaxed);
+			e.nConn.store(nConn, std::memory_order_relaxed);
+			e.nMsgId.store(nMsgId, std::memory_order_relaxed);
+			e.eStage.store(uint8_t(eStage), std::memory_order_relaxed);
+			m_nHead.store(nHead + 1, std::memory_order_release);
+		}
+
+		// Append what the ring holds from nFrom on to out
+		void Collect(std::vector<stamp>& out) const
+		{
+			const uint64_t nHead = m_nHead.load(std::memory_order_acquire);
+			const uint64_t nStart = std::max(m_nFrom.load(std::memory_order_relaxed), nHead > nCapacity ? nHead - nCapacity : 0);
+			const size_t nOld = out.size();
+			for(uint64_t i = nStart; i < nHead; i++)
+			{
+				const event& e = m_events[i % nCapacity];
+				out.push_back({ e.nTrace.load(std::memory_order_relaxed), e.nTime.load(std::memory_order_relaxed),
+					e.nConn.load(std::memory_order_relaxed), e.nMsgId.load(std::memory_order_relaxed),
+					trace_stage(e.eStage.load(std::memory_order_relaxed)), m_nThread });
+			}
+
+			// The owner kept going while we read, drop the slots it came round to
+			std::atomic_thread_fence(std::memory_order_acquire);
+			const uint64_t nWriting = m_nWriting.load(std::memory_order_relaxed);
+			if(nWriting > nCapacity && nWriting - nCapacity > nStart)
+			{
+				const size_t nDrop = size_t(std::min(nWriting - nCapacity - nStart, nHead - nStart));
+				out.erase(out.begin() + nOld, out.begin() + nOld + nDrop);
+			}
+		}
+
+		// Forget everything stamped so far
+		void Clear()
+		{
+			m_nFrom.store(m_nHead.load(std::memory_order_acquire), std::memory_order_relaxed);
+		}
+
+		uint32_t Thread() const
+		{
+			return m_nThread;
+		}
+
+		std::string sName;
+
+		// Its thread has exited, the next new thread takes the ring over
+		bool bFree = false;
+
+	private:
+		const uint32_t m_nThread;
+		std::atomic<uint64_t> m_nHead = 0;
+		std::atomic<uint64_t> m_nWriting = 0;
+		std::atomic<uint64_t> m_nFrom = 0;
+		std::array<event, nCapacity> m_events;
+	};
+
+	// Rings of every thread that stamped, they outlive their threads so a dump
+	// still sees what finished threads recorded, until a new thread reuses them
+	class trace_registry
+	{
+	public:
+		static trace_registry& Get()
+		{
+			static trace_registry registry;
+			return registry;
+		}
+
+		// One message in nEvery is traced, 0 turns tracing off
+		void SetSampling(uint32_t nEvery)
+		{
+			m_nEvery.store(nEvery, std::memory_order_relaxed);
+		}
+
+		// New trace ID when this message is sampled, 0 when not
+		uint64_t Sample()
+		{
+			const uint32_t nEvery = m_nEvery.load(std::memory_order_relaxed);
+			if(nEvery == 0)
+			{
+				return 0;
+			}
+
+			thread_local uint32_t nCount = 0;
+			if(++nCount < nEvery)
+			{
+				return 0;
+			}
+			nCount = 0;
+			return m_nNextTrace.fetch_add(1, std::memory_order_relaxed);
+		}
+
+		trace_ring& Ring()
+		{
+			// Hands the ring back when the thread exits
+			struct owner
+			{
+				std::shared_ptr<trace_ring> pRing;
+
+				~owner()
+				{
+					if(pRing)
+					{
+						trace_registry& registry = Get();
+						std::scoped_lock lock(registry.m_mux);
+						pRing->bFree = true;
+					}
+				}
+			};
+			thread_local owner ring;
+
+			if(!ring.pRing)
+			{
+				std::scoped_lock lock(m_mux);
+				auto it = std::find_if(m_vRings.begin(), m_vRings.end(), [](const auto& p) { return p->bFree; });
+				if(it != m_vRings.end())
+				{
+					ring.pRing = *it;
+					ring.pRing->bFree = false;
+					ring.pRing->sName.clear();
+				}
+				else
+				{
+					ring.pRing = std::make_shared<trace_ring>(uint32_t(m_vRings.size() + 1));
+					m_vRings.push_back(ring.pRing);
+				}
+			}
+			return *ring.pRing;
+		}
+
+		void NameThread(const std::string& sName)
+		{
+			trace_ring& ring = Ring();
+			std::scoped_lock lock(m_mux);
+			ring.sName = sName;
+		}
+
+		void Clear()
+		{
+			std::scoped_lock lock(m_mux);
+			for(auto& pRing : m_vRings)
+			{
+				pRing->Clear();
+			}
+		}
+
+		// Write every trace still in the rings as Chrome trace JSON, false when the file can't be written
+		bool Dump(const std::string& sFile)
+		{
+			std::vector<trace_ring::stamp> vStamps;
+			std::vector<std::pair<uint32_t, std::string>> vThreads;
+			{
+				std::scoped_lock lock(m_mux);
+				for(auto& pRing : m_vRings)
+				{
+					pRing->Collect(vStamps);
+					vThreads.emplace_back(pRing->Thread(), pRing->sName);
+				}
+			}
+
+			std::ofstream file(sFile);
+			if(!file)
+			{
+				return false;
+			}
+
+			// Each message's stamps in order, times relative to the earliest
+			std::sort(vStamps.begin(), vStamps.end(),
+				[](const trace_ring::stamp& a, const trace_ring::stamp& b)
+				{
+					return a.nTrace != b.nTrace ? a.nTrace < b.nTrace : a.nTime < b.nTime;
+				});
+			int64_t nOrigin = INT64_MAX;
+			for(const auto& s : vStamps)
+			{
+				nOrigin = std::min(nOrigin, s.nTime);
+			}
+
+			bool bFirst = true;
+			auto Event = [&](const char* sName, char cPhase, const trace_ring::stamp& s)
+			{
+				file << (bFirst ? "\n" : ",\n") << "{\"name\":\"" << sName << "\",\"cat\":\"net\",\"ph\":\"" << cPhase
+					<< "\",\"id\":" << s.nTrace << ",\"ts\":" << double(s.nTime - nOrigin) / 1000.0
+					<< ",\"pid\":1,\"tid\":" << s.nThread << ",\"args\":{\"conn\":" << s.nConn << ",\"msg\":" << s.nMsgId << "}}";
+				bFirst = false;
+			};
+
+			file.precision(15);
+			file << "{\"traceEvents\":[";
+			for(const auto& t : vThreads)
+			{
+				if(!t.second.empty())
+				{
+					file << (bFirst ? "\n" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << t.first
+						<< ",\"args\":{\"name\":\"";
+					TraceJsonEscape(file, t.second);
+					file << "\"}}";
+					bFirst = false;
+				}
+			}
+
+			for(size_t i = 0; i < vStamps.size();)
+			{
+				size_t j = i + 1;
+				while(j < vStamps.size() && vStamps[j].nTrace == vStamps[i].nTrace)
+				{
+					j++;
+				}
+
+				// The whole message, then a span from each stage to the next inside it
+				if(j - i > 1)
+				{
+					const bool bOut = vStamps[i].eStage <= trace_stage::written;
+					Event(bOut ? "send" : "receive", 'b', vStamps[i]);
+					for(size_t k = i; k + 1 < j; k++)
+					{
+						Event(TraceSpanName(vStamps[k].eStage), 'b', vStamps[k]);
+						Event(TraceSpanName(vStamps[k].eStage), 'e', vStamps[k + 1]);
+					}
+					Event(bOut ? "send" : "receive", 'e', vStamps[j - 1]);
+				}
+				i = j;
+			}
+			file << "\n]}\n";
+			return bool(file);
+		}
+
+	private:
+		std::mutex m_mux;
+		std::vector<std::shared_ptr<trace_ring>> m_vRings;
+		std::atomic<uint32_t> m_nEvery = 0;
+		std::atomic<uint64_t> m_nNextTrace = 1;
+	};
+
+	// Trace one message in nEvery from now on, 0 to stop
+	inline void SetTraceSampling(uint32_t nEvery)
+	{
+		trace_registry::Get().SetSampling(nEvery);
+	}
+
+	// Write what has been traced to sFile as Chrome trace JSON
+	inline bool DumpTrace(const std::string& sFile)
+	{
+		return trace_registry::Get().Dump(sFile);
+	}
+
+	// Drop what has been traced so far
+	inline void ClearTrace()
+	{
+		trace_registry::Get().Clear();
+	}
+}
+
+#define NET_TRACE_SAMPLE(nTrace) ((nTrace) = net::trace_registry::Get().Sample())
+#define NET_TRACE(nTrace, eStage, nConn, id) \
+	do { if(nTrace) net::trace_registry::Get().Ring().Push((nTrace), net::trace_stage::eStage, uint32_t(nConn), uint32_t(id)); } while(0)
+#define NET_TRACE_THREAD(sName) net::trace_registry::Get().NameThread(sName)
+
+#else
+
+#define NET_TRACE_SAMPLE(nTrace)
+#define NET_TRACE(nTrace, eStage, nConn, id)
+#define NET_TRACE_THREAD(sName)
+
+#endif // NET_USE_TRACE
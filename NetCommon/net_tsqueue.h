@@ -3,6 +3,7 @@
 //accessed by client or server
 
 #include "net_common.h"
+#include "net_busypoll.h"
 
 namespace net
 {
@@ -32,6 +33,7 @@ namespace net
 			std::scoped_lock lock(muxQueue);
 			auto t = std::move(deqQueue.front());
 			deqQueue.pop_front();
+			nItems.store(deqQueue.size(), std::memory_order_release);
 			return t;
 		}
 
@@ -40,25 +42,71 @@ namespace net
 			std::scoped_lock lock(muxQueue);
 			auto t = std::move(deqQueue.back());
 			deqQueue.pop_back();
+			nItems.store(deqQueue.size(), std::memory_order_release);
 			return t;
 		}
 
 		void push_back(const T& item)
 		{
-			std::scoped_lock lock(muxQueue);
-			deqQueue.emplace_back(std::move(item));
+			{
+				std::scoped_lock lock(muxQueue);
+				deqQueue.emplace_back(item);
+				nItems.store(deqQueue.size(), std::memory_order_release);
+			}
+			cvBlocking.notify_one();
+			if(fnNotify)
+			{
+				fnNotify();
+			}
+		}
 
-			std::unique_lock<std::mutex> ul(muxBlocking);
+		void push_back(T&& item)
+		{
+			{
+				std::scoped_lock lock(muxQueue);
+				deqQueue.emplace_back(std::move(item));
+				nItems.store(deqQueue.size(), std::memory_order_release);
+			}
 			cvBlocking.notify_one();
+			if(fnNotify)
+			{
+				fnNotify();
+			}
 		}
 
 		void push_front(const T& item)
 		{
-			std::scoped_lock lock(muxQueue);
-			deqQueue.emplace_front(std::move(item));
-
-			std::unique_lock<std::mutex> ul(muxBlocking);
+			{
+				std::scoped_lock lock(muxQueue);
+				deqQueue.emplace_front(item);
+				nItems.store(deqQueue.size(), std::memory_order_release);
+			}
 			cvBlocking.notify_one();
+			if(fnNotify)
+			{
+				fnNotify();
+			}
+		}
+
+		// Moves up to nMax items from the front into out under a single lock
+		// When everything fits and out is empty the containers are just swapped
+		// Returns number of items moved
+		size_t drain(std::deque<T>& out, size_t nMax = -1)
+		{
+			std::scoped_lock lock(muxQueue);
+			const size_t nCount = std::min(nMax, deqQueue.size());
+			if(nCount == deqQueue.size() && out.empty())
+			{
+				out.swap(deqQueue);
+			}
+			else
+			{
+				auto itEnd = deqQueue.begin() + nCount;
+				std::move(deqQueue.begin(), itEnd, std::back_inserter(out));
+				deqQueue.erase(deqQueue.begin(), itEnd);
+			}
+			nItems.store(deqQueue.size(), std::memory_order_release);
+			return nCount;
 		}
 		
 		bool empty()
@@ -77,22 +125,67 @@ namespace net
 		{
 			std::scoped_lock lock(muxQueue);
 			deqQueue.clear();
+			nItems.store(deqQueue.size(), std::memory_order_release);
 		}
 
+		// Block until the queue holds something
+		// The predicate is checked under the queue lock, so a push cannot slip
+		// in between the check and the wait
 		void wait()
 		{
-			while (empty())
+			std::unique_lock<std::mutex> ul(muxQueue);
+			cvBlocking.wait(ul, [this]() { return !deqQueue.empty(); });
+		}
+
+		// As wait, but gives up after timeout, returns false if still empty
+		template<typename Rep, typename Period>
+		bool wait_for(const std::chrono::duration<Rep, Period>& timeout)
+		{
+			std::unique_lock<std::mutex> ul(muxQueue);
+			return cvBlocking.wait_for(ul, timeout, [this]() { return !deqQueue.empty(); });
+		}
+
+		// Called after every push, from the pushing thread, set before anything is pushed
+		void set_notify(std::function<void()> fn)
+		{
+			fnNotify = std::move(fn);
+		}
+
+		// As wait, but spins on the item count without the lock or the condition
+		// variable, for a consumer with a core of its own (see net_busypoll.h)
+		void spin_wait()
+		{
+			uint32_t nSpins = 0;
+			while(nItems.load(std::memory_order_acquire) == 0)
+			{
+				SpinWait(nSpins);
+			}
+		}
+
+		// As wait_for, spinning
+		template<typename Rep, typename Period>
+		bool spin_for(const std::chrono::duration<Rep, Period>& timeout)
+		{
+			const auto tEnd = std::chrono::steady_clock::now() + timeout;
+			uint32_t nSpins = 0;
+			while(nItems.load(std::memory_order_acquire) == 0)
 			{
-				std::unique_lock<std::mutex> ul(muxBlocking);
-				cvBlocking.wait(ul);
+				if(std::chrono::steady_clock::now() >= tEnd)
+				{
+					return false;
+				}
+				SpinWait(nSpins);
 			}
+			return true;
 		}
 
 	protected:
 		std::mutex muxQueue;
 		std::deque<T> deqQueue;
 		std::condition_variable cvBlocking;
-		std::mutex muxBlocking;
+		// Mirrors deqQueue.size(), written under the lock, read without it by the spins
+		std::atomic<size_t> nItems = 0;
+		std::function<void()> fnNotify;
 	};
 
 }
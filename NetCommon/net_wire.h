@@ -0,0 +1,283 @@
+#pragma once
+// Wire byte order
+// Everything the framework puts on the wire is little endian: frame headers,
+// the handshake, and integers, enums and floats pushed into a message. On little
+// endian hosts that costs nothing, big endian hosts swap on the way in and out,
+// arrays with the vector kernels below
+// On x86 the SSSE3 and AVX2 kernels are picked by what the CPU has, whatever
+// the build targets, as net_crc.h does
+
+#include "net_common.h"
+
+#include <type_traits>
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define NET_BIG_ENDIAN
+#endif
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#include <immintrin.h>
+#define NET_WIRE_X86
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define NET_WIRE_SSSE3_TARGET
+#define NET_WIRE_AVX2_TARGET
+#else
+#define NET_WIRE_SSSE3_TARGET __attribute__((target("ssse3")))
+#define NET_WIRE_AVX2_TARGET __attribute__((target("avx2")))
+#endif
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define NET_WIRE_NEON
+#endif
+
+#ifdef _MSC_VER
+#include <stdlib.h>
+#endif
+
+namespace net
+{
+	inline uint16_t ByteSwap(uint16_t n)
+	{
+#ifdef _MSC_VER
+		return _byteswap_ushort(n);
+#else
+		return __builtin_bswap16(n);
+#endif
+	}
+
+	inline uint32_t ByteSwap(uint32_t n)
+	{
+#ifdef _MSC_VER
+		return _byteswap_ulong(n);
+#else
+		return __builtin_bswap32(n);
+#endif
+	}
+
+	inline uint64_t ByteSwap(uint64_t n)
+	{
+#ifdef _MSC_VER
+		return _byteswap_uint64(n);
+#else
+		return __builtin_bswap64(n);
+#endif
+	}
+
+	// Types with a fixed wire layout, everything else is copied as it is
+	template<typename V>
+	constexpr bool bWireScalar = std::is_arithmetic<V>::value || std::is_enum<V>::value;
+
+	// Host to wire order and back, the same swap both ways
+	template<typename V>
+	V WireOrder(V v)
+	{
+		static_assert(bWireScalar<V>, "Only integers, enums and floats have a wire order");
+#ifdef NET_BIG_ENDIAN
+		if constexpr(sizeof(V) > 1)
+		{
+			using bits = std::conditional_t<sizeof(V) == 2, uint16_t, std::conditional_t<sizeof(V) == 4, uint32_t, uint64_t>>;
+			static_assert(sizeof(V) == sizeof(bits), "No byte swap for this size");
+			bits n;
+			std::memcpy(&n, &v, sizeof(n));
+			n = ByteSwap(n);
+			std::memcpy(&v, &n, sizeof(n));
+		}
+#endif
+		return v;
+	}
+
+#if defined(NET_WIRE_X86)
+	enum class wire_kernel
+	{
+		scalar,
+		ssse3,
+		avx2
+	};
+
+	// Best swap kernel this CPU runs, checked once
+	inline wire_kernel WireHardware()
+	{
+		static const wire_kernel eKernel = []()
+		{
+#if defined(_MSC_VER)
+			int nInfo[4];
+			__cpuid(nInfo, 0);
+			const int nLeaves = nInfo[0];
+			__cpuid(nInfo, 1);
+			const bool bSsse3 = (nInfo[2] & (1 << 9)) != 0;
+			// AVX2 needs the OS to save the ymm registers too
+			bool bAvx2 = (nInfo[2] & (1 << 27)) != 0 && (nInfo[2] & (1 << 28)) != 0 && nLeaves >= 7 && (_xgetbv(0) & 6) == 6;
+			if(bAvx2)
+			{
+				__cpuidex(nInfo, 7, 0);
+				bAvx2 = (nInfo[1] & (1 << 5)) != 0;
+			}
+#else
+			const bool bSsse3 = __builtin_cpu_supports("ssse3");
+			const bool bAvx2 = __builtin_cpu_supports("avx2");
+#endif
+			return bAvx2 ? wire_kernel::avx2 : bSsse3 ? wire_kernel::ssse3 : wire_kernel::scalar;
+		}();
+		return eKernel;
+	}
+#endif
+
+	// Name of the bulk swap kernel in use
+	inline const char* WireKernel()
+	{
+#if defined(NET_WIRE_X86)
+		switch(WireHardware())
+		{
+		case wire_kernel::avx2:
+			return "avx2";
+		case wire_kernel::ssse3:
+			return "ssse3";
+		default:
+			return "scalar";
+		}
+#elif defined(NET_WIRE_NEON)
+		return "neon";
+#else
+		return "scalar";
+#endif
+	}
+
+	// Scalar byte swap of nBytes worth of N byte values, the tail the vector kernels leave
+	template<typename N>
+	void ByteSwapCopyScalar(uint8_t* dst, const uint8_t* src, size_t nBytes)
+	{
+		for(size_t i = 0; i + sizeof(N) <= nBytes; i += sizeof(N))
+		{
+			N n;
+			std::memcpy(&n, src + i, sizeof(N));
+			n = ByteSwap(n);
+			std::memcpy(dst + i, &n, sizeof(N));
+		}
+	}
+
+#if defined(NET_WIRE_X86)
+	// pshufb picks each output byte, these reverse every 2, 4 or 8 bytes of a 16 byte lane
+	inline const uint8_t* ByteSwapMask(size_t nSize)
+	{
+		alignas(16) static const uint8_t mask[3][16] = {
+			{ 1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14 },
+			{ 3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12 },
+			{ 7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8 } };
+		return mask[nSize == 2 ? 0 : nSize == 4 ? 1 : 2];
+	}
+
+	// The vector kernels swap whole 16 byte blocks and return the bytes done
+	NET_WIRE_SSSE3_TARGET inline size_t ByteSwapCopySsse3(uint8_t* dst, const uint8_t* src, size_t nBytes, size_t nSize)
+	{
+		const __m128i vMask = _mm_load_si128(reinterpret_cast<const __m128i*>(ByteSwapMask(nSize)));
+		size_t i = 0;
+		for(; i + 16 <= nBytes; i += 16)
+		{
+			const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_shuffle_epi8(v, vMask));
+		}
+		return i;
+	}
+
+	NET_WIRE_AVX2_TARGET inline size_t ByteSwapCopyAvx2(uint8_t* dst, const uint8_t* src, size_t nBytes, size_t nSize)
+	{
+		const __m128i vMask128 = _mm_load_si128(reinterpret_cast<const __m128i*>(ByteSwapMask(nSize)));
+		const __m256i vMask = _mm256_broadcastsi128_si256(vMask128);
+		size_t i = 0;
+		for(; i + 64 <= nBytes; i += 64)
+		{
+			const __m256i v0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+			const __m256i v1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i + 32));
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_shuffle_epi8(v0, vMask));
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i + 32), _mm256_shuffle_epi8(v1, vMask));
+		}
+		for(; i + 16 <= nBytes; i += 16)
+		{
+			const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_shuffle_epi8(v, vMask128));
+		}
+		return i;
+	}
+#endif
+
+	// Copy nCount elements of nSize (2, 4 or 8) bytes from src to dst reversing the
+	// bytes of each, src and dst may be the same but must not overlap otherwise
+	inline void ByteSwapCopy(void* pDst, const void* pSrc, size_t nCount, size_t nSize)
+	{
+		uint8_t* dst = static_cast<uint8_t*>(pDst);
+		const uint8_t* src = static_cast<const uint8_t*>(pSrc);
+		const size_t nBytes = nCount * nSize;
+		size_t i = 0;
+
+#if defined(NET_WIRE_X86)
+		switch(WireHardware())
+		{
+		case wire_kernel::avx2:
+			i = ByteSwapCopyAvx2(dst, src, nBytes, nSize);
+			break;
+		case wire_kernel::ssse3:
+			i = ByteSwapCopySsse3(dst, src, nBytes, nSize);
+			break;
+		default:
+			break;
+		}
+#elif defined(NET_WIRE_NEON)
+		for(; i + 16 <= nBytes; i += 16)
+		{
+			const uint8x16_t v = vld1q_u8(src + i);
+			vst1q_u8(dst + i, nSize == 2 ? vrev16q_u8(v) : nSize == 4 ? vrev32q_u8(v) : vrev64q_u8(v));
+		}
+#endif
+
+		// What is left, or all of it without a vector kernel
+		switch(nSize)
+		{
+		case 2:
+			ByteSwapCopyScalar<uint16_t>(dst + i, src + i, nBytes - i);
+			break;
+		case 4:
+			ByteSwapCopyScalar<uint32_t>(dst + i, src + i, nBytes - i);
+			break;
+		default:
+			ByteSwapCopyScalar<uint64_t>(dst + i, src + i, nBytes - i);
+			break;
+		}
+	}
+
+	// nCount values from the host to wire order, pDst holds nCount * sizeof(V) bytes
+	template<typename V>
+	void CopyToWire(void* pDst, const V* pSrc, size_t nCount)
+	{
+		static_assert(bWireScalar<V>, "Only integers, enums and floats have a wire order");
+#ifdef NET_BIG_ENDIAN
+		if constexpr(sizeof(V) > 1)
+		{
+			ByteSwapCopy(pDst, pSrc, nCount, sizeof(V));
+			return;
+		}
+#endif
+		if(nCount > 0)
+		{
+			std::memcpy(pDst, pSrc, nCount * sizeof(V));
+		}
+	}
+
+	// And back
+	template<typename V>
+	void CopyFromWire(V* pDst, const void* pSrc, size_t nCount)
+	{
+		static_assert(bWireScalar<V>, "Only integers, enums and floats have a wire order");
+#ifdef NET_BIG_ENDIAN
+		if constexpr(sizeof(V) > 1)
+		{
+			ByteSwapCopy(pDst, pSrc, nCount, sizeof(V));
+			return;
+		}
+#endif
+		if(nCount > 0)
+		{
+			std::memcpy(pDst, pSrc, nCount * sizeof(V));
+		}
+	}
+}
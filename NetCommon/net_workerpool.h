@@ -0,0 +1,139 @@
+#pragma once
+// Worker pool for message handlers
+// Jobs are sharded by a key (the connection ID), all jobs with the same key
+// run on the same worker in submission order, different keys run in parallel
+
+#include "net_common.h"
+
+namespace net
+{
+	class worker_pool
+	{
+	public:
+		using job = std::function<void()>;
+
+		// nThreads workers, each owning one shard queue of at most nShardCapacity jobs
+		worker_pool(size_t nThreads, size_t nShardCapacity = 1024)
+			: m_nShardCapacity(std::max<size_t>(nShardCapacity, 1))
+		{
+			nThreads = std::max<size_t>(nThreads, 1);
+			for(size_t i = 0; i < nThreads; i++)
+			{
+				m_vShards.push_back(std::make_unique<shard>());
+			}
+
+			// Start threads once every shard exists
+			for(auto& s : m_vShards)
+			{
+				shard* pShard = s.get();
+				pShard->thr = std::thread([this, pShard]() { WorkerLoop(*pShard); });
+			}
+		}
+
+		worker_pool(const worker_pool&) = delete;
+
+		virtual ~worker_pool()
+		{
+			Stop();
+		}
+
+	public:
+		// Queue a job on the shard owning nKey
+		// Blocks while that shard is full, which pushes back on the caller
+		void Submit(uint32_t nKey, job fn)
+		{
+			shard& s = *m_vShards[nKey % m_vShards.size()];
+
+			std::unique_lock<std::mutex> ul(s.mux);
+			s.cvNotFull.wait(ul, [&]() { return s.deqJobs.size() < m_nShardCapacity || s.bStop; });
+			if(s.bStop)
+			{
+				return;
+			}
+
+			s.deqJobs.push_back(std::move(fn));
+			s.cvNotEmpty.notify_one();
+		}
+
+		// Finish the jobs already queued then join all workers
+		void Stop()
+		{
+			for(auto& s : m_vShards)
+			{
+				std::scoped_lock lock(s->mux);
+				s->bStop = true;
+				s->cvNotEmpty.notify_all();
+				s->cvNotFull.notify_all();
+			}
+
+			for(auto& s : m_vShards)
+			{
+				if(s->thr.joinable())
+				{
+					s->thr.join();
+				}
+			}
+		}
+
+		// Jobs queued or running across all shards
+		size_t Pending()
+		{
+			size_t nCount = 0;
+			for(auto& s : m_vShards)
+			{
+				std::scoped_lock lock(s->mux);
+				nCount += s->deqJobs.size() + (s->bBusy ? 1 : 0);
+			}
+			return nCount;
+		}
+
+		size_t ThreadCount() const
+		{
+			return m_vShards.size();
+		}
+
+	private:
+		struct shard
+		{
+			std::mutex mux;
+			std::condition_variable cvNotEmpty;
+			std::condition_variable cvNotFull;
+			std::deque<job> deqJobs;
+			std::thread thr;
+			bool bBusy = false;
+			bool bStop = false;
+		};
+
+		void WorkerLoop(shard& s)
+		{
+			while(true)
+			{
+				job fn;
+				{
+					std::unique_lock<std::mutex> ul(s.mux);
+					s.cvNotEmpty.wait(ul, [&]() { return !s.deqJobs.empty() || s.bStop; });
+					if(s.deqJobs.empty())
+					{
+						// Stopped and drained
+						return;
+					}
+
+					fn = std::move(s.deqJobs.front());
+					s.deqJobs.pop_front();
+					s.bBusy = true;
+					s.cvNotFull.notify_one();
+				}
+
+				fn();
+
+				std::scoped_lock lock(s.mux);
+				s.bBusy = false;
+			}
+		}
+
+	private:
+		// unique_ptr keeps shards in place, they hold a mutex and a thread
+		std::vector<std::unique_ptr<shard>> m_vShards;
+		size_t m_nShardCapacity;
+	};
+}
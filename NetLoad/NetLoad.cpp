@@ -0,0 +1,118 @@
+//Add 'NetCommon' to Build Dependancies
+//Add path to \NetCommon in Include Directories
+
+// Loads a running server with many scripted client connections on a few threads
+// NetLoad [host] [port] [connections] [seconds] [rate] [sizes] [ping ms] [threads] [csv]
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <net_full.h>
+#include <net_loadgen.h>
+
+// Same IDs as SimpleServer, which echoes ServerPing back
+enum class LoadMsgTypes : uint32_t
+{
+	ServerAccept,
+	ServerDeny,
+	ServerPing,
+	MessageAll,
+	ServerMessage,
+};
+
+// "64" or "64:9,4096:1", body sizes with their weights
+std::vector<std::pair<size_t, double>> ParseSizes(const std::string& s)
+{
+	std::vector<std::pair<size_t, double>> vSizes;
+	std::stringstream ss(s);
+	std::string sItem;
+	while(std::getline(ss, sItem, ','))
+	{
+		const size_t nColon = sItem.find(':');
+		vSizes.push_back({ size_t(std::stoul(sItem.substr(0, nColon))), nColon == std::string::npos ? 1.0 : std::stod(sItem.substr(nColon + 1)) });
+	}
+	return vSizes;
+}
+
+int main(int argc, char* argv[])
+{
+	if(argc > 1 && (std::string(argv[1]) == "-h" || std::string(argv[1]) == "--help"))
+	{
+		std::cout << "Usage: NetLoad [host] [port] [connections] [seconds] [rate] [sizes] [ping ms] [threads] [csv]\n"
+			<< "  rate     data messages per second per connection, Poisson spaced\n"
+			<< "  sizes    body sizes and weights, e.g. 64:9,4096:1\n"
+			<< "  csv      file to write per connection stats to\n"
+			<< "  Each connection is two file descriptors when the server runs on the same machine\n";
+		return 1;
+	}
+
+	const std::string sHost = argc > 1 ? argv[1] : "127.0.0.1";
+	const uint16_t nPort = argc > 2 ? uint16_t(std::stoi(argv[2])) : 60000;
+	const size_t nConnections = argc > 3 ? size_t(std::stoul(argv[3])) : 1000;
+	const double dSeconds = argc > 4 ? std::stod(argv[4]) : 10.0;
+
+	net::load_script script;
+	script.dMessagesPerSecond = argc > 5 ? std::stod(argv[5]) : 1.0;
+	if(argc > 6)
+	{
+		script.vBodySizes = ParseSizes(argv[6]);
+	}
+	script.pingInterval = std::chrono::milliseconds(argc > 7 ? std::stoi(argv[7]) : 1000);
+	const size_t nThreads = argc > 8 ? size_t(std::stoul(argv[8])) : 2;
+	const std::string sCsv = argc > 9 ? argv[9] : "";
+
+	net::load_generator<LoadMsgTypes> load(LoadMsgTypes::ServerMessage, LoadMsgTypes::ServerPing);
+	if(!load.Start(sHost, nPort, nConnections, script, nThreads))
+	{
+		return 1;
+	}
+
+	// A line a second while it runs
+	const auto tEnd = std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(dSeconds));
+	while(std::chrono::steady_clock::now() < tEnd)
+	{
+		std::this_thread::sleep_for(std::min<std::chrono::steady_clock::duration>(std::chrono::seconds(1), tEnd - std::chrono::steady_clock::now()));
+		const net::load_stats p = load.Progress();
+		std::cout << int(p.dSeconds) << "s: " << p.nOpened << " opened, " << p.nReady << " ready, "
+			<< p.nSent << " sent, " << p.nReceived << " received\n";
+	}
+
+	const net::load_stats stats = load.Stop();
+	const auto& vConn = load.ConnectionStats();
+
+	std::cout << "Connections:  " << stats.nConnections << " (" << stats.nReady << " ready, " << stats.nConnected << " still connected)\n"
+		<< "Ready in:     p50 " << stats.ready.Percentile(0.5) / 1000.0 << " ms, p99 " << stats.ready.Percentile(0.99) / 1000.0 << " ms, max " << stats.ready.Max() / 1000.0 << " ms\n"
+		<< "Sent:         " << stats.nSent << " messages (" << stats.nBytesSent << " bytes), " << uint64_t(stats.nSent / std::max(stats.dSeconds, 1e-9)) << " msg/s\n"
+		<< "Received:     " << stats.nReceived << " messages (" << stats.nBytesReceived << " bytes)\n"
+		<< "Ping RTT:     " << stats.rtt.Count() << " samples, p50 " << stats.rtt.Percentile(0.5) << " us, p99 " << stats.rtt.Percentile(0.99)
+		<< " us, p99.9 " << stats.rtt.Percentile(0.999) << " us, max " << stats.rtt.Max() << " us\n";
+
+	// The connections that had it worst
+	std::vector<size_t> vOrder(vConn.size());
+	for(size_t i = 0; i < vOrder.size(); i++)
+	{
+		vOrder[i] = i;
+	}
+	std::sort(vOrder.begin(), vOrder.end(), [&](size_t a, size_t b) { return vConn[a].rtt.Max() > vConn[b].rtt.Max(); });
+	for(size_t i = 0; i < std::min<size_t>(5, vOrder.size()); i++)
+	{
+		const net::load_connection_stats& c = vConn[vOrder[i]];
+		std::cout << "  #" << vOrder[i] << ": rtt max " << c.rtt.Max() << " us, p99 " << c.rtt.Percentile(0.99) << " us, "
+			<< c.nPongs << "/" << c.nPings << " pings echoed, ready in " << c.dReadyMs << " ms\n";
+	}
+
+	if(!sCsv.empty())
+	{
+		std::ofstream csv(sCsv);
+		csv << "connection,ready,connected,ready_ms,sent,bytes_sent,pings,pongs,rtt_mean_us,rtt_p50_us,rtt_p99_us,rtt_max_us\n";
+		for(size_t i = 0; i < vConn.size(); i++)
+		{
+			const net::load_connection_stats& c = vConn[i];
+			csv << i << "," << c.bReady << "," << c.bConnected << "," << c.dReadyMs << "," << c.nSent << "," << c.nBytesSent << ","
+				<< c.nPings << "," << c.nPongs << "," << c.rtt.Mean() << "," << c.rtt.Percentile(0.5) << "," << c.rtt.Percentile(0.99) << "," << c.rtt.Max() << "\n";
+		}
+		std::cout << "Per connection stats written to " << sCsv << "\n";
+	}
+
+	return 0;
+}
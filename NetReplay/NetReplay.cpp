@@ -0,0 +1,41 @@
+//Add 'NetCommon' to Build Dependancies
+//Add path to \NetCommon in Include Directories
+
+// Replays a traffic capture (SimpleServer <capture> records one) against a running server
+// NetReplay <capture> [host] [port] [speed] [threads]
+
+#include <iostream>
+#include <net_full.h>
+#include <net_replay.h>
+
+// Ids are replayed as captured, the tool does not need to know the application's enum
+enum class ReplayMsgTypes : uint32_t
+{
+};
+
+int main(int argc, char* argv[])
+{
+	if(argc < 2)
+	{
+		std::cout << "Usage: NetReplay <capture> [host] [port] [speed] [threads]\n"
+			<< "  speed 1 keeps captured timing, 0 sends as fast as possible\n";
+		return 1;
+	}
+
+	const std::string sCapture = argv[1];
+	const std::string sHost = argc > 2 ? argv[2] : "127.0.0.1";
+	const uint16_t nPort = argc > 3 ? uint16_t(std::stoi(argv[3])) : 60000;
+	const double dSpeed = argc > 4 ? std::stod(argv[4]) : 1.0;
+	const size_t nThreads = argc > 5 ? size_t(std::stoul(argv[5])) : 2;
+
+	net::capture_replay<ReplayMsgTypes> replay(sCapture);
+	net::replay_stats stats = replay.Run(sHost, nPort, dSpeed, nThreads);
+
+	std::cout << "Sessions:       " << stats.nSessions << "\n"
+		<< "Frames sent:    " << stats.nFramesSent << " (" << stats.nBytesSent << " bytes)\n"
+		<< "Frames skipped: " << stats.nFramesSkipped << "\n"
+		<< "Duration:       " << stats.dSeconds << " s, " << uint64_t(stats.nFramesSent / std::max(stats.dSeconds, 1e-9)) << " frames/s\n"
+		<< "Max lag:        " << stats.dMaxLagMs << " ms\n";
+
+	return 0;
+}
@@ -15,11 +15,36 @@ enum class CustomMsgTypes : uint32_t
 	ServerPing,
 	MessageAll,
 	ServerMessage,
+	Count,
 };
 
 class CustomClient : public net::client_interface<CustomMsgTypes>
 {
 public:
+	CustomClient()
+	{
+		// Server bounced our ping back, body is the time it was sent
+		RegisterHandler<std::chrono::system_clock::time_point>(CustomMsgTypes::ServerPing,
+			[](const std::chrono::system_clock::time_point& timeThen)
+			{
+				std::chrono::system_clock::time_point timeNow = std::chrono::system_clock::now();
+				std::cout << "Ping: " << std::chrono::duration<double>(timeNow - timeThen).count() << "\n";
+			});
+
+		RegisterHandler<uint32_t>(CustomMsgTypes::ServerMessage,
+			[](const uint32_t& clientID)
+			{
+				std::cout << "Message from client [" << clientID << "]\n";
+			});
+
+		RegisterHandler(CustomMsgTypes::ServerAccept,
+			[](net::message<CustomMsgTypes>& msg)
+			{
+				// Server has responded to a ping request				
+				std::cout << "Server Accepted Connection\n";
+			});
+	}
+
 	void PingServer()
 	{
 		net::message<CustomMsgTypes> msg;
@@ -29,7 +54,7 @@ public:
 		// ...system clock dependant on platform server/client
 		std::chrono::system_clock::time_point timeNow = std::chrono::system_clock::now();
 		msg << timeNow;
-		Send(msg);
+		Send(msg, net::priority::control);
 	}
 
 	void MessageAll()
@@ -85,38 +110,8 @@ int main()
 
 		if(client.IsConnected())
 		{
-			if(!client.Incoming().empty())
-			{
-				auto msg = client.Incoming().pop_front().msg;
-				switch(msg.header.id)
-				{
-				case CustomMsgTypes::ServerPing:	
-				{
-					std::chrono::system_clock::time_point timeNow = std::chrono::system_clock::now();
-					std::chrono::system_clock::time_point timeThen;
-					msg >> timeThen;
-					std::cout << "Ping: " << std::chrono::duration<double>(timeNow - timeThen).count() << "\n";					
-				}
-				break;
-				case CustomMsgTypes::ServerMessage:
-				{
-					// responded to ping request
-					uint32_t clientID;
-					msg >> clientID;
-					std::cout << "Message from client [" << clientID << "]\n";
-				}
-				break;
-				case CustomMsgTypes::ServerAccept:
-				{
-					// Server has responded to a ping request				
-					std::cout << "Server Accepted Connection\n";
-				}
-				break;
-
-				default:
-					break;
-				}			
-			}
+			// Handle everything the server sent since last frame
+			client.Update();
 		}
 		else
 		{
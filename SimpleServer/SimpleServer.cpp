@@ -9,6 +9,7 @@ enum class CustomMsgTypes : uint32_t
 	ServerPing,
 	MessageAll,
 	ServerMessage,
+	Count,
 };
 
 class CustomServer : public net::server_interface<CustomMsgTypes>
@@ -16,7 +17,25 @@ class CustomServer : public net::server_interface<CustomMsgTypes>
 public:
 	CustomServer(uint16_t nPort): net::server_interface<CustomMsgTypes>(nPort)
 	{
-	
+		RegisterHandler(CustomMsgTypes::ServerPing,
+			[](std::shared_ptr<net::connection<CustomMsgTypes>> client, net::message<CustomMsgTypes>& msg)
+			{
+				// Bounce message back to client, ahead of any bulk traffic
+				NET_LOG_INFO("[", client->GetID(), "]: Server Ping from ");
+				client->Send(msg, net::priority::control);
+			});
+
+		RegisterHandler(CustomMsgTypes::MessageAll,
+			[this](std::shared_ptr<net::connection<CustomMsgTypes>> client, net::message<CustomMsgTypes>& msg)
+			{
+				// Message other clients 
+				NET_LOG_INFO("[", client->GetID(), "]: Message to All ");
+				net::message<CustomMsgTypes> msgB;
+				msgB.header.id = CustomMsgTypes::ServerMessage;
+				msgB << client->GetID();
+				//Ignore client sending the message to all
+				MessageAllClients(msgB, client);
+			});
 	}
 protected:
 	virtual bool OnClientConnect(std::shared_ptr<net::connection<CustomMsgTypes>> client)
@@ -31,51 +50,60 @@ protected:
 	// Called when a client appears to disconnected
 	virtual void OnClientDisconnect(std::shared_ptr<net::connection<CustomMsgTypes>> client)
 	{
-		std::cout << "Removing client [" << client->GetID() << "]\n";
+		NET_LOG_INFO("Removing client [", client->GetID(), "]");
 	}
 
-	// Called when message arrives
+	// Called when message arrives without a registered handler
 	virtual void OnMessage( std::shared_ptr<net::connection<CustomMsgTypes>> client, net::message<CustomMsgTypes>& msg)
 	{
-		switch (msg.header.id)
-		{
-		case CustomMsgTypes::ServerPing:
-		{		
-			// Bounce message back to client
-			std::cout<< "[" << client->GetID() << "]: Server Ping from " <<"\n";
-			client->Send(msg);
-		}
-		break;
+		NET_LOG_WARN("[", client->GetID(), "]: Unhandled ID: ", int(msg.header.id), " Size: ", msg.header.size);
+	}
+};
 
-		case CustomMsgTypes::MessageAll:
-		{		
-			// Message other clients 
-			std::cout<< "[" << client->GetID() << "]: Message to All " <<"\n";
-			net::message<CustomMsgTypes> msgB;
-			msgB.header.id = CustomMsgTypes::ServerMessage;
-			msgB << client->GetID();
-			//Ignore client sending the message to all
-			MessageAllClients(msgB, client);
 
-		}
-		break;
+int main(int argc, char* argv[])
+{
+	CustomServer server(60000);
 
-		default:
-			break;
+	// SimpleServer [--handoff <path>] [capture]
+	// --handoff takes over a SimpleServer already running with the same path, if there
+	// is one, and listens there for the next one: start a second copy to restart
+	// without dropping clients
+	// capture records all traffic, NetReplay can play it back
+	std::string sHandoff;
+	for(int i = 1; i < argc; i++)
+	{
+		if(std::string(argv[i]) == "--handoff" && i + 1 < argc)
+		{
+			sHandoff = argv[++i];
+		}
+		else
+		{
+			server.EnableCapture(argv[i]);
 		}
-
 	}
-};
 
+#ifndef _WIN32
+	if(sHandoff.empty() || !server.StartFromHandoff(sHandoff))
+	{
+		server.Start();
+	}
+	if(!sHandoff.empty())
+	{
+		server.EnableHandoff(sHandoff);
+	}
 
-int main()
-{
-	CustomServer server(60000);
+	while(!server.IsHandedOff())
+	{
+		server.Update(-1, true);
+	}
+#else
 	server.Start();
 	while(1)
 	{
 		server.Update(-1, true);
 	}
+#endif
 
 	return 0;
 }
\ No newline at end of file